@@ -0,0 +1,39 @@
+# ----------------------------------------------------------------------------
+# Version Control
+#    $Author$
+#      $Date$
+#        $Id$
+#
+# Legal
+#    Copyright 2011  Andy Parkins
+#
+# ----------------------------------------------------------------------------
+
+# Benchmarkable modules are any that have 'ifdef BENCHMARK' in them
+BENCHABLE := $(shell grep -ls "ifdef BENCHMARK" $(SOURCES))
+
+# Expand to make convenience targets for the user to "make"
+BENCHEXES := $(patsubst %.cc,bench-%,$(BENCHABLE))
+BENCHRESULTS := $(patsubst %.cc,bench-%.csv,$(BENCHABLE))
+
+benchinfo:
+	@echo "BENCHABLE = $(BENCHABLE)"
+	@echo "BENCHEXES = $(BENCHEXES)"
+
+# Run all the benchmarks; each leaves its results in bench-<module>.csv
+bench: $(BENCHEXES)
+	@for x in $(BENCHEXES); do \
+		echo "[$$x] --------------------------- Running benchmark"; \
+		./$$x > $$x.csv || echo "[$$x] Error $$? in benchmark"; \
+	done
+
+# compile a particular benchmark.  As unit-% in unittest.mak, but with
+# BENCHMARK defined instead of UNITTEST, and optimised, as the numbers
+# are only interesting for the code that will actually run.
+bench-%: %.cc $(UNITLIBS)
+	$(CXX) $*.cc $(CXXFLAGS) -O2 \
+		-DBENCHMARK $(patsubst %,"-D%",$($*_DEFINES)) \
+		$(patsubst %,-I%,$(INCLUDE)) $(patsubst %,-I%,$($*_INCLUDE)) \
+		-o bench-$* $(LDFLAGS) \
+		$(patsubst %,-L%,$(LIBPATH)) $(patsubst %,-L%,$($*_LIBPATH)) \
+		$(patsubst %,-l%,$(LIBS)) $(patsubst %,-l%,$($*_LIBS))
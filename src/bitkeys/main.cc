@@ -19,15 +19,23 @@
 // -------------- Includes
 // --- C
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 // --- C++
 #include <stdexcept>
 #include <typeinfo>
 #include <list>
+#include <vector>
 // --- OS
+#include <unistd.h>
 // --- Project libs
 #include <general/logstream.h>
 #include <general/crypto.h>
+#include <general/sha256.h>
+#include <general/thread.h>
+#include <general/extraint.h>
 #include <general/autoversion.h>
+#include <additup/base58.h>
 #include <additup/hashtypes.h>
 #include <additup/hashtypes.h>
 #include <additup/constants.h>
@@ -44,6 +52,9 @@ enum eCLIInputMode {
 	InputMode_SHA256Phrase
 } CLIInputMode = InputMode_Base58;
 unsigned int DefaultClass;
+unsigned long GenerateCount = 0;
+string VanityPrefix;
+unsigned int WorkerThreads = 0;
 
 
 // -------------- World Globals (need "extern"s in header)
@@ -51,6 +62,127 @@ unsigned int DefaultClass;
 
 // -------------- Class member definitions
 
+//
+// Class:	TGenerateWorker
+// Description:
+// Makes Count independent random keys, and their addresses.
+//
+class TGenerateWorker : public TThread
+{
+  public:
+	TGenerateWorker( unsigned long n ) : Count( n ) {}
+
+	vector<string> Addresses;
+	vector<string> Secrets;
+
+  protected:
+	void run();
+
+  protected:
+	unsigned long Count;
+};
+
+//
+// Function:	TGenerateWorker :: run
+// Description:
+//
+void TGenerateWorker::run()
+{
+	for( unsigned long i = 0; i < Count; i++ ) {
+		TEllipticCurveKey Key;
+		TBitcoinAddress Address( DefaultClass );
+		TBitcoinBase58 Secret;
+
+		Key.generate();
+		Address.fromKey( Key );
+		Secret.fromBytes( Key.getSecret() );
+
+		Addresses.push_back( Address.toString() );
+		Secrets.push_back( Secret.toString() );
+	}
+}
+
+//
+// Class:	TVanityWorker
+// Description:
+// Steps through consecutive keys from a random start until one's
+// address starts with Prefix, or another worker finds one.
+//
+// Each batch of keys is hashed a stage at a time with transformMany(),
+// checksummed the same way, then Base58 encoded together, so the work
+// for each candidate is a point addition and some hashing, never a
+// scalar multiplication.
+//
+class TVanityWorker : public TThread
+{
+  public:
+	TVanityWorker( const string &p, volatile bool &f ) :
+		Prefix( p ), Found( f ), Tried( 0 ) {}
+
+	unsigned long long getTried() const { return Tried; }
+	const TSecureByteArray &getSecret() const { return Secret; }
+
+	static const size_t BATCH = 256;
+
+  protected:
+	void run();
+
+  protected:
+	const string &Prefix;
+	volatile bool &Found;
+	volatile unsigned long long Tried;
+	TSecureByteArray Secret;
+};
+
+const size_t TVanityWorker::BATCH;
+
+//
+// Function:	TVanityWorker :: run
+// Description:
+//
+void TVanityWorker::run()
+{
+	static const size_t KEYHASH_BYTES = TBase58::ADDRESS_BYTES - TBase58::CHECKSUM_BYTES - 1;
+	static const size_t PAYLOAD_BYTES = 1 + KEYHASH_BYTES;
+	TPublicKeySequence Sequence;
+	TByteArray PublicKeys( BATCH * TPublicKeySequence::PUBLIC_KEY_BYTES );
+	TByteArray KeyHashes( BATCH * KEYHASH_BYTES );
+	TByteArray Payloads( BATCH * PAYLOAD_BYTES );
+	TByteArray Checksums( BATCH * TSHA256::DIGEST_BYTES );
+	TByteArray Addresses( BATCH * TBase58::ADDRESS_BYTES );
+	vector<string> Encoded;
+
+	Sequence.start();
+
+	while( !Found ) {
+		Sequence.next( PublicKeys, BATCH );
+
+		// Class byte, key hash, checksum
+		TDigestPool<THash_hash160>::get().transformMany( KeyHashes, PublicKeys,
+				TPublicKeySequence::PUBLIC_KEY_BYTES, BATCH );
+		for( size_t i = 0; i < BATCH; i++ ) {
+			Payloads[i * PAYLOAD_BYTES] = DefaultClass;
+			memcpy( Payloads.ptr( i * PAYLOAD_BYTES + 1 ), KeyHashes.ptr( i * KEYHASH_BYTES ), KEYHASH_BYTES );
+		}
+		TDigestPool<THash_hash256>::get().transformMany( Checksums, Payloads, PAYLOAD_BYTES, BATCH );
+		for( size_t i = 0; i < BATCH; i++ ) {
+			unsigned char *Address = Addresses.ptr( i * TBase58::ADDRESS_BYTES );
+			memcpy( Address, Payloads.ptr( i * PAYLOAD_BYTES ), PAYLOAD_BYTES );
+			memcpy( Address + PAYLOAD_BYTES, Checksums.ptr( i * TSHA256::DIGEST_BYTES ), TBase58::CHECKSUM_BYTES );
+		}
+
+		Encoded.clear();
+		TBase58::encodeAddresses( Encoded, Addresses, BATCH );
+		for( size_t i = 0; i < BATCH; i++ ) {
+			if( Encoded[i].compare( 0, Prefix.size(), Prefix ) != 0 )
+				continue;
+			Secret = Sequence.getSecret( Sequence.getCount() - BATCH + i );
+			Found = true;
+		}
+		Tried += BATCH;
+	}
+}
+
 
 // -------------- Function Definitions
 
@@ -109,6 +241,10 @@ static void help()
 		<< "      --verbose       activate verbose mode" << endl
 		<< "      --hex           parameters are treated as hex digits (address/secret modes)"
 		<< "      --testnet       use the testnet parameters for address type bytes"
+		<< endl
+		<< "      --generate N    MODE make N random keys, printing address and secret" << endl
+		<< "      --vanity P      MODE search for a key whose address starts with P" << endl
+		<< "      --threads N     use N worker threads (generate/vanity modes)" << endl
 		;
 }
 
@@ -122,7 +258,7 @@ static void address( int argc, char *argv[] )
 	list<TBitcoinAddress> Addresses;
 	list<TBitcoinAddress>::const_iterator it;
 
-	for( unsigned int i = 1; i < argc; i++ ) {
+	for( int i = 1; i < argc; i++ ) {
 		if( argv[i][0] == '-' )
 			continue;
 		if( CLIInputMode == InputMode_Base58 ) {
@@ -156,7 +292,7 @@ static void secret( int argc, char *argv[] )
 {
 	list<TEllipticCurveKey> Keys;
 
-	for( unsigned int i = 1; i < argc; i++ ) {
+	for( int i = 1; i < argc; i++ ) {
 		if( argv[i][0] == '-' )
 			continue;
 
@@ -191,6 +327,166 @@ static void secret( int argc, char *argv[] )
 	showKeyArray( Keys );
 }
 
+//
+// Function:	secondsSince
+// Description:
+//
+static double secondsSince( const struct timeval &start )
+{
+	struct timeval now;
+
+	gettimeofday( &now, NULL );
+	return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1e6;
+}
+
+//
+// Function:	workerCount
+// Description:
+//
+static unsigned int workerCount()
+{
+	return WorkerThreads != 0 ? WorkerThreads : TThread::processors();
+}
+
+static void generate()
+{
+	vector<TGenerateWorker *> Workers;
+	unsigned int Threads = workerCount();
+	struct timeval start;
+	double t;
+
+	if( GenerateCount == 0 )
+		throw runtime_error( "--generate needs a number of keys" );
+
+	gettimeofday( &start, NULL );
+	for( unsigned int i = 0; i < Threads; i++ ) {
+		// Share the keys out, the first workers taking the remainder
+		Workers.push_back( new TGenerateWorker( GenerateCount / Threads + (i < GenerateCount % Threads) ) );
+		Workers.back()->start();
+	}
+	for( unsigned int i = 0; i < Threads; i++ )
+		Workers[i]->join();
+	t = secondsSince( start );
+
+	for( unsigned int i = 0; i < Threads; i++ ) {
+		for( size_t j = 0; j < Workers[i]->Addresses.size(); j++ )
+			cout << Workers[i]->Addresses[j] << " " << Workers[i]->Secrets[j] << endl;
+		delete Workers[i];
+	}
+
+	cerr << "Generated " << GenerateCount << " keys in " << t << "s = "
+		<< GenerateCount / t << " keys/s (" << Threads << " threads)" << endl;
+}
+
+//
+// Function:	vanityPossible
+// Description:
+// True if an address of the given class can start with Prefix, so
+// that a search for one will end.  An address is a '1' for each
+// leading zero byte, then the rest of its bytes as a Base58 number.
+// The checksum is treated as free, as it is as far as the search can
+// tell.
+//
+static bool vanityPossible( const string &Prefix, unsigned int Class )
+{
+	const TBigUnsignedInteger One( 1U );
+	TBigUnsignedInteger Lowest, Highest, Rest( 0U ), Scale( 1U );
+	string::size_type Ones, i;
+
+	Ones = Prefix.find_first_not_of( TBase58::ALPHABET[0] );
+	if( Ones == string::npos )
+		Ones = Prefix.size();
+
+	// Which numbers have exactly that many leading zero bytes
+	if( Class != 0 ) {
+		if( Ones > 0 )
+			return false;
+		Lowest = TBigUnsignedInteger( Class ) << (8 * (TBase58::ADDRESS_BYTES - 1));
+		Highest = (TBigUnsignedInteger( Class + 1 ) << (8 * (TBase58::ADDRESS_BYTES - 1))) - One;
+	} else {
+		// The class byte is always one; the hash can add more, but
+		// they can't all be zero
+		if( Ones == 0 || Ones >= TBase58::ADDRESS_BYTES )
+			return false;
+		if( Ones == Prefix.size() )
+			return true;
+		Lowest = One << (8 * (TBase58::ADDRESS_BYTES - 1 - Ones));
+		Highest = (One << (8 * (TBase58::ADDRESS_BYTES - Ones))) - One;
+	}
+
+	// The numbers whose Base58 starts with the rest of the prefix are,
+	// for each count of digits after it, a range; does any overlap?
+	for( i = Ones; i < Prefix.size(); i++ )
+		Rest = Rest * TBigUnsignedInteger( 58U )
+			+ TBigUnsignedInteger( static_cast<unsigned int>( strchr( TBase58::ALPHABET, Prefix[i] ) - TBase58::ALPHABET ) );
+	while( Rest * Scale <= Highest ) {
+		if( (Rest + One) * Scale - One >= Lowest )
+			return true;
+		Scale = Scale * TBigUnsignedInteger( 58U );
+	}
+
+	return false;
+}
+
+static void vanity()
+{
+	vector<TVanityWorker *> Workers;
+	unsigned int Threads = workerCount();
+	volatile bool Found = false;
+	unsigned long long Tried;
+	struct timeval start;
+	unsigned int Ticks = 0;
+	TByteArray Lowest( TBase58::ADDRESS_BYTES ), Highest( TBase58::ADDRESS_BYTES, 0xff );
+	string First, Last;
+
+	// Every character must be Base58, and some address of this class
+	// must start with them all, or the search would never end
+	Lowest[0] = Highest[0] = DefaultClass;
+	First = TBase58::encode( Lowest );
+	Last = TBase58::encode( Highest );
+	if( VanityPrefix.empty() || VanityPrefix.find_first_not_of( TBase58::ALPHABET ) != string::npos )
+		throw runtime_error( "Vanity prefix must be Base58" );
+	if( VanityPrefix.size() > Last.size() )
+		throw runtime_error( "Vanity prefix is longer than any address" );
+	if( !vanityPossible( VanityPrefix, DefaultClass ) )
+		throw runtime_error( "No address of this class starts with " + VanityPrefix
+				+ "; they start with " + First.substr( 0, 1 )
+				+ (First[0] == Last[0] ? "" : " to " + Last.substr( 0, 1 )) );
+
+	gettimeofday( &start, NULL );
+	for( unsigned int i = 0; i < Threads; i++ ) {
+		Workers.push_back( new TVanityWorker( VanityPrefix, Found ) );
+		Workers.back()->start();
+	}
+
+	// Report progress every ten seconds
+	while( !Found ) {
+		usleep( 50000 );
+		if( ++Ticks % 200 != 0 )
+			continue;
+		Tried = 0;
+		for( unsigned int i = 0; i < Threads; i++ )
+			Tried += Workers[i]->getTried();
+		log() << "Tried " << Tried << " keys, " << Tried / secondsSince( start ) << " keys/s" << endl;
+	}
+
+	list<TEllipticCurveKey> Keys;
+	Tried = 0;
+	for( unsigned int i = 0; i < Threads; i++ ) {
+		Workers[i]->join();
+		Tried += Workers[i]->getTried();
+		if( Keys.empty() && !Workers[i]->getSecret().empty() ) {
+			Keys.push_back( TEllipticCurveKey() );
+			Keys.back().setSecret( Workers[i]->getSecret() );
+		}
+		delete Workers[i];
+	}
+
+	cerr << "Tried " << Tried << " keys in " << secondsSince( start ) << "s = "
+		<< Tried / secondsSince( start ) << " keys/s (" << Threads << " threads)" << endl;
+	showKeyArray( Keys );
+}
+
 // ----- Main
 
 int main( int argc, char *argv[] )
@@ -202,6 +498,8 @@ int main( int argc, char *argv[] )
 		MODE_ADDRESS,
 		MODE_SECRET,
 		MODE_BRAINWALLET,
+		MODE_GENERATE,
+		MODE_VANITY,
 		MODE_COUNT
 	} Mode = MODE_HELP;
 
@@ -211,7 +509,7 @@ int main( int argc, char *argv[] )
 	DefaultClass = NETWORK_PRODNET->AddressClass;
 
 	try {
-		unsigned int i;
+		int i;
 
 		for( i = 1; i < argc; i++ ) {
 			if( strcmp(argv[i], "--debug") == 0 ) {
@@ -235,6 +533,14 @@ int main( int argc, char *argv[] )
 				Mode = MODE_BRAINWALLET;
 			} else if( strcmp(argv[i], "--address") == 0 ) {
 				Mode = MODE_ADDRESS;
+			} else if( strcmp(argv[i], "--generate") == 0 && i + 1 < argc ) {
+				Mode = MODE_GENERATE;
+				GenerateCount = strtoul( argv[++i], NULL, 10 );
+			} else if( strcmp(argv[i], "--vanity") == 0 && i + 1 < argc ) {
+				Mode = MODE_VANITY;
+				VanityPrefix = argv[++i];
+			} else if( strcmp(argv[i], "--threads") == 0 && i + 1 < argc ) {
+				WorkerThreads = strtoul( argv[++i], NULL, 10 );
 			} else if( strcmp(argv[i], "--help") == 0 ) {
 				Mode = MODE_HELP;
 			}
@@ -255,6 +561,12 @@ int main( int argc, char *argv[] )
 			case MODE_SECRET:
 				secret( argc, argv );
 				break;
+			case MODE_GENERATE:
+				generate();
+				break;
+			case MODE_VANITY:
+				vanity();
+				break;
 			default:
 				break;
 		}
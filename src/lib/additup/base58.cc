@@ -0,0 +1,512 @@
+// ----------------------------------------------------------------------------
+// Project: additup
+/// @file   base58.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "base58.h"
+
+// -------------- Includes
+// --- C
+#include <stdint.h>
+#include <string.h>
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+// --- Project libs
+#include <general/crypto.h>
+#include <general/sha256.h>
+#include <general/smallvector.h>
+// --- Project
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+// 80 byte lookup table for reversing ALPHABET, indexed by (ASCII_VALUE -
+// '+'), as in TBitcoinBase58::fromCharacter().  Invalid characters are
+// marked by 0xff.
+static const uint8_t ASCIIToBase58[] = {
+	// Output (0-57)                                 // Input (ASCII)
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01,  // + . . . / 0 1 2
+	0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0xff,  // 3 4 5 6 7 8 9 .
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x09, 0x0a,  // . . . . . . A B
+	0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0xff, 0x11,  // C D E F G H I J
+	0x12, 0x13, 0x14, 0x15, 0xff, 0x16, 0x17, 0x18,  // K L M N O P Q R
+	0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,  // S T U V W X Y Z
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x21, 0x22,  // . . . . . . a b
+	0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a,  // c d e f g h i j
+	0x2b, 0xff, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31,  // k l m n o p q r
+	0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39   // s t u v w x y z
+};
+
+// 58^5 is the largest power of 58 that fits in 32 bits, so five digits
+// are worked at a time
+static const unsigned int DIGITS_PER_WORD = 5;
+static const uint32_t WORD_BASE = 58UL * 58 * 58 * 58 * 58;
+
+// Words enough for an address or a key without going to the heap
+typedef TSmallVector<uint32_t, 16> tWords;
+typedef TSmallVector<char, 64> tDigits;
+
+//
+// Function:	doubleSHA256
+// Description:
+// The checksum hash, straight from and to plain buffers.
+//
+static void doubleSHA256( unsigned char *Out, const unsigned char *p, size_t n )
+{
+	TSHA256 SHA256;
+
+	SHA256.transform( Out, p, n );
+	SHA256.transform( Out, Out, TSHA256::DIGEST_BYTES );
+}
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Template instantiations
+
+
+// -------------- Class member definitions
+
+const size_t TBase58::ADDRESS_BYTES;
+const size_t TBase58::CHECKSUM_BYTES;
+const char TBase58::ALPHABET[] =
+	"123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+//
+// Function:	TBase58 :: encode
+// Description:
+// Write the base58 form of the InSize bytes at In to Out, returning the
+// number of characters written.  No terminator is written.
+//
+// The bytes are loaded into 32 bit words, most significant first, then
+// divided by 58^5 until nothing is left; each remainder gives five
+// digits.
+//
+size_t TBase58::encode( char *Out, size_t OutSize, const unsigned char *In, size_t InSize )
+{
+	size_t Zeroes = 0;
+	tWords Words;
+	tDigits Digits;
+
+	// Leading zero bytes are leading zero digits
+	while( Zeroes < InSize && In[Zeroes] == 0 )
+		Zeroes++;
+
+	// The rest, as a big endian number.  The most significant word
+	// takes whatever won't fill a whole one.
+	size_t Remaining = InSize - Zeroes;
+	Words.resize( (Remaining + 3) / 4, 0 );
+	for( size_t i = 0; i < Remaining; i++ ) {
+		size_t FromEnd = Remaining - 1 - i;
+		Words[Words.size() - 1 - FromEnd / 4] |=
+			static_cast<uint32_t>( In[Zeroes + i] ) << (8 * (FromEnd % 4));
+	}
+
+	size_t First = 0;
+	while( First < Words.size() ) {
+		uint64_t Remainder = 0;
+
+		// Long division by 58^5, from the most significant end
+		for( size_t i = First; i < Words.size(); i++ ) {
+			uint64_t x = (Remainder << 32) | Words[i];
+			Words[i] = static_cast<uint32_t>( x / WORD_BASE );
+			Remainder = x % WORD_BASE;
+		}
+		while( First < Words.size() && Words[First] == 0 )
+			First++;
+
+		// Digits come out least significant first; every word but the
+		// most significant gives all five
+		for( unsigned int k = 0; k < DIGITS_PER_WORD; k++ ) {
+			if( First == Words.size() && Remainder == 0 )
+				break;
+			Digits.push_back( ALPHABET[Remainder % 58] );
+			Remainder /= 58;
+		}
+	}
+
+	if( Zeroes + Digits.size() > OutSize )
+		throw range_error( "TBase58::encode: output buffer too small" );
+
+	memset( Out, ALPHABET[0], Zeroes );
+	for( size_t i = 0; i < Digits.size(); i++ )
+		Out[Zeroes + i] = Digits[Digits.size() - 1 - i];
+
+	return Zeroes + Digits.size();
+}
+
+//
+// Function:	TBase58 :: decode
+// Description:
+// Write the bytes of the InSize base58 characters at In to Out,
+// returning the number of bytes written.
+//
+// The reverse of encode(); five digits at a time are multiplied into
+// 32 bit words, least significant first.
+//
+size_t TBase58::decode( unsigned char *Out, size_t OutSize, const char *In, size_t InSize )
+{
+	size_t Zeroes = 0;
+	tWords Words;
+
+	while( Zeroes < InSize && In[Zeroes] == ALPHABET[0] )
+		Zeroes++;
+
+	for( size_t i = Zeroes; i < InSize; ) {
+		uint32_t Chunk = 0, Multiplier = 1;
+
+		for( unsigned int k = 0; k < DIGITS_PER_WORD && i < InSize; k++, i++ ) {
+			unsigned int ch = static_cast<unsigned char>( In[i] );
+			uint8_t Digit = 0xff;
+			if( ch >= '+' && ch - '+' < sizeof(ASCIIToBase58) )
+				Digit = ASCIIToBase58[ch - '+'];
+			if( Digit == 0xff )
+				throw runtime_error( "TBase58::decode: invalid character" );
+			Chunk = Chunk * 58 + Digit;
+			Multiplier *= 58;
+		}
+
+		// Words = Words * Multiplier + Chunk
+		uint64_t Carry = Chunk;
+		for( size_t j = 0; j < Words.size(); j++ ) {
+			uint64_t x = static_cast<uint64_t>( Words[j] ) * Multiplier + Carry;
+			Words[j] = static_cast<uint32_t>( x );
+			Carry = x >> 32;
+		}
+		if( Carry != 0 )
+			Words.push_back( static_cast<uint32_t>( Carry ) );
+	}
+
+	// Words has no leading zero words, but the top word can have
+	// leading zero bytes
+	size_t Bytes = Words.size() * 4;
+	while( Bytes > 0 && (Words[(Bytes - 1) / 4] >> (8 * ((Bytes - 1) % 4)) & 0xff) == 0 )
+		Bytes--;
+
+	if( Zeroes + Bytes > OutSize )
+		throw range_error( "TBase58::decode: output buffer too small" );
+
+	memset( Out, 0, Zeroes );
+	for( size_t i = 0; i < Bytes; i++ ) {
+		size_t FromEnd = Bytes - 1 - i;
+		Out[Zeroes + i] = Words[FromEnd / 4] >> (8 * (FromEnd % 4));
+	}
+
+	return Zeroes + Bytes;
+}
+
+//
+// Function:	TBase58 :: encode
+// Description:
+//
+string TBase58::encode( const unsigned char *In, size_t InSize )
+{
+	tDigits Buffer;
+
+	Buffer.resize( maximumEncodedSize( InSize ) );
+	size_t n = encode( &Buffer[0], Buffer.size(), In, InSize );
+
+	return string( &Buffer[0], n );
+}
+
+//
+// Function:	TBase58 :: decode
+// Description:
+//
+TByteArray TBase58::decode( const string &s )
+{
+	TByteArray Buffer( maximumDecodedSize( s.size() ) );
+
+	Buffer.resize( decode( Buffer.ptr(), Buffer.size(), s.data(), s.size() ) );
+
+	return Buffer;
+}
+
+//
+// Function:	TBase58 :: encodeCheck
+// Description:
+// Base58Check: the payload followed by the first four bytes of its
+// double SHA256.
+//
+string TBase58::encodeCheck( const TByteArray &Payload )
+{
+	unsigned char Checksum[TSHA256::DIGEST_BYTES];
+	TByteArray Buffer( Payload );
+
+	doubleSHA256( Checksum, Payload.empty() ? NULL : Payload.ptr(), Payload.size() );
+	Buffer.insert( Buffer.end(), Checksum, Checksum + CHECKSUM_BYTES );
+
+	return encode( Buffer );
+}
+
+//
+// Function:	TBase58 :: decodeCheck
+// Description:
+// Decode Base58Check, returning the payload without its checksum.
+// Throws runtime_error if the checksum doesn't match.
+//
+TByteArray TBase58::decodeCheck( const string &s )
+{
+	TByteArray Buffer( decode( s ) );
+
+	if( !checksumMatches( Buffer.empty() ? NULL : Buffer.ptr(), Buffer.size() ) )
+		throw runtime_error( "TBase58::decodeCheck: checksum mismatch" );
+
+	Buffer.resize( Buffer.size() - CHECKSUM_BYTES );
+
+	return Buffer;
+}
+
+//
+// Function:	TBase58 :: checksumMatches
+// Description:
+// True if the last four of the n bytes at p are the start of the double
+// SHA256 of the rest.
+//
+bool TBase58::checksumMatches( const unsigned char *p, size_t n )
+{
+	if( n < CHECKSUM_BYTES )
+		return false;
+
+	unsigned char Checksum[TSHA256::DIGEST_BYTES];
+
+	doubleSHA256( Checksum, p, n - CHECKSUM_BYTES );
+
+	return memcmp( Checksum, p + n - CHECKSUM_BYTES, CHECKSUM_BYTES ) == 0;
+}
+
+//
+// Function:	TBase58 :: encodeAddresses
+// Description:
+// Encode N addresses, each ADDRESS_BYTES long and one after the other
+// at Payloads, appending them to Out.  The payloads should already have
+// their checksums.
+//
+void TBase58::encodeAddresses( vector<string> &Out, const unsigned char *Payloads, size_t N )
+{
+	char Buffer[ADDRESS_BYTES * 138 / 100 + 1];
+
+	Out.reserve( Out.size() + N );
+
+	for( size_t i = 0; i < N; i++ ) {
+		size_t n = encode( Buffer, sizeof(Buffer), Payloads + i * ADDRESS_BYTES, ADDRESS_BYTES );
+		Out.push_back( string( Buffer, n ) );
+	}
+}
+
+//
+// Function:	TBase58 :: decodeAddresses
+// Description:
+// Decode each of In to ADDRESS_BYTES at Payloads, one after the other,
+// and check it.  Valid gets one entry per address: false if it has a
+// bad character, isn't exactly ADDRESS_BYTES long, or has the wrong
+// checksum; those leave zeroes in Payloads.  Returns the number that
+// were valid.
+//
+size_t TBase58::decodeAddresses( unsigned char *Payloads, vector<bool> &Valid, const vector<string> &In )
+{
+	unsigned char Buffer[ADDRESS_BYTES * 2];
+	size_t Count = 0;
+
+	Valid.assign( In.size(), false );
+
+	for( size_t i = 0; i < In.size(); i++ ) {
+		unsigned char *Payload = Payloads + i * ADDRESS_BYTES;
+		size_t n;
+
+		memset( Payload, 0, ADDRESS_BYTES );
+
+		// Anything that would overflow the buffer is too long anyway
+		try {
+			n = decode( Buffer, sizeof(Buffer), In[i].data(), In[i].size() );
+		} catch( exception & ) {
+			continue;
+		}
+		if( n != ADDRESS_BYTES )
+			continue;
+
+		if( !checksumMatches( Buffer, ADDRESS_BYTES ) )
+			continue;
+
+		memcpy( Payload, Buffer, ADDRESS_BYTES );
+		Valid[i] = true;
+		Count++;
+	}
+
+	return Count;
+}
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <iostream>
+#include <sys/time.h>
+#include <general/logstream.h>
+#include "hashtypes.h"
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		log() << "--- Testing against known encodings" << endl;
+
+		static const struct {
+			const char *Hex;
+			const char *Base58;
+		} Samples[] = {
+			{ "", "" },
+			{ "61", "2g" },
+			{ "626262", "a3gV" },
+			{ "636363", "aPEr" },
+			{ "73696d706c792061206c6f6e6720737472696e67", "2cFupjhnEsSn59qHXstmK2ffpLv2" },
+			{ "00eb15231dfceb60925886b67d065299925915aeb172c06647", "1NS17iag9jJgTHD1VXjvLCEnZuQ3rJDE9L" },
+			{ "516b6fcd0f", "ABnLTmg" },
+			{ "bf4f89001e670274dd", "3SEo3LWLoPntC" },
+			{ "572e4794", "3EFU7m" },
+			{ "ecac89cad93923c02321", "EJDM8drfXA6uyA" },
+			{ "10c8511e", "Rt5zm" },
+			{ "00000000000000000000", "1111111111" },
+			{ NULL, NULL }
+		};
+
+		for( unsigned int i = 0; Samples[i].Hex != NULL; i++ ) {
+			TByteArray Bytes;
+			for( const char *p = Samples[i].Hex; *p != '\0'; p += 2 )
+				Bytes.push_back( strtoul( string(p, 2).c_str(), NULL, 16 ) );
+
+			string Encoded = TBase58::encode( Bytes );
+			log() << "\"" << Samples[i].Hex << "\" -> \"" << Encoded << "\"" << endl;
+			if( Encoded != Samples[i].Base58 )
+				throw logic_error( "Encoding doesn't match" );
+			if( TBase58::decode( Encoded ) != Bytes )
+				throw logic_error( "Decoding doesn't match" );
+		}
+
+		bool Threw = false;
+		try {
+			TBase58::decode( "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfN0" );
+		} catch( runtime_error &e ) {
+			Threw = true;
+		}
+		if( !Threw )
+			throw logic_error( "Decoding an invalid character should throw" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Testing Base58Check" << endl;
+
+		TByteArray Payload( TBase58::decode( "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa" ) );
+		Payload.resize( Payload.size() - TBase58::CHECKSUM_BYTES );
+
+		string Encoded = TBase58::encodeCheck( Payload );
+		log() << "Genesis address = " << Encoded << endl;
+		if( Encoded != "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa" )
+			throw logic_error( "Base58Check encoding doesn't match" );
+		if( TBase58::decodeCheck( Encoded ) != Payload )
+			throw logic_error( "Base58Check decoding doesn't match" );
+
+		bool Threw = false;
+		try {
+			TBase58::decodeCheck( "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNb" );
+		} catch( runtime_error &e ) {
+			Threw = true;
+		}
+		if( !Threw )
+			throw logic_error( "A bad checksum should throw" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Testing address batches" << endl;
+		static const unsigned int ADDRESSES = 20000;
+		struct timeval start, stop;
+		uint32_t Seed = 0x2468ace0;
+
+		// Make valid addresses, with some leading zero bytes for
+		// variety
+		TByteArray Payloads( ADDRESSES * TBase58::ADDRESS_BYTES );
+		for( unsigned int i = 0; i < ADDRESSES; i++ ) {
+			TByteArray Payload( TBase58::ADDRESS_BYTES - TBase58::CHECKSUM_BYTES );
+			for( unsigned int j = 0; j < Payload.size(); j++ ) {
+				Seed = Seed * 1103515245 + 12345;
+				Payload[j] = (j <= i % 3) ? 0 : (Seed >> 16);
+			}
+			TByteArray Full( TBase58::decode( TBase58::encodeCheck( Payload ) ) );
+			memcpy( Payloads.ptr( i * TBase58::ADDRESS_BYTES ), Full.ptr(), TBase58::ADDRESS_BYTES );
+		}
+
+		vector<string> Addresses;
+		gettimeofday( &start, NULL );
+		TBase58::encodeAddresses( Addresses, Payloads.ptr(), ADDRESSES );
+		gettimeofday( &stop, NULL );
+		log() << "Batch encode: "
+			<< ((stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_usec - start.tv_usec)) / ADDRESSES
+			<< "us per address" << endl;
+
+		// Spoil one, so that validation has something to find
+		Addresses[7][10] = (Addresses[7][10] == 'z') ? 'y' : 'z';
+
+		TByteArray Decoded( ADDRESSES * TBase58::ADDRESS_BYTES );
+		vector<bool> Valid;
+		gettimeofday( &start, NULL );
+		size_t Count = TBase58::decodeAddresses( Decoded.ptr(), Valid, Addresses );
+		gettimeofday( &stop, NULL );
+		log() << "Batch decode and check: "
+			<< ((stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_usec - start.tv_usec)) / ADDRESSES
+			<< "us per address" << endl;
+
+		if( Count != ADDRESSES - 1 || Valid[7] )
+			throw logic_error( "Batch decode should have found exactly one bad address" );
+		for( unsigned int i = 0; i < ADDRESSES; i++ ) {
+			if( i == 7 )
+				continue;
+			if( memcmp( Decoded.ptr( i * TBase58::ADDRESS_BYTES ), Payloads.ptr( i * TBase58::ADDRESS_BYTES ), TBase58::ADDRESS_BYTES ) != 0 )
+				throw logic_error( "Batch decode doesn't match" );
+			if( TBitcoinAddress( Addresses[i] ).toString() != Addresses[i] )
+				throw logic_error( "TBitcoinAddress doesn't agree with the batch" );
+		}
+
+		// For comparison, the big number conversion
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < ADDRESSES; i++ )
+			TBigUnsignedInteger64( Addresses[i], 58 );
+		gettimeofday( &stop, NULL );
+		log() << "Big number decode (no check): "
+			<< ((stop.tv_sec - start.tv_sec) * 1e6 + (stop.tv_usec - start.tv_usec)) / ADDRESSES
+			<< "us per address" << endl;
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
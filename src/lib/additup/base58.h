@@ -0,0 +1,134 @@
+// ----------------------------------------------------------------------------
+// Project: additup
+/// @file   base58.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef BASE58_H
+#define BASE58_H
+
+// -------------- Includes
+// --- C
+#include <stddef.h>
+// --- C++
+#include <string>
+#include <vector>
+// --- Qt
+// --- OS
+// --- Project lib
+#include <general/bytearray.h>
+// --- Project
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TBase58
+// Description:
+// Base58 and Base58Check conversion straight between bytes and
+// characters.
+//
+// Base58 is the bitcoin encoding for addresses and secrets: the bytes
+// as a big endian number, written in base 58 with an alphabet that
+// leaves out the easily confused 0, O, I and l.  Each leading zero byte
+// is written as a leading '1' (the zero digit), so the byte length
+// survives the trip.  Base58Check appends four bytes of double SHA256
+// to the payload before encoding, and checks them when decoding.
+//
+// TBitcoinBase58 can do this with its big number, but needs a big
+// number for every conversion.  These work on fixed size buffers
+// instead, five digits to a 32 bit word, and don't allocate for
+// anything the size of an address.
+//
+// The raw versions throw range_error if the output buffer is too
+// small, and everything throws runtime_error for characters outside
+// the alphabet.
+//
+class TBase58
+{
+  public:
+	// Version byte, RIPEMD160 hash and checksum
+	static const size_t ADDRESS_BYTES = 1 + 20 + 4;
+	static const size_t CHECKSUM_BYTES = 4;
+	static const char ALPHABET[];
+
+	// Most characters n bytes can make, log(256)/log(58) = 1.37 each;
+	// and most bytes n characters can make, which is n when they are
+	// all leading '1's
+	static size_t maximumEncodedSize( size_t n ) { return n * 138 / 100 + 1; }
+	static size_t maximumDecodedSize( size_t n ) { return n; }
+
+	static size_t encode( char *, size_t, const unsigned char *, size_t );
+	static size_t decode( unsigned char *, size_t, const char *, size_t );
+	static string encode( const unsigned char *, size_t );
+	static string encode( const TByteArray &B ) { return encode( B.empty() ? NULL : B.ptr(), B.size() ); }
+	static TByteArray decode( const string & );
+
+	static string encodeCheck( const TByteArray & );
+	static TByteArray decodeCheck( const string & );
+
+	static void encodeAddresses( vector<string> &, const unsigned char *, size_t );
+	static size_t decodeAddresses( unsigned char *, vector<bool> &, const vector<string> & );
+
+	static bool checksumMatches( const unsigned char *, size_t );
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
@@ -19,12 +19,19 @@
 // -------------- Includes
 // --- C
 #include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
 // --- C++
 #include <sstream>
+#include <memory>
 // --- Qt
 // --- OS
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
 #include <unistd.h>
 // --- Project libs
 #include <general/logstream.h>
@@ -36,11 +43,20 @@
 #include "transactions.h"
 
 
+// -------------- Defines
+// A peer hanging up shouldn't kill us with SIGPIPE; where the flag
+// doesn't exist we just have to hope SIGPIPE is ignored
+#ifndef MSG_NOSIGNAL
+#	define MSG_NOSIGNAL 0
+#endif
+
+
 // -------------- Namespace
 
 
 // -------------- Module Globals
 
+static int openConnection( const TNodeInfo & );
 
 // -------------- World Globals (need "extern"s in header)
 
@@ -177,10 +193,12 @@ double TNetworkParameters::convertTargetToDifficulty( const TBitcoinHash &Target
 		hb1 = hb2;
 
 	// Preserve the top N bits (with N being the storage unit of the big
-	// number)
-	hb1 -= TBitcoinHash::bitsPerBlock;
-	q >>= hb1;
-	r >>= hb1;
+	// number); bit hb1 lands on bit N-1
+	if( hb1 >= TBitcoinHash::bitsPerBlock ) {
+		hb1 -= TBitcoinHash::bitsPerBlock - 1;
+		q >>= hb1;
+		r >>= hb1;
+	}
 
 	// We can now be sure that the two number fill one block only of the
 	// big numbers.  We'll let the compiler do the conversion to
@@ -194,11 +212,38 @@ double TNetworkParameters::convertTargetToDifficulty( const TBitcoinHash &Target
 //
 // Function:	TNetworkParameters :: convertDifficultyToTarget
 // Description:
+// Calculate ProofOfWorkLimit / Difficulty; the reverse of
+// convertTargetToDifficulty().
 //
-TBitcoinHash TNetworkParameters::convertDifficultyToTarget( double ) const
+// The difficulty is split into a 53 bit integer mantissa and a power of
+// two, Difficulty = Mantissa * 2^(Exponent - 53), so that the division
+// is by an integer:
+//
+//   Target = ProofOfWorkLimit * 2^(53 - Exponent) / Mantissa
+//
+// A difficulty below one would be a target above the limit, so is
+// given the limit.
+//
+TBitcoinHash TNetworkParameters::convertDifficultyToTarget( double Difficulty ) const
 {
-	// Yuck.
-	throw logic_error( "Don't call TNetworkParameters::convertDifficultyToTarget() until I've written it" );
+	TBitcoinHash Target( ProofOfWorkLimit );
+	int Exponent;
+
+	if( !(Difficulty >= 1.0) )
+		return Target;
+
+	double Fraction = frexp( Difficulty, &Exponent );
+	uint64_t Mantissa = static_cast<uint64_t>( ldexp( Fraction, 53 ) );
+
+	// Difficulty >= 1, so Exponent >= 1 and the multiplier fits a limb
+	if( Exponent <= 53 ) {
+		Target.multiplyDivide( 1ULL << (53 - Exponent), Mantissa );
+	} else {
+		Target >>= Exponent - 53;
+		Target.multiplyDivide( 1, Mantissa );
+	}
+
+	return Target;
 }
 
 //
@@ -230,8 +275,14 @@ unsigned int TNetworkParameters::expectedGHashesPerBlock( const TBitcoinHash &Ta
 	// Where N is the expected number of hashes performed to find an
 	// acceptable block.
 	//
-	Hashes = (TBitcoinHash(1) << 256);
+	// 2^256 doesn't fit in a TBitcoinHash, but
+	//
+	//   2^256 / T = (2^256 - T) / T + 1
+	//
+	// and (2^256 - T) is what negating T gives, modulo 2^256.
+	Hashes = TBitcoinHash(0) - Target;
 	Hashes /= Target;
+	++Hashes;
 
 	// NB: Difficulty = MaxTarget / CurrentTarget
 	//              N = 2^256 / CurrentTarget
@@ -299,6 +350,8 @@ TNodeInfo &TBitcoinNetwork::updateDirectory( const TNodeInfo &Node )
 //
 // Function:	TBitcoinNetwork :: process
 // Description:
+// Hands a received message to the receive_X() handler for its kind,
+// and then to any event objects registered for that kind.
 //
 void TBitcoinNetwork::process( TMessage *Message )
 {
@@ -306,40 +359,87 @@ void TBitcoinNetwork::process( TMessage *Message )
 
 	if( Message == NULL ) {
 		// Spontaneous
-	} else if( dynamic_cast<TMessageUnimplemented*>( Message ) != NULL ) {
-		// No response needed
-		log(TLog::Warning) << "[NETW] Ignoring unknown message type, " << Message->className() << endl;
-	} else if( dynamic_cast<TMessage_version*>( Message ) != NULL ) {
-		receive_version( reinterpret_cast<TMessage_version*>( Message ) );
-	} else if( dynamic_cast<TMessage_inv*>( Message ) != NULL ) {
-		receive_inv( reinterpret_cast<TMessage_inv*>( Message ) );
-	} else if( dynamic_cast<TMessage_getdata*>( Message ) != NULL ) {
-		receive_getdata( reinterpret_cast<TMessage_getdata*>( Message ) );
-	} else if( dynamic_cast<TMessage_getblocks*>( Message ) != NULL ) {
-		receive_getblocks( reinterpret_cast<TMessage_getblocks*>( Message ) );
-	} else if( dynamic_cast<TMessage_getheaders*>( Message ) != NULL ) {
-		receive_getheaders( reinterpret_cast<TMessage_getheaders*>( Message ) );
-	} else if( dynamic_cast<TMessage_getaddr*>( Message ) != NULL ) {
-		receive_getaddr( reinterpret_cast<TMessage_getaddr*>( Message ) );
-	} else if( dynamic_cast<TMessage_tx*>( Message ) != NULL ) {
-		receive_tx( reinterpret_cast<TMessage_tx*>( Message ) );
-	} else if( dynamic_cast<TMessage_block*>( Message ) != NULL ) {
-		receive_block( reinterpret_cast<TMessage_block*>( Message ) );
-	} else if( dynamic_cast<TMessage_headers*>( Message ) != NULL ) {
-		receive_headers( reinterpret_cast<TMessage_headers*>( Message ) );
-	} else if( dynamic_cast<TMessage_addr*>( Message ) != NULL ) {
-		receive_addr( reinterpret_cast<TMessage_addr*>( Message ) );
-	} else if( dynamic_cast<TMessage_reply*>( Message ) != NULL ) {
-		receive_reply( reinterpret_cast<TMessage_reply*>( Message ) );
-	} else if( dynamic_cast<TMessage_ping*>( Message ) != NULL ) {
-		receive_ping( reinterpret_cast<TMessage_ping*>( Message ) );
-	} else if( dynamic_cast<TMessage_submitorder*>( Message ) != NULL ) {
-		receive_submitorder( reinterpret_cast<TMessage_submitorder*>( Message ) );
-	} else if( dynamic_cast<TMessage_checkorder*>( Message ) != NULL ) {
-		receive_checkorder( reinterpret_cast<TMessage_checkorder*>( Message ) );
-	} else if( dynamic_cast<TMessage_alert*>( Message ) != NULL ) {
-		receive_alert( reinterpret_cast<TMessage_alert*>( Message ) );
+		return;
 	}
+
+	// The handlers know the concrete class, messageKind() tells us
+	// which one that is, so the casts are safe
+	switch( Message->messageKind() ) {
+		case MESSAGE_UNIMPLEMENTED:
+			// No response needed
+			log(TLog::Warning) << "[NETW] Ignoring unknown message type, " << Message->className() << endl;
+			break;
+		case MESSAGE_VERSION:
+			receive_version( static_cast<TMessage_version*>( Message ) );
+			break;
+		case MESSAGE_VERACK:
+			receive_verack( static_cast<TMessage_verack*>( Message ) );
+			break;
+		case MESSAGE_INV:
+			receive_inv( static_cast<TMessage_inv*>( Message ) );
+			break;
+		case MESSAGE_GETDATA:
+			receive_getdata( static_cast<TMessage_getdata*>( Message ) );
+			break;
+		case MESSAGE_GETBLOCKS:
+			receive_getblocks( static_cast<TMessage_getblocks*>( Message ) );
+			break;
+		case MESSAGE_GETHEADERS:
+			receive_getheaders( static_cast<TMessage_getheaders*>( Message ) );
+			break;
+		case MESSAGE_GETADDR:
+			receive_getaddr( static_cast<TMessage_getaddr*>( Message ) );
+			break;
+		case MESSAGE_TX:
+			receive_tx( static_cast<TMessage_tx*>( Message ) );
+			break;
+		case MESSAGE_BLOCK:
+			receive_block( static_cast<TMessage_block*>( Message ) );
+			break;
+		case MESSAGE_HEADERS:
+			receive_headers( static_cast<TMessage_headers*>( Message ) );
+			break;
+		case MESSAGE_ADDR:
+			receive_addr( static_cast<TMessage_addr*>( Message ) );
+			break;
+		case MESSAGE_REPLY:
+			receive_reply( static_cast<TMessage_reply*>( Message ) );
+			break;
+		case MESSAGE_PING:
+			receive_ping( static_cast<TMessage_ping*>( Message ) );
+			break;
+		case MESSAGE_SUBMITORDER:
+			receive_submitorder( static_cast<TMessage_submitorder*>( Message ) );
+			break;
+		case MESSAGE_CHECKORDER:
+			receive_checkorder( static_cast<TMessage_checkorder*>( Message ) );
+			break;
+		case MESSAGE_ALERT:
+			receive_alert( static_cast<TMessage_alert*>( Message ) );
+			break;
+		case MESSAGE_KIND_COUNT:
+			break;
+	}
+
+	// Anyone else who asked to see this kind of message
+	list<const TBitcoinEventObject*>::const_iterator it;
+	const list<const TBitcoinEventObject*> &Extra = KindEventObjects[Message->messageKind()];
+	for( it = Extra.begin(); it != Extra.end(); it++ )
+		(*it)->messageReceived( Message );
+}
+
+//
+// Function:	TBitcoinNetwork :: dispatch
+// Description:
+// Called by peers with each message they receive once connected.  We
+// take ownership of the message.  Here it is simply processed, but a
+// network that processes messages on another thread might queue it.
+//
+void TBitcoinNetwork::dispatch( TMessage *Message )
+{
+	auto_ptr<TMessage> AutoTidy( Message );
+
+	process( Message );
 }
 
 //
@@ -507,8 +607,10 @@ void TBitcoinNetwork::receive_getblocks( TMessage_getblocks *getblocks )
 		}
 	}
 	// TX> inv
+	// A peer that isn't keeping up can have this dropped; it will ask
+	// again with another getblocks, which replaces the continuation
 	if( inv->size() > 0 ) {
-		Peer->queueOutgoing( inv );
+		Peer->queueOutgoing( inv, TBitcoinPeer::LowPriority );
 	} else {
 		delete inv;
 	}
@@ -703,6 +805,24 @@ void TBitcoinNetwork::registerEventObject( const TBitcoinEventObject *O )
 	}
 }
 
+//
+// Function:	TBitcoinNetwork :: registerEventObject
+// Description:
+// Adds an event object that will be told about every received message
+// of the given kind, after the network's own handler has dealt with it.
+// Any number may be registered per kind; for example to gather
+// statistics on particular messages.
+//
+void TBitcoinNetwork::registerEventObject( eMessageKind Kind, const TBitcoinEventObject *O )
+{
+	if( Kind >= MESSAGE_KIND_COUNT )
+		throw logic_error( "TBitcoinNetwork::registerEventObject() given an invalid message kind" );
+	if( O == NULL )
+		return;
+
+	KindEventObjects[Kind].push_back( O );
+}
+
 //
 // Function:	TBitcoinNetwork :: getNetworkTime
 // Description:
@@ -746,12 +866,122 @@ void TBitcoinNetwork::connectToNode( const TNodeInfo &n )
 
 // -----------
 
+//
+// Function:	TOutputBuffer :: fill
+// Description:
+// Serialises everything on the peer's outgoing queue onto the end of
+// the buffer.
+//
+void TOutputBuffer::fill( TBitcoinPeer *Peer )
+{
+	ostringstream oss;
+	TMessage *out;
+
+	while( (out = Peer->nextOutgoing()) ) {
+		oss.str("");
+		out->write( oss );
+//		log() << "[NETW] TX> " << *out << " -> ";
+//		TLog::hexify( log(), oss.str() );
+//		log() << " (" << oss.str().size() << ")";
+//		log() << endl;
+		Chunks.push_back( oss.str() );
+		Size += Chunks.back().size();
+		delete out;
+	}
+}
+
+//
+// Function:	TOutputBuffer :: gather
+// Description:
+// Points up to n iovecs at the unwritten bytes, and returns how many
+// were used.  They remain valid until the next fill() or consume().
+//
+unsigned int TOutputBuffer::gather( struct iovec *iov, unsigned int n ) const
+{
+	list<string>::const_iterator it;
+	unsigned int i;
+
+	if( Chunks.empty() || n == 0 )
+		return 0;
+
+	it = Chunks.begin();
+	iov[0].iov_base = const_cast<char *>( it->data() + Offset );
+	iov[0].iov_len = it->size() - Offset;
+	for( i = 1, it++; i < n && it != Chunks.end(); i++, it++ ) {
+		iov[i].iov_base = const_cast<char *>( it->data() );
+		iov[i].iov_len = it->size();
+	}
+
+	return i;
+}
+
+//
+// Function:	TOutputBuffer :: consume
+// Description:
+// Discards n written bytes, which might end part way through a chunk.
+//
+void TOutputBuffer::consume( size_t n )
+{
+	if( n > Size )
+		throw logic_error( "TOutputBuffer::consume() more than is buffered" );
+
+	Size -= n;
+	while( n > 0 ) {
+		string::size_type Remaining = Chunks.front().size() - Offset;
+		if( n < Remaining ) {
+			Offset += n;
+			break;
+		}
+		n -= Remaining;
+		Chunks.pop_front();
+		Offset = 0;
+	}
+}
+
+// -----------
+
 //
 // Function:	TBitcoinNetwork_Sockets :: TBitcoinNetwork_Sockets
 // Description:
+// With IOThreads zero, everything runs on the thread that calls run().
+//
+TBitcoinNetwork_Sockets::TBitcoinNetwork_Sockets( unsigned int n, TSocketPoller::TFactory f ) :
+	IOThreads( n ),
+	PollerFactory( f ),
+	OutputHighWatermark( DEFAULT_OUTPUT_HIGH_WATERMARK )
+{
+	unsigned int i;
+
+	for( i = 0; i < (IOThreads == 0 ? 1 : IOThreads); i++ )
+		Shards.push_back( new TShard( this ) );
+}
+
 //
-TBitcoinNetwork_Sockets::TBitcoinNetwork_Sockets()
+// Function:	TBitcoinNetwork_Sockets :: ~TBitcoinNetwork_Sockets
+// Description:
+// Every I/O thread is stopped before anything is taken apart, so that
+// none of them is left looking at a shard that has gone.  What they
+// had already delivered is processed while the shards still exist, as
+// handlers may reply, and replies go through shardFor().  Deleting the
+// shards closes the remaining sockets; the peers themselves go in the
+// final processDeliveries().
+//
+TBitcoinNetwork_Sockets::~TBitcoinNetwork_Sockets()
 {
+	vector<TShard *>::iterator it;
+
+	for( it = Shards.begin(); it != Shards.end(); it++ )
+		(*it)->stop();
+
+	// Anything still waiting to be processed
+	processDeliveries();
+
+	for( it = Shards.begin(); it != Shards.end(); it++ )
+		delete *it;
+	Shards.clear();
+
+	// Disconnections from the shards' destructors
+	processDeliveries();
 }
 
 //
@@ -760,179 +990,1148 @@ TBitcoinNetwork_Sockets::TBitcoinNetwork_Sockets()
 // It's expected that this function will be the entry point for users of
 // this library to fire-and-forget.
 //
-// We expect to be running in a separate thread, so will not concern
-// ourselves with non-blocking I/O.
+// Sockets are non-blocking, and each is registered with its shard's
+// poller once, when it is connected.  Shards only wake for descriptors
+// that are ready, and only send to peers that have had something queued
+// for them or whose socket has room for what it refused earlier.
+//
+// When threaded, this thread leaves the sockets to the shards, and
+// instead gives the peers the bytes the shards deliver.
 //
 void TBitcoinNetwork_Sockets::run()
 {
-	fd_set readfds;
-	fd_t maxfd;
-	map<TBitcoinPeer *, fd_t>::iterator it;
-	int ret;
-	struct timeval timeout;
-
-	log() << "[NETW] *** TBitcoinNetwork running" << endl;
+	auto_ptr<TSocketPoller> Poller;
+	vector<TSocketPoller::TEvent> Events;
+	vector<TShard *>::iterator it;
+	bool Active;
+
+	log() << "[NETW] *** TBitcoinNetwork running, using "
+		<< Shards.front()->getPollerClassName() << ", with ";
+	if( isThreaded() ) {
+		log() << IOThreads << " I/O threads" << endl;
+	} else {
+		log() << "no I/O threads" << endl;
+	}
 
 	log() << "[NETW] " << Directory.size() << " directory entries available" << endl;
 
+	if( isThreaded() ) {
+		for( it = Shards.begin(); it != Shards.end(); it++ )
+			(*it)->start();
+		Poller.reset( PollerFactory() );
+		Poller->add( DeliveryWakeup.descriptor() );
+	}
+
 	log() << "[NETW] --- TBitcoinNetwork main loop started" << endl;
 	while( true ) {
 		// Check for low connections
-		if( PeerDescriptors.size() < 1 ) {
-			log() << "[NETW] Connectivity is low, " << PeerDescriptors.size() << endl;
+		if( Connections.size() < 1 ) {
+			log() << "[NETW] Connectivity is low, " << Connections.size() << endl;
 			connectToAny();
 		}
 
-		// Prepare the monitor list, and send pending packets while
-		// we're at it
-		FD_ZERO( &readfds );
-		maxfd = 0;
-		for( it = PeerDescriptors.begin(); it != PeerDescriptors.end(); it++ ) {
-			FD_SET( it->second, &readfds );
-			if( maxfd < it->second )
-				maxfd = it->second;
-
-			sendTo( it->first );
-		}
-		// Prepare timeout
-		timeout.tv_sec = 60;
-		timeout.tv_usec = 0;
-
-		// Select
+		// Wait
 //		log() << "[NETW] Waiting for data" << endl;
-		ret = select( maxfd + 1, &readfds, NULL, NULL, &timeout );
-		if( ret == 0 ) {
+		if( isThreaded() ) {
+			Active = Poller->wait( 60 * 1000, Events ) > 0;
+			DeliveryWakeup.clear();
+			processDeliveries();
+		} else {
+			Active = Shards.front()->poll( 60 * 1000 );
+		}
+		if( !Active ) {
 			log() << "[NETW] No data received for 60s" << endl;
 			continue;
-		} else if( ret < 0 ) {
-			throw libc_error( "select()" );
-		}
-
-		// Find the peers that match the activated descriptors
-		for( it = PeerDescriptors.begin(); it != PeerDescriptors.end(); it++ ) {
-			if( FD_ISSET( it->second, &readfds ) )
-				receiveFrom( it->first );
 		}
 	}
 	log() << "[NETW] --- TBitcoinNetwork main loop finished" << endl;
 }
 
 //
-// Function:	TBitcoinNetwork_Sockets :: receiveFrom
+// Function:	TBitcoinNetwork_Sockets :: processDeliveries
 // Description:
+// Each peer's bytes are parsed, and the messages in them processed,
+// here on run()'s thread, in the order they were read.
 //
-void TBitcoinNetwork_Sockets::receiveFrom( TBitcoinPeer *Peer )
+void TBitcoinNetwork_Sockets::processDeliveries()
 {
-	fd_t fd = PeerDescriptors[Peer];
-	int n;
-	TByteArray ba(1024);
+	TDelivery Delivery;
+
+	while( Deliveries.pop( Delivery ) ) {
+		if( Delivery.Dropped ) {
+			if( !Delivery.Reason.empty() )
+				log() << "[NETW] " << Delivery.Reason << endl;
+			// Nothing from this peer can follow its disconnection
+			Connections.erase( Delivery.Peer );
+			delete Delivery.Peer;
+			continue;
+		}
 
-	// Perform the read
-	n = read( fd, ba, ba.size() );
-	if( n == 0 ) {
-		// end of file
-		disconnect( Peer );
-		return;
-	} else if( n < 0 ) {
-		throw libc_error( "read()" );
+		try {
+			Delivery.Peer->receive( Delivery.Received );
+		} catch( exception &e ) {
+			log() << "[NETW] Error processing message, " << e.what() << endl;
+		}
 	}
-	// How many bytes were actually read?
-	ba.resize(n);
+}
 
-//	log() << "[NETW] RX< ";
-//	TLog::hexify( log(), ba );
-//	log() << endl;
+//
+// Function:	TBitcoinNetwork_Sockets :: outgoingQueued
+// Description:
+//
+void TBitcoinNetwork_Sockets::outgoingQueued( TBitcoinPeer *Peer )
+{
+	TShard *Shard = shardFor( Peer );
 
-	// let the peer deal with what it received
-	Peer->receive( ba );
+	if( Shard != NULL )
+		Shard->requestSend( Peer );
 }
 
 //
-// Function:	TBitcoinNetwork_Sockets :: sendTo
+// Function:	TBitcoinNetwork_Sockets :: isCongested
 // Description:
 //
-void TBitcoinNetwork_Sockets::sendTo( TBitcoinPeer *Peer )
+bool TBitcoinNetwork_Sockets::isCongested( const TBitcoinPeer *Peer ) const
 {
-	fd_t fd = PeerDescriptors[Peer];
-	ostringstream oss;
-	TMessage *out;
+	TShard *Shard = shardFor( Peer );
 
-	while( (out = Peer->nextOutgoing()) ) {
-		oss.str("");
-		out->write( oss );
-//		log() << "[NETW] TX> " << *out << " -> ";
-//		TLog::hexify( log(), oss.str() );
-//		log() << " (" << oss.str().size() << ")";
-//		log() << endl;
-		write( fd, oss.str().data(), oss.str().size() );
-	}
+	return Shard != NULL && Shard->isCongested( Peer );
 }
 
 //
-// Function:	TBitcoinNetwork_Sockets :: connectToNode
+// Function:	TBitcoinNetwork_Sockets :: getReadCount
 // Description:
 //
-void TBitcoinNetwork_Sockets::connectToNode( const TNodeInfo &Node )
+unsigned long long TBitcoinNetwork_Sockets::getReadCount() const
 {
-	fd_t fd;
-	sockaddr_in SAI;
-	sockaddr &SA(reinterpret_cast<sockaddr &>(SAI));
-	int ret;
+	vector<TShard *>::const_iterator it;
+	unsigned long long n = 0;
 
-	// Configure the generating fd
-	fd = socket( PF_INET, SOCK_STREAM, 0 );
-	if( fd < 0 )
-		throw socket_error( "socket()" );
+	for( it = Shards.begin(); it != Shards.end(); it++ )
+		n += (*it)->getReadCount();
 
-	// XXX: iterate through known networks
+	return n;
+}
 
-	// Connect address
-	Node.toSockAddr( SA );
-	if( SAI.sin_port == 0 )
-		SAI.sin_port = htons( 8333 );
+//
+// Function:	TBitcoinNetwork_Sockets :: getBytesRead
+// Description:
+//
+unsigned long long TBitcoinNetwork_Sockets::getBytesRead() const
+{
+	vector<TShard *>::const_iterator it;
+	unsigned long long n = 0;
 
-	// Connect
-	log() << "[NETW] Attempting connection to ";
-	Node.printOn( log() );
-	log() << endl;
-	ret = connect( fd, &SA, sizeof( SAI ) );
-	if( ret < 0 )
-		throw socket_error( "connect()" );
-	log() << "[NETW] Successfully connected, creating TBitcoinPeer object to manage descriptor " << fd << endl;
+	for( it = Shards.begin(); it != Shards.end(); it++ )
+		n += (*it)->getBytesRead();
+
+	return n;
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: getBytesPerRead
+// Description:
+//
+double TBitcoinNetwork_Sockets::getBytesPerRead() const
+{
+	unsigned long long Reads = getReadCount();
+
+	return Reads == 0 ? 0.0 : double(getBytesRead()) / Reads;
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: shardFor
+// Description:
+// Peers are spread across the shards by address, so that any thread
+// can find a peer's shard without a shared (and so locked) table.
+// Returns NULL once the destructor has deleted the shards.
+//
+TBitcoinNetwork_Sockets::TShard *TBitcoinNetwork_Sockets::shardFor( const TBitcoinPeer *Peer ) const
+{
+	if( Shards.empty() )
+		return NULL;
+
+	// The bottom bits of a heap address are always the same
+	return Shards[ (reinterpret_cast<size_t>(Peer) >> 4) % Shards.size() ];
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: connectToNode
+// Description:
+//
+void TBitcoinNetwork_Sockets::connectToNode( const TNodeInfo &Node )
+{
+	fd_t fd = openConnection( Node );
+
+	// Everything from here on is non-blocking
+	TSocketPoller::setNonBlocking( fd );
 
 	// Create a peer to match
 	TBitcoinPeer *Peer = new TBitcoinPeer( &Node, this );
-	PeerDescriptors[Peer] = fd;
+	Connections.insert( Peer );
 	Peer->setState( TBitcoinPeer::Connecting );
 
 	// Prod the remote to begin
 	Peer->receive( TByteArray() );
+
+	// From now on the peer belongs to its shard
+	shardFor( Peer )->adopt( Peer, fd );
 }
 
 //
 // Function:	TBitcoinNetwork_Sockets :: disconnect
 // Description:
+// Must be called from the peer's shard's thread.
 //
 void TBitcoinNetwork_Sockets::disconnect( TBitcoinPeer *Peer )
 {
-	fd_t fd = PeerDescriptors[Peer];
-	int ret;
+	TShard *Shard = shardFor( Peer );
 
-	ret = shutdown( fd, SHUT_RDWR );
-	if( ret < 0 )
-		throw socket_error( "shutdown()" );
-	ret = close( fd );
-	if( ret < 0 )
-		throw libc_error( "close()" );
+	if( Shard != NULL )
+		Shard->disconnect( Peer );
+}
 
-	PeerDescriptors.erase( Peer );
-	delete Peer;
+//
+// Function:	TBitcoinNetwork_Sockets :: peerReceived
+// Description:
+// Called by a threaded shard with bytes it has read for a peer, which
+// are passed to run()'s thread to be parsed.
+//
+void TBitcoinNetwork_Sockets::peerReceived( TBitcoinPeer *Peer, const TByteArray &Received )
+{
+	TDelivery Delivery;
 
-	return;
+	Delivery.Peer = Peer;
+	Delivery.Received = Received;
+	Deliveries.push( Delivery );
+	DeliveryWakeup.wake();
 }
 
+//
+// Function:	TBitcoinNetwork_Sockets :: peerDropped
+// Description:
+// Called by a shard once it has closed a peer's socket.  When threaded,
+// bytes from that peer might still be waiting to be processed, so the
+// peer is only deleted, and the reason logged, when run()'s thread gets
+// to this notification, which comes after them.
+//
+void TBitcoinNetwork_Sockets::peerDropped( TBitcoinPeer *Peer, const string &Reason )
+{
+	TDelivery Delivery;
+
+	if( !isThreaded() ) {
+		if( !Reason.empty() )
+			log() << "[NETW] " << Reason << endl;
+		Connections.erase( Peer );
+		delete Peer;
+		return;
+	}
+
+	Delivery.Peer = Peer;
+	Delivery.Dropped = true;
+	Delivery.Reason = Reason;
+	Deliveries.push( Delivery );
+	DeliveryWakeup.wake();
+}
 
-// -------------- Function definitions
+// -----------
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: TShard
+// Description:
+//
+TBitcoinNetwork_Sockets::TShard::TShard( TBitcoinNetwork_Sockets *n ) :
+	Network( n ),
+	Poller( n->PollerFactory() ),
+	Stopping( 0 ),
+	ReadCount( 0 ),
+	BytesRead( 0 )
+{
+	Poller->add( Wakeup.descriptor() );
+	if( Network->isThreaded() )
+		ReadScratch.resize( MINIMUM_READ_SIZE );
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: ~TShard
+// Description:
+//
+TBitcoinNetwork_Sockets::TShard::~TShard()
+{
+	while( !PeerDescriptors.empty() )
+		disconnect( PeerDescriptors.begin()->first );
+	delete Poller;
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: run
+// Description:
+// The I/O thread.
+//
+void TBitcoinNetwork_Sockets::TShard::run()
+{
+	while( !__sync_fetch_and_add( &Stopping, 0 ) )
+		poll( 60 * 1000 );
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: stop
+// Description:
+// Stops the I/O thread, if there is one, and waits for it to finish.
+//
+void TBitcoinNetwork_Sockets::TShard::stop()
+{
+	__sync_lock_test_and_set( &Stopping, 1 );
+	Wakeup.wake();
+	join();
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: poll
+// Description:
+// Waits up to ms milliseconds for activity on the shard's sockets and
+// deals with it.  Returns false if there was none.
+//
+bool TBitcoinNetwork_Sockets::TShard::poll( int ms )
+{
+	vector<TSocketPoller::TEvent> Events;
+	vector<TSocketPoller::TEvent>::const_iterator it;
+	map<fd_t, TBitcoinPeer *>::iterator pit;
+	unsigned int ret;
+
+	// Anything asked of us since we last looked
+	handleRequests();
+
+	ret = Poller->wait( ms, Events );
+
+	// Find the peers that match the activated descriptors; each is
+	// looked up afresh because handling an earlier event might have
+	// disconnected it
+	for( it = Events.begin(); it != Events.end(); it++ ) {
+		if( it->Descriptor == Wakeup.descriptor() ) {
+			Wakeup.clear();
+			handleRequests();
+			continue;
+		}
+
+		pit = DescriptorPeers.find( it->Descriptor );
+		if( pit != DescriptorPeers.end() && it->Writable )
+			sendTo( pit->second );
+
+		pit = DescriptorPeers.find( it->Descriptor );
+		if( pit != DescriptorPeers.end() && it->Readable )
+			receiveFrom( pit->second );
+	}
+
+	return ret > 0;
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: adopt
+// Description:
+// Any thread may give a shard a newly connected peer.
+//
+void TBitcoinNetwork_Sockets::TShard::adopt( TBitcoinPeer *Peer, fd_t fd )
+{
+	Adoptions.push( make_pair( Peer, fd ) );
+	if( !isMine() )
+		Wakeup.wake();
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: requestSend
+// Description:
+// Any thread may ask for a peer's outgoing queue to be sent.
+//
+void TBitcoinNetwork_Sockets::TShard::requestSend( TBitcoinPeer *Peer )
+{
+	SendRequests.push( Peer );
+	if( !isMine() )
+		Wakeup.wake();
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: handleRequests
+// Description:
+// A send request can refer to a peer that has since been disconnected,
+// and even deleted, so it is looked up, never dereferenced.
+//
+void TBitcoinNetwork_Sockets::TShard::handleRequests()
+{
+	pair<TBitcoinPeer *, fd_t> Adoption;
+	TBitcoinPeer *Peer;
+
+	while( Adoptions.pop( Adoption ) ) {
+		PeerDescriptors[Adoption.first] = Adoption.second;
+		DescriptorPeers[Adoption.second] = Adoption.first;
+		Poller->add( Adoption.second );
+		// Anything it queued before it was ours
+		sendTo( Adoption.first );
+	}
+
+	while( SendRequests.pop( Peer ) ) {
+		if( PeerDescriptors.find( Peer ) != PeerDescriptors.end() )
+			sendTo( Peer );
+	}
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: isCongested
+// Description:
+// Messages still on the peer's queue count as well as the bytes
+// waiting for the socket.
+//
+bool TBitcoinNetwork_Sockets::TShard::isCongested( const TBitcoinPeer *Peer ) const
+{
+	TMutexLocker Lock( OutputLock );
+	map<const TBitcoinPeer *, TOutputBuffer>::const_iterator it;
+
+	size_t Backlog = Peer->getOutgoingBytes();
+
+	it = PendingOutput.find( Peer );
+	if( it != PendingOutput.end() )
+		Backlog += it->second.size();
+	return Backlog > Network->getOutputHighWatermark();
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: receiveFrom
+// Description:
+// The poller is edge triggered, so we must read until the socket is
+// empty.
+//
+// Without I/O threads, each read goes straight into the peer's receive
+// buffer, which grows to fit whatever message is part way through
+// arriving, so a large block comes in a few large reads and is parsed
+// where it lands.  A threaded shard instead reads into its own buffer
+// and passes a copy to run()'s thread, as only that thread may touch
+// the peer's parser.
+//
+void TBitcoinNetwork_Sockets::TShard::receiveFrom( TBitcoinPeer *Peer )
+{
+	fd_t fd = PeerDescriptors[Peer];
+	bool Threaded = Network->isThreaded();
+	unsigned char *p;
+	size_t space;
+	ssize_t n;
+
+	while( true ) {
+		// Perform the read
+		if( Threaded ) {
+			space = ReadScratch.size();
+			p = ReadScratch.ptr();
+		} else {
+			space = MINIMUM_READ_SIZE;
+			p = Peer->receiveBuffer( space );
+		}
+		n = read( fd, p, space );
+		__sync_fetch_and_add( &ReadCount, 1 );
+		if( n == 0 ) {
+			// end of file
+			disconnect( Peer );
+			return;
+		} else if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				break;
+			disconnect( Peer, string("read() failed, ") + libc_error( "read()" ).what() );
+			return;
+		}
+		__sync_fetch_and_add( &BytesRead, n );
+
+//		log() << "[NETW] RX< ";
+//		TLog::hexify( log(), string( reinterpret_cast<const char*>(p), n ) );
+//		log() << endl;
+
+		if( Threaded ) {
+			Network->peerReceived( Peer, TByteArray( p, n ) );
+			continue;
+		}
+
+		// let the peer deal with what it received
+		Peer->received( n );
+
+		// Handling the messages can disconnect the peer, and without
+		// I/O threads, delete it, so look it up before reading again
+		map<TBitcoinPeer *, fd_t>::const_iterator it = PeerDescriptors.find( Peer );
+		if( it == PeerDescriptors.end() || it->second != fd )
+			return;
+	}
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: sendTo
+// Description:
+// Moves everything on the peer's outgoing queue into its output buffer,
+// then writes as much of the buffer as the socket will take in as few
+// gathered writes as possible.  Anything left over stays in the buffer,
+// and we ask the poller to tell us when there is room.
+//
+void TBitcoinNetwork_Sockets::TShard::sendTo( TBitcoinPeer *Peer )
+{
+	fd_t fd = PeerDescriptors[Peer];
+	struct iovec iov[TOutputBuffer::MAXIMUM_GATHER];
+	struct msghdr msg;
+	ssize_t n = 0;
+
+	{
+		TMutexLocker Lock( OutputLock );
+		TOutputBuffer &Pending = PendingOutput[Peer];
+
+		Pending.fill( Peer );
+
+		while( !Pending.empty() ) {
+			// sendmsg() is writev() with flags, which we need for
+			// MSG_NOSIGNAL
+			memset( &msg, 0, sizeof(msg) );
+			msg.msg_iov = iov;
+			msg.msg_iovlen = Pending.gather( iov, TOutputBuffer::MAXIMUM_GATHER );
+			n = sendmsg( fd, &msg, MSG_NOSIGNAL );
+			if( n < 0 ) {
+				if( errno == EINTR )
+					continue;
+				if( errno == EAGAIN || errno == EWOULDBLOCK )
+					n = 0;
+				break;
+			}
+			Pending.consume( n );
+		}
+
+		Poller->setWriteInterest( fd, !Pending.empty() );
+	}
+
+	// disconnect() takes the lock itself
+	if( n < 0 )
+		disconnect( Peer, string("sendmsg() failed, ") + libc_error( "sendmsg()" ).what() );
+}
+
+//
+// Function:	TBitcoinNetwork_Sockets :: TShard :: disconnect
+// Description:
+// The reason, if any, is logged by whichever thread the peer belongs
+// to.
+//
+void TBitcoinNetwork_Sockets::TShard::disconnect( TBitcoinPeer *Peer, const string &Reason )
+{
+	fd_t fd = PeerDescriptors[Peer];
+	int ret;
+
+	Poller->remove( fd );
+
+	// The remote may well have gone already, in which case there's
+	// nothing to shut down
+	shutdown( fd, SHUT_RDWR );
+	ret = close( fd );
+	if( ret < 0 )
+		throw libc_error( "close()" );
+
+	PeerDescriptors.erase( Peer );
+	DescriptorPeers.erase( fd );
+	{
+		TMutexLocker Lock( OutputLock );
+		PendingOutput.erase( Peer );
+	}
+
+	Network->peerDropped( Peer, Reason );
+}
+
+
+#ifdef HAVE_IO_URING
+// -----------
+
+//
+// Function:	TBitcoinNetwork_IOUring :: TBitcoinNetwork_IOUring
+// Description:
+// Each peer can have a receive and a send in flight, and there's an
+// accept and a timeout besides, so the ring is sized to never be short
+// of entries.
+//
+TBitcoinNetwork_IOUring::TBitcoinNetwork_IOUring( unsigned int MaximumPeers ) :
+	Ring( 2 * MaximumPeers + 2 ),
+	ReceiveBuffers( MaximumPeers * RECEIVE_BUFFER_SIZE ),
+	ListenDescriptor( -1 ),
+	Accepting( false ),
+	TimerArmed( false ),
+	Activity( false ),
+	Stopping( false ),
+	OutputHighWatermark( TBitcoinNetwork_Sockets::DEFAULT_OUTPUT_HIGH_WATERMARK ),
+	ReadCount( 0 ),
+	BytesRead( 0 )
+{
+	vector<struct iovec> iov( MaximumPeers );
+	unsigned int i;
+
+	if( MaximumPeers == 0 )
+		throw range_error( "TBitcoinNetwork_IOUring needs room for at least one peer" );
+
+	for( i = 0; i < MaximumPeers; i++ ) {
+		iov[i].iov_base = &ReceiveBuffers[i * RECEIVE_BUFFER_SIZE];
+		iov[i].iov_len = RECEIVE_BUFFER_SIZE;
+		// Hand out the lowest first
+		FreeBuffers.push_back( MaximumPeers - 1 - i );
+	}
+	Ring.registerBuffers( &iov[0], iov.size() );
+
+	Timeout.tv_sec = 60;
+	Timeout.tv_nsec = 0;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: ~TBitcoinNetwork_IOUring
+// Description:
+// Operations in flight point at the connections and at the registered
+// receive buffers, and the kernel finishes them in its own time even
+// once the ring is closed.  So every connection is disconnected, the
+// accept and the timeout are cancelled, and completions are reaped
+// until nothing is left in flight; release() deletes each connection
+// as its last operation completes.
+//
+// If the ring fails part way, the connections are leaked rather than
+// freed under the kernel.
+//
+TBitcoinNetwork_IOUring::~TBitcoinNetwork_IOUring()
+{
+	map<TBitcoinPeer *, TConnection *>::iterator it;
+	vector<TBitcoinPeer *> Peers;
+	vector<TBitcoinPeer *>::iterator pit;
+	struct io_uring_cqe cqe;
+
+	Stopping = true;
+
+	try {
+		// disconnect() can delete the connection, so not while we're
+		// walking them
+		for( it = Connections.begin(); it != Connections.end(); it++ )
+			Peers.push_back( it->first );
+		for( pit = Peers.begin(); pit != Peers.end(); pit++ )
+			disconnect( *pit );
+
+		if( Accepting )
+			submitCancel( OP_ACCEPT );
+		if( TimerArmed )
+			submitCancel( OP_TIMEOUT );
+
+		while( !Connections.empty() || Accepting || TimerArmed ) {
+			Ring.submit( 1 );
+			while( Ring.nextCQE( cqe ) )
+				complete( cqe );
+		}
+	} catch( exception &e ) {
+		log() << "[NETW] Couldn't finish outstanding operations, " << e.what() << endl;
+	}
+
+	if( ListenDescriptor >= 0 )
+		close( ListenDescriptor );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: run
+// Description:
+// As TBitcoinNetwork_Sockets::run(), but one io_uring_enter() per
+// iteration both submits everything queued since the last and waits
+// for the next completion.
+//
+void TBitcoinNetwork_IOUring::run()
+{
+	set<TBitcoinPeer *>::iterator it;
+	map<TBitcoinPeer *, TConnection *>::iterator cit;
+	struct io_uring_cqe cqe;
+
+	log() << "[NETW] *** TBitcoinNetwork running, with io_uring" << endl;
+	log() << "[NETW] " << Directory.size() << " directory entries available" << endl;
+
+	submitTimeout();
+
+	log() << "[NETW] --- TBitcoinNetwork main loop started" << endl;
+	while( true ) {
+		// Check for low connections
+		if( Connections.size() < 1 ) {
+			log() << "[NETW] Connectivity is low, " << Connections.size() << endl;
+			connectToAny();
+		}
+
+		// Start sends for anything queued since the last iteration
+		while( !PendingSend.empty() ) {
+			it = PendingSend.begin();
+			cit = Connections.find( *it );
+			PendingSend.erase( it );
+			if( cit == Connections.end() )
+				continue;
+			cit->second->Output.fill( cit->first );
+			if( !cit->second->Sending && !cit->second->Closing )
+				submitSend( cit->second );
+		}
+
+		// Submit and wait
+		Ring.submit( 1 );
+		while( Ring.nextCQE( cqe ) )
+			complete( cqe );
+	}
+	log() << "[NETW] --- TBitcoinNetwork main loop finished" << endl;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: listenOn
+// Description:
+// A single multishot accept delivers every inbound connection.
+//
+void TBitcoinNetwork_IOUring::listenOn( unsigned short Port )
+{
+	sockaddr_in SAI;
+	int one = 1;
+
+	if( ListenDescriptor >= 0 )
+		throw logic_error( "TBitcoinNetwork_IOUring::listenOn() already listening" );
+
+	ListenDescriptor = socket( PF_INET, SOCK_STREAM, 0 );
+	if( ListenDescriptor < 0 )
+		throw socket_error( "socket()" );
+	setsockopt( ListenDescriptor, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+
+	memset( &SAI, 0, sizeof(SAI) );
+	SAI.sin_family = AF_INET;
+	SAI.sin_addr.s_addr = htonl( INADDR_ANY );
+	SAI.sin_port = htons( Port );
+	if( bind( ListenDescriptor, reinterpret_cast<sockaddr *>(&SAI), sizeof(SAI) ) < 0 )
+		throw socket_error( "bind()" );
+	if( listen( ListenDescriptor, SOMAXCONN ) < 0 )
+		throw socket_error( "listen()" );
+
+	log() << "[NETW] Listening on port " << Port << endl;
+	submitAccept();
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: outgoingQueued
+// Description:
+// The send is started by run(), so that a burst of messages for one
+// peer goes in one submission.
+//
+void TBitcoinNetwork_IOUring::outgoingQueued( TBitcoinPeer *Peer )
+{
+	PendingSend.insert( Peer );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: isCongested
+// Description:
+// Messages still on the peer's queue count as well as the bytes
+// waiting for the socket.
+//
+bool TBitcoinNetwork_IOUring::isCongested( const TBitcoinPeer *Peer ) const
+{
+	map<TBitcoinPeer *, TConnection *>::const_iterator it;
+
+	size_t Backlog = Peer->getOutgoingBytes();
+
+	it = Connections.find( const_cast<TBitcoinPeer *>( Peer ) );
+	if( it != Connections.end() )
+		Backlog += it->second->Output.size();
+	return Backlog > OutputHighWatermark;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: connectToNode
+// Description:
+// The connect itself blocks, as it does for TBitcoinNetwork_Sockets.
+//
+void TBitcoinNetwork_IOUring::connectToNode( const TNodeInfo &Node )
+{
+	fd_t fd;
+
+	if( FreeBuffers.empty() ) {
+		log() << "[NETW] No room for another peer" << endl;
+		return;
+	}
+
+	fd = openConnection( Node );
+	adopt( fd, Node );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: adopt
+// Description:
+// Creates the peer and its connection, and starts receiving.
+//
+void TBitcoinNetwork_IOUring::adopt( fd_t fd, const TNodeInfo &Node )
+{
+	TConnection *Connection = new TConnection;
+
+	Connection->Peer = new TBitcoinPeer( &Node, this );
+	Connection->Descriptor = fd;
+	Connection->Buffer = FreeBuffers.back();
+	Connection->Receiving = false;
+	Connection->Sending = false;
+	Connection->Closing = false;
+	FreeBuffers.pop_back();
+	Connections[Connection->Peer] = Connection;
+
+	Connection->Peer->setState( TBitcoinPeer::Connecting );
+
+	// Prod the remote to begin
+	Connection->Peer->receive( TByteArray() );
+
+	submitReceive( Connection );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: disconnect
+// Description:
+// Operations in flight still refer to the connection, so it can't be
+// deleted until they have completed.  Shutting the socket down makes
+// sure they do, promptly.
+//
+void TBitcoinNetwork_IOUring::disconnect( TBitcoinPeer *Peer )
+{
+	map<TBitcoinPeer *, TConnection *>::iterator it;
+
+	it = Connections.find( Peer );
+	if( it == Connections.end() || it->second->Closing )
+		return;
+
+	it->second->Closing = true;
+	shutdown( it->second->Descriptor, SHUT_RDWR );
+	release( it->second );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: release
+// Description:
+// Deletes a closing connection once nothing refers to it any more.
+//
+void TBitcoinNetwork_IOUring::release( TConnection *Connection )
+{
+	if( !Connection->Closing || Connection->Receiving || Connection->Sending )
+		return;
+
+	if( close( Connection->Descriptor ) < 0 )
+		log() << "[NETW] close() failed, " << libc_error( "close()" ).what() << endl;
+
+	FreeBuffers.push_back( Connection->Buffer );
+	Connections.erase( Connection->Peer );
+	PendingSend.erase( Connection->Peer );
+	delete Connection->Peer;
+	delete Connection;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: getSQE
+// Description:
+// The ring is sized so that it can't run out, but if it ever does,
+// submitting what's there makes room.
+//
+struct io_uring_sqe *TBitcoinNetwork_IOUring::getSQE()
+{
+	struct io_uring_sqe *sqe;
+
+	while( (sqe = Ring.getSQE()) == NULL )
+		Ring.submit();
+
+	return sqe;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: submitReceive
+// Description:
+//
+void TBitcoinNetwork_IOUring::submitReceive( TConnection *Connection )
+{
+	struct io_uring_sqe *sqe = getSQE();
+
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->fd = Connection->Descriptor;
+	sqe->addr = reinterpret_cast<unsigned long>( &ReceiveBuffers[Connection->Buffer * RECEIVE_BUFFER_SIZE] );
+	sqe->len = RECEIVE_BUFFER_SIZE;
+	sqe->buf_index = Connection->Buffer;
+	sqe->user_data = reinterpret_cast<unsigned long>( Connection ) | OP_RECEIVE;
+	Connection->Receiving = true;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: submitSend
+// Description:
+// Sends as much of the output buffer as one gathered send allows.
+//
+void TBitcoinNetwork_IOUring::submitSend( TConnection *Connection )
+{
+	struct io_uring_sqe *sqe;
+
+	if( Connection->Output.empty() )
+		return;
+
+	memset( &Connection->SendMessage, 0, sizeof(Connection->SendMessage) );
+	Connection->SendMessage.msg_iov = Connection->SendVector;
+	Connection->SendMessage.msg_iovlen = Connection->Output.gather(
+			Connection->SendVector, TOutputBuffer::MAXIMUM_GATHER );
+
+	sqe = getSQE();
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = Connection->Descriptor;
+	sqe->addr = reinterpret_cast<unsigned long>( &Connection->SendMessage );
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = reinterpret_cast<unsigned long>( Connection ) | OP_SEND;
+	Connection->Sending = true;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: submitAccept
+// Description:
+// The peer's address is looked up after the accept, so we don't need
+// the kernel to fill one in.
+//
+void TBitcoinNetwork_IOUring::submitAccept()
+{
+	struct io_uring_sqe *sqe = getSQE();
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = ListenDescriptor;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = OP_ACCEPT;
+	Accepting = true;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: submitTimeout
+// Description:
+// Completes after a minute, so that run() can report a quiet network.
+// With off zero it is a pure timeout; other completions don't count
+// towards it.
+//
+void TBitcoinNetwork_IOUring::submitTimeout()
+{
+	struct io_uring_sqe *sqe = getSQE();
+
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<unsigned long>( &Timeout );
+	sqe->len = 1;
+	sqe->off = 0;
+	sqe->user_data = OP_TIMEOUT;
+	TimerArmed = true;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: submitCancel
+// Description:
+// Cancels the operation submitted with the given user_data.  The
+// operation still completes, with -ECANCELED if the cancel caught it.
+//
+void TBitcoinNetwork_IOUring::submitCancel( unsigned long Target )
+{
+	struct io_uring_sqe *sqe = getSQE();
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = Target;
+	sqe->user_data = OP_CANCEL;
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: complete
+// Description:
+//
+void TBitcoinNetwork_IOUring::complete( const struct io_uring_cqe &cqe )
+{
+	TConnection *Connection = reinterpret_cast<TConnection *>( cqe.user_data & ~static_cast<__u64>(OP_MASK) );
+
+	switch( cqe.user_data & OP_MASK ) {
+		case OP_RECEIVE:
+			Activity = true;
+			completeReceive( Connection, cqe.res );
+			break;
+		case OP_SEND:
+			completeSend( Connection, cqe.res );
+			break;
+		case OP_ACCEPT:
+			completeAccept( cqe );
+			break;
+		case OP_TIMEOUT:
+			TimerArmed = false;
+			if( Stopping )
+				break;
+			if( !Activity )
+				log() << "[NETW] No data received for 60s" << endl;
+			Activity = false;
+			submitTimeout();
+			break;
+		case OP_CANCEL:
+			// The cancelled operation reports for itself
+			break;
+	}
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: completeReceive
+// Description:
+// The registered buffers belong to the ring, so what arrived is copied
+// into the peer's receive buffer, then the receive is rearmed.
+//
+void TBitcoinNetwork_IOUring::completeReceive( TConnection *Connection, int n )
+{
+	const unsigned char *Source = &ReceiveBuffers[Connection->Buffer * RECEIVE_BUFFER_SIZE];
+	unsigned char *p;
+	size_t space;
+
+	Connection->Receiving = false;
+	ReadCount++;
+
+	if( Connection->Closing ) {
+		release( Connection );
+		return;
+	}
+	if( n == 0 ) {
+		// end of file
+		disconnect( Connection->Peer );
+		return;
+	} else if( n < 0 ) {
+		if( n != -EINTR && n != -EAGAIN ) {
+			log() << "[NETW] read() failed, " << libc_error( "read()", -n ).what() << endl;
+			disconnect( Connection->Peer );
+			return;
+		}
+		submitReceive( Connection );
+		return;
+	}
+	BytesRead += n;
+
+	space = n;
+	p = Connection->Peer->receiveBuffer( space );
+	memcpy( p, Source, n );
+
+	// let the peer deal with what it received.  A handler can
+	// disconnect the peer; while Receiving is set, release() leaves
+	// the connection, and the peer, for us to finish with
+	Connection->Receiving = true;
+	try {
+		Connection->Peer->received( n );
+	} catch( exception &e ) {
+		log() << "[NETW] Error processing message, " << e.what() << endl;
+	}
+	Connection->Receiving = false;
+
+	// The peer may have asked to be disconnected
+	if( Connection->Closing ) {
+		release( Connection );
+		return;
+	}
+	submitReceive( Connection );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: completeSend
+// Description:
+//
+void TBitcoinNetwork_IOUring::completeSend( TConnection *Connection, int n )
+{
+	Connection->Sending = false;
+
+	if( Connection->Closing ) {
+		release( Connection );
+		return;
+	}
+	if( n < 0 ) {
+		if( n != -EINTR && n != -EAGAIN ) {
+			log() << "[NETW] sendmsg() failed, " << libc_error( "sendmsg()", -n ).what() << endl;
+			disconnect( Connection->Peer );
+			return;
+		}
+		n = 0;
+	}
+
+	Connection->Output.consume( n );
+	submitSend( Connection );
+}
+
+//
+// Function:	TBitcoinNetwork_IOUring :: completeAccept
+// Description:
+// The accept stays armed for as long as the kernel sets
+// IORING_CQE_F_MORE; if it stops, we arm it again.
+//
+void TBitcoinNetwork_IOUring::completeAccept( const struct io_uring_cqe &cqe )
+{
+	sockaddr_in SAI;
+	socklen_t Length = sizeof(SAI);
+	fd_t fd = cqe.res;
+
+	if( !(cqe.flags & IORING_CQE_F_MORE) ) {
+		Accepting = false;
+		if( !Stopping )
+			submitAccept();
+	}
+
+	if( fd < 0 ) {
+		if( fd != -ECANCELED || !Stopping )
+			log() << "[NETW] accept() failed, " << libc_error( "accept()", -fd ).what() << endl;
+		return;
+	}
+	if( Stopping ) {
+		close( fd );
+		return;
+	}
+
+	if( FreeBuffers.empty() || getpeername( fd, reinterpret_cast<sockaddr *>(&SAI), &Length ) < 0 ) {
+		log() << "[NETW] Refusing inbound connection" << endl;
+		close( fd );
+		return;
+	}
+
+	TNodeInfo Node( ntohl( SAI.sin_addr.s_addr ) );
+	Node.Port = ntohs( SAI.sin_port );
+	Node.LastConnectSuccess = time(NULL);
+
+	log() << "[NETW] Accepted connection from ";
+	Node.printOn( log() );
+	log() << endl;
+
+	adopt( fd, updateDirectory( Node ) );
+}
+#endif
+
+
+// -------------- Function definitions
+
+
+//
+// Function:	openConnection
+// Description:
+// Makes a blocking connection to the given node, and returns the
+// descriptor.
+//
+static int openConnection( const TNodeInfo &Node )
+{
+	int fd;
+	sockaddr_in SAI;
+	sockaddr &SA(reinterpret_cast<sockaddr &>(SAI));
+	int ret;
+
+	// Configure the generating fd
+	fd = socket( PF_INET, SOCK_STREAM, 0 );
+	if( fd < 0 )
+		throw socket_error( "socket()" );
+
+	// XXX: iterate through known networks
+
+	// Connect address
+	Node.toSockAddr( SA );
+	if( SAI.sin_port == 0 )
+		SAI.sin_port = htons( 8333 );
+
+	// Connect
+	log() << "[NETW] Attempting connection to ";
+	Node.printOn( log() );
+	log() << endl;
+	ret = connect( fd, &SA, sizeof( SAI ) );
+	if( ret < 0 ) {
+		close( fd );
+		throw socket_error( "connect()" );
+	}
+	log() << "[NETW] Successfully connected on descriptor " << fd << endl;
+
+	return fd;
+}
 
 
 #ifdef UNITTEST
@@ -22,13 +22,23 @@
 // --- C++
 #include <list>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <utility>
 // --- Qt
 // --- OS
+#include <sys/uio.h>
+#include <sys/socket.h>
 // --- Project lib
+#include <general/socketpoller.h>
+#include <general/thread.h>
+#include <general/iouring.h>
 // --- Project
 #include "peer.h"
 #include "hashtypes.h"
 #include "messageelements.h"
+#include "messages.h"
 #include "eventobjects.h"
 
 
@@ -190,12 +200,16 @@ class TBitcoinNetwork
 	TNodeInfo &updateDirectory( const TNodeInfo & );
 
 	void process( TMessage * );
+	virtual void dispatch( TMessage * );
+	virtual void outgoingQueued( TBitcoinPeer * ) {}
+	virtual bool isCongested( const TBitcoinPeer * ) const { return false; }
 
 	uint64_t getNonce() const { return Nonce; }
 
 	virtual TMessage_version *createMyVersionMessage() const;
 
 	void registerEventObject( const TBitcoinEventObject * );
+	void registerEventObject( eMessageKind, const TBitcoinEventObject * );
 	const TBitcoinEventObject *eventObject() const { return EventObject; }
 
 	// Handlers
@@ -234,34 +248,321 @@ class TBitcoinNetwork
 	time_t NetworkTimeOffset;
 
 	const TBitcoinEventObject *EventObject;
+	list<const TBitcoinEventObject *> KindEventObjects[MESSAGE_KIND_COUNT];
 
   private:
 	const TBitcoinEventObject NULLEventObject;
 };
 
+//
+// Class:	TOutputBuffer
+// Description:
+// Serialised messages waiting for a socket to accept them.  Each message
+// is kept as its own chunk, so that they can be handed to a gathered
+// write without being concatenated first.
+//
+class TOutputBuffer
+{
+  public:
+	TOutputBuffer() : Offset(0), Size(0) {}
+
+	void fill( TBitcoinPeer * );
+	unsigned int gather( struct iovec *, unsigned int ) const;
+	void consume( size_t );
+
+	size_t size() const { return Size; }
+	bool empty() const { return Size == 0; }
+
+	// IOV_MAX is at least 16, and usually 1024; there's no point
+	// making one write enormous
+	static const unsigned int MAXIMUM_GATHER = 16;
+
+  protected:
+	list<string> Chunks;
+	// Bytes of the first chunk already written
+	string::size_type Offset;
+	// Bytes not yet written, in total
+	size_t Size;
+};
+
 //
 // Class:	TBitcoinNetwork_Sockets
 // Description:
+// Each peer has an output buffer of serialised messages that the
+// socket hasn't accepted yet.  Once that buffer, together with the
+// messages still on the peer's outgoing queue, passes the high
+// watermark the peer is congested, and low priority messages are no
+// longer queued for it.
+//
+// The sockets are divided between shards, each with its own poller.
+// Normally there is one shard and run() drives it, so everything
+// happens on one thread.  Given IOThreads, there are that many shards,
+// each on its own thread doing only the reading and writing for its
+// peers.  The bytes read are passed through a lock-free queue to the
+// thread that called run(), which alone parses them and runs the peers'
+// state machines; so the log, the network parameters, and the block
+// and transaction pools are still only ever used by one thread.
+//
+// Every shard, and run() when threaded, makes its own poller with
+// PollerFactory; the default is TSocketPoller::createBest().
 //
 class TBitcoinNetwork_Sockets : public TBitcoinNetwork
+{
+  protected:
+	typedef TSocketPoller::fd_t fd_t;
+
+	//
+	// Class:	TBitcoinNetwork_Sockets :: TShard
+	// Description:
+	// Owns the sockets of a subset of the peers.  Only the shard's own
+	// thread touches them; other threads hand it work through
+	// adopt() and requestSend().  When threaded, that thread never
+	// calls into a peer other than to take its outgoing messages, and
+	// never logs.
+	//
+	class TShard : public TThread
+	{
+	  public:
+		TShard( TBitcoinNetwork_Sockets * );
+		~TShard();
+
+		bool poll( int );
+		void stop();
+
+		void adopt( TBitcoinPeer *, fd_t );
+		void requestSend( TBitcoinPeer * );
+		bool isCongested( const TBitcoinPeer * ) const;
+
+		void disconnect( TBitcoinPeer *, const string &Reason = string() );
+
+		const char *getPollerClassName() const { return Poller->className(); }
+		unsigned long long getReadCount() const { return __sync_fetch_and_add( &ReadCount, 0 ); }
+		unsigned long long getBytesRead() const { return __sync_fetch_and_add( &BytesRead, 0 ); }
+
+	  protected:
+		void run();
+
+		void handleRequests();
+		void receiveFrom( TBitcoinPeer * );
+		void sendTo( TBitcoinPeer * );
+
+		bool isMine() const { return isStarted() ? isCurrent() : true; }
+
+	  protected:
+		TBitcoinNetwork_Sockets *Network;
+		TSocketPoller *Poller;
+		TPollerWakeup Wakeup;
+		// Only touched with __sync builtins
+		int Stopping;
+
+		// Work from other threads
+		TMPSCQueue<pair<TBitcoinPeer *, fd_t> > Adoptions;
+		TMPSCQueue<TBitcoinPeer *> SendRequests;
+
+		map<TBitcoinPeer *, fd_t> PeerDescriptors;
+		map<fd_t, TBitcoinPeer *> DescriptorPeers;
+
+		// Bytes the socket wouldn't yet accept; locked because
+		// isCongested() is asked from other threads
+		map<const TBitcoinPeer *, TOutputBuffer> PendingOutput;
+		mutable TMutex OutputLock;
+
+		// Where a threaded shard reads to; the peers' own receive
+		// buffers belong to run()'s thread
+		TByteArray ReadScratch;
+
+		// Read from other threads, so only touched with __sync builtins
+		mutable unsigned long long ReadCount;
+		mutable unsigned long long BytesRead;
+	};
+	friend class TShard;
+
+  public:
+	TBitcoinNetwork_Sockets( unsigned int IOThreads = 0,
+			TSocketPoller::TFactory PollerFactory = TSocketPoller::createBest );
+	~TBitcoinNetwork_Sockets();
+
+	void run();
+
+	void outgoingQueued( TBitcoinPeer * );
+	bool isCongested( const TBitcoinPeer * ) const;
+
+	void setOutputHighWatermark( size_t n ) { OutputHighWatermark = n; }
+	size_t getOutputHighWatermark() const { return OutputHighWatermark; }
+
+	static const size_t DEFAULT_OUTPUT_HIGH_WATERMARK = 1024 * 1024;
+
+	// read() calls made, and what they returned, since construction
+	unsigned long long getReadCount() const;
+	unsigned long long getBytesRead() const;
+	double getBytesPerRead() const;
+
+	// Reads are never smaller than this, and are larger when a
+	// message is known to be arriving
+	static const size_t MINIMUM_READ_SIZE = 16 * 1024;
+
+  protected:
+	void connectToNode( const TNodeInfo & );
+	void disconnect( TBitcoinPeer * );
+
+	TShard *shardFor( const TBitcoinPeer * ) const;
+	void peerReceived( TBitcoinPeer *, const TByteArray & );
+	void peerDropped( TBitcoinPeer *, const string &Reason );
+
+	bool isThreaded() const { return IOThreads > 0; }
+	void processDeliveries();
+
+  protected:
+	unsigned int IOThreads;
+	TSocketPoller::TFactory PollerFactory;
+	vector<TShard *> Shards;
+
+	// Connected peers, as far as the connecting thread knows
+	set<TBitcoinPeer *> Connections;
+
+	// From the I/O threads to run()'s thread; either bytes a peer has
+	// received, or, when Dropped, that the peer has been disconnected,
+	// and why, and may be deleted
+	struct TDelivery {
+		TDelivery() : Peer( NULL ), Dropped( false ) {}
+
+		TBitcoinPeer *Peer;
+		bool Dropped;
+		TByteArray Received;
+		string Reason;
+	};
+	TMPSCQueue<TDelivery> Deliveries;
+	TPollerWakeup DeliveryWakeup;
+
+	size_t OutputHighWatermark;
+};
+
+
+#ifdef HAVE_IO_URING
+//
+// Class:	TBitcoinNetwork_IOUring
+// Description:
+// Does the same job as TBitcoinNetwork_Sockets, but with io_uring.
+// Rather than waiting for readiness and then making a system call per
+// socket, every peer always has a receive outstanding, and every peer
+// with output has a send outstanding.  All the new submissions from an
+// iteration of the loop, and the wait for the next completions, are one
+// system call.
+//
+// Receives are into registered buffers, one per peer, so the kernel
+// doesn't have to map the buffer for every read.  The bytes are then
+// copied into the peer's own receive buffer; the registered buffers
+// can't be the peers' receive buffers, because those move as they
+// grow.
+//
+// listenOn() accepts inbound connections, with a single multishot
+// accept that keeps completing as connections arrive.
+//
+// The constructor throws if the kernel doesn't support io_uring;
+// choose TBitcoinNetwork_Sockets instead in that case.
+//
+class TBitcoinNetwork_IOUring : public TBitcoinNetwork
 {
   protected:
 	typedef int fd_t;
 
+	// The low bits of each submission's user_data say what it was
+	enum eOperation {
+		OP_RECEIVE = 0,
+		OP_SEND = 1,
+		OP_ACCEPT = 2,
+		OP_TIMEOUT = 3,
+		OP_CANCEL = 4,
+		OP_MASK = 7
+	};
+
+	struct TConnection {
+		TBitcoinPeer *Peer;
+		fd_t Descriptor;
+		unsigned int Buffer;
+
+		// Operations in flight; a connection can't be deleted until
+		// both have completed
+		bool Receiving;
+		bool Sending;
+		bool Closing;
+
+		TOutputBuffer Output;
+		// Must stay put while a send is in flight
+		struct iovec SendVector[TOutputBuffer::MAXIMUM_GATHER];
+		struct msghdr SendMessage;
+	};
+
   public:
-	TBitcoinNetwork_Sockets();
+	TBitcoinNetwork_IOUring( unsigned int = DEFAULT_MAXIMUM_PEERS );
+	~TBitcoinNetwork_IOUring();
 
 	void run();
+	void listenOn( unsigned short );
+
+	void outgoingQueued( TBitcoinPeer * );
+	bool isCongested( const TBitcoinPeer * ) const;
+
+	void setOutputHighWatermark( size_t n ) { OutputHighWatermark = n; }
+	size_t getOutputHighWatermark() const { return OutputHighWatermark; }
+
+	// Completed receives, and the bytes they brought, since
+	// construction
+	unsigned long long getReadCount() const { return ReadCount; }
+	unsigned long long getBytesRead() const { return BytesRead; }
+	double getBytesPerRead() const { return ReadCount == 0 ? 0.0 : double(BytesRead) / ReadCount; }
+	unsigned int getSystemCalls() const { return Ring.getSystemCalls(); }
+
+	static const unsigned int DEFAULT_MAXIMUM_PEERS = 128;
+	static const size_t RECEIVE_BUFFER_SIZE = 16 * 1024;
 
   protected:
-	void receiveFrom( TBitcoinPeer * );
-	void sendTo( TBitcoinPeer * );
 	void connectToNode( const TNodeInfo & );
 	void disconnect( TBitcoinPeer * );
 
+	void adopt( fd_t, const TNodeInfo & );
+	void release( TConnection * );
+
+	struct io_uring_sqe *getSQE();
+	void submitReceive( TConnection * );
+	void submitSend( TConnection * );
+	void submitAccept();
+	void submitTimeout();
+	void submitCancel( unsigned long );
+
+	void complete( const struct io_uring_cqe & );
+	void completeReceive( TConnection *, int );
+	void completeSend( TConnection *, int );
+	void completeAccept( const struct io_uring_cqe & );
+
   protected:
-	map<TBitcoinPeer *, fd_t> PeerDescriptors;
+	TIOUring Ring;
+
+	// One registered receive buffer per connection
+	vector<unsigned char> ReceiveBuffers;
+	vector<unsigned int> FreeBuffers;
+
+	map<TBitcoinPeer *, TConnection *> Connections;
+	// Peers with messages queued since we last sent to them
+	set<TBitcoinPeer *> PendingSend;
+
+	fd_t ListenDescriptor;
+	bool Accepting;
+
+	// Must stay put while the timeout is in flight
+	struct __kernel_timespec Timeout;
+	bool TimerArmed;
+	bool Activity;
+
+	// Set by the destructor, so that nothing is rearmed
+	bool Stopping;
+
+	size_t OutputHighWatermark;
+
+	unsigned long long ReadCount;
+	unsigned long long BytesRead;
 };
+#endif
 
 
 // -------------- Constants
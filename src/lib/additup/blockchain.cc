@@ -25,6 +25,7 @@
 // --- Project libs
 #include <general/logstream.h>
 #include <general/crypto.h>
+#include <general/sha256.h>
 // --- Project
 #include "messages.h"
 #include "bitcoinnetwork.h"
@@ -191,9 +192,10 @@ TBitcoinHash TBlock::getNextRequiredDifficulty() const
 	// Using the previous difficulty, that which should have taken
 	// DIFFICULTY_TIMESPAN, actually took ObservedTimespan.  We therefore
 	// adjust the current difficulty by ratio of the observed to the
-	// target timespans.
-	NextTarget *= static_cast<unsigned int>( ObservedTimespan );
-	NextTarget /= Pool->getNetwork()->getNetworkParameters()->DIFFICULTY_TIMESPAN;
+	// target timespans, in one step, which makes neither the product
+	// nor the divisor as a separate number.
+	NextTarget.multiplyDivide( ObservedTimespan,
+			Pool->getNetwork()->getNetworkParameters()->DIFFICULTY_TIMESPAN );
 
 	// Limit to the smallest difficulty allowed
 	if( NextTarget > Pool->getNetwork()->getNetworkParameters()->ProofOfWorkLimit )
@@ -364,8 +366,6 @@ const TBitcoinHash &TMessageBasedBlock::getHash() const
 	if( cachedHash.isValid() )
 		return cachedHash;
 
-	ostringstream oss;
-
 	// "The SHA256 hash that identifies each block (and which must have
 	// a run of 0 bits) is calculated from the first 6 fields of this
 	// structure (version, prev_block, merkle_root, timestamp, bits,
@@ -376,28 +376,29 @@ const TBitcoinHash &TMessageBasedBlock::getHash() const
 	// constant during mining and therefore only the second chunk needs
 	// to be processed. However, a Bitcoin hash is the hash of the hash,
 	// so two SHA256 rounds are needed for each mining iteration."
-	Header.write(oss);
-
-	// Field sizes: 4 + 32 + 32 + 4 + 4 + 4 = 80
-	// OpenSSL should pad on its own...
-
-	if( Pool == NULL )
-		return cachedHash;
-
-//	log() << "TMessage_block = ";
-//	TLog::hexify( log(), oss.str() );
-//	log() << endl;
-	cachedHash.fromBytes(
-			Pool->getNetwork()->getNetworkParameters()->blockHasher()->transform( oss.str() ) );
+	//
+	// The network chooses the hasher; the fixed size header functions
+	// stand in for it when it is the usual double SHA-256, and for
+	// blocks with no network, such as the predefined genesis blocks
+	unsigned char Bytes[TBlockHeaderElement::BYTES];
+	unsigned char Digest[TMessageDigest::MAXIMUM_DIGEST_BYTES];
+	TMessageDigest *Hasher = NULL;
+
+	if( Pool != NULL && Pool->getNetwork() != NULL
+			&& Pool->getNetwork()->getNetworkParameters() != NULL )
+		Hasher = Pool->getNetwork()->getNetworkParameters()->blockHasher();
+
+	Header.toBytes( Bytes );
+	if( Hasher == NULL || TSHA256::isDoubleHash( Hasher ) ) {
+		TSHA256::doubleHashHeader( Digest, Bytes );
+	} else if( Hasher->transform( Digest, Bytes, sizeof(Bytes) ) != TSHA256::DIGEST_BYTES ) {
+		throw logic_error( "TMessageBasedBlock::getHash() needs a 256 bit blockHasher()" );
+	}
 
 	// For an unknown reason, bitcoin calculates the hash, then reverses
 	// the byte order, and that reversed form is then treated as the
-	// hash
-	cachedHash = cachedHash.reversedBytes();
-
-//	log() << "TMessage_block.hash = ";
-//	TLog::hexify( log(), hash.toBytes() );
-//	log() << endl;
+	// hash; which is the digest read as a little endian number
+	cachedHash.fromLittleEndian( Digest );
 
 	return cachedHash;
 }
@@ -845,9 +846,30 @@ void TDatabaseBlockPool::scanForNewChildLinks()
 
 #ifdef UNITTEST
 #include <iostream>
+#include <sys/time.h>
 #include "constants.h"
 #include "messageelements.h"
 
+//
+// Class:	TSingleHashParameters
+// Description:
+// A network whose blocks are hashed with a single SHA-256, so that its
+// block hashes differ from those of the predefined networks.
+//
+class TSingleHashParameters : public TNetworkParameters
+{
+  public:
+	const char *networkName() const { return "singlehash"; }
+	unsigned int limitDifficultyTimespan( unsigned int t ) const { return t; }
+
+	TMessageDigest *blockHasher() const { return &Hasher; }
+	TMessageDigest *payloadHasher() const { return &Hasher; }
+	TMessageDigest *merkleHasher() const { return &Hasher; }
+
+  protected:
+	mutable TSHA256 Hasher;
+};
+
 // -------------- main()
 
 int main( int argc, char *argv[] )
@@ -889,35 +911,110 @@ int main( int argc, char *argv[] )
 
 		log() << endl;
 
-//		log() << LOOPS << " loops in " << (end.tv_sec - start.tv_sec)
-//			<< "s and " << (end.tv_usec - start.tv_usec) << "us" << endl;
-
-		log() << "Hash rate is " << LOOPS / (end.tv_sec - start.tv_sec) << " h/s (approx)" << endl;
+		double t = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		log() << "Hash rate is " << LOOPS / t << " h/s (approx)" << endl;
 
 		TBitcoinHash Target(1);
 		Target <<= (256 - 19);
 		Target -= 1;
 
+		// Only the nonce changes, so the first block of the header is
+		// hashed once
+		unsigned char Bytes[TBlockHeaderElement::BYTES];
+		unsigned char Digest[TSHA256::DIGEST_BYTES];
+		TSHA256::tState Midstate;
+
+		// The fixed buffer agrees with serialising through a stream,
+		// and so does the hash
+		ostringstream oss;
+		TestBlockHeader.write( oss );
+		TestBlockHeader.toBytes( Bytes );
+		if( oss.str() != string( reinterpret_cast<const char *>(Bytes), sizeof(Bytes) ) )
+			throw logic_error( "TBlockHeaderElement::toBytes() disagrees with write()" );
+		TBitcoinHash StreamHash;
+		StreamHash.fromBytes( NETWORK_PRODNET->blockHasher()->transform( oss.str() ) );
+		if( StreamHash.reversedBytes() != testblock->getHash() )
+			throw logic_error( "TMessageBasedBlock::getHash() disagrees with blockHasher()" );
+
 		TestBlockHeader.Nonce = 0;
+		TestBlockHeader.toBytes( Bytes );
+		TSHA256::headerMidstate( Midstate, Bytes );
 
 		log() << "Mining";
 		gettimeofday( &start, NULL );
 		i = 0;
 		while( true ) {
-			testblock->flush();
-			hash = testblock->getHash();
-			if( (i & 0xfff) == 0 )
+			Bytes[76] = i;
+			Bytes[77] = i >> 8;
+			Bytes[78] = i >> 16;
+			Bytes[79] = i >> 24;
+			TSHA256::doubleHashHeader( Digest, Midstate, Bytes + TSHA256::BLOCK_BYTES );
+			hash.fromLittleEndian( Digest );
+			if( (i & 0xffff) == 0 )
 				log() << "." << flush;
 			if( hash <= Target )
 				break;
 			i++;
-			TestBlockHeader.Nonce++;
 		}
 		gettimeofday( &end, NULL );
 
 		log() << endl;
+		t = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
 		log() << "Found hash  " << hash << endl
-			<< " less than  " << Target << endl;
+			<< " less than  " << Target << endl
+			<< " at nonce " << i << ", " << (i + 1) / t << " h/s" << endl;
+
+	} catch( std::exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Block hash follows blockHasher()" << endl;
+
+		TBlockHeaderElement Header;
+		unsigned char Bytes[TBlockHeaderElement::BYTES];
+		unsigned char Digest[TSHA256::DIGEST_BYTES];
+		TBitcoinHash Expected;
+
+		// The genesis block, but so easy that any hash is a proof of
+		// work
+		NETWORK_PRODNET->GenesisBlock->writeToHeader( Header );
+		Header.DifficultyBits.setTarget( 0xffffff, 32 );
+		Header.toBytes( Bytes );
+
+		TSingleHashParameters SingleParameters;
+		TBitcoinNetwork_Sockets SingleNetwork;
+		SingleNetwork.setNetworkParameters( &SingleParameters );
+		TBlockMemoryPool SinglePool( &SingleNetwork );
+		TMessageBasedBlock SingleBlock( &SinglePool );
+		SingleBlock.updateFromHeader( Header );
+
+		TSHA256().transform( Digest, Bytes, sizeof(Bytes) );
+		Expected.fromLittleEndian( Digest );
+		if( SingleBlock.getHash() != Expected )
+			throw logic_error( "getHash() ignored a single SHA-256 blockHasher()" );
+		log() << "Single SHA-256 network " << SingleBlock.getHash() << endl;
+
+		// The real genesis block, as prodnet won't take an easier one
+		NETWORK_PRODNET->GenesisBlock->writeToHeader( Header );
+		Header.toBytes( Bytes );
+
+		TBitcoinNetwork_Sockets ProdNetwork;
+		ProdNetwork.setNetworkParameters( NETWORK_PRODNET );
+		TBlockMemoryPool ProdPool( &ProdNetwork );
+		TMessageBasedBlock ProdBlock( &ProdPool );
+		ProdBlock.updateFromHeader( Header );
+
+		TSHA256::doubleHashHeader( Digest, Bytes );
+		Expected.fromLittleEndian( Digest );
+		if( ProdBlock.getHash() != Expected )
+			throw logic_error( "getHash() disagrees with doubleHashHeader() on prodnet" );
+		log() << "Double SHA-256 network " << ProdBlock.getHash() << endl;
+
+		if( !TSHA256::isDoubleHash( NETWORK_PRODNET->blockHasher() )
+				|| TSHA256::isDoubleHash( SingleParameters.blockHasher() ) )
+			throw logic_error( "TSHA256::isDoubleHash() is wrong" );
 
 	} catch( std::exception &e ) {
 		log() << e.what() << endl;
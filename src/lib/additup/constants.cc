@@ -25,6 +25,7 @@
 // --- OS
 // --- Project libs
 #include <general/crypto.h>
+#include <general/sha256.h>
 // --- Project
 #include "hashtypes.h"
 #include "blockchain.h"
@@ -61,7 +62,7 @@ class TPredefinedNetworkParameters : public TNetworkParameters
 		ProtocolVersion = 31800;
 
 		// Hashers are all the same
-		Hasher = new TDoubleHash( new THash_sha256, new THash_sha256 );
+		Hasher = new TDoubleHash( new TSHA256, new TSHA256 );
 	}
 	~TPredefinedNetworkParameters() {
 		delete Hasher;
@@ -527,6 +528,8 @@ int main( int argc, char *argv[] )
 			TBitcoinHash x("00000000000404CB000000000000000000000000000000000000000000000000");
 			log() << "Difficulty of        " << x << " = "
 				<< (*pNetwork)->convertTargetToDifficulty(x) << endl;
+			log() << "Target of difficulty " << (*pNetwork)->convertTargetToDifficulty(x) << " = "
+				<< (*pNetwork)->convertDifficultyToTarget( (*pNetwork)->convertTargetToDifficulty(x) ) << endl;
 			log() << "Hashes per block for " << x << " = "
 				<< (*pNetwork)->expectedGHashesPerBlock(x) << " Ghash" << endl;
 			log() << "Computing power for  " << x << " = "
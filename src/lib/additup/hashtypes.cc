@@ -25,6 +25,7 @@
 // --- OS
 // --- Project libs
 #include <general/crypto.h>
+#include <general/sha256.h>
 // --- Project
 
 
@@ -64,7 +65,7 @@ unsigned int TBitcoinBase58::fromCharacter( unsigned int ch, unsigned int Base )
 	static const unsigned int INVALID = static_cast<unsigned int>(-1);
 
 	if( Base != 58 )
-		return TBigUnsignedInteger::fromCharacter( ch, Base );
+		return TBigUnsignedInteger64::fromCharacter( ch, Base );
 
 	if( ch >= '+' && ch-'+' <= sizeof(ASCIIToBase58) ) {
 		ch = ASCIIToBase58[ch-'+'];
@@ -88,7 +89,7 @@ unsigned int TBitcoinBase58::toCharacter( unsigned int ch, unsigned int Base ) c
 	static const unsigned int INVALID = static_cast<unsigned int>(-1);
 
 	if( Base != 58 )
-		return TBigUnsignedInteger::toCharacter( ch, Base );
+		return TBigUnsignedInteger64::toCharacter( ch, Base );
 
 	if( ch <= sizeof(Base58ToASCII) ) {
 		ch = Base58ToASCII[ch];
@@ -99,6 +100,47 @@ unsigned int TBitcoinBase58::toCharacter( unsigned int ch, unsigned int Base ) c
 	return ch;
 }
 
+//
+// Function:	TBitcoinBase58 :: fromString
+// Description:
+// Base 58 goes through TBase58, which keeps leading '1's as leading
+// zero bytes; other bases are left to the big number.  As with the
+// big number, conversion stops at the first invalid character.
+//
+void TBitcoinBase58::fromString( const string &s, unsigned int b )
+{
+	if( b != 58 ) {
+		TBigUnsignedInteger64::fromString( s, b );
+		return;
+	}
+
+	TByteArray Bytes( TBase58::decode( s.substr( 0, s.find_first_not_of( TBase58::ALPHABET ) ) ) );
+
+	if( Bytes.empty() ) {
+		TBigUnsignedInteger64::operator=( 0ULL );
+	} else {
+		fromBytes( Bytes.str() );
+	}
+}
+
+//
+// Function:	TBitcoinBase58 :: toString
+// Description:
+// The number's bytes, at least minimumBytes() of them, in base 58.
+// Each leading zero byte becomes a leading '1'.
+//
+string TBitcoinBase58::toString() const
+{
+	string Bytes( toBytes( minimumBytes() ) );
+
+	// toBytes() leaves every block of a zero in place; zero is one
+	// zero byte, unless there is a minimum
+	if( Bytes.find_first_not_of( '\0' ) == string::npos )
+		Bytes.assign( max( minimumBytes(), 1U ), '\0' );
+
+	return TBase58::encode( TByteArray( Bytes ) );
+}
+
 //
 // Function:	TBitcoinBase58 :: printOn
 // Description:
@@ -111,7 +153,7 @@ ostream &TBitcoinBase58::printOn( ostream &s ) const
 	}
 
 	if( s.flags() & ostream::hex ) {
-		TBigUnsignedInteger::printOn(s);
+		TBigUnsignedInteger64::printOn(s);
 	} else {
 		s << toString();
 	}
@@ -145,33 +187,29 @@ TBitcoinAddress::TBitcoinAddress( const TEllipticCurveKey &K, unsigned char v )
 //
 void TBitcoinAddress::fromKey( const TEllipticCurveKey &K )
 {
-	TByteArray CSBuffer;
+	// Class, keyhash and checksum, built in place
+	unsigned char Buffer[1 + TMessageDigest::MAXIMUM_DIGEST_BYTES + 4];
+	unsigned char Digest[TMessageDigest::MAXIMUM_DIGEST_BYTES];
+	TByteArray PublicKey( K.getPublicKey() );
+	size_t n;
 
 	invalidate();
 
-	// Hashers
-	THash_sha256 SHA256;
-	THash_ripemd160 RIPEMD160;
-	TDoubleHash SHASHA256( &SHA256, &SHA256 );
-	TDoubleHash RIPESHA256( &RIPEMD160, &SHA256 );
-
-	// Core key hash
-	KeyHash = RIPESHA256.transform( K.getPublicKey() );
-
-	// Prepend the address class
-	CSBuffer.resize( KeyHash.size() + 1 );
-	*(CSBuffer.ptr()) = AddressClass;
-	memcpy( CSBuffer.ptr(1), KeyHash, KeyHash.size() );
+	// Core key hash, after the address class
+	Buffer[0] = AddressClass;
+	n = TDigestPool<THash_hash160>::get().transform( Buffer + 1,
+			PublicKey.empty() ? NULL : PublicKey.ptr(), PublicKey.size() );
+	KeyHash = TByteArray( Buffer + 1, n );
 
 	// Checksum of class and keyhash
-	Checksum = SHASHA256.transform( CSBuffer );
+	TDigestPool<THash_hash256>::get().transform( Digest, Buffer, n + 1 );
+	Checksum = TByteArray( Digest, TSHA256::DIGEST_BYTES );
 
 	// Append four bytes of checksum
-	CSBuffer.resize( CSBuffer.size() + 4 );
-	memcpy( CSBuffer.ptr(CSBuffer.size()-4), Checksum, 4 );
+	memcpy( Buffer + n + 1, Digest, 4 );
 
 	// Base class converts this to bignumber
-	fromBytes( CSBuffer );
+	fromBytes( TByteArray( Buffer, n + 5 ) );
 }
 
 //
@@ -180,39 +218,27 @@ void TBitcoinAddress::fromKey( const TEllipticCurveKey &K )
 //
 bool TBitcoinAddress::isValid() const
 {
-	// Hashers
-	THash_sha256 SHA256;
-	TDoubleHash SHASHA256( &SHA256, &SHA256 );
+	unsigned char Buffer[1 + TMessageDigest::MAXIMUM_DIGEST_BYTES];
+	unsigned char Digest[TMessageDigest::MAXIMUM_DIGEST_BYTES];
 
 	// We assume all the constituent parts have been set (call parse()
 	// if they haven't); we're now checking for consistency
 
+	if( Checksum.size() < 4 || KeyHash.size() > TMessageDigest::MAXIMUM_DIGEST_BYTES )
+		return false;
+
 	// The keyhash is supplied hashed, there is nothing to do with that,
 	// instead we prepend the address class byte and calculate a
 	// checksum
+	Buffer[0] = AddressClass;
+	if( !KeyHash.empty() )
+		memcpy( Buffer + 1, KeyHash.ptr(), KeyHash.size() );
 
-	TByteArray CSBuffer;
-
-	// Prepend the address class
-	CSBuffer.resize( KeyHash.size() + 1 );
-	CSBuffer[0] = AddressClass;
-	memcpy( CSBuffer.ptr(1), KeyHash, KeyHash.size() );
-
-	// Checksum of class and keyhash
-	CSBuffer = SHASHA256.transform( CSBuffer );
+	TDigestPool<THash_hash256>::get().transform( Digest, Buffer, KeyHash.size() + 1 );
 
 	// Compare the first four bytes of the calculated checksum against
 	// the parsed checksum
-
-	if( Checksum.size() < 4 || CSBuffer.size() < 4 ) {
-		return false;
-	}
-
-	if( memcmp( Checksum.ptr(), CSBuffer.ptr(), 4 ) != 0 ) {
-		return false;
-	}
-
-	return true;
+	return memcmp( Checksum.ptr(), Digest, 4 ) == 0;
 }
 
 //
@@ -252,49 +278,21 @@ void TBitcoinAddress::parse()
 	memcpy( Checksum.ptr(), Buffer.ptr( Buffer.size() - 4 ), 4 );
 }
 
-//
-// Function:	TBitcoinAddress :: stringPad
-// Description:
-//
-string TBitcoinAddress::stringPad( const string &s, unsigned int Base ) const
-{
-	string output;
-
-	if( Base == 58 ) {
-		output = s;
-		// Pad to minimum length for a bitcoin address (34)
-		while( output.length() < 34 )
-			output = string() + static_cast<char>(toCharacter(0,58)) + output;
-	} else {
-		return s;
-	}
-
-	return output;
-}
-
 // ------
 
 //
-// Static:	TBitcoinHash :: HASH_BYTES
-// Description:
-//
-const unsigned int TBitcoinHash::HASH_BYTES = 32;
-
-//
-// Function:	TBitcoinHash :: stringPad
+// Function:	TBitcoinHash :: toString
 // Description:
+// Hashes are always shown at their full width in hex.
 //
-string TBitcoinHash::stringPad( const string &s, unsigned int Base ) const
+string TBitcoinHash::toString( unsigned int Base ) const
 {
-	if( s.size() < HASH_BYTES*2 ) {
-		string pad;
-		pad.assign( HASH_BYTES*2 - s.size(), toCharacter(0,Base) );
-		return pad + s;
-	} else if( s.size() > HASH_BYTES*2 ) {
-		throw logic_error( "TBitcoinHashes can't be more than HASH_BYTES bytes" );
-	} else {
-		return s;
-	}
+	string x = TUnsignedInteger256::toString( Base );
+
+	if( Base == 16 && x.size() < BYTES*2 )
+		x = string( BYTES*2 - x.size(), '0' ) + x;
+
+	return x;
 }
 
 //
@@ -308,46 +306,19 @@ ostream &TBitcoinHash::printOn( ostream &s ) const
 		return s;
 	}
 
-	// Force the use of string pad by calling it even for hex (which the
-	// base class doesn't do)
 	string x = toString(16);
 	s << x.substr(0,20) << "..." << x.substr(x.size()-4, x.size()-1);
 
 	return s;
 }
 
-//
-// Function:	TBitcoinHash :: reversedBytes
-// Description:
-//
-TBitcoinHash TBitcoinHash::reversedBytes() const
-{
-	tIndex OldHighestBit = highestBit();
-	TBitcoinHash X( TBigUnsignedInteger::reversedBytes() );
-
-	// Consider these blocks  (highest bit 75)
-	//   XXXX0908 07060504 03020100
-	// After base-class reversal these will be
-	//   00000001 02030405 06070809
-	// Lets say we want a 18 byte hash, then our left shift will be
-	// (18-(75/8))*8 = 9
-	//   0102 03040506 07080900 00000000 00000000
-	// Final size 18 bytes, flipped version of original.
-
-	// The bytes are now reversed, but that's not enough, we have to
-	// reverse to a fixed width for a hash.  For that we need to know
-	// how many bytes we were short of 32 originally.
-	X <<= (HASH_BYTES - 1 - (OldHighestBit/8)) * 8;
-
-	return X;
-}
-
 // -------------- Function definitions
 
 
 #ifdef UNITTEST
 #include <iostream>
 #include <stdexcept>
+#include <sys/time.h>
 #include <general/logstream.h>
 
 // -------------- main()
@@ -427,6 +398,25 @@ int main( int argc, char *argv[] )
 		if( BA2.toString() != "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa" )
 			throw runtime_error("Public key copy by string failed");
 
+		log() << "--- Timing address checks" << endl;
+		static const unsigned int LOOPS = 100000;
+		struct timeval start, end;
+
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS; i++ )
+			if( !BA2.isValid() )
+				throw runtime_error("Expected address to stay valid");
+		gettimeofday( &end, NULL );
+		log() << "isValid(): " << ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec)) / LOOPS << "us" << endl;
+
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS; i++ )
+			BA2.fromKey( ECKEY );
+		gettimeofday( &end, NULL );
+		log() << "fromKey(): " << ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec)) / LOOPS << "us" << endl;
+		if( BA2.toString() != "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa" )
+			throw runtime_error("Public key conversion with pooled hashers failed");
+
 	} catch( exception &e ) {
 		log() << e.what() << endl;
 		return 255;
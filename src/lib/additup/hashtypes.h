@@ -24,8 +24,10 @@
 // --- OS
 // --- Project lib
 #include <general/extraint.h>
+#include <general/uint256.h>
 #include <general/bytearray.h>
 // --- Project
+#include "base58.h"
 
 
 // -------------- Namespace
@@ -62,21 +64,22 @@ class TEllipticCurveKey;
 
 // -------------- Class declarations
 
-class TBitcoinBase58 : public TBigUnsignedInteger
+class TBitcoinBase58 : public TBigUnsignedInteger64
 {
   public:
 	TBitcoinBase58() { invalidate(); }
-	TBitcoinBase58( const TBigUnsignedInteger &O ) { operator=(O); }
-	TBitcoinBase58( const string &s, unsigned int b = 58 ) { TBigUnsignedInteger::fromString(s,b); }
+	TBitcoinBase58( const TBigUnsignedInteger64 &O ) { operator=(O); }
+	TBitcoinBase58( const string &s, unsigned int b = 58 ) { fromString(s,b); }
 
 	ostream &printOn( ostream &s ) const;
 
-	string toString() const { return TBigUnsignedInteger::toString(58); }
+	string toString() const;
 
-	using TBigUnsignedInteger::fromString;
-	void fromString( const string &s, unsigned int b = 58 ) { TBigUnsignedInteger::fromString(s,b); }
+	using TBigUnsignedInteger64::fromString;
+	void fromString( const string &s, unsigned int b = 58 );
 
   protected:
+	virtual unsigned int minimumBytes() const { return 0; }
 	unsigned int fromCharacter( unsigned int, unsigned int ) const;
 	unsigned int toCharacter( unsigned int, unsigned int ) const;
 };
@@ -86,12 +89,12 @@ class TBitcoinAddress : public TBitcoinBase58
   public:
 	TBitcoinAddress( unsigned char v = 0 ) : AddressClass(v) { invalidate(); }
 	TBitcoinAddress( const TEllipticCurveKey &, unsigned char v = 0 );
-	TBitcoinAddress( const TBigUnsignedInteger &O ) : TBitcoinBase58(O) { parse(); }
+	TBitcoinAddress( const TBigUnsignedInteger64 &O ) : TBitcoinBase58(O) { parse(); }
 	TBitcoinAddress( const string &s ) : TBitcoinBase58(s) { parse(); }
 
 	void fromKey( const TEllipticCurveKey & );
 
-	using TBigUnsignedInteger::fromString;
+	using TBigUnsignedInteger64::fromString;
 	void fromString( const string &, unsigned int b = 58 );
 
 	unsigned char getClass() const { return AddressClass; }
@@ -102,7 +105,7 @@ class TBitcoinAddress : public TBitcoinBase58
 
   protected:
 	void parse();
-	string stringPad( const string &, unsigned int ) const;
+	unsigned int minimumBytes() const { return TBase58::ADDRESS_BYTES; }
 
   protected:
 	unsigned char AddressClass;
@@ -113,27 +116,48 @@ class TBitcoinAddress : public TBitcoinBase58
 //
 // Class:	TBitcoinHash
 // Description:
+// A 256 bit hash or difficulty target.  It lives in a fixed-width
+// integer, so hashes can be copied and compared without touching the
+// heap, which matters in the maps that index blocks and transactions.
 //
-class TBitcoinHash : public TBigUnsignedInteger
+// A default constructed hash is invalid; it compares unequal to
+// everything, including itself, as it did when it was a
+// TBigUnsignedInteger.
+//
+class TBitcoinHash : public TUnsignedInteger256
 {
   public:
-	TBitcoinHash() { invalidate(); }
-	TBitcoinHash( const TBigUnsignedInteger &O ) { operator=(O); }
-	TBitcoinHash( const TBitcoinHash &O ) { operator=(O); }
-	TBitcoinHash( const string &s ) { fromString(s,16); }
-	TBitcoinHash( int t ) : TBigUnsignedInteger(t) {}
+	TBitcoinHash() : Valid(false) {}
+	TBitcoinHash( const TUnsignedInteger256 &O ) : TUnsignedInteger256(O), Valid(true) {}
+	TBitcoinHash( const string &s ) : TUnsignedInteger256(s,16), Valid(true) {}
+	TBitcoinHash( int t ) : TUnsignedInteger256( static_cast<unsigned int>(t) ), Valid(true) {}
 
-	ostream &printOn( ostream &s ) const;
+	void invalidate() { Valid = false; }
+	bool isValid() const { return Valid; }
 
-	TBitcoinHash reversedBytes() const;
+	TBitcoinHash &fromBytes( const string &s ) { TUnsignedInteger256::fromBytes(s); Valid = true; return *this; }
+	TBitcoinHash &fromString( const string &s, unsigned int b = 16 ) { TUnsignedInteger256::fromString(s,b); Valid = true; return *this; }
+	TBitcoinHash &fromLittleEndian( const unsigned char *p ) { TUnsignedInteger256::fromLittleEndian(p); Valid = true; return *this; }
 
-	// Import operators masked by C++ defaults
-	using TBigUnsignedInteger::operator=;
+	ostream &printOn( ostream &s ) const;
+	string toString( unsigned int = 16 ) const;
+
+	TBitcoinHash reversedBytes() const {
+		TBitcoinHash x( TUnsignedInteger256::reversedBytes() );
+		x.Valid = Valid;
+		return x;
+	}
+
+	// Comparison; invalid hashes compare false with anything
+	bool operator<( const TBitcoinHash &O ) const { return Valid && O.Valid && TUnsignedInteger256::operator<(O); }
+	bool operator>( const TBitcoinHash &O ) const { return Valid && O.Valid && TUnsignedInteger256::operator>(O); }
+	bool operator==( const TBitcoinHash &O ) const { return Valid && O.Valid && TUnsignedInteger256::operator==(O); }
+	bool operator!=( const TBitcoinHash &O ) const { return Valid && O.Valid && TUnsignedInteger256::operator!=(O); }
+	bool operator<=( const TBitcoinHash &O ) const { return Valid && O.Valid && TUnsignedInteger256::operator<=(O); }
+	bool operator>=( const TBitcoinHash &O ) const { return Valid && O.Valid && TUnsignedInteger256::operator>=(O); }
 
   protected:
-	string stringPad( const string &, unsigned int ) const;
-
-	static const unsigned int HASH_BYTES;
+	bool Valid;
 };
 
 
@@ -142,6 +166,11 @@ class TBitcoinHash : public TBigUnsignedInteger
 
 // -------------- Inline Functions
 
+inline ostream &operator<<( ostream &s, const TBitcoinHash &O )
+{
+	return O.printOn(s);
+}
+
 
 // -------------- Function prototypes
 
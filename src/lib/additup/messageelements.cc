@@ -27,6 +27,7 @@
 // --- OS
 // --- Project libs
 #include <general/crypto.h>
+#include <general/sha256.h>
 #include <general/logstream.h>
 // --- Project
 #include "script.h"
@@ -38,6 +39,18 @@
 
 // -------------- Module Globals
 
+//
+// Function:	writeLittleEndian32
+// Description:
+//
+static inline void writeLittleEndian32( unsigned char *p, uint32_t x )
+{
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
 
 // -------------- World Globals (need "extern"s in header)
 
@@ -50,6 +63,8 @@
 
 // -------------- Class member definitions
 
+const size_t TBlockHeaderElement::BYTES;
+
 //
 // Function:	TNULTerminatedStringElement :: write
 // Description:
@@ -231,6 +246,23 @@ bool TDifficultyTargetElement::operator==( const TBitcoinHash &Target ) const
 	return (*this == x);
 }
 
+//
+// Function:	TBlockHeaderElement :: toBytes
+// Description:
+// The same BYTES that write() would give, straight into a buffer, for
+// hashing.
+//
+void TBlockHeaderElement::toBytes( unsigned char *p ) const
+{
+	writeLittleEndian32( p, Version.getValue() );
+	PreviousBlock.get().toLittleEndian( p + 4 );
+	MerkleRoot.get().toLittleEndian( p + 36 );
+	writeLittleEndian32( p + 68, Timestamp.getValue() );
+	writeLittleEndian32( p + 72, (DifficultyBits.Mantissa.getValue() & 0xffffff)
+			| static_cast<uint32_t>(DifficultyBits.Exponent.getValue()) << 24 );
+	writeLittleEndian32( p + 76, Nonce.getValue() );
+}
+
 //
 // Function:	TSignatureElement :: read
 // Description:
@@ -370,7 +402,7 @@ void TOutputSplitElement::encodePubKeyScript( const TBitcoinScript &lScript )
 
 // --------
 
-TMessageDigest *TTransactionElement::Hasher = new TDoubleHash( new THash_sha256, new THash_sha256 );
+TMessageDigest *TTransactionElement::Hasher = new TDoubleHash( new TSHA256, new TSHA256 );
 
 //
 // Function:	TTransactionElement :: getHash
@@ -87,6 +87,11 @@ class TMessageElement
 		| static_cast<uint8_t>(d[p+1]) << 8
 		| static_cast<uint8_t>(d[p+2]) << 16
 		| static_cast<uint8_t>(d[p+3]) << 24; }
+	static uint32_t littleEndian32FromBytes( const unsigned char *d ) {
+		return static_cast<uint32_t>(d[0]) << 0
+		| static_cast<uint32_t>(d[1]) << 8
+		| static_cast<uint32_t>(d[2]) << 16
+		| static_cast<uint32_t>(d[3]) << 24; }
 	static uint64_t littleEndian64FromString( const string &d, string::size_type p = 0) {
 		return static_cast<uint64_t>(littleEndian32FromString(d,p)) << 0
 		| static_cast<uint64_t>(littleEndian32FromString(d,p+4)) << 32; }
@@ -141,9 +146,11 @@ class TSizedStringElement : public TStringBasedElement
 	TSizedStringElement(string::size_type n) : N(n) {}
 
 	istream &read( istream &is ) {
-		char buffer[N];
-		is.read( buffer, N );
-		Value.assign( buffer, N );
+		// Read straight into the value; payloads can be megabytes, too
+		// big to bounce through a stack buffer
+		Value.resize( N );
+		if( N > 0 )
+			is.read( &Value[0], N );
 		return is;
 	}
 	ostream &write( ostream &os ) const;
@@ -367,17 +374,17 @@ class THashElement : public TMessageElement
   public:
 	THashElement() { Hash.invalidate(); }
 
+	// Hashes are written little endian
 	istream &read( istream &is ) {
-		char buffer[32];
-		is.read( buffer, sizeof(buffer) );
-		string s( buffer, sizeof(buffer) );
-		Hash.fromBytes(s);
-		Hash = Hash.reversedBytes();
+		unsigned char buffer[TBitcoinHash::BYTES];
+		is.read( reinterpret_cast<char *>(buffer), sizeof(buffer) );
+		Hash.fromLittleEndian( buffer );
 		return is;
 	}
 	ostream &write( ostream &os ) const {
-		// Hashes are written little endian
-		os.write( Hash.reversedBytes().toBytes(32).data(), 32 );
+		unsigned char buffer[TBitcoinHash::BYTES];
+		Hash.toLittleEndian( buffer );
+		os.write( reinterpret_cast<const char *>(buffer), sizeof(buffer) );
 		return os;
 	}
 
@@ -433,6 +440,16 @@ typedef TLittleEndian32Element TTimestampElement;
 //
 class TMessageHeaderElement : public TMessageElement
 {
+  public:
+	// Wire layout of the part of the header every message has; the
+	// checksum, when present, follows it
+	static const unsigned int MAGIC_SIZE = 4;
+	static const unsigned int COMMAND_OFFSET = 4;
+	static const unsigned int COMMAND_SIZE = 12;
+	static const unsigned int PAYLOAD_LENGTH_OFFSET = 16;
+	static const unsigned int UNCHECKSUMMED_SIZE = 20;
+	static const unsigned int CHECKSUM_SIZE = 4;
+
   public:
 	TMessageHeaderElement() { Magic = 0; PayloadLength = 0; hasChecksum = false; Checksum = 0; }
 
@@ -593,6 +610,8 @@ class TDifficultyTargetElement : public TMessageElement
 class TBlockHeaderElement : public TMessageElement
 {
   public:
+	static const size_t BYTES = 80;
+
 	istream &read( istream &is ) {
 		is >> Version
 			>> PreviousBlock >> MerkleRoot >> Timestamp
@@ -604,6 +623,7 @@ class TBlockHeaderElement : public TMessageElement
 			<< DifficultyBits << Nonce;
 		return os;
 	}
+	void toBytes( unsigned char * ) const;
 
   public:
 	TLittleEndian32Element Version;
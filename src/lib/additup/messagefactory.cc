@@ -19,8 +19,8 @@
 // -------------- Includes
 // --- C
 // --- C++
-#include <sstream>
 #include <memory>
+#include <algorithm>
 // --- Qt
 // --- OS
 // --- Project libs
@@ -46,12 +46,19 @@
 
 // -------------- Class declarations
 
+//
+// Static:	TMessageFactory :: MAXIMUM_PAYLOAD_LENGTH
+// Description:
+//
+const uint32_t TMessageFactory::MAXIMUM_PAYLOAD_LENGTH = 0x02000000;
+
 //
 // Function:	TMessageFactory :: TMessageFactory
 // Description:
 //
 TMessageFactory::TMessageFactory() :
 	Initialised( false ),
+	UnknownHaveChecksum( false ),
 	Peer( NULL )
 {
 }
@@ -75,53 +82,166 @@ TMessageFactory::~TMessageFactory()
 // receive() handles the conversion of raw bytes from the peer to a
 // TMessage child.
 //
-void TMessageFactory::receive( const string &s )
+// Incoming bytes are appended to RXBuffer, and complete messages are
+// framed directly from it: the fixed part of the header is inspected
+// in place, and no parse is attempted until the whole of the payload
+// it announces has arrived.  The templates then read from a view of
+// RXBuffer, so the buffered bytes are never copied, and parsed
+// messages are removed by moving the head of the buffer rather than
+// rebuilding it.
+//
+void TMessageFactory::receive( const TByteArray &s )
 {
+	if( !s.empty() )
+		RXBuffer.append( s.ptr(), s.size() );
+
+	parse();
+}
+
+//
+// Function:	TMessageFactory :: reserve
+// Description:
+// Returns space for the caller to read at least n bytes directly into
+// RXBuffer, and sets n to the amount actually available.  If a message
+// is part way through arriving, the space is at least enough for the
+// rest of it, so that a large payload can be read in a few large reads
+// rather than many small ones.  The bytes are added with commit(), and
+// parsed by the next receive().
+//
+unsigned char *TMessageFactory::reserve( TRingBuffer::size_type &n )
+{
+	TRingBuffer::size_type Wanted = bytesWanted();
+	unsigned char *p;
+
+	p = RXBuffer.reserve( Wanted > n ? Wanted : n );
+	n = RXBuffer.space();
+
+	return p;
+}
+
+//
+// Function:	TMessageFactory :: commit
+// Description:
+// Adds n bytes written to the space from reserve().
+//
+void TMessageFactory::commit( TRingBuffer::size_type n )
+{
+	RXBuffer.commit( n );
+}
+
+//
+// Function:	TMessageFactory :: bytesWanted
+// Description:
+// If RXBuffer starts with a plausible header, returns how many more
+// bytes are needed to complete its message (including a checksum,
+// which not every version has, so this might be four over).  Otherwise
+// there's nothing to predict and we return zero.
+//
+TRingBuffer::size_type TMessageFactory::bytesWanted() const
+{
+	if( RXBuffer.size() < TMessageHeaderElement::UNCHECKSUMMED_SIZE )
+		return 0;
+
+	uint32_t PayloadLength = TMessageElement::littleEndian32FromBytes(
+			RXBuffer.ptr() + TMessageHeaderElement::PAYLOAD_LENGTH_OFFSET );
+	if( PayloadLength > MAXIMUM_PAYLOAD_LENGTH )
+		return 0;
+
+	TRingBuffer::size_type Total = TMessageHeaderElement::UNCHECKSUMMED_SIZE
+		+ TMessageHeaderElement::CHECKSUM_SIZE + PayloadLength;
+	if( Total <= RXBuffer.size() )
+		return 0;
+
+	return Total - RXBuffer.size();
+}
+
+//
+// Function:	TMessageFactory :: parse
+// Description:
+// Turns as much of RXBuffer as possible into messages on the peer's
+// incoming queue.
+//
+void TMessageFactory::parse()
+{
+	map<string, list<const TMessage*> >::const_iterator ct;
 	list<const TMessage*>::const_iterator it;
-	RXBuffer += s;
-	istringstream iss( RXBuffer );
-	iss.exceptions( ios::eofbit | ios::failbit | ios::badbit );
 
 	// We should be initialised if we want the templates to be available
 	if( !Initialised )
 		init();
 
-	streamoff sp = 0;
-
 	if( Peer == NULL )
 		throw runtime_error("TMessageFactory::receive() is impossible without a known peer");
 
-	while( !iss.str().empty() && sp < iss.str().size() ) {
+	while( !RXBuffer.empty() ) {
 		TMessage *WorkingClone = NULL;
 
 		// --- Sync
 
-		string::size_type pos = findNextMagic(iss.str(), sp);
-		if( pos == string::npos || pos >= iss.str().size() ) {
-			// If there is no magic in the string, then there is no point
-			// looking for a message in it.  This buffer is nothing we
-			// can read, so we discard all of it.
-//			log() << "Discarding " << RXBuffer.size() << endl;
-			RXBuffer.clear();
-			// XXX: What about the last 1-3 bytes?
+		TRingBuffer::size_type pos = findNextMagic( RXBuffer.ptr(), RXBuffer.size() );
+		if( pos >= RXBuffer.size() ) {
+			// If there is no magic in the buffer, then there is no
+			// point looking for a message in it.  We discard all of
+			// it, except for the last few bytes, which might be the
+			// start of a magic that is still arriving.
+			if( RXBuffer.size() >= TMessageHeaderElement::MAGIC_SIZE )
+				RXBuffer.consume( RXBuffer.size() - (TMessageHeaderElement::MAGIC_SIZE - 1) );
 			break;
-		} else {
-//			log() << "Ignoring " << pos << endl;
-			// Anything before the magic has been read or isn't a
-			// message
-			RXBuffer = RXBuffer.substr( pos, RXBuffer.size() - pos );
-			// And now repoint the stringstream at this shortened buffer
-			iss.str( RXBuffer );
-			iss.seekg( 0, ios::beg );
+		}
+		// Anything before the magic has been read or isn't a message
+		RXBuffer.consume( pos );
+
+		// --- Frame
+
+		// Wait for the header
+		if( RXBuffer.size() < TMessageHeaderElement::UNCHECKSUMMED_SIZE )
+			break;
+
+		uint32_t PayloadLength = TMessageElement::littleEndian32FromBytes(
+				RXBuffer.ptr() + TMessageHeaderElement::PAYLOAD_LENGTH_OFFSET );
+
+		if( PayloadLength > MAXIMUM_PAYLOAD_LENGTH
+				|| !isValidCommand( RXBuffer.ptr() + TMessageHeaderElement::COMMAND_OFFSET ) ) {
+			// This isn't a real header, so resynchronise on the next
+			// magic.  Without a known magic this is our only defence
+			// against waiting forever for a length read from garbage.
+			RXBuffer.consume( 1 );
+			continue;
+		}
+
+		// Wait for the payload.  Messages with a checksum are four
+		// bytes longer still; they will underflow below if those
+		// haven't arrived yet.
+		if( RXBuffer.size() < TMessageHeaderElement::UNCHECKSUMMED_SIZE + PayloadLength )
+			break;
+
+		// --- Dispatch
+
+		const char *c = reinterpret_cast<const char *>( RXBuffer.ptr() + TMessageHeaderElement::COMMAND_OFFSET );
+		ct = CommandTemplates.find( string( c, find( c, c + TMessageHeaderElement::COMMAND_SIZE, '\0' ) - c ) );
+
+		if( ct == CommandTemplates.end() ) {
+			// None of our templates understand this command, so there
+			// is no point parsing it; skip the whole message, which
+			// has a checksum if our other messages do
+			TRingBuffer::size_type Total = TMessageHeaderElement::UNCHECKSUMMED_SIZE + PayloadLength;
+			if( UnknownHaveChecksum )
+				Total += TMessageHeaderElement::CHECKSUM_SIZE;
+			if( RXBuffer.size() < Total )
+				break;
+			RXBuffer.consume( Total );
+			continue;
 		}
 
 		// --- Try to read
 
-		// bookmark position
-		sp = iss.tellg();
+		TMemoryInputStream iss( RXBuffer.ptr(), RXBuffer.size() );
+		iss.exceptions( ios::eofbit | ios::failbit | ios::badbit );
 
-		// Test against each template message
-		for( it = Templates.begin(); it != Templates.end(); it++ ) {
+		// Test against each template message with this command;
+		// normally there is only one, but the versioning factory has a
+		// version template for every protocol version
+		for( it = ct->second.begin(); it != ct->second.end(); it++ ) {
 			// The clone gets automatically deleted unless we release
 			// the auto_ptr
 			auto_ptr<TMessage> AutoTidyClone( (*it)->clone() );
@@ -130,18 +250,14 @@ void TMessageFactory::receive( const string &s )
 			// Clear outstanding exceptions
 			iss.clear();
 			// Restore our bookmark
-			iss.seekg( sp, ios::beg );
+			iss.seekg( 0, ios::beg );
 
 			try {
 				// Attempt read
 				AutoTidyClone->read( iss );
 			} catch( ios::failure &e ) {
-//				log() << "[FACT] Parser at byte " << sp << "/" << iss.str().size();
-//				log() << " D: ";
-//				TLog::hexify( log(), iss.str() );
-//				log() << " - " << e.what() << ", " << (*it)->className() << endl;
 				// If we run out of message from the source, then we
-				// leave the pointer where it is, while in principle
+				// leave the buffer where it is, while in principle
 				// this is identical to the underflow error, it only
 				// gets thrown by body reads not header reads.  Fail
 				// during a body read means the packet was correctly
@@ -151,16 +267,12 @@ void TMessageFactory::receive( const string &s )
 				return;
 
 			} catch( message_parse_error_underflow &e ) {
-//				log() << "[FACT] Parser at byte " << sp << "/" << iss.str().size();
-//				log() << " D: ";
-//				TLog::hexify( log(), iss.str() );
-//				log() << " - " << e.what() << ", " << (*it)->className() << endl;
 				// Same as above, but caught by the parser
 				return;
 
 			} catch( message_parse_error_magic &e ) {
-				log() << "[FACT] Parser at byte " << sp << "/" << iss.str().size();
-				TLog::hexify( log(), iss.str() );
+				log() << "[FACT] Parser at byte 0/" << RXBuffer.size();
+				TLog::hexify( log(), RXBuffer.str() );
 				log() << " - " << e.what() << ", " << (*it)->className() << endl;
 				// A magic error applies to all message types, so we
 				// break out of this loop, there is no point trying
@@ -168,9 +280,9 @@ void TMessageFactory::receive( const string &s )
 				break;
 
 			} catch( message_parse_error_version &e ) {
-				log() << "[FACT] Parser at byte " << sp << "/" << RXBuffer.size();
+				log() << "[FACT] Parser at byte 0/" << RXBuffer.size();
 				log() << " D: ";
-				TLog::hexify( log(), RXBuffer );
+				TLog::hexify( log(), RXBuffer.str() );
 				log() << " - " << e.what() << ", " << (*it)->className() << endl;
 				// Version errors shouldn't happen after versioning has
 				// taken place, it means a TMessage_version_X was used
@@ -182,24 +294,19 @@ void TMessageFactory::receive( const string &s )
 				continue;
 
 			} catch( message_parse_error_type &e ) {
-//				log() << "[FACT] Parser at byte " << sp << "/" << RXBuffer.size();
-//				log() << " D: ";
-//				TLog::hexify( log(), RXBuffer );
-//				log() << " - " << e.what() << ", " << (*it)->className() << endl;
 				// This incoming stream contains a message that is of a
-				// different type than the template; this is perfectly
-				// normal, most of the time the template won't be the
-				// right type, we simply try next template with the same data
+				// different type than the template; the command table
+				// should have prevented that, but the next template
+				// might still manage
 				continue;
 
 			} catch( message_parse_error &e ) {
-				log() << "[FACT] Parser at byte " << sp << "/" << RXBuffer.size();
+				log() << "[FACT] Parser at byte 0/" << RXBuffer.size();
 				log() << " D: ";
-				TLog::hexify( log(), RXBuffer );
+				TLog::hexify( log(), RXBuffer.str() );
 				log() << " - " << e.what() << ", " << (*it)->className() << endl;
-				// Any other error from the parser means we can't handle
-				// this message
-				sp += 1;
+				// Any other error from the parser means this template
+				// can't handle this message
 				continue;
 			}
 
@@ -214,21 +321,15 @@ void TMessageFactory::receive( const string &s )
 			// If the read successfully converted bytes into a TMessage
 			// then push it onto the receive queue
 			Peer->queueIncoming( WorkingClone );
-			// The data we've parsed can be removed from the stream
-			sp = iss.tellg();
-//			log() << "Eaten " << sp << " to make " << *WorkingClone << endl;
-			RXBuffer = RXBuffer.substr( sp, RXBuffer.size() - sp );
-			// Repoint the stringstream at this shortened buffer
-			iss.str( RXBuffer );
-			// ... and point at the start
-			sp = 0;
+			// The data we've parsed can be removed from the buffer
+			RXBuffer.consume( iss.tellg() );
 			if( !continuousParse() )
 				break;
 		} else {
 			// Not having found a message makes it harder to predict
 			// were we should start the next search for the magic.  The
 			// best we can do is start one byte along and try again.
-			sp += 1;
+			RXBuffer.consume( 1 );
 		}
 	}
 }
@@ -236,35 +337,54 @@ void TMessageFactory::receive( const string &s )
 //
 // Function:	TMessageFactory :: findNextMagic
 // Description:
+// Returns the offset of the first network magic in the n bytes at p,
+// or n if there isn't one.
 //
-string::size_type TMessageFactory::findNextMagic( const string &s, string::size_type start ) const
+TRingBuffer::size_type TMessageFactory::findNextMagic( const unsigned char *p, TRingBuffer::size_type n ) const
 {
+	TRingBuffer::size_type i;
+
 	if( Peer == NULL || Peer->getNetworkParameters() == NULL ) {
 		// If we have no peer, then we have no magic available,
 		// which makes it hard to synchronise.  We'll have
 		// to fall back to moving one byte at a time
-//		log() << "Magic search impossible" << endl;
-		return start;
+		return 0;
+	}
+
+	uint32_t Magic = Peer->getNetworkParameters()->Magic;
+
+	for( i = 0; i + TMessageHeaderElement::MAGIC_SIZE <= n; i++ ) {
+		if( TMessageElement::littleEndian32FromBytes( p + i ) == Magic )
+			return i;
 	}
 
-	// Convert the magic to a string
-	TLittleEndian32Element Magic;
-	Magic = Peer->getNetworkParameters()->Magic;
-	ostringstream oss;
-	oss << Magic;
+	return n;
+}
+
+//
+// Function:	TMessageFactory :: isValidCommand
+// Description:
+// A command is printable ASCII, NUL padded to twelve bytes.
+//
+bool TMessageFactory::isValidCommand( const unsigned char *p )
+{
+	unsigned int i = 0;
 
-//	log() << "Next magic ";
-//	TLog::hexify( log(), oss.str() );
-//	log() << " from " << start;
-	start = s.find( oss.str(), start );
+	if( p[0] == '\0' )
+		return false;
 
-	if( start == string::npos ) {
-//		log() << " not found" << endl;
-		return s.size();
+	while( i < TMessageHeaderElement::COMMAND_SIZE && p[i] != '\0' ) {
+		if( p[i] < ' ' || p[i] > '~' )
+			return false;
+		i++;
+	}
+	while( i < TMessageHeaderElement::COMMAND_SIZE ) {
+		if( p[i] != '\0' )
+			return false;
+		i++;
 	}
-//	log() << " found at buffer position " << start << endl;
 
-	return start;
+	return true;
 }
 
 //
@@ -275,9 +395,19 @@ void TMessageFactory::init()
 {
 	list<const TMessage*>::const_iterator it;
 
-	// Set the template flag on any messages the child class created
+	// Set the template flag on any messages the child class created,
+	// and index them by command, preserving the order the child
+	// class gave them in.  Commands we don't know are assumed to be
+	// framed like the ones we do; if any of ours has a checksum, theirs
+	// will too
+	CommandTemplates.clear();
+	UnknownHaveChecksum = false;
 	for( it = Templates.begin(); it != Templates.end(); it++ ) {
 		(*it)->setTemplate( true );
+		if( (*it)->commandString() != NULL )
+			CommandTemplates[(*it)->commandString()].push_back( *it );
+		if( dynamic_cast<const TMessageWithChecksum *>( *it ) != NULL )
+			UnknownHaveChecksum = true;
 	}
 
 	Initialised = true;
@@ -452,10 +582,28 @@ TBitcoinScript *TMessageFactory_31402::createVersionedBitcoinScript() const
 
 #ifdef UNITTEST
 #include <iostream>
+#include <sstream>
+#include <sys/time.h>
 #include "unittest.h"
 #include <general/logstream.h>
 #include "peer.h"
 
+//
+// Class:	TUnitTestMessageFactory
+// Description:
+// Exposes the templates so that the speed test can compare against
+// offering every message to every template.
+//
+class TUnitTestMessageFactory : public TMessageFactory_31402
+{
+  public:
+	const list<const TMessage*> &templates() {
+		if( !Initialised )
+			init();
+		return Templates;
+	}
+};
+
 // -------------- main()
 
 int main( int argc, char *argv[] )
@@ -467,7 +615,7 @@ int main( int argc, char *argv[] )
 
 		log() << "--- " << PF.className() << endl;
 
-		const string *p = UNITTESTSampleMessages;
+		const TByteArray *p = UNITTESTSampleMessages;
 		while( !p->empty() ) {
 			PF.receive( *p );
 			if( Peer.newestIncoming() != NULL ) {
@@ -490,7 +638,7 @@ int main( int argc, char *argv[] )
 
 		log() << "--- " << PF.className() << endl;
 
-		const string *p = UNITTESTSampleMessages;
+		const TByteArray *p = UNITTESTSampleMessages;
 		while( !p->empty() ) {
 			PF.receive( *p );
 			if( Peer.newestIncoming() != NULL ) {
@@ -506,6 +654,154 @@ int main( int argc, char *argv[] )
 		return 255;
 	}
 
+	try {
+		TBitcoinPeer Peer;
+		TMessageFactory_31402 PF;
+		PF.setPeer( &Peer );
+		TMessage *m;
+
+		log() << "--- Unknown command with a checksum" << endl;
+
+		// Its checksum must be skipped too, leaving nothing for the
+		// resynchronisation to throw away.  Sent a byte at a time, to
+		// see that the factory waits for the whole message
+		TByteArray Stream( "\xf9\xbe\xb4\xd9"    // Magic
+				"unknowncmd\0\0"     // Command
+				"\x03\0\0\0"         // Length
+				"\x12\x34\x56\x78"   // Checksum
+				"abc"                // Payload
+				"\xf9\xbe\xb4\xd9"    // Magic
+				"verack\0\0\0\0\0\0"  // Command
+				"\0\0\0\0"           // Length
+				, 51 );
+		for( unsigned int i = 0; i < Stream.size(); i++ ) {
+			PF.receive( TByteArray( Stream.ptr(i), 1 ) );
+			if( i == 26 && !PF.getRXBuffer().empty() )
+				throw logic_error( "Unknown command wasn't skipped whole" );
+		}
+		m = Peer.nextIncoming();
+		if( m == NULL || dynamic_cast<TMessage_verack *>( m ) == NULL )
+			throw logic_error( "Message after an unknown command was lost" );
+		log() << "PF.queue() = " << *m << endl;
+		delete m;
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		TBitcoinPeer Peer;
+		TMessageFactory_31402 PF;
+		PF.setPeer( &Peer );
+		const TByteArray *p;
+		string Stream;
+		TRingBuffer::size_type pos, n;
+		unsigned int Direct = 0, InPlace = 0, Reads = 0;
+		TMessage *m;
+
+		log() << "--- In place receive" << endl;
+
+		for( p = UNITTESTSampleMessages; !p->empty(); p++ ) {
+			Stream += p->str();
+			PF.receive( *p );
+			while( (m = Peer.nextIncoming()) != NULL ) {
+				delete m;
+				Direct++;
+			}
+		}
+
+		// Pretend to be a socket that never returns more than seven
+		// bytes at a time
+		for( pos = 0; pos < Stream.size(); pos += n ) {
+			n = 7;
+			unsigned char *b = PF.reserve( n );
+			if( n < 7 )
+				throw logic_error( "TMessageFactory::reserve() gave too little space" );
+			n = min<TRingBuffer::size_type>( 7, Stream.size() - pos );
+			memcpy( b, Stream.data() + pos, n );
+			PF.commit( n );
+			PF.receive( TByteArray() );
+			Reads++;
+			while( (m = Peer.nextIncoming()) != NULL ) {
+				delete m;
+				InPlace++;
+			}
+		}
+
+		log() << Direct << " messages received by copy, " << InPlace
+			<< " in place from " << Reads << " reads" << endl;
+		if( Direct != InPlace )
+			throw logic_error( "In place receive gave different messages" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		static const unsigned int LOOPS = 1000;
+		TBitcoinPeer Peer;
+		TUnitTestMessageFactory PF;
+		PF.setPeer( &Peer );
+		list<const TMessage*>::const_iterator it;
+		struct timeval start, end;
+		const TByteArray *p;
+		TMessage *m;
+		unsigned int i, n;
+		double t;
+
+		log() << "--- Speed test" << endl;
+
+		// Offer every message to every template in turn, which is
+		// what the factory did before it had a command table
+		n = 0;
+		gettimeofday( &start, NULL );
+		for( i = 0; i < LOOPS; i++ ) {
+			for( p = UNITTESTSampleMessages; !p->empty(); p++ ) {
+				istringstream iss( *p );
+				iss.exceptions( ios::eofbit | ios::failbit | ios::badbit );
+				for( it = PF.templates().begin(); it != PF.templates().end(); it++ ) {
+					auto_ptr<TMessage> Clone( (*it)->clone() );
+					iss.clear();
+					iss.seekg( 0, ios::beg );
+					try {
+						Clone->read( iss );
+					} catch( exception &e ) {
+						continue;
+					}
+					n++;
+					break;
+				}
+			}
+		}
+		gettimeofday( &end, NULL );
+		t = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		log() << "Trial parse:   " << n << " messages in " << t << "s = "
+			<< n / t << " messages/s" << endl;
+
+		// The factory, looking the command up once per message
+		n = 0;
+		gettimeofday( &start, NULL );
+		for( i = 0; i < LOOPS; i++ ) {
+			for( p = UNITTESTSampleMessages; !p->empty(); p++ ) {
+				PF.receive( *p );
+				while( (m = Peer.nextIncoming()) != NULL ) {
+					delete m;
+					n++;
+				}
+			}
+		}
+		gettimeofday( &end, NULL );
+		t = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		log() << "Command table: " << n << " messages in " << t << "s = "
+			<< n / t << " messages/s" << endl;
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
 	return 0;
 }
 #endif
@@ -23,9 +23,11 @@
 // --- C++
 #include <string>
 #include <list>
+#include <map>
 // --- Qt
 // --- OS
 // --- Project lib
+#include <general/bytearray.h>
 // --- Project
 
 
@@ -75,6 +77,10 @@ class TBitcoinScript;
 // TMessage_version::createMessageFactory() to create a
 // TVersionedMessageFactory to read messages.
 //
+// init() indexes the templates by command string, so each incoming
+// message is only offered to the templates that share its command,
+// rather than to every template in turn.
+//
 class TMessageFactory
 {
   public:
@@ -82,26 +88,41 @@ class TMessageFactory
 	virtual ~TMessageFactory();
 	virtual const char *className() { return "TMessageFactory"; }
 
-	void receive( const string & );
+	void receive( const TByteArray & );
+	unsigned char *reserve( TRingBuffer::size_type & );
+	void commit( TRingBuffer::size_type );
 	void transmit( TMessage * );
 
 	void setPeer( TBitcoinPeer *p ) { Peer = p; }
 
-	string::size_type findNextMagic( const string &, string::size_type = 0 ) const;
+	TRingBuffer::size_type findNextMagic( const unsigned char *, TRingBuffer::size_type ) const;
+
+	TByteArray getRXBuffer() const { return TByteArray( RXBuffer.ptr(), RXBuffer.size() ); }
 
-	const string &getRXBuffer() const { return RXBuffer; }
+	// The official client's MAX_SIZE; a header claiming a longer
+	// payload than this is garbage, not something to wait for
+	static const uint32_t MAXIMUM_PAYLOAD_LENGTH;
 
   protected:
 	virtual void init();
 
+	void parse();
+	TRingBuffer::size_type bytesWanted() const;
+
 	virtual bool continuousParse() const { return true; }
 
+	static bool isValidCommand( const unsigned char * );
+
   protected:
-	string RXBuffer;
+	TRingBuffer RXBuffer;
 
 	bool Initialised;
+	// Whether to skip a checksum after the header of a command we
+	// have no template for
+	bool UnknownHaveChecksum;
 
 	list<const TMessage *> Templates;
+	map<string, list<const TMessage *> > CommandTemplates;
 
 	TBitcoinPeer *Peer;
 };
@@ -18,6 +18,7 @@
 
 // -------------- Includes
 // --- C
+#include <string.h>
 // --- C++
 #include <list>
 #include <sstream>
@@ -25,6 +26,7 @@
 // --- OS
 // --- Project libs
 #include <general/crypto.h>
+#include <general/sha256.h>
 #include <general/logstream.h>
 // --- Project
 #include "messagefactory.h"
@@ -215,7 +217,7 @@ void TMessageWithChecksum::verifyPayloadChecksum() const
 {
 	// Can't verify a checksum without knowing the hash that the network
 	// uses
-	if( Peer == NULL )
+	if( Peer == NULL || Peer->getNetworkParameters() == NULL )
 		return;
 	string digest = Peer->getNetworkParameters()->payloadHasher()->transform( RawPayload );
 	uint32_t CalculatedChecksum = TMessageElement::littleEndian32FromString( digest, 0 );
@@ -684,80 +686,72 @@ ostream &TMessage_tx::printOn( ostream &s ) const
 //
 void TMessage_block::calculateMerkleTree()
 {
-	MerkleTree.clear();
-	MerkleTree.reserve( Transactions.size() * 2 );
-
-	// The tree is primed using the hashes of the transactions
-	ostringstream oss;
-	for( unsigned int i = 0; i < Transactions.size(); i++ ) {
-		MerkleTree.push_back( Transactions[i].getHash() );
+	static const size_t HASH_BYTES = TBitcoinHash::BYTES;
+
+	// The merkle hash is fixed by the protocol, so a block that hasn't
+	// come from a peer can still calculate it
+	TSHA256 SHA256;
+	TDoubleHash SHASHA256( &SHA256, &SHA256 );
+	const TNetworkParameters *Parameters = (Peer == NULL) ? NULL : Peer->getNetworkParameters();
+	TMessageDigest *Hasher = (Parameters == NULL) ? &SHASHA256 : Parameters->merkleHasher();
+
+	// Each level has half as many nodes as the one below, rounded up,
+	// until there is only the root
+	size_t Nodes = Transactions.size();
+	for( size_t depthSize = Transactions.size(); depthSize > 1; ) {
+		depthSize = (depthSize + 1) / 2;
+		Nodes += depthSize;
 	}
+	MerkleTree.resize( Nodes * HASH_BYTES );
 
-	// We run two loops, the first of which is going to iterate through
-	// the merkle tree at decreasing depths, like this (using an 8
-	// transaction input as an example)
-	//
-	//  size = {8, 4, 2, 1}
-	//
-	// For each of these, a loop from 0 to size is iterated through, two
-	// at a time.  Further, a second index is calculated, being the
-	// first offset by one:
-	//
-	//   size == 8  ->  i = {0, 2, 4, 6}   i2 = {1, 3, 5, 7}
-	//   size == 4  ->  i = {0, 2}         i2 = (1, 3}
-	//   size == 2  ->  i = {0}            i2 = {1}
-	//   size == 1  ->  i = {0}            i2 = {0}
-	//
-	// Finally, the two array indexes for the two hashes being in turn
-	// hashed are calculated as offsets from a final iterator, j, which
-	// is the index of the start of the current merkle tree depth.  j
-	// then represents the index of the block of hashes of a width
-	// represented by size.
-	//
-	//   size == 8  ->  j = 0   i = {0, 2, 4, 6}   i2 = {1, 3, 5, 7}
-	//   size == 4  ->  j = 8   i = {0, 2}         i2 = (1, 3}
-	//   size == 2  ->  j = 12  i = {0}            i2 = {1}
-	//
-	// indexes are therefore
+	// The tree is primed using the hashes of the transactions
+	for( unsigned int i = 0; i < Transactions.size(); i++ )
+		Transactions[i].getHash().toLittleEndian( MerkleTree.ptr( i * HASH_BYTES ) );
+
+	// Each level is written straight after the one below it.  In the
+	// level below, each pair of neighbours is already the 64 bytes
+	// that their parent is the hash of, so the whole level can go to
+	// the hasher at once.  An odd node out at the end of a level is
+	// paired with itself.
 	//
-	//   size == 8  ->  pairs = { {0,1}, {2,3}, {4,5}, {6,7} }  size() = 12
-	//   size == 4  ->  pairs = { {8,9}, {10,11} }              size() = 14
-	//   size == 2  ->  pairs = { {12, 13} }                    size() = 15
+	//   size == 8  ->  pairs = { {0,1}, {2,3}, {4,5}, {6,7} }  -> 8..11
+	//   size == 4  ->  pairs = { {8,9}, {10,11} }              -> 12..13
+	//   size == 2  ->  pairs = { {12, 13} }                    -> 14
 	//
-	// I've renamed the variables, from their "official" names to be
-	// clearer about what's going on
-
-	unsigned int depthIndex = 0;
-	for( unsigned int depthSize = Transactions.size();
+	size_t depthIndex = 0;
+	for( size_t depthSize = Transactions.size();
 			depthSize > 1; depthSize = (depthSize + 1) / 2 ) {
-		for( unsigned int Offset0 = 0; Offset0 < depthSize; Offset0 += 2 ) {
-			unsigned int Offset1 = (Offset0 + 1 < depthSize - 1) ? (Offset0 + 1) : (depthSize - 1);
-
-			// We could argue that we could do the reading writing of
-			// hashes from a buffer ourselves, but that would mean that
-			// we're duplicating code that already does that.  In
-			// particular if we use THashElement we can forget whether
-			// the bytes need reversing or not; it already knows how
-			THashElement leaf1, leaf2, result;
-			leaf1 = MerkleTree[depthIndex + Offset0];
-			leaf2 = MerkleTree[depthIndex + Offset1];
-
-			// Write the leaves to a buffer
-			ostringstream oss;
-			oss << leaf1 << leaf2;
-
-			istringstream iss( Peer->getNetworkParameters()->merkleHasher()->transform( oss.str() ) );
+		const unsigned char *Level = MerkleTree.ptr( depthIndex * HASH_BYTES );
+		unsigned char *Parents = MerkleTree.ptr( (depthIndex + depthSize) * HASH_BYTES );
+		size_t Pairs = depthSize / 2;
 
-			// Read the resultant hash from a buffer
-			iss >> result;
+		Hasher->transformMany( Parents, Level, 2 * HASH_BYTES, Pairs );
 
-			// Push it onto the array
-			MerkleTree.push_back( result );
+		if( depthSize % 2 != 0 ) {
+			unsigned char Pair[2 * HASH_BYTES];
+			memcpy( Pair, Level + (depthSize - 1) * HASH_BYTES, HASH_BYTES );
+			memcpy( Pair + HASH_BYTES, Pair, HASH_BYTES );
+			Hasher->transformMany( Parents + Pairs * HASH_BYTES, Pair, sizeof(Pair), 1 );
 		}
+
 		depthIndex += depthSize;
 	}
 }
 
+//
+// Function:	TMessage_block :: merkleNode
+// Description:
+// Node i of the merkle tree; the leaves come first and the root last.
+//
+TBitcoinHash TMessage_block::merkleNode( size_t i ) const
+{
+	TBitcoinHash Node;
+
+	Node.fromLittleEndian( MerkleTree.ptr( i * TBitcoinHash::BYTES ) );
+
+	return Node;
+}
+
 //
 // Function:	TMessage_block :: setMerkleRoot
 // Description:
@@ -770,7 +764,7 @@ void TMessage_block::setMerkleRoot()
 	// The last item in the merkle tree is the root.  We simply copy it
 	// to the block header
 
-	blockHeader().MerkleRoot = MerkleTree.back();
+	blockHeader().MerkleRoot = merkleNode( merkleTreeSize() - 1 );
 }
 
 //
@@ -782,11 +776,10 @@ ostream &TMessage_block::printOn( ostream &s ) const
 	s << className();
 	s << "{ N=" << Transactions.size();
 	s << "; Merkle=[";
-	vector<TBitcoinHash>::const_iterator it;
-	for( it = MerkleTree.begin(); it != MerkleTree.end(); it++ )
-		s << (*it) << ", ";
+	for( size_t i = 0; i < merkleTreeSize(); i++ )
+		s << merkleNode(i) << ", ";
 	s << "]";
-	if( !MerkleTree.empty() && blockHeader().MerkleRoot != MerkleTree.back() )
+	if( !MerkleTree.empty() && blockHeader().MerkleRoot != merkleNode( merkleTreeSize() - 1 ) )
 		s << "!=" << blockHeader().MerkleRoot.get();
 	s << "; TX=[";
 	for( unsigned int i = 0; i < Transactions.size(); i++ ) {
@@ -988,6 +981,27 @@ int main( int argc, char *argv[] )
 
 			if( potential != NULL ) {
 				log() << " - is a " << *potential << endl;
+
+				// A block knows its merkle root, so the tree can be
+				// checked against it
+				TMessage_block *block = dynamic_cast<TMessage_block*>( potential );
+				if( block != NULL ) {
+					TBitcoinHash Root( block->blockHeader().MerkleRoot.get() );
+					static const unsigned int LOOPS = 20000;
+					struct timeval start, end;
+
+					gettimeofday( &start, NULL );
+					for( unsigned int i = 0; i < LOOPS; i++ )
+						block->calculateMerkleTree();
+					gettimeofday( &end, NULL );
+
+					block->setMerkleRoot();
+					if( block->blockHeader().MerkleRoot != Root )
+						throw runtime_error( "calculated merkle root doesn't match the block's" );
+					log() << " - merkle root of " << block->merkleTreeSize() << " nodes matches, "
+						<< ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec)) / LOOPS
+						<< "us per tree" << endl;
+				}
 			} else {
 				log() << " - is not a message" << endl;
 				p++;
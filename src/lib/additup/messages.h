@@ -50,6 +50,36 @@
 
 // -------------- Enumerations
 
+//
+// Enumeration:	eMessageKind
+// Description:
+// Every concrete TMessage reports one of these from messageKind(), which
+// lets a received message be dispatched with a switch rather than by
+// trying dynamic_cast<> against each message class in turn.
+//
+enum eMessageKind {
+	MESSAGE_UNIMPLEMENTED,
+	MESSAGE_VERSION,
+	MESSAGE_VERACK,
+	MESSAGE_ADDR,
+	MESSAGE_INV,
+	MESSAGE_GETDATA,
+	MESSAGE_GETBLOCKS,
+	MESSAGE_GETHEADERS,
+	MESSAGE_TX,
+	MESSAGE_BLOCK,
+	MESSAGE_HEADERS,
+	MESSAGE_GETADDR,
+	MESSAGE_CHECKORDER,
+	MESSAGE_SUBMITORDER,
+	MESSAGE_REPLY,
+	MESSAGE_PING,
+	MESSAGE_ALERT,
+
+	// Number of kinds, not a kind
+	MESSAGE_KIND_COUNT
+};
+
 
 // -------------- Structures/Unions
 
@@ -155,9 +185,11 @@ class TMessage
 	virtual void setFields();
 	void setMagic( uint32_t m ) { MessageHeader.Magic = m; }
 
+	virtual const char *commandString() const = 0;
+	virtual eMessageKind messageKind() const = 0;
+
   protected:
 	virtual bool acceptCommandCode( const string & ) const;
-	virtual const char *commandString() const = 0;
 
 	virtual ostream &printOn( ostream & ) const;
 	friend ostream &operator<<( ostream &, const TMessage & );
@@ -187,6 +219,7 @@ class TMessageUnimplemented : public TMessage
   protected:
 	bool acceptCommandCode( const string & ) const { return true; }
 	const char *commandString() const { return NULL; }
+	eMessageKind messageKind() const { return MESSAGE_UNIMPLEMENTED; }
 };
 
 //
@@ -255,6 +288,7 @@ class TMessage_version : public TMessageWithoutChecksum
 
   protected:
 	const char *commandString() const { return "version"; }
+	eMessageKind messageKind() const { return MESSAGE_VERSION; }
 
 	ostream &printOn( ostream & ) const;
   protected:
@@ -366,6 +400,7 @@ class TMessage_verack : public TMessageWithoutChecksum
 
   protected:
 	const char *commandString() const { return "verack"; }
+	eMessageKind messageKind() const { return MESSAGE_VERACK; }
 
   protected:
 };
@@ -393,6 +428,7 @@ class TMessage_addr : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "addr"; }
+	eMessageKind messageKind() const { return MESSAGE_ADDR; }
 };
 
 //
@@ -513,6 +549,7 @@ class TMessage_inv : public TMessage_InventoryBase
 
   protected:
 	const char *commandString() const { return "inv"; }
+	eMessageKind messageKind() const { return MESSAGE_INV; }
 
   protected:
 };
@@ -532,6 +569,7 @@ class TMessage_getdata : public TMessage_InventoryBase
 
   protected:
 	const char *commandString() const { return "getdata"; }
+	eMessageKind messageKind() const { return MESSAGE_GETDATA; }
 
   protected:
 };
@@ -589,6 +627,7 @@ class TMessage_getblocks : public TMessageGetBase
 
   protected:
 	const char *commandString() const { return "getblocks"; }
+	eMessageKind messageKind() const { return MESSAGE_GETBLOCKS; }
 
   protected:
 	static const unsigned int MAXIMUM_BLOCK_COUNT;
@@ -612,6 +651,7 @@ class TMessage_getheaders : public TMessageGetBase
 
   protected:
 	const char *commandString() const { return "getheaders"; }
+	eMessageKind messageKind() const { return MESSAGE_GETHEADERS; }
 
   protected:
 	static const unsigned int MAXIMUM_BLOCK_COUNT;
@@ -643,6 +683,7 @@ class TMessage_tx : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "tx"; }
+	eMessageKind messageKind() const { return MESSAGE_TX; }
 
 	ostream &printOn( ostream & ) const;
   protected:
@@ -685,16 +726,21 @@ class TMessage_block : public TMessageWithChecksum
 
 	void calculateMerkleTree();
 	void setMerkleRoot();
+	size_t merkleTreeSize() const { return MerkleTree.size() / TBitcoinHash::BYTES; }
+	TBitcoinHash merkleNode( size_t ) const;
 
   protected:
 	const char *commandString() const { return "block"; }
+	eMessageKind messageKind() const { return MESSAGE_BLOCK; }
 
 	ostream &printOn( ostream & ) const;
   protected:
 	TBlockHeaderElement BlockHeader;
 	TNElementsElement<TTransactionElement> Transactions;
 
-	vector<TBitcoinHash> MerkleTree;
+	// Every level of the tree, leaves first, as consecutive little
+	// endian hashes
+	TByteArray MerkleTree;
 };
 
 //
@@ -730,6 +776,7 @@ class TMessage_headers : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "headers"; }
+	eMessageKind messageKind() const { return MESSAGE_HEADERS; }
 
 	ostream &printOn( ostream & ) const;
   protected:
@@ -757,6 +804,7 @@ class TMessage_getaddr : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "getaddr"; }
+	eMessageKind messageKind() const { return MESSAGE_GETADDR; }
 
   protected:
 };
@@ -791,6 +839,7 @@ class TMessage_checkorder : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "checkorder"; }
+	eMessageKind messageKind() const { return MESSAGE_CHECKORDER; }
 
   protected:
 	TWalletTxElement WalletTransaction;
@@ -821,6 +870,7 @@ class TMessage_submitorder : public TMessage_checkorder
 
   protected:
 	const char *commandString() const { return "submitorder"; }
+	eMessageKind messageKind() const { return MESSAGE_SUBMITORDER; }
 
   protected:
 	THashElement TransactionHash;
@@ -849,6 +899,7 @@ class TMessage_reply : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "reply"; }
+	eMessageKind messageKind() const { return MESSAGE_REPLY; }
 
   protected:
 	TLittleEndian32Element ReplyCode;
@@ -871,6 +922,7 @@ class TMessage_ping : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "ping"; }
+	eMessageKind messageKind() const { return MESSAGE_PING; }
 
   protected:
 };
@@ -910,6 +962,7 @@ class TMessage_alert : public TMessageWithChecksum
 
   protected:
 	const char *commandString() const { return "alert"; }
+	eMessageKind messageKind() const { return MESSAGE_ALERT; }
 
   protected:
 	TVariableSizedStringElement Message;
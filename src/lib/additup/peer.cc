@@ -145,7 +145,9 @@ TBitcoinPeer::TBitcoinPeer( const TNodeInfo *info, TBitcoinNetwork *network ) :
 	State( Unconnected ),
 	VersionSent( false ),
 	VerackReceived( false ),
-	VersionMessage( NULL )
+	VersionMessage( NULL ),
+	OutgoingBytes( 0 ),
+	ReceivingInPlace( false )
 {
 }
 
@@ -163,10 +165,9 @@ TBitcoinPeer::~TBitcoinPeer()
 		delete IncomingQueue.front();
 		IncomingQueue.erase( IncomingQueue.begin() );
 	}
-	while( !OutgoingQueue.empty() ) {
-		delete OutgoingQueue.front();
-		OutgoingQueue.erase( OutgoingQueue.begin() );
-	}
+	TMessage *m;
+	while( OutgoingQueue.pop( m ) )
+		delete m;
 }
 
 //
@@ -221,24 +222,39 @@ TMessage *TBitcoinPeer::nextIncoming()
 //
 TMessage *TBitcoinPeer::nextOutgoing()
 {
-	if( OutgoingQueue.empty() )
+	TMessage *x;
+	if( !OutgoingQueue.pop( x ) )
 		return NULL;
-	TMessage *x = OutgoingQueue.front();
-	OutgoingQueue.pop_front();
+	__sync_fetch_and_sub( &OutgoingBytes, x->getMessageSize() );
 	return x;
 }
 
 //
 // Function:	TBitcoinPeer :: queueOutgoing
 // Description:
+// Takes ownership of m.  Low priority messages are refused (and deleted)
+// when the network says this peer is already too far behind; returns
+// false in that case.
 //
-void TBitcoinPeer::queueOutgoing( TMessage *m )
+bool TBitcoinPeer::queueOutgoing( TMessage *m, ePriority Priority )
 {
+	if( Priority == LowPriority && Network != NULL && Network->isCongested( this ) ) {
+		delete m;
+		return false;
+	}
+
 	// If it's on our queue it's going to this peer
 	m->setPeer( this );
 	// Make sure the message is valid
 	m->setFields();
-	OutgoingQueue.push_back( m );
+	__sync_fetch_and_add( &OutgoingBytes, m->getMessageSize() );
+	OutgoingQueue.push( m );
+
+	// Let the network know there's something to send
+	if( Network != NULL )
+		Network->outgoingQueued( this );
+
+	return true;
 }
 
 //
@@ -252,6 +268,52 @@ void TBitcoinPeer::queueIncoming( TMessage *m )
 	IncomingQueue.push_back( m );
 }
 
+//
+// Function:	TBitcoinPeer :: receiveBuffer
+// Description:
+// Returns space for the caller to read at least n bytes into, and sets
+// n to how much there is.  Having written to it, the caller must call
+// received() before asking again.
+//
+// Once we have a factory the space is in its receive buffer, so the
+// bytes are read and parsed where they land.  Before that receive()
+// has work to do on the raw bytes, so we use a scratch buffer and pass
+// that on.
+//
+unsigned char *TBitcoinPeer::receiveBuffer( size_t &n )
+{
+	ReceivingInPlace = Factory != NULL && (State == Handshaking || State == Connected);
+
+	if( ReceivingInPlace ) {
+		TRingBuffer::size_type m = n;
+		unsigned char *p = Factory->reserve( m );
+		n = m;
+		return p;
+	}
+
+	if( ReceiveScratch.size() < n )
+		ReceiveScratch.resize( n );
+	n = ReceiveScratch.size();
+	return ReceiveScratch.ptr();
+}
+
+//
+// Function:	TBitcoinPeer :: received
+// Description:
+// n bytes have been written to the space from receiveBuffer().
+//
+void TBitcoinPeer::received( size_t n )
+{
+	if( ReceivingInPlace ) {
+		Factory->commit( n );
+		// The bytes are already with the factory, we need only
+		// prompt the processing
+		receive( TByteArray() );
+	} else {
+		receive( TByteArray( ReceiveScratch.ptr(), n ) );
+	}
+}
+
 //
 // Function:	TBitcoinPeer :: receive
 // Description:
@@ -345,7 +407,7 @@ void TBitcoinPeer::receive( const TByteArray &s )
 				log() << "[PEER]  - Testing potential network magic " << hex << PotentialMagic.getValue() << dec << endl;
 
 				const TNetworkParameters *p = KNOWN_NETWORKS::O().magicToNetwork( PotentialMagic.getValue() );
-				if( p == NULL ) {
+				if( p != NULL ) {
 					if( Network != NULL ) {
 						log() << "[PEER]  - Network magic found, for " << p->networkName() << endl;
 						Network->setNetworkParameters( p );
@@ -475,18 +537,12 @@ void TBitcoinPeer::receive( const TByteArray &s )
 			return;
 		}
 
-		auto_ptr<TMessage> Message;
-
-		do {
-			Message.reset( nextIncoming() );
-			if( Message.get() == NULL )
-				break;
+		TMessage *Message;
 
-			// The network gets to process the packets once we're
-			// connected
-			Network->process( Message.get() );
-
-		} while( true );
+		// The network gets to process the packets once we're
+		// connected
+		while( (Message = nextIncoming()) != NULL )
+			Network->dispatch( Message );
 	}
 }
 
@@ -500,27 +556,133 @@ void TBitcoinPeer::receive( const TByteArray &s )
 #ifdef UNITTEST
 #include <iostream>
 #include <sstream>
+#include <poll.h>
+#include <unistd.h>
 #include "unittest.h"
 #include <general/logstream.h>
+#include <general/extraexcept.h>
 #include "bitcoinnetwork.h"
 
+//
+// Class:	TUnitTestNetwork
+// Description:
+// Attaches peers to a descriptor we already have, rather than to a
+// node, and lets the test turn run()'s loop by hand.
+//
+class TUnitTestNetwork : public TBitcoinNetwork_Sockets
+{
+  public:
+	TUnitTestNetwork( unsigned int n, TSocketPoller::TFactory f ) :
+		TBitcoinNetwork_Sockets( n, f )
+	{
+		vector<TShard *>::iterator it;
+		if( isThreaded() ) {
+			for( it = Shards.begin(); it != Shards.end(); it++ )
+				(*it)->start();
+		}
+	}
+
+	void attach( fd_t fd ) {
+		TSocketPoller::setNonBlocking( fd );
+		TBitcoinPeer *Peer = new TBitcoinPeer( NULL, this );
+		Connections.insert( Peer );
+		Peer->setState( TBitcoinPeer::Connecting );
+		Peer->receive( TByteArray() );
+		shardFor( Peer )->adopt( Peer, fd );
+	}
+
+	void step() {
+		if( isThreaded() ) {
+			processDeliveries();
+		} else {
+			Shards.front()->poll( 0 );
+		}
+	}
+
+	size_t connections() const { return Connections.size(); }
+	const char *pollerClassName() const { return Shards.front()->getPollerClassName(); }
+};
+
+//
+// Function:	loopbackTest
+// Description:
+// Attaches a peer to one end of a socket pair and plays the remote node
+// on the other: sends a version and verack, expects a version and a
+// verack back, then hangs up and expects the peer to be dropped.
+//
+static void loopbackTest( unsigned int IOThreads, TSocketPoller::TFactory Factory )
+{
+	TUnitTestNetwork Network( IOThreads, Factory );
+	// The protocol specification's version, 31900, which wants a
+	// verack, and its verack
+	const TByteArray &Version = UNITTESTSampleMessages[5];
+	const TByteArray &Verack = UNITTESTSampleMessages[6];
+	string Reply;
+	char buffer[4096];
+	struct pollfd pfd;
+	unsigned int i;
+	int sv[2];
+	ssize_t n;
+
+	log() << "--- Loopback, " << Network.pollerClassName()
+		<< ", " << IOThreads << " I/O threads" << endl;
+
+	Network.setNetworkParameters( NETWORK_PRODNET );
+
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) < 0 )
+		throw socket_error( "socketpair()" );
+	Network.attach( sv[0] );
+
+	if( write( sv[1], Version.ptr(), Version.size() ) != static_cast<ssize_t>( Version.size() ) )
+		throw libc_error( "write()" );
+	if( write( sv[1], Verack.ptr(), Verack.size() ) != static_cast<ssize_t>( Verack.size() ) )
+		throw libc_error( "write()" );
+
+	for( i = 0; i < 500 && Reply.find( "verack" ) == string::npos; i++ ) {
+		Network.step();
+		pfd.fd = sv[1];
+		pfd.events = POLLIN;
+		if( poll( &pfd, 1, 10 ) > 0 ) {
+			n = read( sv[1], buffer, sizeof(buffer) );
+			if( n > 0 )
+				Reply.append( buffer, n );
+		}
+	}
+	if( Reply.find( "version" ) == string::npos || Reply.find( "verack" ) == string::npos )
+		throw runtime_error( "no version and verack from the peer" );
+
+	close( sv[1] );
+	for( i = 0; i < 500 && Network.connections() > 0; i++ ) {
+		Network.step();
+		usleep( 1000 );
+	}
+	if( Network.connections() > 0 )
+		throw runtime_error( "peer not dropped when the remote hung up" );
+
+	log() << "Handshake answered and hang up noticed" << endl;
+}
+
 // -------------- main()
 
 int main( int argc, char *argv[] )
 {
+	// Force KNOWN_NETWORKS creation
+	KNOWN_NETWORKS::create();
+
 	try {
-		TBitcoinNetwork Network;
+		TBitcoinNetwork_Sockets Network;
+		Network.setNetworkParameters( NETWORK_PRODNET );
 		TBitcoinPeer Peer( NULL, &Network );
 		Peer.setState( TBitcoinPeer::Connecting );
 
-		const string *p = UNITTESTSampleMessages;
+		const TByteArray *p = UNITTESTSampleMessages;
 		while( !p->empty() ) {
 			// Fake reception of partial messages
 			for( unsigned int i = 0; i < p->size(); i += 1000 ) {
 				log() << "[TEST] RX< " << p->size() << " bytes @ " << i << endl;
 				Peer.receive( p->size() - i < 200
 						? *p
-						: p->substr(i,200) );
+						: TByteArray( p->ptr(i), 200 ) );
 			}
 			p++;
 
@@ -538,6 +700,60 @@ int main( int argc, char *argv[] )
 		return 255;
 	}
 
+	try {
+		log() << "--- Congestion" << endl;
+
+		TBitcoinNetwork_Sockets Network;
+		Network.setNetworkParameters( NETWORK_PRODNET );
+		Network.setOutputHighWatermark( 0 );
+		TBitcoinPeer Peer( NULL, &Network );
+
+		// Nothing queued yet, so low priority messages still go
+		if( !Peer.queueOutgoing( new TMessage_ping, TBitcoinPeer::LowPriority ) )
+			throw runtime_error( "uncongested peer refused a low priority message" );
+		if( !Network.isCongested( &Peer ) )
+			throw runtime_error( "peer with a backlog over the watermark isn't congested" );
+
+		size_t Backlog = Peer.getOutgoingBytes();
+		if( Peer.queueOutgoing( new TMessage_inv, TBitcoinPeer::LowPriority ) )
+			throw runtime_error( "congested peer accepted a low priority message" );
+		if( Peer.getOutgoingBytes() != Backlog )
+			throw runtime_error( "dropped message counted in the backlog" );
+		if( !Peer.queueOutgoing( new TMessage_ping ) )
+			throw runtime_error( "congested peer refused a normal priority message" );
+		if( Peer.getOutgoingBytes() <= Backlog )
+			throw runtime_error( "normal priority message not counted in the backlog" );
+
+		for( unsigned int i = 0; i < 2; i++ ) {
+			TMessage *out = Peer.nextOutgoing();
+			if( dynamic_cast<TMessage_ping*>( out ) == NULL )
+				throw runtime_error( "expected the two pings to be queued" );
+			delete out;
+		}
+		if( Peer.nextOutgoing() != NULL )
+			throw runtime_error( "dropped message was queued" );
+		if( Peer.getOutgoingBytes() != 0 || Network.isCongested( &Peer ) )
+			throw runtime_error( "peer still congested with nothing queued" );
+
+		log() << "Low priority dropped, normal priority queued" << endl;
+
+	} catch( std::exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		loopbackTest( 0, TSocketPoller_select::create );
+		loopbackTest( 2, TSocketPoller_select::create );
+#ifdef HAVE_EPOLL
+		loopbackTest( 0, TSocketPoller_epoll::create );
+		loopbackTest( 2, TSocketPoller_epoll::create );
+#endif
+	} catch( std::exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
 	return 0;
 }
 #endif
@@ -28,6 +28,7 @@
 // --- OS
 // --- Project lib
 #include <general/bytearray.h>
+#include <general/thread.h>
 // --- Project
 #include "hashtypes.h"
 
@@ -124,6 +125,13 @@ class TBitcoinPeer
 		// Unintentionally disconnected
 		Disconnected
 	};
+	enum ePriority {
+		// Must be sent; replies and anything the protocol depends on
+		NormalPriority,
+		// May be dropped when the peer isn't keeping up; relays of
+		// inventory or addresses that the peer can learn elsewhere
+		LowPriority
+	};
   public:
 	TBitcoinPeer( const TNodeInfo * = NULL, TBitcoinNetwork * = NULL );
 	~TBitcoinPeer();
@@ -131,6 +139,8 @@ class TBitcoinPeer
 	void setState( eState s ) { State = s; }
 	eState getState() const { return State; }
 	void receive( const TByteArray & );
+	unsigned char *receiveBuffer( size_t & );
+	void received( size_t );
 
 	const TBitcoinNetwork *getNetwork() const { return Network; }
 	const TNetworkParameters *getNetworkParameters() const;
@@ -141,8 +151,9 @@ class TBitcoinPeer
 	TMessage *newestIncoming() const;
 	TMessage *nextIncoming();
 	TMessage *nextOutgoing();
-	void queueOutgoing( TMessage * );
+	bool queueOutgoing( TMessage *, ePriority = NormalPriority );
 	void queueIncoming( TMessage * );
+	size_t getOutgoingBytes() const { return OutgoingBytes; }
 
 	const TBitcoinHash &getContinuationHash() const { return ContinuationHash; }
 	void setContinuationHash( const TBitcoinHash &ch ) { ContinuationHash = ch; }
@@ -160,7 +171,16 @@ class TBitcoinPeer
 	TMessage_version *VersionMessage;
 
 	list<TMessage*> IncomingQueue;
-	list<TMessage*> OutgoingQueue;
+	// Queued to by whichever thread processes our messages, and
+	// emptied by whichever does our I/O
+	TMPSCQueue<TMessage*> OutgoingQueue;
+	// What OutgoingQueue's messages will serialise to, so that the
+	// network can count them when judging congestion
+	volatile size_t OutgoingBytes;
+
+	// Where receiveBuffer() last pointed the caller
+	bool ReceivingInPlace;
+	TByteArray ReceiveScratch;
 
 	TBitcoinHash ContinuationHash;
 };
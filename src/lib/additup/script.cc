@@ -28,6 +28,8 @@
 // --- Project libs
 #include <general/logstream.h>
 #include <general/crypto.h>
+#include <general/sha256.h>
+#include <general/sigverify.h>
 // --- Project
 
 
@@ -1914,9 +1916,9 @@ TStackOperator_CryptographicDigest::execute( TExecutionContext &Stack, const TBi
 		throw script_run_parameter_type_error();
 
 	// Push the hashed version back onto the stack
-	TMessageDigest *Hasher = createHasher();
-	Stack.give( new TStackElementString(Hasher->transform( IN->Data ) ) );
-	delete Hasher;
+	unsigned char Digest[TMessageDigest::MAXIMUM_DIGEST_BYTES];
+	size_t n = hasher().transform( Digest, IN->Data.data(), IN->Data.size() );
+	Stack.give( new TStackElementString( string( reinterpret_cast<const char *>(Digest), n ) ) );
 
 	return ip;
 }
@@ -1926,9 +1928,9 @@ TStackOperator_CryptographicDigest::execute( TExecutionContext &Stack, const TBi
 // Input:     in
 // Output:    hash
 // Operation: The input is hashed using RIPEMD-160.
-TMessageDigest *TStackOperator_OP_RIPEMD160::createHasher() const
+TMessageDigest &TStackOperator_OP_RIPEMD160::hasher() const
 {
-	return new THash_ripemd160;
+	return TDigestPool<THash_ripemd160>::get();
 }
 
 //
@@ -1936,9 +1938,9 @@ TMessageDigest *TStackOperator_OP_RIPEMD160::createHasher() const
 // Input:     in
 // Output:    hash
 // Operation: The input is hashed using SHA-1.
-TMessageDigest *TStackOperator_OP_SHA1::createHasher() const
+TMessageDigest &TStackOperator_OP_SHA1::hasher() const
 {
-	return new THash_sha1;
+	return TDigestPool<THash_sha1>::get();
 }
 
 //
@@ -1946,9 +1948,9 @@ TMessageDigest *TStackOperator_OP_SHA1::createHasher() const
 // Input:     in
 // Output:    hash
 // Operation: The input is hashed using SHA-256.
-TMessageDigest *TStackOperator_OP_SHA256::createHasher() const
+TMessageDigest &TStackOperator_OP_SHA256::hasher() const
 {
-	return new THash_sha256;
+	return TDigestPool<TSHA256>::get();
 }
 
 //
@@ -1957,9 +1959,9 @@ TMessageDigest *TStackOperator_OP_SHA256::createHasher() const
 // Output:    hash
 // Operation: The input is hashed twice: first with SHA-256 and then
 // with RIPEMD-160.
-TMessageDigest *TStackOperator_OP_HASH160::createHasher() const
+TMessageDigest &TStackOperator_OP_HASH160::hasher() const
 {
-	return new TDoubleHash( new THash_ripemd160, new THash_sha256 );
+	return TDigestPool<THash_hash160>::get();
 }
 
 //
@@ -1967,9 +1969,9 @@ TMessageDigest *TStackOperator_OP_HASH160::createHasher() const
 // Input:     in
 // Output:    hash
 // Operation: The input is hashed two times with SHA-256.
-TMessageDigest *TStackOperator_OP_HASH256::createHasher() const
+TMessageDigest &TStackOperator_OP_HASH256::hasher() const
 {
-	return new TDoubleHash( new THash_sha256, new THash_sha256 );
+	return TDigestPool<THash_hash256>::get();
 }
 
 //
@@ -2264,7 +2266,17 @@ TStackOperator_INTOP_FINALSIGNATURE::execute( TExecutionContext &Stack, const TB
 	if( PublicKey == NULL || Signature == NULL )
 		throw script_run_error( "Invalid parameter type given to OP_CHECKSIG" );
 
+	// Signatures are checked through the shared cache, so that one
+	// seen in a loose transaction isn't checked again when its block
+	// arrives.  Without a signature hash there is nothing to check
+	// against.  The script's signature is DER followed by a byte of
+	// hash type, which belongs to the signature hash; only the DER is
+	// verified, and so only it keys the cache
 	bool Verified = false;
+	if( !Stack.SignatureHash.empty() && !Signature->Data.empty() ) {
+		TByteArray DER( Signature->Data.data(), Signature->Data.size() - 1 );
+		Verified = TSignatureCache::shared().verify( PublicKey->Data, Stack.SignatureHash, DER );
+	}
 
 	Stack.give( new TStackElementBoolean( Verified ) );
 
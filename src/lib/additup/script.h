@@ -299,7 +299,7 @@ class TStackElement_t : public TStackElement
 };
 typedef TStackElement_t<bool> TStackElementBoolean;
 typedef TStackElement_t<int> TStackElementInteger;
-typedef TStackElement_t<TBigInteger> TStackElementBigInteger;
+typedef TStackElement_t<TBigInteger64> TStackElementBigInteger;
 typedef TStackElement_t<TBitcoinHash> TStackElementHash;
 typedef TStackElement_t<string> TStackElementString;
 
@@ -332,6 +332,10 @@ class TExecutionContext
 
 	TTransaction *Transaction;
 	bool Invalid;
+
+	// The digest that OP_CHECKSIG's signature must sign, left here by
+	// INTOP_SIGHASH
+	TByteArray SignatureHash;
 };
 
 //
@@ -1575,7 +1579,8 @@ class TStackOperator_CryptographicDigest : public TStackOperatorFromOpcode
 	TBitcoinScript::tInstructionPointer execute( TExecutionContext &, const TBitcoinScript::tInstructionPointer &ip ) const;
 
   protected:
-	virtual TMessageDigest *createHasher() const = 0;
+	// The calling thread's pooled digest, reset
+	virtual TMessageDigest &hasher() const = 0;
 };
 
 //
@@ -1590,7 +1595,7 @@ class TStackOperator_OP_RIPEMD160 : public TStackOperator_CryptographicDigest
 	eScriptOp getOpcode() const { return OP_RIPEMD160; }
 
   protected:
-	virtual TMessageDigest *createHasher() const;
+	virtual TMessageDigest &hasher() const;
 };
 
 //
@@ -1605,7 +1610,7 @@ class TStackOperator_OP_SHA1 : public TStackOperator_CryptographicDigest
 	eScriptOp getOpcode() const { return OP_SHA1; }
 
   protected:
-	virtual TMessageDigest *createHasher() const;
+	virtual TMessageDigest &hasher() const;
 };
 
 //
@@ -1620,7 +1625,7 @@ class TStackOperator_OP_SHA256 : public TStackOperator_CryptographicDigest
 	eScriptOp getOpcode() const { return OP_SHA256; }
 
   protected:
-	virtual TMessageDigest *createHasher() const;
+	virtual TMessageDigest &hasher() const;
 };
 
 //
@@ -1635,7 +1640,7 @@ class TStackOperator_OP_HASH160 : public TStackOperator_CryptographicDigest
 	eScriptOp getOpcode() const { return OP_HASH160; }
 
   protected:
-	virtual TMessageDigest *createHasher() const;
+	virtual TMessageDigest &hasher() const;
 };
 
 //
@@ -1650,7 +1655,7 @@ class TStackOperator_OP_HASH256 : public TStackOperator_CryptographicDigest
 	eScriptOp getOpcode() const { return OP_HASH256; }
 
   protected:
-	virtual TMessageDigest *createHasher() const;
+	virtual TMessageDigest &hasher() const;
 };
 
 //
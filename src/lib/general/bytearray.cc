@@ -20,6 +20,7 @@
 // --- C
 // --- C++
 #include <iomanip>
+#include <stdexcept>
 // --- Qt
 // --- OS
 // --- Project libs
@@ -48,6 +49,155 @@ TBufferDescription::~TBufferDescription()
 {
 }
 
+// --------
+
+//
+// Function:	TRingBuffer :: append
+// Description:
+//
+void TRingBuffer::append( const void *p, size_type n )
+{
+	if( n == 0 )
+		return;
+
+	makeRoom( n );
+	memcpy( Storage.ptr(Tail), p, n );
+	Tail += n;
+}
+
+//
+// Function:	TRingBuffer :: consume
+// Description:
+// Discard n bytes from the head of the buffer.  No bytes are moved.
+//
+void TRingBuffer::consume( size_type n )
+{
+	if( n > size() )
+		throw logic_error( "TRingBuffer::consume() can't consume more bytes than are buffered" );
+
+	Head += n;
+
+	// An empty buffer can start again from the beginning for free
+	if( Head == Tail )
+		clear();
+}
+
+//
+// Function:	TRingBuffer :: reserve
+// Description:
+// Returns a pointer to at least n writable bytes after the tail.  They
+// aren't part of the buffer until commit() is called; space() says how
+// many there actually are, which might be more than asked for.
+//
+unsigned char *TRingBuffer::reserve( size_type n )
+{
+	makeRoom( n == 0 ? 1 : n );
+	return Storage.ptr(Tail);
+}
+
+//
+// Function:	TRingBuffer :: commit
+// Description:
+// Add n bytes, written to the space returned by reserve(), to the tail.
+//
+void TRingBuffer::commit( size_type n )
+{
+	if( n > space() )
+		throw logic_error( "TRingBuffer::commit() can't commit more bytes than were reserved" );
+
+	Tail += n;
+}
+
+//
+// Function:	TRingBuffer :: str
+// Description:
+//
+string TRingBuffer::str() const
+{
+	if( empty() )
+		return string();
+	return string( reinterpret_cast<const char *>(ptr()), size() );
+}
+
+//
+// Function:	TRingBuffer :: makeRoom
+// Description:
+// Ensure there are at least n bytes available after the tail.  We first
+// try shuffling the unread bytes down over the consumed ones; if that
+// isn't enough we grow geometrically so that appends are amortised
+// constant time.
+//
+void TRingBuffer::makeRoom( size_type n )
+{
+	if( Storage.size() - Tail >= n )
+		return;
+
+	if( Head > 0 ) {
+		memmove( Storage.ptr(), Storage.ptr(Head), size() );
+		Tail -= Head;
+		Head = 0;
+	}
+
+	if( Storage.size() - Tail < n ) {
+		size_type newSize = Storage.size() * 2;
+		if( newSize < Tail + n )
+			newSize = Tail + n;
+		Storage.resize( newSize );
+	}
+}
+
+// --------
+
+//
+// Function:	TMemoryStreamBuffer :: TMemoryStreamBuffer
+// Description:
+//
+TMemoryStreamBuffer::TMemoryStreamBuffer( const void *p, size_t n )
+{
+	// streambuf has no notion of a read-only get area, but we never
+	// write through these pointers, so the const_cast is safe
+	char *b = const_cast<char *>( reinterpret_cast<const char *>(p) );
+	setg( b, b, b + n );
+}
+
+//
+// Function:	TMemoryStreamBuffer :: seekoff
+// Description:
+//
+TMemoryStreamBuffer::pos_type TMemoryStreamBuffer::seekoff( off_type off,
+		ios_base::seekdir dir, ios_base::openmode which )
+{
+	char *base;
+
+	if( (which & ios_base::in) == 0 )
+		return pos_type(off_type(-1));
+
+	if( dir == ios_base::beg ) {
+		base = eback();
+	} else if( dir == ios_base::cur ) {
+		base = gptr();
+	} else {
+		base = egptr();
+	}
+
+	if( off < eback() - base || off > egptr() - base )
+		return pos_type(off_type(-1));
+
+	setg( eback(), base + off, egptr() );
+
+	return pos_type( gptr() - eback() );
+}
+
+//
+// Function:	TMemoryStreamBuffer :: seekpos
+// Description:
+//
+TMemoryStreamBuffer::pos_type TMemoryStreamBuffer::seekpos( pos_type pos,
+		ios_base::openmode which )
+{
+	return seekoff( off_type(pos), ios_base::beg, which );
+}
+
 
 // -------------- Explicit template instantiations
 template class TByteArray_t<allocator<unsigned char> >;
@@ -92,6 +242,51 @@ int main( int argc, char *argv[] )
 		return 255;
 	}
 
+	try {
+		TRingBuffer rb;
+		unsigned int i;
+
+		// Append in small pieces and consume in different small pieces,
+		// the unread bytes should always come out in order
+		for( i = 0; i < 1000; i++ ) {
+			rb.append( "0123456789", 10 );
+			if( i % 3 == 0 )
+				rb.consume( 7 );
+		}
+		log() << "TRingBuffer size " << rb.size() << " in capacity " << rb.capacity() << endl;
+		if( rb.size() != 10000 - 334 * 7 )
+			throw logic_error( "TRingBuffer has wrong size" );
+		if( rb.str().substr(0,10) != "8901234567" )
+			throw logic_error( "TRingBuffer has wrong contents" );
+
+		TMemoryInputStream is( rb.ptr(), rb.size() );
+		is.exceptions( ios::eofbit | ios::failbit | ios::badbit );
+		char buffer[4];
+		is.seekg( 5, ios::beg );
+		is.read( buffer, sizeof(buffer) );
+		log() << "TMemoryInputStream read \"" << string(buffer, sizeof(buffer))
+			<< "\", now at " << is.tellg() << endl;
+		if( string(buffer, sizeof(buffer)) != "3456" || is.tellg() != streampos(9) )
+			throw logic_error( "TMemoryInputStream seek/read failed" );
+
+		rb.consume( rb.size() );
+		if( !rb.empty() )
+			throw logic_error( "TRingBuffer not empty" );
+
+		// Writing in place should look exactly like an append
+		rb.append( "abc", 3 );
+		unsigned char *p = rb.reserve( 4 );
+		if( rb.space() < 4 )
+			throw logic_error( "TRingBuffer::reserve() reserved too little" );
+		memcpy( p, "defg", 4 );
+		rb.commit( 4 );
+		if( rb.str() != "abcdefg" )
+			throw logic_error( "TRingBuffer::commit() failed" );
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
 	return 0;
 }
 #endif
@@ -243,6 +243,86 @@ class TByteArray_t : public vector<unsigned char, TAllocator>
 	bool operator>( const char *m ) const { return strncmp(*this, m, size()) > 0; }
 };
 
+//
+// Class:	TRingBuffer
+// Description:
+// A receive buffer that bytes are appended to at the tail and consumed
+// from the head.
+//
+// Unlike a classic ring buffer, the unread bytes are always contiguous,
+// so that a parser can be handed a (pointer, length) view of them
+// without copying.  Consuming only moves the head offset; the unread
+// bytes are shuffled back to the start of the storage only when the
+// tail runs out of room, so the cost of a large message arriving in
+// small pieces is linear rather than quadratic.
+//
+// reserve() and commit() let a reader such as read() write straight
+// into the tail, instead of into a temporary that is then appended.
+//
+class TRingBuffer
+{
+  public:
+	typedef vector<unsigned char>::size_type size_type;
+
+  public:
+	TRingBuffer() : Head(0), Tail(0) {}
+
+	const unsigned char *ptr() const { return Storage.empty() ? NULL : Storage.ptr(Head); }
+	size_type size() const { return Tail - Head; }
+	bool empty() const { return Tail == Head; }
+	size_type capacity() const { return Storage.size(); }
+
+	void append( const void *, size_type );
+	void consume( size_type );
+	void clear() { Head = Tail = 0; }
+
+	unsigned char *reserve( size_type );
+	size_type space() const { return Storage.size() - Tail; }
+	void commit( size_type );
+
+	string str() const;
+
+  protected:
+	void makeRoom( size_type );
+
+  protected:
+	TByteArray_t<allocator<unsigned char> > Storage;
+	size_type Head;
+	size_type Tail;
+};
+
+//
+// Class:	TMemoryStreamBuffer
+// Description:
+// A read-only streambuf over memory owned by someone else.  Nothing is
+// copied; the get area is simply pointed at the supplied bytes.  Seeking
+// is supported, which the message parsers rely on.
+//
+class TMemoryStreamBuffer : public streambuf
+{
+  public:
+	TMemoryStreamBuffer( const void *, size_t );
+
+  protected:
+	pos_type seekoff( off_type, ios_base::seekdir, ios_base::openmode = ios_base::in | ios_base::out );
+	pos_type seekpos( pos_type, ios_base::openmode = ios_base::in | ios_base::out );
+};
+
+//
+// Class:	TMemoryInputStream
+// Description:
+// An istream that reads directly from a (pointer, length) view, in
+// place of an istringstream built from a copy of the bytes.
+//
+class TMemoryInputStream : public istream
+{
+  public:
+	TMemoryInputStream( const void *p, size_t n ) : istream(NULL), Buffer(p, n) { rdbuf( &Buffer ); }
+
+  protected:
+	TMemoryStreamBuffer Buffer;
+};
+
 
 // -------------- Typedefs
 typedef TByteArray_t<allocator<unsigned char> > TByteArray;
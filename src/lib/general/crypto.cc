@@ -18,6 +18,7 @@
 
 // -------------- Includes
 // --- C
+#include <string.h>
 // --- C++
 // --- Qt
 // --- OS
@@ -367,6 +368,26 @@ void TEllipticCurveKey::setPublicKey( const TByteArray &s )
 	KeyAvailable = true;
 }
 
+//
+// Function:	TEllipticCurveKey :: setPublicKey
+// Description:
+// As setPublicKey(), but copying the point from Cache if it has been
+// decoded before, and adding it to Cache if not.
+//
+void TEllipticCurveKey::setPublicKey( const TByteArray &s, TPublicKeyCache &Cache )
+{
+	if( !Cache.lookup( s, Key ) ) {
+		setPublicKey( s );
+		Cache.insert( s, Key );
+		return;
+	}
+
+	// o2i_ECPublicKey() would have taken the form from the first byte,
+	// and getPublicKey() should give back what we were given
+	EC_KEY_set_conv_form( Key, static_cast<point_conversion_form_t>( s[0] & ~0x01 ) );
+	KeyAvailable = true;
+}
+
 //
 // Function:	TEllipticCurveKey :: generate
 // Description:
@@ -462,6 +483,336 @@ bool TEllipticCurveKey::verify( const TByteArray &digest, const TByteArray &DERS
 
 // -----------------
 
+const size_t TPublicKeyCache::DEFAULT_CAPACITY;
+const unsigned int TPublicKeyCache::SHARDS;
+
+//
+// Function:	TPublicKeyCache :: TPublicKeyCache
+// Description:
+//
+TPublicKeyCache::TPublicKeyCache( size_t Capacity ) :
+	ShardCapacity( Capacity / SHARDS > 0 ? Capacity / SHARDS : 1 ),
+	Hits( 0 ),
+	Misses( 0 )
+{
+	Group = EC_GROUP_new_by_curve_name( NID_secp256k1 );
+	if( Group == NULL )
+		throw ssl_error( "EC_GROUP_new_by_curve_name()" );
+}
+
+//
+// Function:	TPublicKeyCache :: ~TPublicKeyCache
+// Description:
+//
+TPublicKeyCache::~TPublicKeyCache()
+{
+	for( unsigned int i = 0; i < SHARDS; i++ ) {
+		tEntries::iterator it;
+		for( it = Shards[i].Entries.begin(); it != Shards[i].Entries.end(); it++ )
+			EC_POINT_free( it->second );
+	}
+	EC_GROUP_free( Group );
+}
+
+//
+// Function:	TPublicKeyCache :: lookup
+// Description:
+// If the key with these bytes is cached, make it Key's public key and
+// return true.  The copy is made under the shard's lock, as the point
+// could otherwise be evicted from under us.
+//
+bool TPublicKeyCache::lookup( const TByteArray &s, EC_KEY *Key )
+{
+	TShard &Shard( shardFor( s ) );
+	TMutexLocker L( Shard.Lock );
+	map<TByteArray, tEntries::iterator>::iterator it;
+
+	it = Shard.Index.find( s );
+	if( it == Shard.Index.end() ) {
+		__sync_fetch_and_add( &Misses, 1 );
+		return false;
+	}
+	__sync_fetch_and_add( &Hits, 1 );
+
+	// Now the most recently used
+	Shard.Entries.splice( Shard.Entries.begin(), Shard.Entries, it->second );
+
+	if( !EC_KEY_set_public_key( Key, it->second->second ) )
+		throw ssl_error( "EC_KEY_set_public_key()" );
+
+	return true;
+}
+
+//
+// Function:	TPublicKeyCache :: insert
+// Description:
+// Remember Key's public point as the decoding of these bytes,
+// forgetting the shard's least recently used key if it is full.
+//
+void TPublicKeyCache::insert( const TByteArray &s, const EC_KEY *Key )
+{
+	TShard &Shard( shardFor( s ) );
+	EC_POINT *Point;
+
+	Point = EC_POINT_dup( EC_KEY_get0_public_key( Key ), Group );
+	if( Point == NULL )
+		throw ssl_error( "EC_POINT_dup()" );
+
+	TMutexLocker L( Shard.Lock );
+
+	// Another thread got there first
+	if( Shard.Index.find( s ) != Shard.Index.end() ) {
+		EC_POINT_free( Point );
+		return;
+	}
+
+	Shard.Entries.push_front( make_pair( s, Point ) );
+	Shard.Index[s] = Shard.Entries.begin();
+
+	if( Shard.Index.size() > ShardCapacity ) {
+		Shard.Index.erase( Shard.Entries.back().first );
+		EC_POINT_free( Shard.Entries.back().second );
+		Shard.Entries.pop_back();
+	}
+}
+
+//
+// Function:	TPublicKeyCache :: shared
+// Description:
+// The cache that signature checking uses.
+//
+TPublicKeyCache &TPublicKeyCache::shared()
+{
+	static TPublicKeyCache Cache;
+	return Cache;
+}
+
+// -----------------
+
+const size_t TPublicKeySequence::PUBLIC_KEY_BYTES;
+
+//
+// Function:	TPublicKeySequence :: TPublicKeySequence
+// Description:
+// start() must be called before next().
+//
+TPublicKeySequence::TPublicKeySequence() :
+	Count( 0 )
+{
+	Group = EC_GROUP_new_by_curve_name( NID_secp256k1 );
+	Context = BN_CTX_new();
+	Order = BN_new();
+	Start = BN_new();
+	Next = Group == NULL ? NULL : EC_POINT_new( Group );
+
+	if( Next == NULL || Context == NULL || Order == NULL || Start == NULL
+			|| !EC_GROUP_get_order( Group, Order, Context ) ) {
+		EC_POINT_free( Next );
+		BN_free( Start );
+		BN_free( Order );
+		BN_CTX_free( Context );
+		EC_GROUP_free( Group );
+		throw ssl_error( "TPublicKeySequence::TPublicKeySequence()" );
+	}
+	BN_zero( Start );
+}
+
+//
+// Function:	TPublicKeySequence :: ~TPublicKeySequence
+// Description:
+//
+TPublicKeySequence::~TPublicKeySequence()
+{
+	for( size_t i = 0; i < Points.size(); i++ )
+		EC_POINT_free( Points[i] );
+	EC_POINT_clear_free( Next );
+	BN_clear_free( Start );
+	BN_free( Order );
+	BN_CTX_free( Context );
+	EC_GROUP_free( Group );
+}
+
+//
+// Function:	TPublicKeySequence :: start
+// Description:
+// Start at a random secret.
+//
+void TPublicKeySequence::start()
+{
+	do {
+		if( !BN_rand_range( Start, Order ) )
+			throw ssl_error( "BN_rand_range()" );
+	} while( BN_is_zero( Start ) );
+
+	if( !EC_POINT_mul( Group, Next, Start, NULL, NULL, Context ) )
+		throw ssl_error( "EC_POINT_mul()" );
+	Count = 0;
+}
+
+//
+// Function:	TPublicKeySequence :: start
+// Description:
+// Start at the given 256 bit secret.
+//
+void TPublicKeySequence::start( const TSecureByteArray &s )
+{
+	if( s.size() != 32 )
+		throw runtime_error( "TPublicKeySequence::start() must use 256 bits" );
+
+	if( BN_bin2bn( s, s.size(), Start ) == NULL )
+		throw ssl_error( "BN_bin2bn()" );
+	if( !EC_POINT_mul( Group, Next, Start, NULL, NULL, Context ) )
+		throw ssl_error( "EC_POINT_mul()" );
+	Count = 0;
+}
+
+//
+// Function:	TPublicKeySequence :: next
+// Description:
+// Write the next N public keys, uncompressed, PUBLIC_KEY_BYTES each,
+// one after the other at Out.  The first is the key of secret
+// getSecret( getCount() ) as it was before the call.
+//
+void TPublicKeySequence::next( unsigned char *Out, size_t N )
+{
+	const EC_POINT *G = EC_GROUP_get0_generator( Group );
+
+	if( N == 0 )
+		return;
+
+	while( Points.size() < N ) {
+		EC_POINT *p = EC_POINT_new( Group );
+		if( p == NULL )
+			throw ssl_error( "EC_POINT_new()" );
+		Points.push_back( p );
+	}
+
+	for( size_t i = 0; i < N; i++ ) {
+		if( !EC_POINT_copy( Points[i], Next )
+				|| !EC_POINT_add( Group, Next, Next, G, Context ) )
+			throw ssl_error( "EC_POINT_add()" );
+	}
+
+	// One inversion for the whole batch
+	if( !EC_POINTs_make_affine( Group, N, &Points[0], Context ) )
+		throw ssl_error( "EC_POINTs_make_affine()" );
+
+	for( size_t i = 0; i < N; i++ ) {
+		if( EC_POINT_point2oct( Group, Points[i], POINT_CONVERSION_UNCOMPRESSED,
+					Out + i * PUBLIC_KEY_BYTES, PUBLIC_KEY_BYTES, Context ) != PUBLIC_KEY_BYTES )
+			throw ssl_error( "EC_POINT_point2oct()" );
+	}
+
+	Count += N;
+}
+
+//
+// Function:	TPublicKeySequence :: getSecret
+// Description:
+// The 256 bit secret of the Index'th key since start(), for
+// TEllipticCurveKey::setSecret().
+//
+TSecureByteArray TPublicKeySequence::getSecret( unsigned long long Index ) const
+{
+	unsigned char IndexBytes[sizeof(Index)];
+	TSecureByteArray ret( 32 );
+	BIGNUM *Secret = BN_new();
+	BIGNUM *Offset = BN_new();
+
+	for( size_t i = 0; i < sizeof(Index); i++ )
+		IndexBytes[i] = Index >> ((sizeof(Index) - 1 - i) * 8);
+
+	if( Secret == NULL || Offset == NULL
+			|| BN_bin2bn( IndexBytes, sizeof(IndexBytes), Offset ) == NULL
+			|| !BN_mod_add( Secret, Start, Offset, Order, Context ) ) {
+		BN_clear_free( Secret );
+		BN_free( Offset );
+		throw ssl_error( "BN_mod_add()" );
+	}
+
+	if( !BN_is_zero( Secret ) )
+		BN_bn2bin( Secret, ret.ptr( ret.size() - BN_num_bytes( Secret ) ) );
+
+	BN_clear_free( Secret );
+	BN_free( Offset );
+
+	return ret;
+}
+
+// -----------------
+
+const size_t TMessageDigest::MAXIMUM_DIGEST_BYTES;
+
+//
+// Function:	TMessageDigest :: transform
+// Description:
+// Hash the n bytes at In, writing the digest to Out, which should have
+// room for MAXIMUM_DIGEST_BYTES.  Returns the size of the digest.  This
+// version goes through transform( TByteArray ); digests that can work
+// on plain buffers override it.
+//
+size_t TMessageDigest::transform( unsigned char *Out, const void *In, size_t n )
+{
+	TByteArray Digest( transform( TByteArray( static_cast<const unsigned char *>(In), n ) ) );
+
+	memcpy( Out, Digest.ptr(), Digest.size() );
+
+	return Digest.size();
+}
+
+//
+// Function:	TMessageDigest :: transformMany
+// Description:
+// Hash N independent inputs, each InBytes long and one after the other
+// at In, writing the digests one after the other at Out.  This version
+// simply calls transform() for each; digests that can hash several
+// inputs at once override it.
+//
+void TMessageDigest::transformMany( unsigned char *Out, const unsigned char *In, size_t InBytes, size_t N )
+{
+	for( size_t i = 0; i < N; i++ ) {
+		TByteArray Digest( transform( TByteArray( In + i * InBytes, InBytes ) ) );
+		memcpy( Out, Digest.ptr(), Digest.size() );
+		Out += Digest.size();
+	}
+}
+
+// -----------------
+
+//
+// Function:	TDoubleHash :: transformMany
+// Description:
+// Each stage hashes the whole batch in turn.  The size of the first
+// stage's digest isn't known until it has done one, so the first input
+// is hashed on its own.
+//
+void TDoubleHash::transformMany( unsigned char *Out, const unsigned char *In, size_t InBytes, size_t N )
+{
+	if( N == 0 )
+		return;
+
+	TByteArray First( Hash1->transform( TByteArray( In, InBytes ) ) );
+	TByteArray Middle( N * First.size() );
+
+	memcpy( Middle.ptr(), First.ptr(), First.size() );
+	if( N > 1 )
+		Hash1->transformMany( Middle.ptr( First.size() ), In + InBytes, InBytes, N - 1 );
+	Hash2->transformMany( Out, Middle.ptr(), First.size(), N );
+}
+
+//
+// Function:	TDoubleHash :: transform
+// Description:
+//
+size_t TDoubleHash::transform( unsigned char *Out, const void *In, size_t n )
+{
+	unsigned char Middle[MAXIMUM_DIGEST_BYTES];
+
+	return Hash2->transform( Out, Middle, Hash1->transform( Middle, In, n ) );
+}
+
+// -----------------
+
 //
 // Function:	TSSLMessageDigest :: TSSLMessageDigest
 // Description:
@@ -524,6 +875,34 @@ TByteArray TSSLMessageDigest::transform( const TByteArray &s )
 	return final();
 }
 
+//
+// Function:	TSSLMessageDigest :: transform
+// Description:
+// Hash the n bytes at In straight into Out, without going through a
+// TByteArray either way.
+//
+size_t TSSLMessageDigest::transform( unsigned char *Out, const void *In, size_t n )
+{
+	unsigned int returnSize;
+	int ret;
+
+	if( !Initialised )
+		init();
+
+	ret = EVP_DigestUpdate( &EVPContext, In, n );
+	if( ret != 1 ) {
+		deinit();
+		throw ssl_error( "EVP_DigestUpdate()" );
+	}
+
+	ret = EVP_DigestFinal_ex( &EVPContext, Out, &returnSize );
+	deinit();
+	if( ret != 1 )
+		throw ssl_error( "EVP_DigestFinal_ex()" );
+
+	return returnSize;
+}
+
 //
 // Function:	TSSLMessageDigest :: update
 // Description:
@@ -626,6 +1005,7 @@ TEMPLATE_INSTANCE( TSSLMessageDigestTemplate<EVP_ripemd160>, THash_ripemd160 );
 #ifdef UNITTEST
 #include <iostream>
 #include <iomanip>
+#include <sys/time.h>
 #include "logstream.h"
 
 //
@@ -714,6 +1094,71 @@ int main( int argc, char *argv[] )
 		TEllipticCurveKey ECKEY2;
 		ECKEY2.setPublicKey( ECKEY.getPublicKey() );
 
+		// Through the cache the key is decoded once, then copied, in
+		// either form
+		static const unsigned int LOOPS = 1000;
+		TPublicKeyCache Cache;
+		TByteArray Uncompressed( ECKEY.getPublicKey() );
+		TByteArray Compressed( Uncompressed.ptr(), 33 );
+		Compressed[0] = 0x02 | (Uncompressed[64] & 1);
+		const TByteArray *Forms[] = { &Uncompressed, &Compressed };
+
+		for( unsigned int i = 0; i < 2; i++ ) {
+			const TByteArray &PublicKey( *Forms[i] );
+			struct timeval start, mid, end;
+			TEllipticCurveKey K;
+
+			gettimeofday( &start, NULL );
+			for( unsigned int j = 0; j < LOOPS; j++ )
+				K.setPublicKey( PublicKey );
+			gettimeofday( &mid, NULL );
+			for( unsigned int j = 0; j < LOOPS; j++ )
+				K.setPublicKey( PublicKey, Cache );
+			gettimeofday( &end, NULL );
+
+			if( K.getPublicKey() != PublicKey || !K.verify( digest, signature ) )
+				throw logic_error( "Cached public key is wrong" );
+			log() << "EC: setPublicKey() of " << PublicKey.size() << " bytes: "
+				<< ((mid.tv_sec - start.tv_sec) * 1e6 + (mid.tv_usec - start.tv_usec)) / LOOPS << "us, cached "
+				<< ((end.tv_sec - mid.tv_sec) * 1e6 + (end.tv_usec - mid.tv_usec)) / LOOPS << "us" << endl;
+		}
+		if( Cache.getMisses() != 2 || Cache.getHits() != 2 * LOOPS - 2 )
+			throw logic_error( "Public key cache didn't hit" );
+
+		// Stepping through keys matches making each from its secret,
+		// and costs a point addition rather than a multiplication
+		static const size_t BATCH = 256;
+		TPublicKeySequence Sequence;
+		TByteArray Batch( BATCH * TPublicKeySequence::PUBLIC_KEY_BYTES );
+		struct timeval start, mid, end;
+
+		Sequence.start();
+		Sequence.next( Batch, 3 );
+		for( unsigned int i = 0; i < 3; i++ ) {
+			TEllipticCurveKey K;
+			K.setSecret( Sequence.getSecret( i ) );
+			if( K.getPublicKey() != TByteArray( Batch.ptr( i * TPublicKeySequence::PUBLIC_KEY_BYTES ), TPublicKeySequence::PUBLIC_KEY_BYTES ) )
+				throw logic_error( "TPublicKeySequence key doesn't match its secret" );
+		}
+
+		gettimeofday( &start, NULL );
+		for( unsigned int j = 0; j < BATCH; j++ ) {
+			TEllipticCurveKey K;
+			K.generate();
+		}
+		gettimeofday( &mid, NULL );
+		for( unsigned int j = 0; j < LOOPS / BATCH + 1; j++ )
+			Sequence.next( Batch, BATCH );
+		gettimeofday( &end, NULL );
+		log() << "EC: generate(): "
+			<< ((mid.tv_sec - start.tv_sec) * 1e6 + (mid.tv_usec - start.tv_usec)) / BATCH << "us per key, TPublicKeySequence: "
+			<< ((end.tv_sec - mid.tv_sec) * 1e6 + (end.tv_usec - mid.tv_usec)) / ((LOOPS / BATCH + 1) * BATCH) << "us per key" << endl;
+
+		TEllipticCurveKey Last;
+		Last.setSecret( Sequence.getSecret( Sequence.getCount() - 1 ) );
+		if( Last.getPublicKey() != TByteArray( Batch.ptr( (BATCH - 1) * TPublicKeySequence::PUBLIC_KEY_BYTES ), TPublicKeySequence::PUBLIC_KEY_BYTES ) )
+			throw logic_error( "TPublicKeySequence lost its place" );
+
 	} catch( exception &e ) {
 		log() << e.what() << endl;
 		return 255;
@@ -20,6 +20,8 @@
 // -------------- Includes
 // --- C
 // --- C++
+#include <list>
+#include <map>
 #include <vector>
 // --- OS
 // --- Lib
@@ -30,6 +32,7 @@
 #include <openssl/evp.h>
 // --- Project
 #include "extraexcept.h"
+#include "thread.h"
 #include "bytearray.h"
 
 
@@ -60,6 +63,8 @@
 
 // -------------- Class pre-declarations
 
+class TPublicKeyCache;
+
 
 // -------------- Function pre-class prototypes
 
@@ -160,6 +165,7 @@ class TEllipticCurveKey : public TDigitalSignature
 	TSecureByteArray getPrivateKey() const;
 	TSecureByteArray getSecret() const;
 	void setPublicKey( const TByteArray & );
+	void setPublicKey( const TByteArray &, TPublicKeyCache & );
 	void setPrivateKey( const TSecureByteArray & );
 	void setSecret( const TSecureByteArray & );
 
@@ -190,6 +196,111 @@ class TEllipticCurveKey : public TDigitalSignature
 	static const int EC_SIGNATURE_TYPE;
 };
 
+//
+// Class:	TPublicKeyCache
+// Description:
+/// Public keys that have already been decoded.
+//
+/// setPublicKey() has to turn the key's bytes into a point on the
+/// curve, checking that it is on the curve, and for a compressed key
+/// finding the point's y with a modular square root.  The same keys are
+/// used again and again, so this keeps the decoded points of the most
+/// recently used, to be copied into a key rather than decoded again.
+///
+/// It is split into SHARDS, chosen by the key's last byte, which is a
+/// coordinate and so as good as random.  Each is its own least recently
+/// used list with its own lock, so threads rarely wait for each other.
+//
+class TPublicKeyCache
+{
+  public:
+	TPublicKeyCache( size_t Capacity = DEFAULT_CAPACITY );
+	~TPublicKeyCache();
+
+	bool lookup( const TByteArray &, EC_KEY * );
+	void insert( const TByteArray &, const EC_KEY * );
+
+	unsigned long getHits() const { return Hits; }
+	unsigned long getMisses() const { return Misses; }
+
+	static TPublicKeyCache &shared();
+
+	static const size_t DEFAULT_CAPACITY = 4096;
+
+  protected:
+	// Most recently used first
+	typedef list< pair<TByteArray, EC_POINT *> > tEntries;
+
+	struct TShard {
+		TMutex Lock;
+		tEntries Entries;
+		map<TByteArray, tEntries::iterator> Index;
+	};
+
+	TShard &shardFor( const TByteArray &s ) { return Shards[s.empty() ? 0 : s[s.size() - 1] % SHARDS]; }
+
+	static const unsigned int SHARDS = 16;
+
+  protected:
+	EC_GROUP *Group;
+	TShard Shards[SHARDS];
+	size_t ShardCapacity;
+
+	volatile unsigned long Hits;
+	volatile unsigned long Misses;
+
+  private:
+	// Not copyable
+	TPublicKeyCache( const TPublicKeyCache & );
+	TPublicKeyCache &operator=( const TPublicKeyCache & );
+};
+
+//
+// Class:	TPublicKeySequence
+// Description:
+/// The public keys of consecutive secrets, k, k+1, k+2...
+//
+/// Making a key from a secret is a scalar multiplication, k.G, but the
+/// next secret's key is just one point addition away, (k+1).G = k.G +
+/// G.  next() makes a batch of keys that way, then takes them all out
+/// of projective coordinates with one shared inversion, rather than one
+/// each, before serialising them.  Searching for keys with a property
+/// of their address, such as a vanity prefix, is then far cheaper than
+/// generate() for each candidate.
+///
+/// The keys are related, so this is no way to make keys that are meant
+/// to be independent.
+//
+class TPublicKeySequence
+{
+  public:
+	TPublicKeySequence();
+	~TPublicKeySequence();
+
+	void start();
+	void start( const TSecureByteArray & );
+
+	void next( unsigned char *Out, size_t N );
+	TSecureByteArray getSecret( unsigned long long Index ) const;
+	unsigned long long getCount() const { return Count; }
+
+	static const size_t PUBLIC_KEY_BYTES = 65;
+
+  protected:
+	EC_GROUP *Group;
+	BN_CTX *Context;
+	BIGNUM *Order;
+	BIGNUM *Start;
+	EC_POINT *Next;
+	vector<EC_POINT *> Points;
+	unsigned long long Count;
+
+  private:
+	// Not copyable
+	TPublicKeySequence( const TPublicKeySequence & );
+	TPublicKeySequence &operator=( const TPublicKeySequence & );
+};
+
 // ------------
 
 //
@@ -213,10 +324,19 @@ class TEllipticCurveKey : public TDigitalSignature
 //
 class TMessageDigest
 {
+  public:
+	// Enough for the output of any digest
+	static const size_t MAXIMUM_DIGEST_BYTES = EVP_MAX_MD_SIZE;
+
   public:
 	TMessageDigest() : Initialised( false ) {}
 	virtual ~TMessageDigest() {}
 	virtual TByteArray transform( const TByteArray & ) = 0;
+	virtual size_t transform( unsigned char *Out, const void *In, size_t n );
+	virtual void transformMany( unsigned char *Out, const unsigned char *In, size_t InBytes, size_t N );
+
+	// Abandon any hash in progress
+	virtual void reset() { deinit(); }
 
   protected:
 	virtual void init() { Initialised = true; }
@@ -237,12 +357,68 @@ class TDoubleHash : public TMessageDigest
 		Hash1(h1), Hash2(h2) {}
 
 	TByteArray transform( const TByteArray &s ) { return Hash2->transform( Hash1->transform(s) ); }
+	size_t transform( unsigned char *Out, const void *In, size_t n );
+	void transformMany( unsigned char *Out, const unsigned char *In, size_t InBytes, size_t N );
+
+	void reset() { Hash1->reset(); Hash2->reset(); }
+
+	const TMessageDigest *getFirst() const { return Hash1; }
+	const TMessageDigest *getSecond() const { return Hash2; }
 
   protected:
 	TMessageDigest *Hash1;
 	TMessageDigest *Hash2;
 };
 
+//
+// Template:		TDoubleHashTemplate
+// Description:
+/// A TDoubleHash that owns its two hashes, so that it can be made and
+/// pooled like any other digest.
+//
+template <typename tHash2, typename tHash1>
+class TDoubleHashTemplate : public TDoubleHash
+{
+  public:
+	TDoubleHashTemplate() : TDoubleHash( &Second, &First ) {}
+
+  protected:
+	tHash2 Second;
+	tHash1 First;
+
+  private:
+	// Not copyable; the copy would point at our hashes
+	TDoubleHashTemplate( const TDoubleHashTemplate & );
+	TDoubleHashTemplate &operator=( const TDoubleHashTemplate & );
+};
+
+//
+// Template:		TDigestPool
+// Description:
+/// One digest of each type for each thread, for callers that would
+/// otherwise construct one for every hash.
+//
+/// \code
+///   unsigned char Digest[TMessageDigest::MAXIMUM_DIGEST_BYTES];
+///   size_t n = TDigestPool<THash_ripemd160>::get().transform( Digest, p, size );
+/// \endcode
+///
+/// get() resets the digest, so nothing a previous user left unfinished
+/// leaks into the next hash.  The reference shouldn't be kept beyond
+/// the next get() of the same type on the same thread.
+//
+template <typename tDigest>
+class TDigestPool
+{
+  public:
+	static tDigest &get() {
+		static TThreadLocal<tDigest> Local;
+		tDigest &Digest( Local.get() );
+		Digest.reset();
+		return Digest;
+	}
+};
+
 
 //
 // Class:		TSSLMessageDigest
@@ -275,6 +451,7 @@ class TSSLMessageDigest : public TMessageDigest
 	virtual ~TSSLMessageDigest();
 
 	TByteArray transform( const TByteArray & );
+	size_t transform( unsigned char *Out, const void *In, size_t n );
 	void update( const TByteArray & );
 	TByteArray final();
 
@@ -50,6 +50,17 @@
 template <typename tLittleInteger>
 const size_t TGenericBigInteger<tLittleInteger>::bitsPerBlock = numeric_limits<tLittleInteger>::digits;
 
+//
+// Function:	TGenericBigInteger :: KaratsubaThreshold
+// Description:
+// Karatsuba's method does three half size multiplies instead of four,
+// but pays for it in additions and scratch space.  Measured with the
+// unit test, it starts to win at around 2048 bit operands.
+//
+template <typename tLittleInteger>
+typename TGenericBigInteger<tLittleInteger>::tIndex
+TGenericBigInteger<tLittleInteger>::KaratsubaThreshold = 2048 / numeric_limits<tLittleInteger>::digits;
+
 //
 // Function:	TGenericBigInteger :: TGenericBigInteger
 // Description:
@@ -99,6 +110,15 @@ TGenericBigInteger<tLittleInteger> &TGenericBigInteger<tLittleInteger>::fromStri
 	string::size_type pos;
 	unsigned int ch;
 
+	if( Base < 2 )
+		throw range_error("TGenericBigInteger::fromString: base must be at least two");
+
+	// Rather than multiply the whole number by Base for every digit, we
+	// collect digits in a single block for as long as they fit, and
+	// only touch the whole number once per block's worth.
+	const tLittleInteger ChunkLimit = numeric_limits<tLittleInteger>::max() / Base;
+	tLittleInteger Chunk = 0, Multiplier = 1;
+
 	// Start at zero
 	(*this) = 0;
 
@@ -106,24 +126,24 @@ TGenericBigInteger<tLittleInteger> &TGenericBigInteger<tLittleInteger>::fromStri
 	while( pos < s.size() ) {
 		ch = static_cast<unsigned char>( s[pos] );
 
-//		cerr << "'" << (char)(ch) << "' ";
-
 		ch = fromCharacter( ch, Base );
 		if( ch > 0xff )
 			break;
 
-//		cerr << "shl, adding " << ch
-//			<< " to " << hex << *this << dec << "*" << Base;
-
-		// Shift left by base, and add the next digit
-		(*this) *= Base;
-		(*this) += TGenericBigInteger( ch );
+		// Another digit would overflow the chunk, so shift left by the
+		// chunk's worth of digits, and add the chunk
+		if( Multiplier > ChunkLimit ) {
+			multiplyAndAddBlock( Multiplier, Chunk );
+			Chunk = 0;
+			Multiplier = 1;
+		}
 
-//		cerr << " = " << hex << *this << dec << endl;;
-//		cerr << " = " << toString(58) << endl;;
+		Chunk = Chunk * Base + ch;
+		Multiplier *= Base;
 
 		pos++;
 	}
+	multiplyAndAddBlock( Multiplier, Chunk );
 
 	normalise();
 
@@ -209,10 +229,10 @@ string TGenericBigInteger<tLittleInteger>::toString( tLittleInteger Base ) const
 	unsigned int ch;
 	string output;
 
-	TGenericBigInteger quotient, remainder;
-
-	// Start with the whole number
-	quotient = *this;
+	if( Base < 2 )
+		throw range_error("TGenericBigInteger::toString: base must be at least two");
+	if( !isValid() )
+		return output;
 
 	// e.g.
 	// 1234567890123 / 10  = 123456789012 r 3
@@ -231,28 +251,45 @@ string TGenericBigInteger<tLittleInteger>::toString( tLittleInteger Base ) const
 	// Read the remainder from bottom to top.  Each remainder is the
 	// "nth" symbol in base-N display.  We just look up what character
 	// should be displayed for that number and we have our conversion.
+	//
+	// Dividing the whole number by Base for every digit is slow, so we
+	// divide by the largest power of Base that fits in a block instead,
+	// and pick the digits out of each remainder with ordinary integer
+	// arithmetic.  With 64 bit blocks and base 10 that's 19 digits per
+	// big division.
+
+	tLittleInteger Chunk = Base;
+	unsigned int ChunkDigits = 1;
+	while( Chunk <= numeric_limits<tLittleInteger>::max() / Base ) {
+		Chunk *= Base;
+		ChunkDigits++;
+	}
+
+	TGenericBigInteger quotient( *this );
 
-//	cerr << hex << quotient << dec << endl;
 	do {
-		remainder = quotient;
-		remainder.divideWithRemainder( Base, quotient );
+		tLittleInteger remainder = quotient.divideByBlock( Chunk );
 
-//		cerr << hex << quotient << dec << " r " << remainder.getBlock(0) << endl;
+		// The digits come out least significant first
+		for( unsigned int i = 0; i < ChunkDigits; i++ ) {
+			// Every chunk but the most significant is zero padded
+			if( i > 0 && remainder == 0 && quotient.isZero() )
+				break;
 
-		// Remainder is guaranteed to be less than Base, and Base is an
-		// little int, so we're safe using the zero block untouched
-		ch = toCharacter( remainder.getBlock(0), Base );
+			ch = toCharacter( remainder % Base, Base );
 
-		// Hitting an invalid conversion is a serious error
-		if( ch > 0xff )
-			logic_error("toCharacter() returned INVALID -- impossible");
+			// Hitting an invalid conversion is a serious error
+			if( ch > 0xff )
+				throw logic_error("toCharacter() returned INVALID -- impossible");
 
-		// Prepend character
-		output = string() + static_cast<char>(ch) + output;
+			output += static_cast<char>(ch);
+			remainder /= Base;
+		}
 	} while( !quotient.isZero() );
 
+	reverse( output.begin(), output.end() );
+
 	return stringPad( output, Base );
-//	return output;
 }
 
 //
@@ -406,24 +443,24 @@ TGenericBigInteger<tLittleInteger>::fromBytes( const string &s )
 		switch( sizeof( tLittleInteger ) ) {
 			case 8:
 				if( pos + 7 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+7]) << (sizeof(tLittleInteger)*8 - 64);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+7])) << (sizeof(tLittleInteger)*8 - 64);
 				if( pos + 6 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+6]) << (sizeof(tLittleInteger)*8 - 56);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+6])) << (sizeof(tLittleInteger)*8 - 56);
 				if( pos + 5 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+5]) << (sizeof(tLittleInteger)*8 - 48);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+5])) << (sizeof(tLittleInteger)*8 - 48);
 				if( pos + 4 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+4]) << (sizeof(tLittleInteger)*8 - 40);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+4])) << (sizeof(tLittleInteger)*8 - 40);
 			case 4:
 				if( pos + 3 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+3]) << (sizeof(tLittleInteger)*8 - 32);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+3])) << (sizeof(tLittleInteger)*8 - 32);
 				if( pos + 2 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+2]) << (sizeof(tLittleInteger)*8 - 24);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+2])) << (sizeof(tLittleInteger)*8 - 24);
 			case 2:
 				if( pos + 1 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+1]) << (sizeof(tLittleInteger)*8 - 16);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+1])) << (sizeof(tLittleInteger)*8 - 16);
 			case 1:
 				if( pos + 0 >= 0 )
-					Accumulator |= static_cast<unsigned char>(s[pos+0]) << (sizeof(tLittleInteger)*8 - 8);
+					Accumulator |= static_cast<tLittleInteger>(static_cast<unsigned char>(s[pos+0])) << (sizeof(tLittleInteger)*8 - 8);
 		}
 
 		LittleDigits.push_back( Accumulator );
@@ -484,7 +521,11 @@ TGenericBigInteger<tLittleInteger> &TGenericBigInteger<tLittleInteger>::operator
 
 	do {
 		LittleDigits.push_back( t & numeric_limits<tLittleInteger>::max() );
-		t >>= numeric_limits<tLittleInteger>::digits;
+		// A limb as wide as the argument takes it all in one go, and
+		// shifting by the full width is undefined
+		if( numeric_limits<tLittleInteger>::digits >= numeric_limits<unsigned long long>::digits )
+			break;
+		t >>= numeric_limits<tLittleInteger>::digits % numeric_limits<unsigned long long>::digits;
 	} while( t > 0 );
 
 	return *this;
@@ -626,36 +667,16 @@ TGenericBigInteger<tLittleInteger>::operator+=(
 	// Starting at the least significant blocks (the front of the
 	// vector), we now iterate through until we've used up the shortest
 	// input argument.
-	bool carryIn = false, carryOut;
-	tLittleInteger temp;
+	tLittleInteger carryIn = 0;
 
 	// Point at begining of both arrays
 	itA = LittleDigits.begin();
 	itB = B.LittleDigits.begin();
 
 	while( itA != LittleDigits.end() && itB != B.LittleDigits.end() ) {
-		// Perform sum
-		temp = *itA + *itB;
-
-		// A carry has ocurred if we've got an answer smaller than the
-		// inputs.  The result will be the wrap around equivalent of the
-		// answer, so we must note that we need an extra in the next
-		// block if we detect it.
-		// http://www.fefe.de/intof.html
-		carryOut = (temp < *itA);
-
-		// Was there a carry from the previous block?
-		if( carryIn ) {
-			// Add it in
-			temp++;
-			// Adding a carry can overflow too; check for it.  If we've
-			// already had a carry, then we leave it set.
-			carryOut |= (temp == 0);
-		}
-
-		// Store
-		*itA = temp;
-		carryIn = carryOut;
+		// Sum, with the carry from the previous block in and the carry
+		// for the next block out
+		carryIn = addWithCarry( *itA, *itA, *itB, carryIn );
 
 		// Next element
 		itA++;
@@ -667,7 +688,7 @@ TGenericBigInteger<tLittleInteger>::operator+=(
 		if( carryIn )
 			(*itA)++;
 		if( *itA != 0 )
-			carryIn = false;
+			carryIn = 0;
 		itA++;
 	}
 	// Remote array still has digits, whilst we have run out. Basically
@@ -677,7 +698,7 @@ TGenericBigInteger<tLittleInteger>::operator+=(
 		if( carryIn )
 			LittleDigits.back()++;
 		if( LittleDigits.back() != 0 )
-			carryIn = false;
+			carryIn = 0;
 		itB++;
 	}
 
@@ -718,7 +739,7 @@ TGenericBigInteger<tLittleInteger>::operator-=(
 
 	// ---
 
-	bool borrowIn = false, borrowOut;
+	tLittleInteger borrowIn = 0;
 
 	// Point at begining of both arrays
 	itA = LittleDigits.begin();
@@ -726,27 +747,9 @@ TGenericBigInteger<tLittleInteger>::operator-=(
 
 	// For each block index that is present in both inputs...
 	while( itA != LittleDigits.end() && itB != B.LittleDigits.end() ) {
-		// If we're short in this block; we must borrow from the next
-		// block; we're "short" when the subtraction is going to be
-		// negative -- which means wrapped around
-		borrowOut = (*itB > *itA);
-
-		// Perform subtraction
-		*itA -= *itB;
-
-		// Check for a borrow request from the previous loop
-		if( borrowIn ) {
-			// If we need to borrow but our block is already zero, then
-			// we'll have to borrow from the next block.  If we're
-			// already borrowing then it will take care of itself, we've
-			// got a whole digits worth of extra numbers already
-			borrowOut |= (*itA == 0);
-			// Apply our borrow
-			(*itA)--;
-		}
-
-		// Our borrowOut, is the next loop's borrowIn
-		borrowIn = borrowOut;
+		// Subtract, taking the borrow from the previous block and
+		// noting whether this block had to borrow from the next
+		borrowIn = subtractWithBorrow( *itA, *itA, *itB, borrowIn );
 
 		// Next element
 		itA++;
@@ -790,46 +793,24 @@ TGenericBigInteger<tLittleInteger> &
 TGenericBigInteger<tLittleInteger>::operator*=(
 		const TGenericBigInteger<tLittleInteger> &B)
 {
-	// We can't do this multiply in place, as we need an accumulator
-	TGenericBigInteger<tLittleInteger> C(*this);
+	// If one is invalid, then the answer is invalid
+	if( !isValid() || !B.isValid() ) {
+		invalidate();
+		return *this;
+	}
 
-	// Warn our own vector how much space it's going to need
-	LittleDigits.clear();
-	LittleDigits.assign( B.LittleDigits.size() + C.LittleDigits.size(), 0 );
+	// We can't do this multiply in place, as we need an accumulator;
+	// so the result goes in a new vector, which is the only allocation
+	// long multiplication makes.  It is fine for B to be *this, as both
+	// inputs are only read.
+	tLittleDigitsVector Result( LittleDigits.size() + B.LittleDigits.size() );
 
-	// We're multiplying two N digit numbers.  The digits are in base
-	// 2^32 (say).  We multiply each digit pair and add to an
-	// accumulator.  Let's say we're multiplying two two digit numbers,
-	// the result of each product of two single digits is two digits
-	//
-	//  B = 51;  C = 69
-	//
-	//       [0] [1]           [0] [1]           [0] [1]
-	//   [0] 1*9 1*6   ->  [0]  09  06  and  [0]   0   1
-	//   [1] 5*9 5*6       [1]  45  30       [1]   1   2
-	//                         result           position
-	// Using the position table to shift left the result table:
-	//
-	//          2 1 0
-	//        -------
-	// [0][0]       9
-	// [0][1]     6
-	// [1][0]   4 5
-	// [1][1] 3 0
-	//        -------
-	//        3 5 1 9
-
-	tLittleInteger R0, R1;
-
-	for( tIndex i = 0; i < B.LittleDigits.size(); i++ ) {
-		for( tIndex j = 0; j < C.LittleDigits.size(); j++ ) {
-			blockMultiply( R1, R0, B.LittleDigits[i], C.LittleDigits[j] );
-
-			// Use TGenericBigInteger to do the digit shift and addition with
-			// carry
-			(*this) += TGenericBigInteger<tLittleInteger>(R1,R0).blockShiftLeft( i + j );;
-		}
-	}
+	multiplyBlocks( &Result[0],
+			&LittleDigits[0], LittleDigits.size(),
+			&B.LittleDigits[0], B.LittleDigits.size() );
+
+	LittleDigits.swap( Result );
+	normalise();
 
 	return *this;
 }
@@ -931,6 +912,391 @@ void TGenericBigInteger<tLittleInteger>::blockMultiply(tLittleInteger &R1, tLitt
 		+ Carry;
 }
 
+#ifdef __SIZEOF_INT128__
+//
+// Function:	TGenericBigInteger<unsigned long long> :: blockMultiply
+// Description:
+/// Single block multiply, for 64 bit blocks
+//
+/// The generic version is careful not to assume a type twice the width
+/// of a block; but where the compiler has a 128 bit type the product is
+/// one multiply instruction.
+//
+template <>
+void TGenericBigInteger<unsigned long long>::blockMultiply(unsigned long long &R1, unsigned long long &R0,
+		unsigned long long B, const unsigned long long C )
+{
+	unsigned __int128 R = static_cast<unsigned __int128>(B) * C;
+
+	R0 = static_cast<unsigned long long>( R );
+	R1 = static_cast<unsigned long long>( R >> 64 );
+}
+#endif
+
+//
+// Function:	TGenericBigInteger<unsigned int> :: blockMultiply
+// Description:
+/// Single block multiply, for 32 bit blocks
+//
+/// uint64_t is always available, so there's no need for the four half
+/// width multiplies of the generic version.
+//
+template <>
+void TGenericBigInteger<unsigned int>::blockMultiply(unsigned int &R1, unsigned int &R0,
+		unsigned int B, const unsigned int C )
+{
+	uint64_t R = static_cast<uint64_t>(B) * C;
+
+	R0 = static_cast<unsigned int>( R );
+	R1 = static_cast<unsigned int>( R >> 32 );
+}
+
+//
+// Function:	TGenericBigInteger :: blockDivide
+// Description:
+/// Single block divide
+//
+/// Calculate Q = [N1,N0] / D and R = [N1,N0] % D.  N1 must be less than
+/// D, so that the quotient fits in one block.
+//
+/// As with blockMultiply(), we don't assume there is a type twice the
+/// width of a block, so this is binary long division, one bit of N0 at
+/// a time.
+//
+template <typename tLittleInteger>
+void TGenericBigInteger<tLittleInteger>::blockDivide( tLittleInteger &Q, tLittleInteger &R,
+		tLittleInteger N1, tLittleInteger N0, tLittleInteger D )
+{
+	tLittleInteger Quotient = 0;
+	bool Overflow;
+
+	for( tIndex i = bitsPerBlock; i-- > 0; ) {
+		// Bring down the next bit; the remainder can briefly need one
+		// more bit than a block has
+		Overflow = (N1 >> (bitsPerBlock - 1)) != 0;
+		N1 = (N1 << 1) | ((N0 >> i) & 1);
+		Quotient <<= 1;
+		if( Overflow || N1 >= D ) {
+			N1 -= D;
+			Quotient |= 1;
+		}
+	}
+
+	Q = Quotient;
+	R = N1;
+}
+
+#ifdef __SIZEOF_INT128__
+//
+// Function:	TGenericBigInteger<unsigned long long> :: blockDivide
+// Description:
+/// Single block divide, for 64 bit blocks
+//
+template <>
+void TGenericBigInteger<unsigned long long>::blockDivide( unsigned long long &Q, unsigned long long &R,
+		unsigned long long N1, unsigned long long N0, unsigned long long D )
+{
+	unsigned __int128 N = (static_cast<unsigned __int128>(N1) << 64) | N0;
+
+	Q = static_cast<unsigned long long>( N / D );
+	R = static_cast<unsigned long long>( N % D );
+}
+#endif
+
+//
+// Function:	TGenericBigInteger<unsigned int> :: blockDivide
+// Description:
+/// Single block divide, for 32 bit blocks
+//
+template <>
+void TGenericBigInteger<unsigned int>::blockDivide( unsigned int &Q, unsigned int &R,
+		unsigned int N1, unsigned int N0, unsigned int D )
+{
+	uint64_t N = (static_cast<uint64_t>(N1) << 32) | N0;
+
+	Q = static_cast<unsigned int>( N / D );
+	R = static_cast<unsigned int>( N % D );
+}
+
+//
+// Function:	TGenericBigInteger :: addWithCarry
+// Description:
+/// Single block add
+//
+/// Calculate R = A + B + Carry, returning the carry out (zero or one).
+/// Carry must be zero or one.
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericBigInteger<tLittleInteger>::addWithCarry( tLittleInteger &R,
+		tLittleInteger A, tLittleInteger B, tLittleInteger Carry )
+{
+	// A carry has ocurred if we've got an answer smaller than the
+	// inputs.  The result will be the wrap around equivalent of the
+	// answer.  Only one of the two additions can overflow, as A + B
+	// is at most two less than 2^N.
+	// http://www.fefe.de/intof.html
+	tLittleInteger Sum = A + B;
+	tLittleInteger CarryOut = (Sum < A);
+
+	Sum += Carry;
+	CarryOut |= (Sum < Carry);
+
+	R = Sum;
+	return CarryOut;
+}
+
+//
+// Function:	TGenericBigInteger :: subtractWithBorrow
+// Description:
+/// Single block subtract
+//
+/// Calculate R = A - B - Borrow, returning the borrow out (zero or
+/// one).  Borrow must be zero or one.
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericBigInteger<tLittleInteger>::subtractWithBorrow( tLittleInteger &R,
+		tLittleInteger A, tLittleInteger B, tLittleInteger Borrow )
+{
+	// We're "short" when the subtraction is going to be negative --
+	// which means wrapped around.  If this block is then zero, applying
+	// the incoming borrow is short too; only one of the two can happen.
+	tLittleInteger Difference = A - B;
+	tLittleInteger BorrowOut = (B > A);
+
+	BorrowOut |= (Difference < Borrow);
+	Difference -= Borrow;
+
+	R = Difference;
+	return BorrowOut;
+}
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_addcll) && __has_builtin(__builtin_subcll)
+//
+// Function:	TGenericBigInteger<unsigned long long> :: addWithCarry
+// Description:
+/// Single block add, using the compiler's add-with-carry
+//
+template <>
+unsigned long long TGenericBigInteger<unsigned long long>::addWithCarry( unsigned long long &R,
+		unsigned long long A, unsigned long long B, unsigned long long Carry )
+{
+	unsigned long long CarryOut;
+	R = __builtin_addcll( A, B, Carry, &CarryOut );
+	return CarryOut;
+}
+
+//
+// Function:	TGenericBigInteger<unsigned long long> :: subtractWithBorrow
+// Description:
+/// Single block subtract, using the compiler's subtract-with-borrow
+//
+template <>
+unsigned long long TGenericBigInteger<unsigned long long>::subtractWithBorrow( unsigned long long &R,
+		unsigned long long A, unsigned long long B, unsigned long long Borrow )
+{
+	unsigned long long BorrowOut;
+	R = __builtin_subcll( A, B, Borrow, &BorrowOut );
+	return BorrowOut;
+}
+#endif
+#endif
+
+//
+// Function:	TGenericBigInteger :: addBlocks
+// Description:
+/// Implement R = R + X on raw blocks, least significant first
+//
+/// R is RN blocks long, and X is XN blocks long, with XN <= RN.  Any
+/// carry runs on into the rest of R; a carry out of the top of R is
+/// returned.
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericBigInteger<tLittleInteger>::addBlocks( tLittleInteger *R, tIndex RN,
+		const tLittleInteger *X, tIndex XN )
+{
+	tLittleInteger Carry = 0;
+	tIndex i;
+
+	for( i = 0; i < XN; i++ )
+		Carry = addWithCarry( R[i], R[i], X[i], Carry );
+	for( ; i < RN && Carry != 0; i++ )
+		Carry = addWithCarry( R[i], R[i], 0, Carry );
+
+	return Carry;
+}
+
+//
+// Function:	TGenericBigInteger :: subtractBlocks
+// Description:
+/// Implement R = R - X on raw blocks, least significant first
+//
+/// As addBlocks(), but returns the borrow out of the top of R.
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericBigInteger<tLittleInteger>::subtractBlocks( tLittleInteger *R, tIndex RN,
+		const tLittleInteger *X, tIndex XN )
+{
+	tLittleInteger Borrow = 0;
+	tIndex i;
+
+	for( i = 0; i < XN; i++ )
+		Borrow = subtractWithBorrow( R[i], R[i], X[i], Borrow );
+	for( ; i < RN && Borrow != 0; i++ )
+		Borrow = subtractWithBorrow( R[i], R[i], 0, Borrow );
+
+	return Borrow;
+}
+
+//
+// Function:	TGenericBigInteger :: multiplyBlocks
+// Description:
+/// Implement R = A * B on raw blocks, least significant first
+//
+/// R must have room for AN + BN blocks, and must not overlap A or B.
+/// A and B may be the same.
+//
+/// Long multiplication for small operands; Karatsuba for large.
+/// Karatsuba wants operands of equal length, so a long A is cut into
+/// pieces the length of B, and each piece's product is added in at its
+/// offset.
+//
+template <typename tLittleInteger>
+void TGenericBigInteger<tLittleInteger>::multiplyBlocks( tLittleInteger *R,
+		const tLittleInteger *A, tIndex AN, const tLittleInteger *B, tIndex BN )
+{
+	if( AN < BN ) {
+		swap( A, B );
+		swap( AN, BN );
+	}
+
+	if( BN < KaratsubaThreshold || BN < 4 ) {
+		longMultiply( R, A, AN, B, BN );
+		return;
+	}
+
+	// Room for one piece's product, followed by Karatsuba's scratch
+	tLittleDigitsVector Scratch( 2 * BN + karatsubaScratchSize( BN ) );
+	tLittleInteger *Piece = &Scratch[0];
+
+	fill( R, R + AN + BN, 0 );
+
+	for( tIndex Offset = 0; Offset < AN; Offset += BN ) {
+		tIndex PieceN = min( BN, AN - Offset );
+
+		if( PieceN == BN ) {
+			karatsubaMultiply( Piece, A + Offset, B, BN, Piece + 2 * BN );
+		} else {
+			multiplyBlocks( Piece, A + Offset, PieceN, B, BN );
+		}
+
+		addBlocks( R + Offset, AN + BN - Offset, Piece, PieceN + BN );
+	}
+}
+
+//
+// Function:	TGenericBigInteger :: longMultiply
+// Description:
+/// Implement R = A * B by long multiplication
+//
+/// Each row is one block of A times the whole of B, added into the
+/// result at that block's offset, with the carry running along the
+/// row.  That carry can't overflow: the largest a single step can make
+/// is (2^N-1) + (2^N-1)*(2^N-1) + (2^N-1) = 2^2N - 1, which fits in
+/// the two blocks of [Carry,R].
+//
+template <typename tLittleInteger>
+void TGenericBigInteger<tLittleInteger>::longMultiply( tLittleInteger *R,
+		const tLittleInteger *A, tIndex AN, const tLittleInteger *B, tIndex BN )
+{
+	tLittleInteger R0, R1, Carry;
+
+	fill( R, R + AN + BN, 0 );
+
+	for( tIndex i = 0; i < AN; i++ ) {
+		Carry = 0;
+		for( tIndex j = 0; j < BN; j++ ) {
+			blockMultiply( R1, R0, A[i], B[j] );
+			R1 += addWithCarry( R[i+j], R[i+j], R0, 0 );
+			R1 += addWithCarry( R[i+j], R[i+j], Carry, 0 );
+			Carry = R1;
+		}
+		R[i+BN] = Carry;
+	}
+}
+
+//
+// Function:	TGenericBigInteger :: karatsubaMultiply
+// Description:
+/// Implement R = A * B, where A and B are both N blocks long
+//
+/// Split each operand at H blocks, A = A1.X^H + A0, then
+///
+///   A*B = Z2.X^2H + (Z1 - Z2 - Z0).X^H + Z0
+///
+/// where Z0 = A0*B0, Z2 = A1*B1 and Z1 = (A0+A1)*(B0+B1).  Z0 and Z2
+/// go straight into the bottom and top halves of R; Z1 is made in
+/// Scratch, which must be karatsubaScratchSize(N) blocks long.
+//
+template <typename tLittleInteger>
+void TGenericBigInteger<tLittleInteger>::karatsubaMultiply( tLittleInteger *R,
+		const tLittleInteger *A, const tLittleInteger *B, tIndex N,
+		tLittleInteger *Scratch )
+{
+	if( N < KaratsubaThreshold || N < 4 ) {
+		longMultiply( R, A, N, B, N );
+		return;
+	}
+
+	// H low blocks and M high blocks, with M >= H.  The sums need one
+	// more block than M for their carry.
+	tIndex H = N / 2;
+	tIndex M = N - H;
+	tLittleInteger *SumA = Scratch;
+	tLittleInteger *SumB = SumA + (M + 1);
+	tLittleInteger *Z1 = SumB + (M + 1);
+	tLittleInteger *Next = Z1 + 2 * (M + 1);
+
+	karatsubaMultiply( R, A, B, H, Next );
+	karatsubaMultiply( R + 2 * H, A + H, B + H, M, Next );
+
+	copy( A + H, A + N, SumA );
+	SumA[M] = addBlocks( SumA, M, A, H );
+	copy( B + H, B + N, SumB );
+	SumB[M] = addBlocks( SumB, M, B, H );
+
+	karatsubaMultiply( Z1, SumA, SumB, M + 1, Next );
+
+	// Z1 >= Z0 + Z2, so these can't borrow out of the top
+	subtractBlocks( Z1, 2 * (M + 1), R, 2 * H );
+	subtractBlocks( Z1, 2 * (M + 1), R + 2 * H, 2 * M );
+
+	// The whole product fits in R, so whatever of Z1 doesn't is zero
+	addBlocks( R + H, 2 * N - H, Z1, min( 2 * (M + 1), 2 * N - H ) );
+}
+
+//
+// Function:	TGenericBigInteger :: karatsubaScratchSize
+// Description:
+/// The scratch karatsubaMultiply() needs for N block operands
+//
+/// Each level needs room for the two sums and their product, then the
+/// largest of its three multiplies, which is the one of the sums.
+//
+template <typename tLittleInteger>
+typename TGenericBigInteger<tLittleInteger>::tIndex
+TGenericBigInteger<tLittleInteger>::karatsubaScratchSize( tIndex N )
+{
+	tIndex Size = 0;
+
+	while( N >= KaratsubaThreshold && N >= 4 ) {
+		N = N - N / 2 + 1;
+		Size += 4 * N;
+	}
+
+	return Size;
+}
+
 //
 // Function:	TGenericBigInteger :: divideWithRemainder
 // Description:
@@ -942,104 +1308,383 @@ TGenericBigInteger<tLittleInteger> &TGenericBigInteger<tLittleInteger>::divideWi
 	// themselves.  This macro detects a self operation and reruns the
 	// operation using a temporary copy.
 	if( this == &d || this == &Q ) {
-		TGenericBigInteger<tLittleInteger> Temporary;
+		TGenericBigInteger<tLittleInteger> Temporary( *this );
 		Temporary.divideWithRemainder(d,Q);
 		*this = Temporary;
 		return *this;
 	}
 
-	// "this" is the numerator; D is the denominator, and we'll be
+	// "this" is the numerator; d is the denominator, and we'll be
 	// storing the remainder in this and the quotient in Q.
 
-	TGenericBigInteger<tLittleInteger> D(d);
-
-	// Binary division goes like this:
-	//
-	//   11 into 11011
-	//   11 into 11     goes 1 r 0
-	//   11 into  00    goes 0 r 0
-	//   11 into   01   goes 0 r 1 (the remainder carries down)
-	//   11 into    11  goes 1 r 0
-	//
-	// Obviously, this is going to be horrendously inefficient with our
-	// arbitrary precision numbers, but it's the best we can do, as
-	// there is no way to build up a division out of smaller components.
+	if( !isValid() || !d.isValid() ) {
+		invalidate();
+		Q.invalidate();
+		return *this;
+	}
+	if( d.isZero() )
+		throw range_error("TGenericBigInteger::divideWithRemainder: division by zero");
 
-	// Note however that we only need to process the ones in the
-	// dividend, zeroes are guaranteed to return zero.
+	// The denominator is larger than the numerator, so the numerator
+	// is the remainder and the quotient is zero
+	if( compareTo( d ) == LessThan ) {
+		Q = 0;
+		return *this;
+	}
 
-	// Note also that we're really saying this:
-	//
-	//  11 into 11111
-	//  11000 into 11111  goes 1 times remainder 111
-	//   1100 into   111  goes 0 times remainder 111
-	//    110 into   111  goes 1 times remainder   1
-	//     11 into     1  goes 0 times remainder   1
-	//
-	// In other words, we shift left the divisor to make it the same
-	// length as the dividend, then we see if it will subtract.  If it
-	// does, then we push 1 into the quotient, and pass the remainder to
-	// the next stage.  If it does not, we push a 0 into the quotient.
-	// Then we shift right the dividend and try again.  Being binary, it
-	// will either subtract once or not at all, making the decision
-	// easy.  When we have undone all the shifts we initially
-	// introduced, then whatever remains is the remainder.
-
-	tIndex denominatorHighBit = D.highestBit();
-	tIndex numeratorHighBit = highestBit();
-
-	Q = 0;
-
-	if( denominatorHighBit > numeratorHighBit ) {
-		// The numerator is the remainder and the quotient is zero
-		// because the denominator is larger than the numerator
+	// A single block denominator is a simple walk down the numerator
+	if( d.LittleDigits.size() == 1 ) {
+		tLittleInteger Divisor = d.LittleDigits[0];
+		Q = *this;
+		*this = 0;
+		LittleDigits[0] = Q.divideByBlock( Divisor );
 		return *this;
 	}
 
-//	cerr << "NHB - DHB      = " << numeratorHighBit << " - " << denominatorHighBit << endl;
-//	cerr << "Numerator      = " << hex << *this << endl;
-//	cerr << "Denominator    = " << D << dec << endl;
+	// Otherwise this is Knuth's Algorithm D (TAOCP Vol 2, 4.3.1); long
+	// division as we would do it on paper, but with a whole block for
+	// each digit.  The trick is in guessing each quotient digit from
+	// the top two digits of the remainder and the top digit of the
+	// denominator.  If the denominator is first shifted so that its top
+	// bit is set, that guess is never more than two too big, and the
+	// check against the next digit down nearly always corrects it.
+	const tLittleInteger TopBit = static_cast<tLittleInteger>(1) << (bitsPerBlock - 1);
+	tIndex n = d.LittleDigits.size();
+	tIndex m = LittleDigits.size() - n;
+	tIndex Shift = 0;
+
+	for( tLittleInteger x = d.LittleDigits.back(); (x & TopBit) == 0; x <<= 1 )
+		Shift++;
+
+	// Normalised denominator, V, and numerator, U, which needs an extra
+	// block to take whatever is shifted out of the top
+	tLittleDigitsVector V( (d << Shift).LittleDigits );
+	tLittleDigitsVector U( (*this << Shift).LittleDigits );
+	U.resize( m + n + 1, 0 );
+
+	Q.LittleDigits.assign( m + 1, 0 );
+
+	tLittleInteger qhat, rhat, P0, P1, Carry, Borrow;
+	bool rhatOverflow;
+
+	for( tIndex j = m + 1; j-- > 0; ) {
+		// Estimate the quotient digit, qhat, from the top two blocks of
+		// this part of the numerator.  They can't be more than V[n-1]
+		// times the block size, so the estimate is at most one block.
+		if( U[j+n] >= V[n-1] ) {
+			qhat = numeric_limits<tLittleInteger>::max();
+			rhat = U[j+n-1] + V[n-1];
+			rhatOverflow = (rhat < V[n-1]);
+		} else {
+			blockDivide( qhat, rhat, U[j+n], U[j+n-1], V[n-1] );
+			rhatOverflow = false;
+		}
+
+		// Test the estimate against the next block down; once rhat no
+		// longer fits in a block the test can't fail
+		while( !rhatOverflow ) {
+			blockMultiply( P1, P0, qhat, V[n-2] );
+			if( P1 < rhat || (P1 == rhat && P0 <= U[j+n-2]) )
+				break;
+			qhat--;
+			rhat += V[n-1];
+			rhatOverflow = (rhat < V[n-1]);
+		}
+
+		// Multiply and subtract, U[j..j+n] -= qhat * V
+		Carry = 0;
+		Borrow = 0;
+		for( tIndex i = 0; i < n; i++ ) {
+			blockMultiply( P1, P0, qhat, V[i] );
+			P1 += addWithCarry( P0, P0, Carry, 0 );
+			Carry = P1;
+			Borrow = subtractWithBorrow( U[i+j], U[i+j], P0, Borrow );
+		}
+		Borrow = subtractWithBorrow( U[j+n], U[j+n], Carry, Borrow );
+
+		// Very rarely, qhat is still one too big, which shows as a
+		// negative result; add one V back
+		if( Borrow ) {
+			qhat--;
+			Carry = 0;
+			for( tIndex i = 0; i < n; i++ )
+				Carry = addWithCarry( U[i+j], U[i+j], V[i], Carry );
+			U[j+n] += Carry;
+		}
+
+		Q.LittleDigits[j] = qhat;
+	}
+	Q.normalise();
+
+	// What's left of U is the remainder, still shifted by the
+	// normalisation
+	LittleDigits.assign( U.begin(), U.begin() + n );
+	normalise();
+	*this >>= Shift;
+
+	return *this;
+}
+
+//
+// Function:	TGenericBigInteger :: divideByBlock
+// Description:
+/// Implement A = A / d for a single block d, returning the remainder
+//
+/// Long division, one block at a time, from the most significant end;
+/// each remainder is the top block of the next two block division.
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericBigInteger<tLittleInteger>::divideByBlock( tLittleInteger d )
+{
+	tLittleInteger Remainder = 0;
+
+	if( d == 0 )
+		throw range_error("TGenericBigInteger::divideByBlock: division by zero");
 
-	// First we shift the denominator up to have its high bit in the
-	// same place as the numerator high bit
-	D <<= numeratorHighBit - denominatorHighBit;
+	for( tIndex i = LittleDigits.size(); i-- > 0; )
+		blockDivide( LittleDigits[i], Remainder, Remainder, LittleDigits[i], d );
 
-	tIndex shifts = numeratorHighBit - denominatorHighBit + 1;
+	normalise();
 
-//	cerr << "Denominator[0] = " << hex << D << dec << endl;
-//	cerr << "shifts         = " << shifts << endl;
+	return Remainder;
+}
 
-	while( shifts > 0 ) {
-		shifts--;
-		Q <<= 1;
+//
+// Function:	TGenericBigInteger :: multiplyAndAddBlock
+// Description:
+/// Implement A = A * M + X for single blocks M and X
+//
+template <typename tLittleInteger>
+void TGenericBigInteger<tLittleInteger>::multiplyAndAddBlock( tLittleInteger M, tLittleInteger X )
+{
+	tLittleInteger R0, R1, Carry = X;
 
-		// If the current denominator is less than or equal to the
-		// numerator, then it will divide...
-		if( D <= *this ) {
-			// ... so we push a one
-			Q |= 1;
-			// and subtract this denominator to leave a remainder for
-			// the next cycle
-			*this -= D;
-		} else {
-			// ... if not, then we push a zero, and the previous
-			// remainder remains (as we haven't subtracted anything from
-			// it)
+	if( !isValid() )
+		return;
+
+	for( tIndex i = 0; i < LittleDigits.size(); i++ ) {
+		blockMultiply( R1, R0, LittleDigits[i], M );
+		R1 += addWithCarry( LittleDigits[i], R0, Carry, 0 );
+		Carry = R1;
+	}
+	if( Carry != 0 )
+		LittleDigits.push_back( Carry );
+
+	normalise();
+}
+
+//
+// Function:	TGenericBigInteger :: shiftedBlock
+// Description:
+/// Block i of A << Bits, without making A << Bits
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericBigInteger<tLittleInteger>::shiftedBlock( tIndex i, tIndex Bits ) const
+{
+	tIndex Blocks = Bits / bitsPerBlock;
+	tIndex Shift = Bits % bitsPerBlock;
+	tLittleInteger x = 0;
+
+	if( i < Blocks )
+		return 0;
+	i -= Blocks;
+
+	if( i < LittleDigits.size() )
+		x = LittleDigits[i] << Shift;
+	if( Shift != 0 && i > 0 && i - 1 < LittleDigits.size() )
+		x |= LittleDigits[i-1] >> (bitsPerBlock - Shift);
+
+	return x;
+}
+
+//
+// Function:	TGenericBigInteger :: multiplyAdd
+// Description:
+/// Implement A = A + X * Y
+//
+/// The product's rows are added straight into A, so unlike A += X * Y
+/// there is no product to allocate and copy.  Operands long enough for
+/// Karatsuba still go via a product, as Karatsuba can't accumulate.
+//
+template <typename tLittleInteger>
+TGenericBigInteger<tLittleInteger> &
+TGenericBigInteger<tLittleInteger>::multiplyAdd( const TGenericBigInteger &X, const TGenericBigInteger &Y )
+{
+	if( !isValid() || !X.isValid() || !Y.isValid() ) {
+		invalidate();
+		return *this;
+	}
+
+	// The rows would be reading what they're writing
+	if( &X == this || &Y == this )
+		return multiplyAdd( TGenericBigInteger( X ), TGenericBigInteger( Y ) );
+
+	if( X.isZero() || Y.isZero() )
+		return *this;
+
+	const tIndex XN = X.LittleDigits.size();
+	const tIndex YN = Y.LittleDigits.size();
+	const tIndex RN = max( LittleDigits.size(), XN + YN ) + 1;
+	LittleDigits.resize( RN, 0 );
+	tLittleInteger *R = &LittleDigits[0];
+
+	if( min( XN, YN ) >= KaratsubaThreshold && min( XN, YN ) >= 4 ) {
+		tLittleDigitsVector Product( XN + YN );
+		multiplyBlocks( &Product[0], &X.LittleDigits[0], XN, &Y.LittleDigits[0], YN );
+		addBlocks( R, RN, &Product[0], XN + YN );
+		normalise();
+		return *this;
+	}
+
+	// As longMultiply(), but onto what's already there
+	for( tIndex i = 0; i < XN; i++ ) {
+		tLittleInteger R0, R1, Carry = 0;
+		for( tIndex j = 0; j < YN; j++ ) {
+			blockMultiply( R1, R0, X.LittleDigits[i], Y.LittleDigits[j] );
+			R1 += addWithCarry( R[i+j], R[i+j], R0, 0 );
+			R1 += addWithCarry( R[i+j], R[i+j], Carry, 0 );
+			Carry = R1;
 		}
+		addBlocks( R + i + YN, RN - i - YN, &Carry, 1 );
+	}
+
+	normalise();
+
+	return *this;
+}
 
-		// Next denominator
-		D >>= 1;
+//
+// Function:	TGenericBigInteger :: shiftAdd
+// Description:
+/// Implement A = A + (X << Bits)
+//
+/// X is shifted a block at a time as it is added.
+//
+template <typename tLittleInteger>
+TGenericBigInteger<tLittleInteger> &
+TGenericBigInteger<tLittleInteger>::shiftAdd( const TGenericBigInteger &X, tIndex Bits )
+{
+	if( !isValid() || !X.isValid() ) {
+		invalidate();
+		return *this;
 	}
 
-//	cerr << hex;
-//	cerr << "Remainder      = " << *this << endl;
-//	cerr << "Denominator    = " << D << endl;
-//	cerr << "Quotient       = " << Q << endl;
-//	cerr << dec;
+	if( &X == this )
+		return shiftAdd( TGenericBigInteger( X ), Bits );
+
+	const tIndex First = Bits / bitsPerBlock;
+	const tIndex Last = First + X.LittleDigits.size() + 1;
+	const tIndex RN = max( LittleDigits.size(), Last ) + 1;
+	tLittleInteger Carry = 0;
+
+	LittleDigits.resize( RN, 0 );
+
+	for( tIndex i = First; i < Last; i++ )
+		Carry = addWithCarry( LittleDigits[i], LittleDigits[i], X.shiftedBlock( i, Bits ), Carry );
+	addBlocks( &LittleDigits[Last], RN - Last, &Carry, 1 );
+
+	normalise();
 
 	return *this;
 }
 
+//
+// Function:	TGenericBigInteger :: compareToShifted
+// Description:
+/// Compare A with X << Bits
+//
+template <typename tLittleInteger>
+typename TGenericBigInteger<tLittleInteger>::eComparisonResult
+TGenericBigInteger<tLittleInteger>::compareToShifted( const TGenericBigInteger &X, tIndex Bits ) const
+{
+	// Zeroes first, as highestBit() can't tell zero from one
+	if( X.isZero() )
+		return isZero() ? EqualTo : GreaterThan;
+	if( isZero() )
+		return LessThan;
+
+	// Different lengths give the answer without looking further
+	tIndex HB = highestBit(), XHB = X.highestBit() + Bits;
+	if( HB != XHB )
+		return HB < XHB ? LessThan : GreaterThan;
+
+	// Same length, so the same number of blocks; compare from the top
+	for( tIndex i = LittleDigits.size(); i-- > 0; ) {
+		tLittleInteger x = X.shiftedBlock( i, Bits );
+		if( LittleDigits[i] != x )
+			return LittleDigits[i] < x ? LessThan : GreaterThan;
+	}
+
+	return EqualTo;
+}
+
+//
+// Function:	TGenericBigInteger :: add
+// Description:
+/// Implement R = A + B
+//
+/// R may be A or B.  R's storage is reused, so a result that is used
+/// over and over again only allocates when it grows.
+//
+template <typename tLittleInteger>
+TGenericBigInteger<tLittleInteger> &
+TGenericBigInteger<tLittleInteger>::add( TGenericBigInteger &R, const TGenericBigInteger &A, const TGenericBigInteger &B )
+{
+	if( &R == &B )
+		return R += A;
+
+	R = A;
+	return R += B;
+}
+
+//
+// Function:	TGenericBigInteger :: subtract
+// Description:
+/// Implement R = A - B
+//
+template <typename tLittleInteger>
+TGenericBigInteger<tLittleInteger> &
+TGenericBigInteger<tLittleInteger>::subtract( TGenericBigInteger &R, const TGenericBigInteger &A, const TGenericBigInteger &B )
+{
+	if( &R == &B && &R != &A )
+		return R = A - B;
+
+	R = A;
+	return R -= B;
+}
+
+//
+// Function:	TGenericBigInteger :: multiply
+// Description:
+/// Implement R = A * B
+//
+/// The product goes straight into R's blocks; operator*= has to make a
+/// new vector for it, as it overwrites an operand.
+//
+template <typename tLittleInteger>
+TGenericBigInteger<tLittleInteger> &
+TGenericBigInteger<tLittleInteger>::multiply( TGenericBigInteger &R, const TGenericBigInteger &A, const TGenericBigInteger &B )
+{
+	if( &R == &A || &R == &B ) {
+		if( &R == &A )
+			return R *= B;
+		return R *= A;
+	}
+
+	if( !A.isValid() || !B.isValid() ) {
+		R.invalidate();
+		return R;
+	}
+
+	R.LittleDigits.resize( A.LittleDigits.size() + B.LittleDigits.size() );
+	multiplyBlocks( &R.LittleDigits[0],
+			&A.LittleDigits[0], A.LittleDigits.size(),
+			&B.LittleDigits[0], B.LittleDigits.size() );
+	R.normalise();
+
+	return R;
+}
+
 //
 // Function:	TGenericBigInteger :: operator&=
 // Description:
@@ -1212,6 +1857,9 @@ TGenericBigInteger<tLittleInteger>::reversedBytes() const
 	while( it != LittleDigits.rend() ) {
 		tLittleInteger Hold = (*it);
 		switch( sizeof(Hold) ) {
+			case 8:
+				Hold = __builtin_bswap64( Hold );
+				break;
 			case 4:
 				// x0 x1 x2 x3 -> x3 x2 x1 x0
 				Hold = (Hold & 0xff000000) >> 24
@@ -1384,17 +2032,19 @@ TGenericBigInteger<tLittleInteger>::blockShiftRight( tIndex b )
 	if( !isValid() || isZero() || b == 0 )
 		return *this;
 
+	// Shifting off every block leaves zero
+	if( b >= LittleDigits.size() ) {
+		LittleDigits.clear();
+		LittleDigits.push_back(0);
+		return *this;
+	}
+
 	// Start at least significant end of source
 	itA = LittleDigits.begin();
 	itB = LittleDigits.begin();
 
 	// Point b blocks more significant
 	itB += b;
-	if( itB == LittleDigits.end() ) {
-		LittleDigits.clear();
-		LittleDigits.push_back(0);
-		return *this;
-	}
 
 	while( itB != LittleDigits.end() ) {
 //		cerr << *this << endl;
@@ -1893,16 +2543,105 @@ ostream &TGenericBigSignedInteger<tLittleInteger>::printOn( ostream &s ) const
 // -------------- Explicit template instantiations
 template class TGenericBigInteger<unsigned int>;
 template class TGenericBigSignedInteger<unsigned int>;
+template class TGenericBigInteger<unsigned long long>;
+template class TGenericBigSignedInteger<unsigned long long>;
 
 
 // -------------- Function definitions
 
 
+#if defined(UNITTEST) || defined(BENCHMARK)
+#include <new>
+#include <stdlib.h>
+
+// Count heap allocations, so that we can see what the arithmetic costs
+static unsigned long Allocations = 0;
+#if __cplusplus >= 201103L
+void *operator new( size_t n )
+#else
+void *operator new( size_t n ) throw( bad_alloc )
+#endif
+{
+	void *p = malloc( n == 0 ? 1 : n );
+	if( p == NULL )
+		throw bad_alloc();
+	Allocations++;
+	return p;
+}
+void operator delete( void *p ) throw()
+{
+	free( p );
+}
+#endif
+
+
 #ifdef UNITTEST
 #include "logstream.h"
 #include "extratime.h"
 #include <sstream>
 
+//
+// Function:	benchmarkBlockWidth
+// Description:
+// Time multiply, divide and toString() on operands of the given size,
+// for one block width.  The results are returned as hex so that the
+// caller can check the block widths agree.
+//
+template <typename tBigInteger>
+static string benchmarkBlockWidth( const string &AHex, const string &BHex, unsigned int Loops )
+{
+	TTimeAbsolute start, stop;
+	tBigInteger A( AHex, 16 ), B( BHex, 16 );
+	tBigInteger Product, Quotient, Remainder;
+	string Decimal;
+	ostringstream Results;
+
+	start.setNow();
+	for( unsigned int i = 0; i < Loops; i++ )
+		Product = A * B;
+	stop.setNow();
+	log() << "  multiply " << (stop - start).perSecond(Loops) << ";";
+
+	start.setNow();
+	for( unsigned int i = 0; i < Loops; i++ ) {
+		Remainder = Product;
+		Remainder.divideWithRemainder( B, Quotient );
+	}
+	stop.setNow();
+	log() << " divide " << (stop - start).perSecond(Loops) << ";";
+
+	// Each digit is a division, so this is far slower than the others
+	Loops = Loops / 16 + 1;
+	start.setNow();
+	for( unsigned int i = 0; i < Loops; i++ )
+		Decimal = A.toString(10);
+	stop.setNow();
+	log() << " toString(10) " << (stop - start).perSecond(Loops) << endl;
+
+	Results << hex << Product << " " << Quotient << " " << Remainder << " " << Decimal;
+	return Results.str();
+}
+
+//
+// Function:	checkDivision
+// Description:
+// Divide, then check the answer by multiplying back.
+//
+template <typename tBigInteger>
+static void checkDivision( const string &NHex, const string &DHex )
+{
+	tBigInteger N( NHex, 16 ), D( DHex, 16 ), Q, R;
+
+	R = N;
+	R.divideWithRemainder( D, Q );
+
+	if( !(R < D) || !(Q * D + R == N) ) {
+		ostringstream oss;
+		oss << hex << N << " / " << D << " gave " << Q << " r " << R;
+		throw logic_error( oss.str() );
+	}
+}
+
 // -------------- main()
 
 int main( int argc, char *argv[] )
@@ -2397,7 +3136,420 @@ int main( int argc, char *argv[] )
 		return 255;
 	}
 
+	try {
+		log(TLog::Status) << "Block width comparison" << endl;
+		static const char HexDigits[] = "0123456789abcdef";
+		uint32_t Seed = 0x12345678;
+
+		for( unsigned int Bits = 256; Bits <= 4096; Bits *= 2 ) {
+			string AHex, BHex;
+
+			// Arbitrary, but repeatable, operands; A is full width, B is
+			// half width so that the divide has work to do
+			for( unsigned int i = 0; i < Bits / 4; i++ ) {
+				Seed = Seed * 1103515245 + 12345;
+				AHex += HexDigits[(Seed >> 16) & 0xf];
+				if( i < Bits / 8 )
+					BHex += HexDigits[(Seed >> 20) & 0xf];
+			}
+			AHex[0] = 'f';
+			BHex[0] = 'f';
+
+			unsigned int Loops = (4096 / Bits) * (4096 / Bits) * 4;
+
+			log() << Bits << " bit <unsigned int> blocks:" << endl;
+			string Results32 = benchmarkBlockWidth<TBigUnsignedInteger>( AHex, BHex, Loops );
+			log() << Bits << " bit <unsigned long long> blocks:" << endl;
+			string Results64 = benchmarkBlockWidth<TBigUnsignedInteger64>( AHex, BHex, Loops );
+
+			if( Results32 != Results64 )
+				throw logic_error( "32 and 64 bit blocks disagree" );
+		}
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log(TLog::Status) << "Allocations" << endl;
+		TBigUnsignedInteger64 a( 1234567890123ULL ), b( 678 ), c;
+		TBigInteger64 sa( -12345 ), sb( 678 ), sc;
+		unsigned long Before;
+
+		// Numbers that fit in the inline blocks shouldn't allocate at all
+		Before = Allocations;
+		for( unsigned int i = 0; i < LOOPS / 10; i++ ) {
+			c = a + b;
+			c = c * b;
+			c = c - a;
+			c = c / b;
+			c++;
+			sc = sa * sb + sa;
+		}
+		log() << "Small operands: " << Allocations - Before << " allocations" << endl;
+		if( Allocations != Before )
+			throw logic_error( "Arithmetic on small numbers shouldn't allocate" );
+
+		// Only numbers bigger than the inline blocks go to the heap
+		TBigUnsignedInteger64 Big( TBigUnsignedInteger64(1) << 1024 );
+		Before = Allocations;
+		for( unsigned int i = 0; i < LOOPS / 100; i++ ) {
+			c = Big + b;
+			c = c * b;
+		}
+		log() << "1024 bit operands: "
+			<< static_cast<double>(Allocations - Before) / (LOOPS / 100)
+			<< " allocations per add and multiply" << endl;
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log(TLog::Status) << "Block division" << endl;
+		static const char HexDigits[] = "0123456789abcdef";
+		uint32_t Seed = 0x13572468;
+
+		// Cases that need qhat correcting, and one that needs adding
+		// back, for both block widths
+		checkDivision<TBigUnsignedInteger>( "7fffffff800000000000000000000000", "800000000000000000000001" );
+		checkDivision<TBigUnsignedInteger64>( "7fffffffffffffff800000000000000000000000000000000000000000000000", "800000000000000000000000000000000000000000000001" );
+		checkDivision<TBigUnsignedInteger>( "ffffffffffffffffffffffff", "ffffffffffffffff" );
+		checkDivision<TBigUnsignedInteger64>( "ffffffffffffffffffffffffffffffffffffffffffffffff", "ffffffffffffffffffffffffffffffff" );
+		checkDivision<TBigUnsignedInteger>( "100000000000000000000000000000000", "100000001" );
+		checkDivision<TBigUnsignedInteger64>( "100000000000000000000000000000000", "10000000000000001" );
+
+		for( unsigned int i = 0; i < 2000; i++ ) {
+			string NHex, DHex;
+			Seed = Seed * 1103515245 + 12345;
+			unsigned int NDigits = 1 + (Seed >> 16) % 160;
+			Seed = Seed * 1103515245 + 12345;
+			unsigned int DDigits = 1 + (Seed >> 16) % NDigits;
+			for( unsigned int j = 0; j < NDigits; j++ ) {
+				Seed = Seed * 1103515245 + 12345;
+				// Runs of f and 0 make for more difficult quotient digits
+				NHex += (i % 3 == 0) ? "f0"[(Seed >> 24) & 1] : HexDigits[(Seed >> 16) & 0xf];
+			}
+			for( unsigned int j = 0; j < DDigits; j++ ) {
+				Seed = Seed * 1103515245 + 12345;
+				DHex += (i % 5 == 0) ? "f0"[(Seed >> 24) & 1] : HexDigits[(Seed >> 16) & 0xf];
+			}
+			if( DHex.find_first_not_of('0') == string::npos )
+				DHex += '1';
+			checkDivision<TBigUnsignedInteger>( NHex, DHex );
+			checkDivision<TBigUnsignedInteger64>( NHex, DHex );
+		}
+		log() << "Random divisions: OK" << endl;
+
+		TBigUnsignedInteger64 Zero;
+		bool Threw = false;
+		try {
+			TBigUnsignedInteger64( 10 ) / Zero;
+		} catch( range_error &e ) {
+			Threw = true;
+		}
+		if( !Threw )
+			throw logic_error( "Division by zero didn't throw" );
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log(TLog::Status) << "Karatsuba multiplication" << endl;
+		TTimeAbsolute start, stop;
+		TBigUnsignedInteger64::tIndex DefaultThreshold = TBigUnsignedInteger64::KaratsubaThreshold;
+		static const char HexDigits[] = "0123456789abcdef";
+		uint32_t Seed = 0x87654321;
+
+		// Block counts either side of the splits, unbalanced, and all
+		// ones, which has the most carries
+		static const unsigned int Sizes[][2] = {
+			{ 4, 4 }, { 5, 5 }, { 7, 4 }, { 16, 16 }, { 17, 17 },
+			{ 33, 31 }, { 64, 9 }, { 100, 37 }, { 129, 128 }, { 0, 0 }
+		};
+		for( const unsigned int (*p)[2] = Sizes; (*p)[0] != 0; p++ ) {
+			for( unsigned int Ones = 0; Ones < 2; Ones++ ) {
+				string AHex, BHex;
+				for( unsigned int i = 0; i < (*p)[0] * 16; i++ ) {
+					Seed = Seed * 1103515245 + 12345;
+					AHex += Ones ? 'f' : HexDigits[(Seed >> 16) & 0xf];
+				}
+				for( unsigned int i = 0; i < (*p)[1] * 16; i++ ) {
+					Seed = Seed * 1103515245 + 12345;
+					BHex += Ones ? 'f' : HexDigits[(Seed >> 16) & 0xf];
+				}
+				TBigUnsignedInteger64 A( AHex, 16 ), B( BHex, 16 );
+
+				TBigUnsignedInteger64::KaratsubaThreshold = 1000000;
+				TBigUnsignedInteger64 Long = A * B;
+				TBigUnsignedInteger64::KaratsubaThreshold = 4;
+				TBigUnsignedInteger64 Karatsuba = A * B;
+				TBigUnsignedInteger64 Square = A * A;
+				TBigUnsignedInteger64::KaratsubaThreshold = 1000000;
+
+				if( Long.toString(16) != Karatsuba.toString(16) )
+					throw logic_error( "Karatsuba and long multiplication disagree" );
+				if( Square.toString(16) != (A * A).toString(16) )
+					throw logic_error( "Karatsuba squaring disagrees with long multiplication" );
+				if( Long.toString(16) != (TBigUnsignedInteger( AHex, 16 ) * TBigUnsignedInteger( BHex, 16 )).toString(16) )
+					throw logic_error( "64 bit blocks disagree with 32 bit blocks" );
+			}
+			log() << (*p)[0] << "x" << (*p)[1] << " blocks: OK" << endl;
+		}
+
+		// Where does Karatsuba start to pay?
+		for( unsigned int Bits = 1024; Bits <= 16384; Bits *= 2 ) {
+			string AHex, BHex;
+			for( unsigned int i = 0; i < Bits / 4; i++ ) {
+				Seed = Seed * 1103515245 + 12345;
+				AHex += HexDigits[(Seed >> 16) & 0xf];
+				BHex += HexDigits[(Seed >> 20) & 0xf];
+			}
+			TBigUnsignedInteger64 A( AHex, 16 ), B( BHex, 16 ), C;
+			unsigned int Loops = (16384 / Bits) * (16384 / Bits) * 2;
+
+			log() << Bits << " bits:";
+			for( TBigUnsignedInteger64::tIndex Threshold = 8; Threshold <= 256; Threshold *= 2 ) {
+				TBigUnsignedInteger64::KaratsubaThreshold = Threshold;
+				start.setNow();
+				for( unsigned int i = 0; i < Loops; i++ )
+					C = A * B;
+				stop.setNow();
+				log() << " " << Threshold << "=" << (stop - start).perSecond(Loops);
+			}
+			log() << endl;
+		}
+
+		TBigUnsignedInteger64::KaratsubaThreshold = DefaultThreshold;
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log(TLog::Status) << "Fused arithmetic" << endl;
+		static const char HexDigits[] = "0123456789abcdef";
+		uint32_t Seed = 0x24681357;
+		unsigned long Before;
+
+		for( unsigned int i = 0; i < 500; i++ ) {
+			string Hex[3];
+			for( unsigned int k = 0; k < 3; k++ ) {
+				Seed = Seed * 1103515245 + 12345;
+				unsigned int Digits = 1 + (Seed >> 16) % (i < 450 ? 80 : 800);
+				for( unsigned int j = 0; j < Digits; j++ ) {
+					Seed = Seed * 1103515245 + 12345;
+					Hex[k] += HexDigits[(Seed >> 16) & 0xf];
+				}
+			}
+			TBigUnsignedInteger64 A( Hex[0], 16 ), B( Hex[1], 16 ), C( Hex[2], 16 ), R;
+			TBigUnsignedInteger64::tIndex Shift = (Seed >> 8) % 200;
+
+			R = C;
+			if( R.multiplyAdd( A, B ) != C + A * B )
+				throw logic_error( "multiplyAdd() disagrees with + and *" );
+			R = C;
+			if( R.shiftAdd( A, Shift ) != C + (A << Shift) )
+				throw logic_error( "shiftAdd() disagrees with + and <<" );
+			if( C.compareToShifted( A, Shift ) != C.compareTo( A << Shift ) )
+				throw logic_error( "compareToShifted() disagrees with compareTo() and <<" );
+			if( (A << Shift).compareToShifted( A, Shift ) != TBigUnsignedInteger64::EqualTo )
+				throw logic_error( "compareToShifted() of equal numbers isn't EqualTo" );
+			if( TBigUnsignedInteger64::multiply( R, A, B ) != A * B
+					|| TBigUnsignedInteger64::add( R, A, B ) != A + B
+					|| TBigUnsignedInteger64::subtract( R, A + B, B ) != A )
+				throw logic_error( "Into-destination arithmetic disagrees with the operators" );
+
+			// Destinations that are also operands
+			R = A;
+			if( R.multiplyAdd( R, B ) != A + A * B )
+				throw logic_error( "multiplyAdd() of itself is wrong" );
+			R = A;
+			if( TBigUnsignedInteger64::multiply( R, B, R ) != A * B )
+				throw logic_error( "multiply() into an operand is wrong" );
+		}
+		log() << "Random fused operations: OK" << endl;
+
+		// a*b + c, the way the operators do it and the fused way, on
+		// numbers too big for the inline blocks
+		TBigUnsignedInteger64 a( TBigUnsignedInteger64(1) << 700 ), b( TBigUnsignedInteger64(3) << 500 ), c( 12345 ), R;
+		a -= 1;
+		Before = Allocations;
+		for( unsigned int i = 0; i < LOOPS / 100; i++ )
+			R = a * b + c;
+		log() << "R = a * b + c: "
+			<< static_cast<double>(Allocations - Before) / (LOOPS / 100)
+			<< " allocations" << endl;
+		// Once to grow R to fit, then it should never need to again
+		R = c;
+		R.multiplyAdd( a, b );
+		Before = Allocations;
+		for( unsigned int i = 0; i < LOOPS / 100; i++ ) {
+			R = c;
+			R.multiplyAdd( a, b );
+		}
+		log() << "R = c; R.multiplyAdd( a, b ): "
+			<< static_cast<double>(Allocations - Before) / (LOOPS / 100)
+			<< " allocations" << endl;
+		if( Allocations != Before )
+			throw logic_error( "multiplyAdd() into a grown destination shouldn't allocate" );
+		if( R != a * b + c )
+			throw logic_error( "multiplyAdd() gave the wrong answer" );
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
 	return 0;
 }
 #endif
 
+
+
+#ifdef BENCHMARK
+#include <sys/time.h>
+#include <stdio.h>
+
+//
+// Class:	TBenchmarkOperands
+// Description:
+// The numbers each benchmark works on.  A is the full operand size, B
+// half of it, and C equal to A, which makes comparison look at every
+// block.
+//
+template <typename tBigInteger>
+struct TBenchmarkOperands
+{
+	tBigInteger A, B, C, R;
+	string AString, S;
+	unsigned long Sink;
+};
+
+template <typename tBigInteger> static void benchAdd( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A + O.B; }
+template <typename tBigInteger> static void benchSubtract( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A - O.B; }
+template <typename tBigInteger> static void benchMultiply( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A * O.B; }
+template <typename tBigInteger> static void benchDivide( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A / O.B; }
+template <typename tBigInteger> static void benchShiftLeft( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A << 37; }
+template <typename tBigInteger> static void benchShiftRight( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A >> 37; }
+template <typename tBigInteger> static void benchCompare( TBenchmarkOperands<tBigInteger> &O ) { O.Sink += O.A.compareTo( O.C ); }
+template <typename tBigInteger> static void benchToString( TBenchmarkOperands<tBigInteger> &O ) { O.S = O.A.toString( 10 ); }
+template <typename tBigInteger> static void benchFromString( TBenchmarkOperands<tBigInteger> &O ) { O.R.fromString( O.AString, 10 ); }
+template <typename tBigInteger> static void benchToBytes( TBenchmarkOperands<tBigInteger> &O ) { O.S = O.A.toBytes(); }
+template <typename tBigInteger> static void benchReversedBytes( TBenchmarkOperands<tBigInteger> &O ) { O.R = O.A.reversedBytes(); }
+
+//
+// Function:	benchmark
+// Description:
+// Time one operation, doubling the loop count until it runs for at
+// least MinimumSeconds, and print a line of results.
+//
+template <typename tBigInteger>
+static void benchmark( const char *Name, void (*Operation)( TBenchmarkOperands<tBigInteger> & ),
+		TBenchmarkOperands<tBigInteger> &O, unsigned int Bits, double MinimumSeconds )
+{
+	struct timeval start, stop;
+	unsigned long Loops = 1, Before;
+	double t;
+
+	// Once first, so that R and S have grown to fit
+	Operation( O );
+
+	for( ;; ) {
+		Before = Allocations;
+		gettimeofday( &start, NULL );
+		for( unsigned long i = 0; i < Loops; i++ )
+			Operation( O );
+		gettimeofday( &stop, NULL );
+		t = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6;
+		if( t >= MinimumSeconds )
+			break;
+		Loops *= 2;
+	}
+
+	printf( "%s,%u,%u,%.1f,%.2f\n", Name,
+			static_cast<unsigned int>( tBigInteger::bitsPerBlock ), Bits,
+			t * 1e9 / Loops,
+			static_cast<double>( Allocations - Before ) / Loops );
+}
+
+//
+// Function:	benchmarkBlocks
+// Description:
+// Every operation, at every operand size, for one block width.
+//
+template <typename tBigInteger>
+static void benchmarkBlocks( double MinimumSeconds )
+{
+	static const char HexDigits[] = "0123456789abcdef";
+	static const unsigned int Sizes[] = { 64, 256, 1024, 4096, 0 };
+	uint32_t Seed = 0x5eed1234;
+
+	for( const unsigned int *pBits = Sizes; *pBits != 0; pBits++ ) {
+		TBenchmarkOperands<tBigInteger> O;
+		string AHex, BHex;
+
+		// Repeatable operands, with their top digits set so that they
+		// are the full size
+		for( unsigned int i = 0; i < *pBits / 4; i++ ) {
+			Seed = Seed * 1103515245 + 12345;
+			AHex += (i == 0) ? 'f' : HexDigits[(Seed >> 16) & 0xf];
+			if( i < *pBits / 8 )
+				BHex += (i == 0) ? 'f' : HexDigits[(Seed >> 20) & 0xf];
+		}
+		O.A.fromString( AHex, 16 );
+		O.B.fromString( BHex, 16 );
+		O.C = O.A;
+		O.AString = O.A.toString( 10 );
+		O.Sink = 0;
+
+		benchmark<tBigInteger>( "add", benchAdd<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "subtract", benchSubtract<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "multiply", benchMultiply<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "divide", benchDivide<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "shiftleft", benchShiftLeft<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "shiftright", benchShiftRight<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "compare", benchCompare<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "tostring", benchToString<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "fromstring", benchFromString<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "tobytes", benchToBytes<tBigInteger>, O, *pBits, MinimumSeconds );
+		benchmark<tBigInteger>( "reversedbytes", benchReversedBytes<tBigInteger>, O, *pBits, MinimumSeconds );
+
+		// Compare's results go here so that it can't be optimised away
+		if( O.Sink != 0 )
+			throw logic_error( "Comparison of equal numbers wasn't equal" );
+	}
+}
+
+// -------------- main()
+
+//
+// Benchmark build: "make bench" in this directory.  Prints one CSV
+// line per operation, block width and operand size:
+//
+//   operation,block_bits,operand_bits,ns_per_op,allocations_per_op
+//
+// The optional argument is the minimum time, in seconds, to run each
+// for; the default is 0.1.
+//
+int main( int argc, char *argv[] )
+{
+	double MinimumSeconds = (argc > 1) ? atof( argv[1] ) : 0.1;
+
+	try {
+		printf( "operation,block_bits,operand_bits,ns_per_op,allocations_per_op\n" );
+		benchmarkBlocks<TBigUnsignedInteger>( MinimumSeconds );
+		benchmarkBlocks<TBigUnsignedInteger64>( MinimumSeconds );
+	} catch( exception &e ) {
+		fprintf( stderr, "%s\n", e.what() );
+		return 255;
+	}
+
+	return 0;
+}
+#endif
@@ -27,6 +27,7 @@
 // --- Qt
 // --- OS
 // --- Project
+#include "smallvector.h"
 // --- Project lib
 
 
@@ -56,6 +57,7 @@
 
 
 // -------------- Class pre-declarations
+template <typename tLittleInteger> class TGenericModulus;
 
 
 // -------------- Function pre-class prototypes
@@ -84,16 +86,24 @@ class TGenericBigInteger
 		GreaterThan = 1
 	};
 	typedef tLittleInteger tStorageType;
-	typedef vector<tLittleInteger> tLittleDigitsVector;
+	// Eight blocks live inside the object, so small numbers, and the
+	// temporaries the operators make of them, don't touch the heap
+	typedef TSmallVector<tLittleInteger, 8> tLittleDigitsVector;
 	typedef typename tLittleDigitsVector::size_type tIndex;
 	static const size_t bitsPerBlock;
+	// Operands of at least this many blocks are multiplied by
+	// Karatsuba's method rather than long multiplication
+	static tIndex KaratsubaThreshold;
 
   public:
 	TGenericBigInteger() { LittleDigits.push_back(0); }
-	TGenericBigInteger( const TGenericBigInteger &O ) { operator=(O); }
+	TGenericBigInteger( const TGenericBigInteger &O ) : LittleDigits( O.LittleDigits ) {}
+#if __cplusplus >= 201103L
+	TGenericBigInteger( TGenericBigInteger &&O ) : LittleDigits( static_cast<tLittleDigitsVector &&>(O.LittleDigits) ) {}
+#endif
 	TGenericBigInteger( const string &s, unsigned int b = 10 ) { fromString(s,b); }
 	TGenericBigInteger( int t ) { operator=(static_cast<unsigned int>(t) ); }
-	TGenericBigInteger( tLittleInteger r0 ) { operator=(r0); }
+	TGenericBigInteger( unsigned int r0 ) { operator=(r0); }
 	TGenericBigInteger( tLittleInteger r1, tLittleInteger r0 );
 	TGenericBigInteger( tLittleInteger r2, tLittleInteger r1, tLittleInteger r0 );
 	TGenericBigInteger( tLittleInteger r3, tLittleInteger r2, tLittleInteger r1, tLittleInteger r0 );
@@ -108,12 +118,15 @@ class TGenericBigInteger
 //	TGenericBigInteger &operator=( unsigned int t ) { LittleDigits.clear(); LittleDigits.push_back(t); return *this; }
 	TGenericBigInteger &operator=( unsigned long long t );
 	TGenericBigInteger &operator=( const TGenericBigInteger &O ) { LittleDigits = O.LittleDigits; return *this; }
+#if __cplusplus >= 201103L
+	TGenericBigInteger &operator=( TGenericBigInteger &&O ) { LittleDigits = static_cast<tLittleDigitsVector &&>(O.LittleDigits); return *this; }
+#endif
 	TGenericBigInteger &fromBytes( const string & );
 
 	// Access
 	bool getBit( tIndex bi ) const {
 		if( bi/bitsPerBlock < LittleDigits.size() ) {
-			return (LittleDigits[bi/bitsPerBlock] & (1 << (bi % bitsPerBlock))) != 0;
+			return (LittleDigits[bi/bitsPerBlock] & (static_cast<tLittleInteger>(1) << (bi % bitsPerBlock))) != 0;
 		} else {
 			return false;
 		}
@@ -138,6 +151,17 @@ class TGenericBigInteger
 	TGenericBigInteger &blockShiftRight( tIndex );
 	TGenericBigInteger &divideWithRemainder(const TGenericBigInteger &b, TGenericBigInteger &q);
 
+	// Arithmetic - Fused; these make no temporaries
+	TGenericBigInteger &multiplyAdd( const TGenericBigInteger &A, const TGenericBigInteger &B );
+	TGenericBigInteger &shiftAdd( const TGenericBigInteger &X, tIndex Bits );
+	eComparisonResult compareToShifted( const TGenericBigInteger &X, tIndex Bits ) const;
+
+	// Arithmetic - Into a caller's destination, which keeps its storage
+	// from one use to the next
+	static TGenericBigInteger &add( TGenericBigInteger &R, const TGenericBigInteger &A, const TGenericBigInteger &B );
+	static TGenericBigInteger &subtract( TGenericBigInteger &R, const TGenericBigInteger &A, const TGenericBigInteger &B );
+	static TGenericBigInteger &multiply( TGenericBigInteger &R, const TGenericBigInteger &A, const TGenericBigInteger &B );
+
 	TGenericBigInteger &operator++() { return (*this += 1);}
 	TGenericBigInteger &operator++( int ) { return (*this += 1);}
 	TGenericBigInteger &operator--() { return (*this -= 1); }
@@ -176,6 +200,9 @@ class TGenericBigInteger
 
   protected:
 	void normalise();
+	tLittleInteger divideByBlock( tLittleInteger );
+	void multiplyAndAddBlock( tLittleInteger, tLittleInteger );
+	tLittleInteger shiftedBlock( tIndex, tIndex ) const;
 
 	virtual unsigned int fromCharacter( unsigned int, unsigned int ) const;
 	virtual unsigned int toCharacter( unsigned int, unsigned int ) const;
@@ -184,9 +211,30 @@ class TGenericBigInteger
   protected:
 	tLittleDigitsVector LittleDigits;
 
+	// Montgomery multiplication works on the blocks directly
+	friend class TGenericModulus<tLittleInteger>;
+
   private:
 	static void blockMultiply(tLittleInteger &R1, tLittleInteger &R0,
 		tLittleInteger B, const tLittleInteger C );
+	static void blockDivide( tLittleInteger &Q, tLittleInteger &R,
+		tLittleInteger N1, tLittleInteger N0, tLittleInteger D );
+	static tLittleInteger addWithCarry( tLittleInteger &R,
+		tLittleInteger A, tLittleInteger B, tLittleInteger Carry );
+	static tLittleInteger subtractWithBorrow( tLittleInteger &R,
+		tLittleInteger A, tLittleInteger B, tLittleInteger Borrow );
+	static tLittleInteger addBlocks( tLittleInteger *R, tIndex RN,
+		const tLittleInteger *X, tIndex XN );
+	static tLittleInteger subtractBlocks( tLittleInteger *R, tIndex RN,
+		const tLittleInteger *X, tIndex XN );
+	static void multiplyBlocks( tLittleInteger *R,
+		const tLittleInteger *A, tIndex AN, const tLittleInteger *B, tIndex BN );
+	static void longMultiply( tLittleInteger *R,
+		const tLittleInteger *A, tIndex AN, const tLittleInteger *B, tIndex BN );
+	static void karatsubaMultiply( tLittleInteger *R,
+		const tLittleInteger *A, const tLittleInteger *B, tIndex N,
+		tLittleInteger *Scratch );
+	static tIndex karatsubaScratchSize( tIndex N );
 
 };
 
@@ -207,11 +255,14 @@ class TGenericBigSignedInteger : public TGenericBigInteger<tLittleInteger>
 
   public:
 	TGenericBigSignedInteger() : Negative(false) {}
-	TGenericBigSignedInteger( const TGenericBigSignedInteger &O ) { operator=(O); }
+	TGenericBigSignedInteger( const TGenericBigSignedInteger &O ) : TGenericBigInteger<tLittleInteger>( O ), Negative( O.Negative ) {}
+#if __cplusplus >= 201103L
+	TGenericBigSignedInteger( TGenericBigSignedInteger &&O ) : TGenericBigInteger<tLittleInteger>( static_cast<TGenericBigInteger<tLittleInteger> &&>(O) ), Negative( O.Negative ) {}
+#endif
 	explicit TGenericBigSignedInteger( const TGenericBigInteger<tLittleInteger> &O ) { operator=(O); }
 	TGenericBigSignedInteger( const string &s, unsigned int b = 10 ) { fromString(s,b); }
 	TGenericBigSignedInteger( int t ) { operator=(t); }
-	TGenericBigSignedInteger( tLittleInteger r0 ) { operator=(r0); }
+	TGenericBigSignedInteger( unsigned int r0 ) { operator=(r0); }
 	TGenericBigSignedInteger( tLittleInteger r1, tLittleInteger r0 );
 	TGenericBigSignedInteger( tLittleInteger r2, tLittleInteger r1, tLittleInteger r0 );
 	TGenericBigSignedInteger( tLittleInteger r3, tLittleInteger r2, tLittleInteger r1, tLittleInteger r0 );
@@ -226,6 +277,9 @@ class TGenericBigSignedInteger : public TGenericBigInteger<tLittleInteger>
 	TGenericBigSignedInteger &operator=( const string &s ) { return fromString(s, 10); }
 	TGenericBigSignedInteger &operator=( long long t );
 	TGenericBigSignedInteger &operator=( const TGenericBigSignedInteger &O ) { TGenericBigInteger<tLittleInteger>::operator=(O); Negative=O.Negative; return *this; }
+#if __cplusplus >= 201103L
+	TGenericBigSignedInteger &operator=( TGenericBigSignedInteger &&O ) { TGenericBigInteger<tLittleInteger>::operator=( static_cast<TGenericBigInteger<tLittleInteger> &&>(O) ); Negative=O.Negative; return *this; }
+#endif
 	TGenericBigSignedInteger &operator=( const TGenericBigInteger<tLittleInteger> &O ) { TGenericBigInteger<tLittleInteger>::operator=(O); Negative=false; return *this; }
 	TGenericBigSignedInteger &fromBytes( const string & );
 
@@ -301,13 +355,40 @@ inline ostream &operator<<( ostream &s, const TGenericBigInteger<tLittleInteger>
 
 // -------------- Template instantiations
 
+// Block arithmetic specialised where the compiler can do better than
+// the generic version; see extraint.cc
+template <> void TGenericBigInteger<unsigned int>::blockMultiply(
+	unsigned int &, unsigned int &, unsigned int, const unsigned int );
+template <> void TGenericBigInteger<unsigned int>::blockDivide(
+	unsigned int &, unsigned int &, unsigned int, unsigned int, unsigned int );
+#ifdef __SIZEOF_INT128__
+template <> void TGenericBigInteger<unsigned long long>::blockMultiply(
+	unsigned long long &, unsigned long long &, unsigned long long, const unsigned long long );
+template <> void TGenericBigInteger<unsigned long long>::blockDivide(
+	unsigned long long &, unsigned long long &, unsigned long long, unsigned long long, unsigned long long );
+#endif
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_addcll) && __has_builtin(__builtin_subcll)
+template <> unsigned long long TGenericBigInteger<unsigned long long>::addWithCarry(
+	unsigned long long &, unsigned long long, unsigned long long, unsigned long long );
+template <> unsigned long long TGenericBigInteger<unsigned long long>::subtractWithBorrow(
+	unsigned long long &, unsigned long long, unsigned long long, unsigned long long );
+#endif
+#endif
+
 // Forward declarations explicitly instantiated templates
 extern template class TGenericBigInteger<unsigned int>;
 extern template class TGenericBigSignedInteger<unsigned int>;
+extern template class TGenericBigInteger<unsigned long long>;
+extern template class TGenericBigSignedInteger<unsigned long long>;
 
 // Shortnames
 typedef TGenericBigInteger<unsigned int> TBigUnsignedInteger;
 typedef TGenericBigSignedInteger<unsigned int> TBigInteger;
+// Half as many limbs, and each limb product is a single multiply
+// instruction where the compiler has a 128 bit type
+typedef TGenericBigInteger<unsigned long long> TBigUnsignedInteger64;
+typedef TGenericBigSignedInteger<unsigned long long> TBigInteger64;
 
 
 
@@ -0,0 +1,470 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   iouring.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "iouring.h"
+
+// -------------- Includes
+// --- C
+#include <errno.h>
+#include <string.h>
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// --- Project libs
+// --- Project
+#include "extraexcept.h"
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+#ifdef HAVE_IO_URING
+//
+// Function:	TIOUring :: TIOUring
+// Description:
+// Creates a ring with room for at least n submissions.
+//
+TIOUring::TIOUring( unsigned int n ) :
+	SQRing( MAP_FAILED ),
+	CQRing( MAP_FAILED ),
+	SQEs( reinterpret_cast<struct io_uring_sqe *>( MAP_FAILED ) ),
+	SQLocalTail( 0 ),
+	SystemCalls( 0 )
+{
+	struct io_uring_params p;
+	unsigned char *sq, *cq;
+
+	memset( &p, 0, sizeof(p) );
+	RingDescriptor = syscall( __NR_io_uring_setup, n, &p );
+	if( RingDescriptor < 0 )
+		throw libc_error( "io_uring_setup()" );
+
+	SQRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	CQRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	SQEsSize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	// Newer kernels let both rings share one mapping
+	if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if( CQRingSize > SQRingSize )
+			SQRingSize = CQRingSize;
+		CQRingSize = 0;
+	}
+
+	SQRing = mmap( NULL, SQRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, RingDescriptor, IORING_OFF_SQ_RING );
+	if( SQRing == MAP_FAILED ) {
+		close( RingDescriptor );
+		throw libc_error( "mmap(IORING_OFF_SQ_RING)" );
+	}
+	if( CQRingSize == 0 ) {
+		cq = reinterpret_cast<unsigned char *>( SQRing );
+	} else {
+		CQRing = mmap( NULL, CQRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, RingDescriptor, IORING_OFF_CQ_RING );
+		if( CQRing == MAP_FAILED ) {
+			munmap( SQRing, SQRingSize );
+			close( RingDescriptor );
+			throw libc_error( "mmap(IORING_OFF_CQ_RING)" );
+		}
+		cq = reinterpret_cast<unsigned char *>( CQRing );
+	}
+	SQEs = reinterpret_cast<struct io_uring_sqe *>( mmap( NULL, SQEsSize,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				RingDescriptor, IORING_OFF_SQES ) );
+	if( SQEs == MAP_FAILED ) {
+		if( CQRing != MAP_FAILED )
+			munmap( CQRing, CQRingSize );
+		munmap( SQRing, SQRingSize );
+		close( RingDescriptor );
+		throw libc_error( "mmap(IORING_OFF_SQES)" );
+	}
+
+	sq = reinterpret_cast<unsigned char *>( SQRing );
+	SQHead = reinterpret_cast<unsigned int *>( sq + p.sq_off.head );
+	SQTail = reinterpret_cast<unsigned int *>( sq + p.sq_off.tail );
+	SQMask = *reinterpret_cast<unsigned int *>( sq + p.sq_off.ring_mask );
+	SQEntries = p.sq_entries;
+	SQArray = reinterpret_cast<unsigned int *>( sq + p.sq_off.array );
+	SQLocalTail = *SQTail;
+
+	CQHead = reinterpret_cast<unsigned int *>( cq + p.cq_off.head );
+	CQTail = reinterpret_cast<unsigned int *>( cq + p.cq_off.tail );
+	CQMask = *reinterpret_cast<unsigned int *>( cq + p.cq_off.ring_mask );
+	CQEs = reinterpret_cast<struct io_uring_cqe *>( cq + p.cq_off.cqes );
+}
+
+//
+// Function:	TIOUring :: ~TIOUring
+// Description:
+//
+TIOUring::~TIOUring()
+{
+	munmap( SQEs, SQEsSize );
+	if( CQRing != MAP_FAILED )
+		munmap( CQRing, CQRingSize );
+	munmap( SQRing, SQRingSize );
+	close( RingDescriptor );
+}
+
+//
+// Function:	TIOUring :: getSQE
+// Description:
+// Returns a cleared submission queue entry for the caller to fill in,
+// or NULL if the queue is full, in which case submit() and try again.
+//
+struct io_uring_sqe *TIOUring::getSQE()
+{
+	unsigned int Index;
+
+	__sync_synchronize();
+	if( SQLocalTail - *SQHead >= SQEntries )
+		return NULL;
+
+	Index = SQLocalTail & SQMask;
+	SQArray[Index] = Index;
+	SQLocalTail++;
+
+	memset( &SQEs[Index], 0, sizeof(SQEs[Index]) );
+	return &SQEs[Index];
+}
+
+//
+// Function:	TIOUring :: submit
+// Description:
+// Gives the kernel everything from getSQE() since the last submit(),
+// and waits until at least Wait completions are available.  Both are
+// done in one system call.  Returns the number submitted.
+//
+unsigned int TIOUring::submit( unsigned int Wait )
+{
+	unsigned int ToSubmit;
+	int ret;
+
+	// The entries must be complete before the kernel can see the tail
+	__sync_synchronize();
+	ToSubmit = SQLocalTail - *SQTail;
+	*SQTail = SQLocalTail;
+	__sync_synchronize();
+
+	if( ToSubmit == 0 && Wait == 0 )
+		return 0;
+
+	SystemCalls++;
+	ret = syscall( __NR_io_uring_enter, RingDescriptor, ToSubmit, Wait,
+			Wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+	if( ret < 0 ) {
+		if( errno == EINTR )
+			return 0;
+		throw libc_error( "io_uring_enter()" );
+	}
+
+	return ret;
+}
+
+//
+// Function:	TIOUring :: nextCQE
+// Description:
+// Copies the next completion out of the ring, if there is one.
+//
+bool TIOUring::nextCQE( struct io_uring_cqe &cqe )
+{
+	unsigned int Head = *CQHead;
+
+	__sync_synchronize();
+	if( Head == *CQTail )
+		return false;
+	__sync_synchronize();
+
+	cqe = CQEs[Head & CQMask];
+
+	// Done with the slot; the kernel may reuse it
+	__sync_synchronize();
+	*CQHead = Head + 1;
+
+	return true;
+}
+
+//
+// Function:	TIOUring :: registerBuffers
+// Description:
+// Registers buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED,
+// which then refer to them by index.  The kernel pins them once, here,
+// rather than on every operation.
+//
+void TIOUring::registerBuffers( const struct iovec *iov, unsigned int n )
+{
+	SystemCalls++;
+	if( syscall( __NR_io_uring_register, RingDescriptor, IORING_REGISTER_BUFFERS, iov, n ) < 0 )
+		throw libc_error( "io_uring_register(IORING_REGISTER_BUFFERS)" );
+}
+#endif
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <stdlib.h>
+#include <vector>
+#include <memory>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "socketpoller.h"
+#include "logstream.h"
+
+//
+// Struct:	TUnitTestResult
+// Description:
+//
+struct TUnitTestResult {
+	double Seconds;
+	unsigned long long SystemCalls;
+};
+
+//
+// Function:	makePairs
+// Description:
+// Count socketpairs; the first of each pair is non-blocking and is
+// what we read from.
+//
+static void makePairs( unsigned int Count, vector<int> &Near, vector<int> &Far )
+{
+	int sv[2];
+
+	for( unsigned int i = 0; i < Count; i++ ) {
+		if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) < 0 )
+			throw socket_error( "socketpair()" );
+		TSocketPoller::setNonBlocking( sv[0] );
+		Near.push_back( sv[0] );
+		Far.push_back( sv[1] );
+	}
+}
+
+//
+// Function:	closePairs
+// Description:
+//
+static void closePairs( vector<int> &Near, vector<int> &Far )
+{
+	for( unsigned int i = 0; i < Near.size(); i++ ) {
+		close( Near[i] );
+		close( Far[i] );
+	}
+	Near.clear();
+	Far.clear();
+}
+
+//
+// Function:	sendToAll
+// Description:
+// Writes a small message to every far end, as if every peer had sent
+// us something at once.
+//
+static void sendToAll( const vector<int> &Far )
+{
+	static const char Message[64] = "inv";
+
+	for( unsigned int i = 0; i < Far.size(); i++ ) {
+		if( write( Far[i], Message, sizeof(Message) ) != sizeof(Message) )
+			throw libc_error( "write()" );
+	}
+}
+
+//
+// Function:	pollerBenchmark
+// Description:
+// Each round, every peer sends, and we wait and read until we have
+// heard from all of them.  Only the receiving is timed.
+//
+static TUnitTestResult pollerBenchmark( TSocketPoller &P, unsigned int Count, unsigned int Rounds )
+{
+	vector<int> Near, Far;
+	vector<TSocketPoller::TEvent> Events;
+	struct timeval start, end;
+	TUnitTestResult Result;
+	unsigned int Round, i, Received;
+	char buffer[16384];
+	ssize_t n;
+
+	makePairs( Count, Near, Far );
+	for( i = 0; i < Count; i++ )
+		P.add( Near[i] );
+
+	Result.SystemCalls = 0;
+	Result.Seconds = 0;
+	for( Round = 0; Round < Rounds; Round++ ) {
+		sendToAll( Far );
+		gettimeofday( &start, NULL );
+		Received = 0;
+		while( Received < Count ) {
+			Result.SystemCalls++;
+			P.wait( 1000, Events );
+			for( i = 0; i < Events.size(); i++ ) {
+				if( !Events[i].Readable )
+					continue;
+				// Edge triggered, so read until it would block
+				do {
+					Result.SystemCalls++;
+					n = read( Events[i].Descriptor, buffer, sizeof(buffer) );
+				} while( n > 0 );
+				Received++;
+			}
+		}
+		gettimeofday( &end, NULL );
+		Result.Seconds += (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	}
+
+	for( i = 0; i < Count; i++ )
+		P.remove( Near[i] );
+	closePairs( Near, Far );
+
+	return Result;
+}
+
+#ifdef HAVE_IO_URING
+//
+// Function:	ringBenchmark
+// Description:
+// As pollerBenchmark(), but every socket always has a receive into its
+// own registered buffer outstanding.  Each completion is re-armed, and
+// all the re-arms go to the kernel in the same io_uring_enter() that
+// waits for the next completions.
+//
+static TUnitTestResult ringBenchmark( unsigned int Count, unsigned int Rounds )
+{
+	static const unsigned int BUFFER_SIZE = 16384;
+	TIOUring Ring( Count );
+	vector<int> Near, Far;
+	vector<unsigned char> Buffers( Count * BUFFER_SIZE );
+	vector<struct iovec> iov( Count );
+	struct io_uring_cqe cqe;
+	struct io_uring_sqe *sqe;
+	struct timeval start, end;
+	TUnitTestResult Result;
+	unsigned int Round, i, Received;
+
+	makePairs( Count, Near, Far );
+	for( i = 0; i < Count; i++ ) {
+		iov[i].iov_base = &Buffers[i * BUFFER_SIZE];
+		iov[i].iov_len = BUFFER_SIZE;
+	}
+	Ring.registerBuffers( &iov[0], Count );
+
+	for( i = 0; i < Count; i++ ) {
+		sqe = Ring.getSQE();
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->fd = Near[i];
+		sqe->addr = reinterpret_cast<unsigned long>( iov[i].iov_base );
+		sqe->len = BUFFER_SIZE;
+		sqe->buf_index = i;
+		sqe->user_data = i;
+	}
+
+	Result.Seconds = 0;
+	for( Round = 0; Round < Rounds; Round++ ) {
+		sendToAll( Far );
+		gettimeofday( &start, NULL );
+		Received = 0;
+		while( Received < Count ) {
+			Ring.submit( 1 );
+			while( Ring.nextCQE( cqe ) ) {
+				if( cqe.res <= 0 )
+					throw runtime_error( "IORING_OP_READ_FIXED failed" );
+				Received++;
+				i = cqe.user_data;
+				sqe = Ring.getSQE();
+				sqe->opcode = IORING_OP_READ_FIXED;
+				sqe->fd = Near[i];
+				sqe->addr = reinterpret_cast<unsigned long>( iov[i].iov_base );
+				sqe->len = BUFFER_SIZE;
+				sqe->buf_index = i;
+				sqe->user_data = i;
+			}
+		}
+		gettimeofday( &end, NULL );
+		Result.Seconds += (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	}
+	Result.SystemCalls = Ring.getSystemCalls();
+
+	// Closing the far ends completes the outstanding reads
+	closePairs( Near, Far );
+	Ring.submit( 0 );
+
+	return Result;
+}
+#endif
+
+//
+// Function:	report
+// Description:
+//
+static void report( const char *Name, unsigned int Count, unsigned int Rounds, const TUnitTestResult &R )
+{
+	log() << Name << ": " << Count << " peers, " << Rounds << " rounds, "
+		<< R.Seconds * 1e6 / Rounds << "us/round, "
+		<< double(R.SystemCalls) / Rounds << " syscalls/round" << endl;
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	static const unsigned int ROUNDS = 200;
+	static const unsigned int COUNTS[] = { 100, 500, 0 };
+
+	try {
+		struct rlimit rl;
+		const unsigned int *Count;
+
+		// Two descriptors per peer
+		if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < 2100 ) {
+			rl.rlim_cur = rl.rlim_max < 2100 ? rl.rlim_max : 2100;
+			setrlimit( RLIMIT_NOFILE, &rl );
+		}
+
+		for( Count = COUNTS; *Count != 0; Count++ ) {
+			TSocketPoller_select S;
+			report( S.className(), *Count, ROUNDS, pollerBenchmark( S, *Count, ROUNDS ) );
+
+			auto_ptr<TSocketPoller> P( TSocketPoller::createBest() );
+			report( P->className(), *Count, ROUNDS, pollerBenchmark( *P, *Count, ROUNDS ) );
+
+#ifdef HAVE_IO_URING
+			report( "TIOUring", *Count, ROUNDS, ringBenchmark( *Count, ROUNDS ) );
+#endif
+		}
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
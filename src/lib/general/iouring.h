@@ -0,0 +1,151 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   iouring.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef IOURING_H
+#define IOURING_H
+
+// -------------- Includes
+// --- C
+// --- C++
+// --- Qt
+// --- OS
+#if defined(__linux__) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		include <linux/io_uring.h>
+#	endif
+#endif
+#include <sys/uio.h>
+// --- Project
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+// Multishot accept is the newest thing we use.  Whether the running
+// kernel supports any of it is only discovered when a TIOUring is
+// constructed.
+#if defined(IORING_ACCEPT_MULTISHOT)
+#	define HAVE_IO_URING 1
+#endif
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+#ifdef HAVE_IO_URING
+//
+// Class:	TIOUring
+// Description:
+// A minimal io_uring, driven by the raw system calls so that we don't
+// depend on liburing.
+//
+// Callers fill in submission queue entries from getSQE(), then a
+// single submit() hands all of them to the kernel and optionally waits
+// for completions, which are then collected with nextCQE().  Only one
+// thread may use a TIOUring.
+//
+// The constructor throws libc_error if the kernel doesn't support
+// io_uring, so a caller can fall back to something else.
+//
+class TIOUring
+{
+  public:
+	TIOUring( unsigned int );
+	~TIOUring();
+
+	struct io_uring_sqe *getSQE();
+	unsigned int submit( unsigned int = 0 );
+	bool nextCQE( struct io_uring_cqe & );
+
+	void registerBuffers( const struct iovec *, unsigned int );
+
+	unsigned int getSystemCalls() const { return SystemCalls; }
+
+  protected:
+	int RingDescriptor;
+
+	void *SQRing;
+	size_t SQRingSize;
+	void *CQRing;
+	size_t CQRingSize;
+	struct io_uring_sqe *SQEs;
+	size_t SQEsSize;
+
+	volatile unsigned int *SQHead;
+	volatile unsigned int *SQTail;
+	unsigned int SQMask;
+	unsigned int SQEntries;
+	unsigned int *SQArray;
+	// Entries filled in but not yet made visible to the kernel
+	unsigned int SQLocalTail;
+
+	volatile unsigned int *CQHead;
+	volatile unsigned int *CQTail;
+	unsigned int CQMask;
+	struct io_uring_cqe *CQEs;
+
+	unsigned int SystemCalls;
+
+  private:
+	// Not copyable
+	TIOUring( const TIOUring & );
+	TIOUring &operator=( const TIOUring & );
+};
+#endif
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
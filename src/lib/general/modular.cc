@@ -0,0 +1,648 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   modular.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "modular.h"
+
+// -------------- Includes
+// --- C
+// --- C++
+#include <vector>
+// --- Qt
+// --- OS
+// --- Project libs
+// --- Project
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+//
+// Function:	TGenericModulus :: TGenericModulus
+// Description:
+// Work out the Barrett and, for odd moduli, Montgomery constants.
+//
+template <typename tLittleInteger>
+TGenericModulus<tLittleInteger>::TGenericModulus( const tInteger &M ) :
+	Modulus( M ),
+	Odd( false ),
+	NegativeInverse( 0 )
+{
+	if( !M.isValid() || M < tInteger(2U) )
+		throw range_error( "TGenericModulus: modulus must be at least two" );
+
+	Blocks = Modulus.LittleDigits.size();
+
+	// Mu = floor(b^2k / M)
+	Mu = 1U;
+	Mu.blockShiftLeft( 2 * Blocks );
+	Mu /= Modulus;
+
+	Odd = Modulus.getBit(0);
+	if( !Odd )
+		return;
+
+	// Newton's iteration for 1/M0 modulo one block: if x is right in
+	// its bottom n bits, x(2 - M0x) is right in its bottom 2n.  M0 is
+	// its own inverse in the bottom three bits, for any odd M0.
+	const tLittleInteger M0 = Modulus.LittleDigits[0];
+	tLittleInteger x = M0;
+	for( size_t Good = 3; Good < tInteger::bitsPerBlock; Good *= 2 )
+		x *= static_cast<tLittleInteger>(2) - M0 * x;
+	NegativeInverse = static_cast<tLittleInteger>(0) - x;
+
+	// R^2 mod M, which toMontgomery() multiplies by
+	RSquared = 1U;
+	RSquared.blockShiftLeft( 2 * Blocks );
+	RSquared %= Modulus;
+}
+
+//
+// Function:	TGenericModulus :: reduce
+// Description:
+// X mod M.  Barrett's method handles anything up to twice the
+// modulus' length, which includes every product of two residues;
+// anything bigger is divided.
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::reduce( const tInteger &X ) const
+{
+	if( !X.isValid() || X < Modulus )
+		return X;
+	if( X.LittleDigits.size() > 2 * Blocks )
+		return X % Modulus;
+
+	// Q = floor( floor(X / b^(k-1)) * Mu / b^(k+1) ), which is at most
+	// two less than floor(X / M)
+	tInteger Q( X );
+	Q.blockShiftRight( Blocks - 1 );
+	Q *= Mu;
+	Q.blockShiftRight( Blocks + 1 );
+	Q *= Modulus;
+
+	tInteger R( X );
+	R -= Q;
+	while( R >= Modulus )
+		R -= Modulus;
+
+	return R;
+}
+
+//
+// Function:	TGenericModulus :: add
+// Description:
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::add( const tInteger &A, const tInteger &B ) const
+{
+	tInteger R( A );
+
+	R += B;
+	if( R >= Modulus )
+		R -= Modulus;
+
+	return R;
+}
+
+//
+// Function:	TGenericModulus :: subtract
+// Description:
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::subtract( const tInteger &A, const tInteger &B ) const
+{
+	tInteger R( A );
+
+	// The big integers are unsigned, so go via A + M when B is bigger
+	if( R < B )
+		R += Modulus;
+	R -= B;
+
+	return R;
+}
+
+//
+// Function:	TGenericModulus :: power
+// Description:
+// Base^Exponent mod M by sliding windows.
+//
+// The odd powers Base^1, Base^3 ... Base^(2^w - 1) are made first;
+// then the exponent is read from the top, squaring once per bit, and
+// each run of up to w bits that starts and ends with a one costs a
+// single multiply by one of those.  Odd moduli do all of this in
+// Montgomery form.
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::power( const tInteger &Base, const tInteger &Exponent ) const
+{
+	tInteger (TGenericModulus::*Multiply)( const tInteger &, const tInteger & ) const;
+
+	if( !Base.isValid() || !Exponent.isValid() )
+		return tInteger();
+
+	if( Exponent.isZero() )
+		return tInteger(1U);
+
+	tIndex Bits = Exponent.highestBit() + 1;
+	unsigned int Window = windowBits( Bits );
+	vector<tInteger> OddPowers( static_cast<size_t>(1) << (Window - 1) );
+
+	if( Odd ) {
+		Multiply = &TGenericModulus::montgomeryMultiply;
+		OddPowers[0] = toMontgomery( Base );
+	} else {
+		Multiply = &TGenericModulus::multiply;
+		OddPowers[0] = reduce( Base );
+	}
+	if( OddPowers.size() > 1 ) {
+		tInteger Square( (this->*Multiply)( OddPowers[0], OddPowers[0] ) );
+		for( size_t k = 1; k < OddPowers.size(); k++ )
+			OddPowers[k] = (this->*Multiply)( OddPowers[k-1], Square );
+	}
+
+	tInteger R;
+	bool Started = false;
+	tIndex i = Bits;
+
+	while( i > 0 ) {
+		if( !Exponent.getBit( i - 1 ) ) {
+			R = (this->*Multiply)( R, R );
+			i--;
+			continue;
+		}
+
+		// The longest window, no wider than Window, from bit i-1 down
+		// to a one bit
+		tIndex Low = (i > Window) ? i - Window : 0;
+		while( !Exponent.getBit( Low ) )
+			Low++;
+
+		unsigned int Value = 0;
+		for( tIndex k = i; k > Low; k-- ) {
+			Value = (Value << 1) | (Exponent.getBit( k - 1 ) ? 1 : 0);
+			if( Started )
+				R = (this->*Multiply)( R, R );
+		}
+		R = Started ? (this->*Multiply)( R, OddPowers[Value >> 1] ) : OddPowers[Value >> 1];
+		Started = true;
+
+		i = Low;
+	}
+
+	return Odd ? fromMontgomery( R ) : R;
+}
+
+//
+// Function:	TGenericModulus :: inverse
+// Description:
+// The X for which AX = 1 mod M, by the extended Euclidean algorithm.
+// Throws range_error if A and M aren't coprime, in which case there
+// isn't one.
+//
+// The coefficients are kept as residues, which saves needing signed
+// numbers: each R_i is T_i.A mod M, with R_0 = M, T_0 = 0 and R_1 = A,
+// T_1 = 1.
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::inverse( const tInteger &A ) const
+{
+	tInteger R0( Modulus ), R1( reduce( A ) );
+	tInteger T0( 0U ), T1( 1U );
+	tInteger Q;
+
+	while( !R1.isZero() ) {
+		tInteger R2( R0 );
+		R2.divideWithRemainder( R1, Q );
+		R0 = R1;
+		R1 = R2;
+
+		tInteger T2( subtract( T0, reduce( Q * T1 ) ) );
+		T0 = T1;
+		T1 = T2;
+	}
+
+	if( !(R0 == tInteger(1U)) )
+		throw range_error( "TGenericModulus::inverse: number and modulus aren't coprime" );
+
+	return T0;
+}
+
+//
+// Function:	TGenericModulus :: toMontgomery
+// Description:
+// XR mod M; Montgomery multiplying by R^2 does that without a division.
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::toMontgomery( const tInteger &X ) const
+{
+	return montgomeryMultiply( reduce( X ), RSquared );
+}
+
+//
+// Function:	TGenericModulus :: fromMontgomery
+// Description:
+// X/R mod M, by Montgomery multiplying by one.
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::fromMontgomery( const tInteger &X ) const
+{
+	return montgomeryMultiply( X, tInteger(1U) );
+}
+
+//
+// Function:	TGenericModulus :: montgomeryMultiply
+// Description:
+// AB/R mod M, for A and B less than M.
+//
+// This is the coarsely integrated operand scanning form: for each block
+// of A, add that multiple of B to the total, then add the multiple of
+// M that makes the bottom block zero, and drop the bottom block.  The
+// total never exceeds 2M, so it needs only k + 2 blocks, and one
+// subtraction at the end makes it a residue.
+//
+template <typename tLittleInteger>
+typename TGenericModulus<tLittleInteger>::tInteger
+TGenericModulus<tLittleInteger>::montgomeryMultiply( const tInteger &A, const tInteger &B ) const
+{
+	if( !Odd )
+		throw logic_error( "TGenericModulus::montgomeryMultiply: modulus is even" );
+	if( !A.isValid() || !B.isValid() )
+		return tInteger();
+
+	const tIndex n = Blocks;
+	const tIndex AN = min( A.LittleDigits.size(), n );
+	const tIndex BN = min( B.LittleDigits.size(), n );
+	const tLittleInteger *Ap = A.LittleDigits.begin();
+	const tLittleInteger *Bp = B.LittleDigits.begin();
+	const tLittleInteger *Mp = Modulus.LittleDigits.begin();
+	TSmallVector<tLittleInteger, 18> T( n + 2, 0 );
+	tLittleInteger Carry, Discard;
+
+	for( tIndex i = 0; i < n; i++ ) {
+		tLittleInteger a = (i < AN) ? Ap[i] : 0;
+
+		// T += a.B
+		Carry = 0;
+		for( tIndex j = 0; j < BN; j++ )
+			Carry = multiplyAccumulate( T[j], a, Bp[j], T[j], Carry );
+		for( tIndex j = BN; j < n; j++ )
+			Carry = tInteger::addWithCarry( T[j], T[j], 0, Carry );
+		T[n+1] = tInteger::addWithCarry( T[n], T[n], Carry, 0 );
+
+		// T = (T + m.M) / b, where m makes the bottom block zero
+		tLittleInteger m = T[0] * NegativeInverse;
+		Carry = multiplyAccumulate( Discard, m, Mp[0], T[0], 0 );
+		for( tIndex j = 1; j < n; j++ )
+			Carry = multiplyAccumulate( T[j-1], m, Mp[j], T[j], Carry );
+		Carry = tInteger::addWithCarry( T[n-1], T[n], Carry, 0 );
+		T[n] = T[n+1] + Carry;
+	}
+
+	tInteger R;
+	R.LittleDigits.assign( T.begin(), T.begin() + n + 1 );
+	R.normalise();
+	if( R >= Modulus )
+		R -= Modulus;
+
+	return R;
+}
+
+//
+// Function:	TGenericModulus :: windowBits
+// Description:
+// Window width for an exponent of the given length.  Wider windows
+// save multiplies but cost 2^(w-1) to set up, so only pay for long
+// exponents.
+//
+template <typename tLittleInteger>
+unsigned int TGenericModulus<tLittleInteger>::windowBits( tIndex Bits )
+{
+	if( Bits > 671 )
+		return 6;
+	if( Bits > 239 )
+		return 5;
+	if( Bits > 79 )
+		return 4;
+	if( Bits > 23 )
+		return 3;
+	return 1;
+}
+
+//
+// Function:	TGenericModulus :: multiplyAccumulate
+// Description:
+// R = low block of A.B + X + Carry, returning the high block.  That
+// can't overflow two blocks: (b-1)^2 + 2(b-1) = b^2 - 1.
+//
+template <typename tLittleInteger>
+tLittleInteger TGenericModulus<tLittleInteger>::multiplyAccumulate( tLittleInteger &R,
+	tLittleInteger A, tLittleInteger B, tLittleInteger X, tLittleInteger Carry )
+{
+	tLittleInteger Hi, Lo;
+
+	tInteger::blockMultiply( Hi, Lo, A, B );
+	Hi += tInteger::addWithCarry( Lo, Lo, X, 0 );
+	Hi += tInteger::addWithCarry( Lo, Lo, Carry, 0 );
+	R = Lo;
+
+	return Hi;
+}
+
+
+// -------------- Explicit template instantiations
+template class TGenericModulus<unsigned int>;
+template class TGenericModulus<unsigned long long>;
+
+
+// -------------- Function definitions
+
+
+#if defined(UNITTEST) || defined(BENCHMARK)
+#include "logstream.h"
+#include <sstream>
+
+// secp256k1's field prime and group order
+static const char FieldPrime[] = "fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f";
+static const char GroupOrder[] = "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364141";
+
+static unsigned long RandomState = 0x13579bdf;
+
+//
+// Function:	randomHex
+// Description:
+// A pseudo-random hex number of the given number of digits; the same
+// every run, so failures can be repeated.
+//
+static string randomHex( unsigned int Digits )
+{
+	static const char Hex[] = "0123456789abcdef";
+	string s;
+
+	for( unsigned int i = 0; i < Digits; i++ ) {
+		RandomState = RandomState * 1103515245 + 12345;
+		s += Hex[(RandomState >> 16) & 0xf];
+	}
+
+	return s;
+}
+#endif
+
+
+#ifdef UNITTEST
+
+//
+// Function:	checkModulus
+// Description:
+// Compare everything against the plain arithmetic, for random operands
+// below the given modulus.
+//
+template <typename tLittleInteger>
+static void checkModulus( const string &MHex, unsigned int Loops )
+{
+	typedef TGenericBigInteger<tLittleInteger> tInteger;
+	TGenericModulus<tLittleInteger> Mod( tInteger( MHex, 16 ) );
+	const tInteger &M = Mod.modulus();
+
+	for( unsigned int i = 0; i < Loops; i++ ) {
+		tInteger A( tInteger( randomHex( MHex.size() ), 16 ) % M );
+		tInteger B( tInteger( randomHex( MHex.size() ), 16 ) % M );
+		tInteger Big( randomHex( MHex.size() * 3 ), 16 );
+		tInteger E( randomHex( (i % 8) * 4 + 1 ), 16 );
+
+		if( Mod.reduce( Big ) != Big % M || Mod.reduce( A * B ) != (A * B) % M )
+			throw logic_error( "reduce() doesn't agree with %" );
+		if( Mod.multiply( A, B ) != (A * B) % M )
+			throw logic_error( "multiply() doesn't agree with * and %" );
+		if( Mod.add( A, B ) != (A + B) % M )
+			throw logic_error( "add() doesn't agree with + and %" );
+		if( Mod.add( Mod.subtract( A, B ), B ) != A )
+			throw logic_error( "subtract() doesn't undo add()" );
+
+		if( Mod.isMontgomery() ) {
+			tInteger AM( Mod.toMontgomery( A ) ), BM( Mod.toMontgomery( B ) );
+			if( Mod.fromMontgomery( AM ) != A )
+				throw logic_error( "Montgomery form doesn't round trip" );
+			if( Mod.fromMontgomery( Mod.montgomeryMultiply( AM, BM ) ) != (A * B) % M )
+				throw logic_error( "montgomeryMultiply() doesn't agree with * and %" );
+		}
+
+		// Square and multiply, one bit at a time
+		tInteger P( 1U );
+		for( typename tInteger::tIndex b = E.highestBit() + 1; b > 0; b-- ) {
+			P = (P * P) % M;
+			if( E.getBit( b - 1 ) )
+				P = (P * A) % M;
+		}
+		if( Mod.power( A, E ) != P ) {
+			ostringstream oss;
+			oss << hex << A << "^" << E << " mod " << M << " gave " << Mod.power( A, E ) << " not " << P;
+			throw logic_error( oss.str() );
+		}
+	}
+}
+
+//
+// Function:	checkPrimeField
+// Description:
+// Fermat and inverses, which need a prime.
+//
+template <typename tLittleInteger>
+static void checkPrimeField( const string &PHex, unsigned int Loops )
+{
+	typedef TGenericBigInteger<tLittleInteger> tInteger;
+	TGenericModulus<tLittleInteger> Mod( tInteger( PHex, 16 ) );
+	const tInteger &P = Mod.modulus();
+	const tInteger One( 1U );
+
+	for( unsigned int i = 0; i < Loops; i++ ) {
+		tInteger A( tInteger( randomHex( PHex.size() ), 16 ) % P );
+		if( A.isZero() )
+			continue;
+
+		if( Mod.power( A, P - One ) != One )
+			throw logic_error( "A^(P-1) isn't one" );
+		if( Mod.multiply( A, Mod.inverse( A ) ) != One )
+			throw logic_error( "A.inverse(A) isn't one" );
+	}
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		log() << "--- Testing against plain arithmetic" << endl;
+		const char *Moduli[] = {
+			"2", "3", "ff", "100", "10001", "fffffffb", "100000000",
+			"ffffffffffffffc5", "fffffffffffffffe", "10000000000000001",
+			"123456789abcdef0123456789abcdef", "123456789abcdef0123456789abcdef1",
+			"fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc2f",
+			"fffffffffffffffffffffffffffffffffffffffffffffffffffffffefffffc30",
+			"800000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000001",
+			NULL
+		};
+		for( unsigned int i = 0; Moduli[i] != NULL; i++ ) {
+			log() << "Modulus " << Moduli[i] << endl;
+			checkModulus<unsigned int>( Moduli[i], 200 );
+			checkModulus<unsigned long long>( Moduli[i], 200 );
+		}
+
+		log() << "--- Testing secp256k1's prime field and group order" << endl;
+		checkPrimeField<unsigned int>( FieldPrime, 50 );
+		checkPrimeField<unsigned long long>( FieldPrime, 50 );
+		checkPrimeField<unsigned int>( GroupOrder, 50 );
+		checkPrimeField<unsigned long long>( GroupOrder, 50 );
+
+		// 2 and 6 aren't coprime, so there's no inverse
+		bool Threw = false;
+		try {
+			TBigModulus( 6U ).inverse( 2U );
+		} catch( range_error &e ) {
+			Threw = true;
+		}
+		if( !Threw )
+			throw logic_error( "inverse() without one should throw" );
+
+		Threw = false;
+		try {
+			TBigModulus M( 1U );
+		} catch( range_error &e ) {
+			Threw = true;
+		}
+		if( !Threw )
+			throw logic_error( "A modulus of one should throw" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Testing power() against square and multiply" << endl;
+		TBigUnsignedInteger64 P( FieldPrime, 16 ), E( GroupOrder, 16 );
+		TBigUnsignedInteger64 A( randomHex( 64 ), 16 ), Check( 1U );
+		TBigModulus64 Mod( P );
+		TBigModulus Mod32( TBigUnsignedInteger( FieldPrime, 16 ) );
+		TBigUnsignedInteger R32;
+
+		for( TBigUnsignedInteger64::tIndex b = E.highestBit() + 1; b > 0; b-- ) {
+			Check = (Check * Check) % P;
+			if( E.getBit( b - 1 ) )
+				Check = (Check * A) % P;
+		}
+		R32 = Mod32.power( TBigUnsignedInteger( A.toString(16), 16 ), TBigUnsignedInteger( GroupOrder, 16 ) );
+		if( Mod.power( A, E ) != Check || R32.toString(16) != Check.toString(16) )
+			throw logic_error( "power() doesn't agree with square and multiply" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
+
+
+#ifdef BENCHMARK
+#include <sys/time.h>
+#include <stdio.h>
+
+//
+// Function:	elapsed
+// Description:
+//
+static double elapsed( const struct timeval &start )
+{
+	struct timeval end;
+
+	gettimeofday( &end, NULL );
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		static const unsigned int LOOPS = 2000;
+		struct timeval start;
+		double Plain, t;
+
+		TBigUnsignedInteger64 P( FieldPrime, 16 ), E( GroupOrder, 16 );
+		TBigUnsignedInteger64 A( randomHex( 64 ), 16 ), R, Check;
+		TBigModulus64 Mod( P );
+		TBigModulus Mod32( TBigUnsignedInteger( FieldPrime, 16 ) );
+		TBigUnsignedInteger A32( A.toString(16), 16 ), E32( GroupOrder, 16 ), R32;
+
+		printf( "operation,block bits,microseconds,speedup\n" );
+
+		// What power() replaces
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS / 10; i++ ) {
+			Check = 1U;
+			for( TBigUnsignedInteger64::tIndex b = E.highestBit() + 1; b > 0; b-- ) {
+				Check = (Check * Check) % P;
+				if( E.getBit( b - 1 ) )
+					Check = (Check * A) % P;
+			}
+		}
+		Plain = elapsed( start ) / (LOOPS / 10);
+		printf( "square-and-multiply,64,%.2f,1.00\n", Plain * 1e6 );
+
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS; i++ )
+			R = Mod.power( A, E );
+		t = elapsed( start ) / LOOPS;
+		printf( "power,64,%.2f,%.2f\n", t * 1e6, Plain / t );
+
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS; i++ )
+			R32 = Mod32.power( A32, E32 );
+		t = elapsed( start ) / LOOPS;
+		printf( "power,32,%.2f,%.2f\n", t * 1e6, Plain / t );
+
+		if( R != Check || R.toString(16) != R32.toString(16) )
+			throw logic_error( "power() doesn't agree with square and multiply" );
+
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS; i++ )
+			R = Mod.inverse( A );
+		t = elapsed( start ) / LOOPS;
+		printf( "inverse,64,%.2f,\n", t * 1e6 );
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
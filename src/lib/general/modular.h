@@ -0,0 +1,155 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   modular.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef MODULAR_H
+#define MODULAR_H
+
+// -------------- Includes
+// --- C
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+// --- Project
+#include "extraint.h"
+// --- Project lib
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TGenericModulus
+// Description:
+/// Arithmetic modulo a fixed number.
+//
+/// Everything that depends only on the modulus is worked out once, at
+/// construction, so that each reduction afterwards is a couple of
+/// multiplies instead of a division:
+///
+///  - Barrett's constant, floor(b^2k / M) for a k block modulus, which
+///    reduces any product of two residues with two multiplies and a
+///    subtraction.  This works for any modulus.
+///  - For odd moduli, Montgomery's constants: -1/M modulo one block,
+///    and R^2 mod M where R = b^k.  A number in Montgomery form, xR mod
+///    M, can be multiplied by another without ever dividing; only
+///    getting into and out of the form costs anything, so it pays for
+///    long chains of multiplies like power(), or a run of point
+///    operations on a curve whose field prime is the modulus.
+///
+/// Arguments are expected to be residues (less than the modulus)
+/// except for reduce(), which takes anything.  Results are always
+/// residues.
+//
+template <typename tLittleInteger>
+class TGenericModulus
+{
+  public:
+	typedef TGenericBigInteger<tLittleInteger> tInteger;
+	typedef typename tInteger::tIndex tIndex;
+
+  public:
+	explicit TGenericModulus( const tInteger & );
+
+	const tInteger &modulus() const { return Modulus; }
+	bool isMontgomery() const { return Odd; }
+
+	tInteger reduce( const tInteger & ) const;
+	tInteger add( const tInteger &, const tInteger & ) const;
+	tInteger subtract( const tInteger &, const tInteger & ) const;
+	tInteger multiply( const tInteger &A, const tInteger &B ) const { return reduce( A * B ); }
+	tInteger power( const tInteger &, const tInteger & ) const;
+	tInteger inverse( const tInteger & ) const;
+
+	// Montgomery form; these throw logic_error for an even modulus
+	tInteger toMontgomery( const tInteger & ) const;
+	tInteger fromMontgomery( const tInteger & ) const;
+	tInteger montgomeryMultiply( const tInteger &, const tInteger & ) const;
+
+  protected:
+	static unsigned int windowBits( tIndex );
+	static tLittleInteger multiplyAccumulate( tLittleInteger &R,
+		tLittleInteger A, tLittleInteger B, tLittleInteger X, tLittleInteger Carry );
+
+  protected:
+	tInteger Modulus;
+	tIndex Blocks;
+
+	// Barrett
+	tInteger Mu;
+
+	// Montgomery
+	bool Odd;
+	tLittleInteger NegativeInverse;
+	tInteger RSquared;
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+// Forward declarations explicitly instantiated templates
+extern template class TGenericModulus<unsigned int>;
+extern template class TGenericModulus<unsigned long long>;
+
+// Shortnames
+typedef TGenericModulus<unsigned int> TBigModulus;
+typedef TGenericModulus<unsigned long long> TBigModulus64;
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
@@ -0,0 +1,996 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   sha256.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "sha256.h"
+
+// -------------- Includes
+// --- C
+#include <string.h>
+// --- C++
+#include <algorithm>
+// --- Qt
+// --- OS
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+// --- Project libs
+// --- Project
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+// The first 32 bits of the fractional parts of the cube roots of the
+// first 64 primes
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+typedef void (*tCompressFunction)( TSHA256::tState &, const unsigned char *, size_t );
+typedef void (*tCompressManyFunction)( TSHA256::tState *, const unsigned char *const *, size_t );
+
+//
+// Function:	readBigEndian32
+// Description:
+//
+static inline uint32_t readBigEndian32( const unsigned char *p )
+{
+	return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+		| (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+//
+// Function:	writeBigEndian32
+// Description:
+//
+static inline void writeBigEndian32( unsigned char *p, uint32_t x )
+{
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+// The SHA-256 bit mixing functions.  These are macros so that the same
+// code works on single words and on GCC vectors of them, lane by lane.
+#define ROTATE_RIGHT(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SIGMA0(x) (ROTATE_RIGHT(x, 2) ^ ROTATE_RIGHT(x, 13) ^ ROTATE_RIGHT(x, 22))
+#define SIGMA1(x) (ROTATE_RIGHT(x, 6) ^ ROTATE_RIGHT(x, 11) ^ ROTATE_RIGHT(x, 25))
+#define sigma0(x) (ROTATE_RIGHT(x, 7) ^ ROTATE_RIGHT(x, 18) ^ ((x) >> 3))
+#define sigma1(x) (ROTATE_RIGHT(x, 17) ^ ROTATE_RIGHT(x, 19) ^ ((x) >> 10))
+
+//
+// Function:	compressScalar
+// Description:
+// The block function as the standard gives it, a block at a time.
+//
+static void compressScalar( TSHA256::tState &State, const unsigned char *Blocks, size_t N )
+{
+	uint32_t W[16];
+
+	for( ; N > 0; N--, Blocks += TSHA256::BLOCK_BYTES ) {
+		uint32_t a = State[0], b = State[1], c = State[2], d = State[3];
+		uint32_t e = State[4], f = State[5], g = State[6], h = State[7];
+
+		for( unsigned int t = 0; t < 64; t++ ) {
+			// The message schedule only ever looks back 16 words
+			if( t < 16 ) {
+				W[t] = readBigEndian32( Blocks + 4 * t );
+			} else {
+				W[t & 15] += sigma1( W[(t - 2) & 15] ) + W[(t - 7) & 15] + sigma0( W[(t - 15) & 15] );
+			}
+
+			uint32_t T1 = h + SIGMA1(e) + (g ^ (e & (f ^ g))) + K[t] + W[t & 15];
+			uint32_t T2 = SIGMA0(a) + ((a & b) | (c & (a | b)));
+			h = g; g = f; f = e; e = d + T1;
+			d = c; c = b; b = a; a = T1 + T2;
+		}
+
+		State[0] += a; State[1] += b; State[2] += c; State[3] += d;
+		State[4] += e; State[5] += f; State[6] += g; State[7] += h;
+	}
+}
+
+//
+// Function:	compressLanes
+// Description:
+// One block for each of LANES independent states, side by side in the
+// lanes of tVector.  This is compressScalar() with every word replaced
+// by a vector of words; the compiler generates whichever instructions
+// the calling function's target allows.
+//
+template <typename tVector, unsigned int LANES>
+static inline __attribute__((always_inline)) void compressLanes( TSHA256::tState *States,
+		const unsigned char *const *Blocks )
+{
+	tVector S[8], W[16];
+
+	for( unsigned int k = 0; k < 8; k++ )
+		for( unsigned int l = 0; l < LANES; l++ )
+			S[k][l] = States[l][k];
+	for( unsigned int t = 0; t < 16; t++ )
+		for( unsigned int l = 0; l < LANES; l++ )
+			W[t][l] = readBigEndian32( Blocks[l] + 4 * t );
+
+	tVector a = S[0], b = S[1], c = S[2], d = S[3];
+	tVector e = S[4], f = S[5], g = S[6], h = S[7];
+
+	for( unsigned int t = 0; t < 64; t++ ) {
+		if( t >= 16 )
+			W[t & 15] += sigma1( W[(t - 2) & 15] ) + W[(t - 7) & 15] + sigma0( W[(t - 15) & 15] );
+
+		tVector T1 = h + SIGMA1(e) + (g ^ (e & (f ^ g))) + K[t] + W[t & 15];
+		tVector T2 = SIGMA0(a) + ((a & b) | (c & (a | b)));
+		h = g; g = f; f = e; e = d + T1;
+		d = c; c = b; b = a; a = T1 + T2;
+	}
+
+	S[0] += a; S[1] += b; S[2] += c; S[3] += d;
+	S[4] += e; S[5] += f; S[6] += g; S[7] += h;
+
+	for( unsigned int k = 0; k < 8; k++ )
+		for( unsigned int l = 0; l < LANES; l++ )
+			States[l][k] = S[k][l];
+}
+
+//
+// Function:	compressManySingle
+// Description:
+// compressMany() with no lanes: each block in turn, with the single
+// block function.
+//
+static void compressManySingle( TSHA256::tState *States, const unsigned char *const *Blocks, size_t N )
+{
+	for( size_t i = 0; i < N; i++ )
+		TSHA256::compress( States[i], Blocks[i], 1 );
+}
+
+#ifdef SHA256_X86
+typedef uint32_t tLanes4 __attribute__((vector_size(16)));
+typedef uint32_t tLanes8 __attribute__((vector_size(32)));
+
+//
+// Function:	compressManySSE4
+// Description:
+//
+__attribute__((target("sse4.1")))
+static void compressManySSE4( TSHA256::tState *States, const unsigned char *const *Blocks, size_t N )
+{
+	for( ; N >= 4; N -= 4, States += 4, Blocks += 4 )
+		compressLanes<tLanes4, 4>( States, Blocks );
+	compressManySingle( States, Blocks, N );
+}
+
+//
+// Function:	compressManyAVX2
+// Description:
+//
+__attribute__((target("avx2")))
+static void compressManyAVX2( TSHA256::tState *States, const unsigned char *const *Blocks, size_t N )
+{
+	for( ; N >= 8; N -= 8, States += 8, Blocks += 8 )
+		compressLanes<tLanes8, 8>( States, Blocks );
+	compressManySSE4( States, Blocks, N );
+}
+
+//
+// Function:	compressSHANI
+// Description:
+// The block function with the x86 SHA extensions.
+//
+// sha256rnds2 does two rounds, on the state held as ABEF and CDGH
+// rather than ABCD and EFGH, so the state is rearranged on the way in
+// and out.  sha256msg1 and sha256msg2 do the two halves of the
+// message schedule, four words at a time.
+//
+__attribute__((target("sha,ssse3,sse4.1")))
+static void compressSHANI( TSHA256::tState &State, const unsigned char *Blocks, size_t N )
+{
+	const __m128i ByteSwap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+	__m128i State0, State1, Save0, Save1, Message, M[4], Tmp;
+
+	Tmp = _mm_loadu_si128( reinterpret_cast<const __m128i *>( &State[0] ) );
+	State1 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( &State[4] ) );
+	Tmp = _mm_shuffle_epi32( Tmp, 0xb1 );             // CDAB
+	State1 = _mm_shuffle_epi32( State1, 0x1b );       // EFGH
+	State0 = _mm_alignr_epi8( Tmp, State1, 8 );       // ABEF
+	State1 = _mm_blend_epi16( State1, Tmp, 0xf0 );    // CDGH
+
+	for( ; N > 0; N--, Blocks += TSHA256::BLOCK_BYTES ) {
+		Save0 = State0;
+		Save1 = State1;
+
+		for( unsigned int i = 0; i < 16; i++ ) {
+			if( i < 4 ) {
+				M[i] = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( Blocks + 16 * i ) ), ByteSwap );
+			} else {
+				// W[t-16] + sigma0(W[t-15]), plus W[t-7], plus sigma1(W[t-2])
+				Tmp = _mm_sha256msg1_epu32( M[i & 3], M[(i + 1) & 3] );
+				Tmp = _mm_add_epi32( Tmp, _mm_alignr_epi8( M[(i + 3) & 3], M[(i + 2) & 3], 4 ) );
+				M[i & 3] = _mm_sha256msg2_epu32( Tmp, M[(i + 3) & 3] );
+			}
+
+			Message = _mm_add_epi32( M[i & 3], _mm_loadu_si128( reinterpret_cast<const __m128i *>( &K[4 * i] ) ) );
+			State1 = _mm_sha256rnds2_epu32( State1, State0, Message );
+			Message = _mm_shuffle_epi32( Message, 0x0e );
+			State0 = _mm_sha256rnds2_epu32( State0, State1, Message );
+		}
+
+		State0 = _mm_add_epi32( State0, Save0 );
+		State1 = _mm_add_epi32( State1, Save1 );
+	}
+
+	Tmp = _mm_shuffle_epi32( State0, 0x1b );          // FEBA
+	State1 = _mm_shuffle_epi32( State1, 0xb1 );       // DCHG
+	State0 = _mm_blend_epi16( Tmp, State1, 0xf0 );    // DCBA
+	State1 = _mm_alignr_epi8( State1, Tmp, 8 );       // HGFE
+
+	_mm_storeu_si128( reinterpret_cast<__m128i *>( &State[0] ), State0 );
+	_mm_storeu_si128( reinterpret_cast<__m128i *>( &State[4] ), State1 );
+}
+
+//
+// Functions:	hasSHANI, hasAVX2, hasSSE4
+// Description:
+//
+static bool hasSHANI()
+{
+	unsigned int a, b, c, d;
+
+	if( !__get_cpuid_count( 7, 0, &a, &b, &c, &d ) )
+		return false;
+
+	return (b & (1 << 29)) != 0 && __builtin_cpu_supports( "sse4.1" );
+}
+static bool hasAVX2() { return __builtin_cpu_supports( "avx2" ); }
+static bool hasSSE4() { return __builtin_cpu_supports( "sse4.1" ); }
+#endif
+
+static bool always() { return true; }
+
+// Fastest first
+static const struct TSingleImplementation {
+	const char *Name;
+	bool (*Supported)();
+	tCompressFunction Function;
+} SingleImplementations[] = {
+#ifdef SHA256_X86
+	{ "shani", hasSHANI, compressSHANI },
+#endif
+	{ "scalar", always, compressScalar },
+	{ NULL, NULL, NULL }
+};
+
+static const struct TManyImplementation {
+	const char *Name;
+	bool (*Supported)();
+	tCompressManyFunction Function;
+} ManyImplementations[] = {
+#ifdef SHA256_X86
+	// The SHA extensions a block at a time beat eight lanes of AVX2
+	{ "shani", hasSHANI, compressManySingle },
+	{ "avx2", hasAVX2, compressManyAVX2 },
+	{ "sse4", hasSSE4, compressManySSE4 },
+#endif
+	{ "scalar", always, compressManySingle },
+	{ NULL, NULL, NULL }
+};
+
+//
+// Function:	firstSupported
+// Description:
+// The index of the first (so fastest) entry in an implementations
+// table that this processor supports.
+//
+template <typename tTable>
+static unsigned int firstSupported( const tTable *Table )
+{
+	unsigned int i = 0;
+	while( !Table[i].Supported() )
+		i++;
+	return i;
+}
+
+//
+// Function:	singleImplementation
+// Description:
+// The index of the single block function in use.  It's a function
+// static so that it's chosen on first use, rather than during static
+// initialisation when __builtin_cpu_supports() might not be ready.
+//
+static unsigned int &singleImplementation()
+{
+	static unsigned int Chosen = firstSupported( SingleImplementations );
+	return Chosen;
+}
+
+//
+// Function:	manyImplementationIndex
+// Description:
+//
+static unsigned int &manyImplementationIndex()
+{
+	static unsigned int Chosen = firstSupported( ManyImplementations );
+	return Chosen;
+}
+
+//
+// Function:	padBlock
+// Description:
+// Pad a message whose last Used bytes are at the start of Block, and
+// which was Length bytes in all: a one bit, zeroes, and the length in
+// bits, to the end of one block, or two if there isn't room for the
+// length in the first.  Returns the number of blocks.
+//
+static size_t padBlock( unsigned char *Block, size_t Used, uint64_t Length )
+{
+	size_t Blocks = (Used + 1 + 8 > TSHA256::BLOCK_BYTES) ? 2 : 1;
+	unsigned char *End = Block + Blocks * TSHA256::BLOCK_BYTES;
+	uint64_t Bits = Length * 8;
+
+	Block[Used] = 0x80;
+	memset( Block + Used + 1, 0, End - 8 - (Block + Used + 1) );
+	writeBigEndian32( End - 8, Bits >> 32 );
+	writeBigEndian32( End - 4, Bits );
+
+	return Blocks;
+}
+
+//
+// Function:	padHeaderTail
+// Description:
+// The second block of an 80 byte message.
+//
+static void padHeaderTail( unsigned char *Block, const unsigned char *Tail )
+{
+	memcpy( Block, Tail, TSHA256::HEADER_TAIL_BYTES );
+	padBlock( Block, TSHA256::HEADER_TAIL_BYTES, TSHA256::HEADER_BYTES );
+}
+
+//
+// Function:	padDigest
+// Description:
+// The only block of a hash of a hash.
+//
+static void padDigest( unsigned char *Block, const TSHA256::tState &State )
+{
+	for( unsigned int i = 0; i < TSHA256::STATE_WORDS; i++ )
+		writeBigEndian32( Block + 4 * i, State[i] );
+	padBlock( Block, TSHA256::DIGEST_BYTES, TSHA256::DIGEST_BYTES );
+}
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+const size_t TSHA256::DIGEST_BYTES;
+const size_t TSHA256::BLOCK_BYTES;
+const unsigned int TSHA256::STATE_WORDS;
+const size_t TSHA256::HEADER_BYTES;
+const size_t TSHA256::HEADER_TAIL_BYTES;
+
+// The first 32 bits of the fractional parts of the square roots of the
+// first 8 primes
+const TSHA256::tState TSHA256::INITIAL_STATE = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+//
+// Function:	TSHA256 :: init
+// Description:
+// Start a new hash.
+//
+void TSHA256::init()
+{
+	memcpy( State, INITIAL_STATE, sizeof(State) );
+	Buffered = 0;
+	Length = 0;
+
+	TMessageDigest::init();
+}
+
+//
+// Function:	TSHA256 :: transform
+// Description:
+// Return the hash for a completely available input string.
+//
+TByteArray TSHA256::transform( const TByteArray &s )
+{
+	update( s );
+
+	return final();
+}
+
+//
+// Function:	TSHA256 :: transformMany
+// Description:
+// Hash N independent inputs, each InBytes long, in SIMD lanes.  Every
+// input has the same number of blocks, so the lanes stay in step from
+// the first block to the padding.  Merkle trees are the main user: 64
+// byte pairs of hashes, then the 32 byte hashes of those.
+//
+void TSHA256::transformMany( unsigned char *Out, const unsigned char *In, size_t InBytes, size_t N )
+{
+	// Enough for the widest lanes
+	static const size_t CHUNK = 8;
+	const size_t FullBlocks = InBytes / BLOCK_BYTES;
+	const size_t Remainder = InBytes % BLOCK_BYTES;
+	tState S[CHUNK];
+	unsigned char Tails[CHUNK][2 * BLOCK_BYTES];
+	const unsigned char *Pointers[CHUNK];
+
+	while( N > 0 ) {
+		size_t n = min( N, CHUNK );
+		size_t TailBlocks = 0;
+
+		for( size_t i = 0; i < n; i++ )
+			memcpy( S[i], INITIAL_STATE, sizeof(tState) );
+
+		// Whole blocks straight from the input
+		for( size_t b = 0; b < FullBlocks; b++ ) {
+			for( size_t i = 0; i < n; i++ )
+				Pointers[i] = In + i * InBytes + b * BLOCK_BYTES;
+			compressMany( S, Pointers, n );
+		}
+
+		// The rest, padded
+		for( size_t i = 0; i < n; i++ ) {
+			memcpy( Tails[i], In + i * InBytes + FullBlocks * BLOCK_BYTES, Remainder );
+			TailBlocks = padBlock( Tails[i], Remainder, InBytes );
+		}
+		for( size_t b = 0; b < TailBlocks; b++ ) {
+			for( size_t i = 0; i < n; i++ )
+				Pointers[i] = Tails[i] + b * BLOCK_BYTES;
+			compressMany( S, Pointers, n );
+		}
+
+		for( size_t i = 0; i < n; i++ )
+			for( unsigned int j = 0; j < STATE_WORDS; j++ )
+				writeBigEndian32( Out + i * DIGEST_BYTES + 4 * j, S[i][j] );
+
+		Out += n * DIGEST_BYTES;
+		In += n * InBytes;
+		N -= n;
+	}
+}
+
+//
+// Function:	TSHA256 :: update
+// Description:
+// Add n bytes to the hash.  Whole blocks are compressed straight from
+// the input; only the ends are copied to Buffer.
+//
+void TSHA256::update( const unsigned char *p, size_t n )
+{
+	if( !Initialised )
+		init();
+
+	Length += n;
+
+	if( Buffered > 0 ) {
+		size_t Take = min( n, BLOCK_BYTES - Buffered );
+		memcpy( Buffer + Buffered, p, Take );
+		Buffered += Take;
+		p += Take;
+		n -= Take;
+		if( Buffered < BLOCK_BYTES )
+			return;
+		compress( State, Buffer, 1 );
+		Buffered = 0;
+	}
+
+	if( n >= BLOCK_BYTES ) {
+		compress( State, p, n / BLOCK_BYTES );
+		p += n - n % BLOCK_BYTES;
+		n %= BLOCK_BYTES;
+	}
+
+	memcpy( Buffer, p, n );
+	Buffered = n;
+}
+
+//
+// Function:	TSHA256 :: final
+// Description:
+// Pad, and write the DIGEST_BYTES of the hash to Out.  The next
+// update() starts a new hash.
+//
+void TSHA256::final( unsigned char *Out )
+{
+	if( !Initialised )
+		init();
+
+	uint64_t Bits = Length * 8;
+
+	// A one bit, zeroes to 56 bytes into a block, and the length
+	Buffer[Buffered++] = 0x80;
+	if( Buffered > BLOCK_BYTES - 8 ) {
+		memset( Buffer + Buffered, 0, BLOCK_BYTES - Buffered );
+		compress( State, Buffer, 1 );
+		Buffered = 0;
+	}
+	memset( Buffer + Buffered, 0, BLOCK_BYTES - 8 - Buffered );
+	writeBigEndian32( Buffer + BLOCK_BYTES - 8, Bits >> 32 );
+	writeBigEndian32( Buffer + BLOCK_BYTES - 4, Bits );
+	compress( State, Buffer, 1 );
+
+	for( unsigned int i = 0; i < STATE_WORDS; i++ )
+		writeBigEndian32( Out + 4 * i, State[i] );
+
+	deinit();
+}
+
+//
+// Function:	TSHA256 :: final
+// Description:
+//
+TByteArray TSHA256::final()
+{
+	TByteArray Result( DIGEST_BYTES );
+
+	final( Result.ptr() );
+
+	return Result;
+}
+
+//
+// Function:	TSHA256 :: compress
+// Description:
+// Run the block function over N consecutive blocks.
+//
+void TSHA256::compress( tState &S, const unsigned char *Blocks, size_t N )
+{
+	SingleImplementations[singleImplementation()].Function( S, Blocks, N );
+}
+
+//
+// Function:	TSHA256 :: compressMany
+// Description:
+// Run the block function once on each of N states, each with its own
+// block.
+//
+void TSHA256::compressMany( tState *States, const unsigned char *const *Blocks, size_t N )
+{
+	ManyImplementations[manyImplementationIndex()].Function( States, Blocks, N );
+}
+
+//
+// Function:	TSHA256 :: headerMidstate
+// Description:
+// The state after the first block of an 80 byte header, for
+// doubleHashHeader() to start from.
+//
+void TSHA256::headerMidstate( tState &Midstate, const unsigned char *Header )
+{
+	memcpy( Midstate, INITIAL_STATE, sizeof(tState) );
+	compress( Midstate, Header, 1 );
+}
+
+//
+// Function:	TSHA256 :: isDoubleHash
+// Description:
+// Whether Digest is a TSHA256 of a TSHA256, so that the header
+// functions give the same answer as it would.
+//
+bool TSHA256::isDoubleHash( const TMessageDigest *Digest )
+{
+	const TDoubleHash *Double = dynamic_cast<const TDoubleHash *>( Digest );
+
+	return Double != NULL
+		&& dynamic_cast<const TSHA256 *>( Double->getFirst() ) != NULL
+		&& dynamic_cast<const TSHA256 *>( Double->getSecond() ) != NULL;
+}
+
+//
+// Function:	TSHA256 :: doubleHashHeader
+// Description:
+// SHA-256 of the SHA-256 of the HEADER_BYTES at Header, to
+// DIGEST_BYTES at Out.
+//
+void TSHA256::doubleHashHeader( unsigned char *Out, const unsigned char *Header )
+{
+	tState Midstate;
+
+	headerMidstate( Midstate, Header );
+	doubleHashHeader( Out, Midstate, Header + BLOCK_BYTES );
+}
+
+//
+// Function:	TSHA256 :: doubleHashHeader
+// Description:
+// As above, for a header whose first block gave Midstate and whose last
+// HEADER_TAIL_BYTES are at Tail.
+//
+void TSHA256::doubleHashHeader( unsigned char *Out, const tState &Midstate, const unsigned char *Tail )
+{
+	unsigned char Block[BLOCK_BYTES];
+	tState S;
+
+	memcpy( S, Midstate, sizeof(tState) );
+	padHeaderTail( Block, Tail );
+	compress( S, Block, 1 );
+
+	padDigest( Block, S );
+	memcpy( S, INITIAL_STATE, sizeof(tState) );
+	compress( S, Block, 1 );
+
+	for( unsigned int i = 0; i < STATE_WORDS; i++ )
+		writeBigEndian32( Out + 4 * i, S[i] );
+}
+
+//
+// Function:	TSHA256 :: doubleHashHeaders
+// Description:
+// doubleHashHeader() for N headers that share a first block, with their
+// tails one after the other at Tails and their digests one after the
+// other at Out.  The headers are hashed side by side with
+// compressMany().
+//
+void TSHA256::doubleHashHeaders( unsigned char *Out, const tState &Midstate, const unsigned char *Tails, size_t N )
+{
+	// Enough for the widest lanes
+	static const size_t CHUNK = 8;
+	tState S[CHUNK];
+	unsigned char Blocks[CHUNK][BLOCK_BYTES];
+	const unsigned char *Pointers[CHUNK];
+
+	while( N > 0 ) {
+		size_t n = min( N, CHUNK );
+
+		for( size_t i = 0; i < n; i++ ) {
+			memcpy( S[i], Midstate, sizeof(tState) );
+			padHeaderTail( Blocks[i], Tails + i * HEADER_TAIL_BYTES );
+			Pointers[i] = Blocks[i];
+		}
+		compressMany( S, Pointers, n );
+
+		for( size_t i = 0; i < n; i++ ) {
+			padDigest( Blocks[i], S[i] );
+			memcpy( S[i], INITIAL_STATE, sizeof(tState) );
+		}
+		compressMany( S, Pointers, n );
+
+		for( size_t i = 0; i < n; i++ )
+			for( unsigned int j = 0; j < STATE_WORDS; j++ )
+				writeBigEndian32( Out + i * DIGEST_BYTES + 4 * j, S[i][j] );
+
+		Out += n * DIGEST_BYTES;
+		Tails += n * HEADER_TAIL_BYTES;
+		N -= n;
+	}
+}
+
+//
+// Function:	TSHA256 :: implementation
+// Description:
+//
+const char *TSHA256::implementation()
+{
+	return SingleImplementations[singleImplementation()].Name;
+}
+
+//
+// Function:	TSHA256 :: manyImplementation
+// Description:
+//
+const char *TSHA256::manyImplementation()
+{
+	return ManyImplementations[manyImplementationIndex()].Name;
+}
+
+//
+// Function:	TSHA256 :: useImplementation
+// Description:
+// Use the named block function, if this processor supports it.
+// "scalar" sets both the single and the many block functions back to
+// portable C.  Returns false, changing nothing, for an unknown or
+// unsupported name.
+//
+bool TSHA256::useImplementation( const char *Name )
+{
+	bool Found = false;
+
+	for( unsigned int i = 0; SingleImplementations[i].Name != NULL; i++ ) {
+		if( strcmp( SingleImplementations[i].Name, Name ) == 0 && SingleImplementations[i].Supported() ) {
+			singleImplementation() = i;
+			Found = true;
+		}
+	}
+	for( unsigned int i = 0; ManyImplementations[i].Name != NULL; i++ ) {
+		if( strcmp( ManyImplementations[i].Name, Name ) == 0 && ManyImplementations[i].Supported() ) {
+			manyImplementationIndex() = i;
+			Found = true;
+		}
+	}
+
+	return Found;
+}
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <stdio.h>
+#include <sys/time.h>
+#include "logstream.h"
+
+//
+// Function:	hex
+// Description:
+//
+static string hex( const unsigned char *p, size_t n )
+{
+	static const char Digits[] = "0123456789abcdef";
+	string s;
+
+	for( size_t i = 0; i < n; i++ ) {
+		s += Digits[p[i] >> 4];
+		s += Digits[p[i] & 0xf];
+	}
+
+	return s;
+}
+
+//
+// Function:	elapsed
+// Description:
+//
+static double elapsed( const struct timeval &start )
+{
+	struct timeval end;
+
+	gettimeofday( &end, NULL );
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	// Slowest first, so that using each in turn leaves the best
+	static const char *Implementations[] = { "scalar", "sse4", "avx2", "shani", NULL };
+
+	try {
+		log() << "--- Testing against known hashes and OpenSSL" << endl;
+
+		static const struct {
+			const char *Input;
+			const char *Hash;
+		} Samples[] = {
+			{ "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+			{ "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+			{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+				"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+			{ NULL, NULL }
+		};
+
+		for( const char **Name = Implementations; *Name != NULL; Name++ ) {
+			if( !TSHA256::useImplementation( *Name ) ) {
+				log() << *Name << ": not supported here" << endl;
+				continue;
+			}
+
+			TSHA256 Hasher;
+			THash_sha256 Reference;
+			unsigned char Digest[TSHA256::DIGEST_BYTES];
+
+			for( unsigned int i = 0; Samples[i].Input != NULL; i++ ) {
+				Hasher.transform( Digest, reinterpret_cast<const unsigned char *>( Samples[i].Input ), strlen( Samples[i].Input ) );
+				if( hex( Digest, sizeof(Digest) ) != Samples[i].Hash )
+					throw logic_error( string(*Name) + ": wrong hash of \"" + Samples[i].Input + "\"" );
+			}
+
+			// Every length either side of the padding boundaries, and
+			// fed in awkward pieces
+			TByteArray Data;
+			for( unsigned int n = 0; n < 300; n++ ) {
+				if( Hasher.transform( Data ) != Reference.transform( Data ) )
+					throw logic_error( string(*Name) + ": disagrees with OpenSSL" );
+				for( unsigned int Piece = 1; Piece < 70; Piece += 13 ) {
+					for( unsigned int j = 0; j < n; j += Piece )
+						Hasher.update( Data.ptr(j), min( Piece, n - j ) );
+					if( Hasher.final() != Reference.transform( Data ) )
+						throw logic_error( string(*Name) + ": piecewise update disagrees with OpenSSL" );
+				}
+				Data.push_back( n * 7 + 3 );
+			}
+
+			// Independent blocks in lanes, for counts that don't fill
+			// the lanes
+			for( unsigned int N = 0; N < 20; N++ ) {
+				// Arrays can't be vector elements before C++11
+				TSHA256::tState States[20], Expected[20];
+				const unsigned char *Blocks[20];
+				for( unsigned int j = 0; j < N; j++ ) {
+					memcpy( States[j], TSHA256::INITIAL_STATE, sizeof(TSHA256::tState) );
+					States[j][0] += j;
+					memcpy( Expected[j], States[j], sizeof(TSHA256::tState) );
+					Blocks[j] = Data.ptr( j * 7 );
+					TSHA256::compress( Expected[j], Blocks[j], 1 );
+				}
+				TSHA256::compressMany( States, Blocks, N );
+				for( unsigned int j = 0; j < N; j++ )
+					if( memcmp( States[j], Expected[j], sizeof(TSHA256::tState) ) != 0 )
+						throw logic_error( string(*Name) + ": compressMany() disagrees with compress()" );
+			}
+
+			// Batches of every length either side of the padding
+			// boundaries, through TDoubleHash too
+			TSHA256 H1, H2;
+			TDoubleHash Double( &H1, &H2 );
+			for( unsigned int n = 0; n < 150; n += 7 ) {
+				for( unsigned int N = 0; N < 20; N += 3 ) {
+					vector<unsigned char> Many( N * TSHA256::DIGEST_BYTES + 1 ), DoubleMany( Many );
+					Hasher.transformMany( &Many[0], Data.ptr(), n, N );
+					Double.transformMany( &DoubleMany[0], Data.ptr(), n, N );
+					for( unsigned int j = 0; j < N; j++ ) {
+						TByteArray Input( Data.ptr( j * n ), n );
+						if( memcmp( &Many[j * TSHA256::DIGEST_BYTES], Reference.transform( Input ).ptr(), TSHA256::DIGEST_BYTES ) != 0 )
+							throw logic_error( string(*Name) + ": transformMany() disagrees with OpenSSL" );
+						if( memcmp( &DoubleMany[j * TSHA256::DIGEST_BYTES], Double.transform( Input ).ptr(), TSHA256::DIGEST_BYTES ) != 0 )
+							throw logic_error( string(*Name) + ": TDoubleHash::transformMany() disagrees with transform()" );
+					}
+				}
+			}
+			THash_sha256 S1, S2;
+			TDoubleHash SSLDouble( &S1, &S2 );
+			vector<unsigned char> SSLMany( 5 * TSHA256::DIGEST_BYTES ), Many( SSLMany );
+			SSLDouble.transformMany( &SSLMany[0], Data.ptr(), 64, 5 );
+			Double.transformMany( &Many[0], Data.ptr(), 64, 5 );
+			if( SSLMany != Many )
+				throw logic_error( string(*Name) + ": default transformMany() disagrees" );
+
+			// Headers, whole, from a midstate and in batches; the
+			// genesis block header hashes to 000000000019d6...
+			static const char *GenesisHeader =
+				"0100000000000000000000000000000000000000000000000000000000000000"
+				"000000003ba3edfd7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa"
+				"4b1e5e4a29ab5f49ffff001d1dac2b7c";
+			unsigned char Header[TSHA256::HEADER_BYTES];
+			for( unsigned int j = 0; j < sizeof(Header); j++ )
+				sscanf( GenesisHeader + 2 * j, "%2hhx", &Header[j] );
+			Hasher.doubleHashHeader( Digest, Header );
+			reverse( Digest, Digest + sizeof(Digest) );
+			if( hex( Digest, sizeof(Digest) ) != "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f" )
+				throw logic_error( string(*Name) + ": wrong genesis block hash" );
+
+			TSHA256::tState Midstate;
+			TSHA256::headerMidstate( Midstate, Header );
+			unsigned char Tails[20 * TSHA256::HEADER_TAIL_BYTES], Batch[20 * TSHA256::DIGEST_BYTES];
+			for( unsigned int j = 0; j < 20; j++ ) {
+				memcpy( Tails + j * TSHA256::HEADER_TAIL_BYTES, Header + TSHA256::BLOCK_BYTES, TSHA256::HEADER_TAIL_BYTES );
+				Tails[(j + 1) * TSHA256::HEADER_TAIL_BYTES - 1] = j;
+			}
+			TSHA256::doubleHashHeaders( Batch, Midstate, Tails, 20 );
+			for( unsigned int j = 0; j < 20; j++ ) {
+				Header[TSHA256::HEADER_BYTES - 1] = j;
+				TSHA256 H;
+				H.transform( Digest, Header, sizeof(Header) );
+				H.transform( Digest, Digest, sizeof(Digest) );
+				if( memcmp( Digest, Batch + j * TSHA256::DIGEST_BYTES, sizeof(Digest) ) != 0 )
+					throw logic_error( string(*Name) + ": doubleHashHeaders() disagrees with transform()" );
+			}
+
+			log() << *Name << ": OK" << endl;
+		}
+
+		TSHA256::useImplementation( "scalar" );
+		for( const char **Name = Implementations; *Name != NULL; Name++ )
+			TSHA256::useImplementation( *Name );
+		log() << "Using " << TSHA256::implementation() << " and " << TSHA256::manyImplementation() << endl;
+
+		// Usable where the network parameters want a hasher
+		TSHA256 H1, H2;
+		THash_sha256 S1, S2;
+		TDoubleHash Double( &H1, &H2 ), SSLDouble( &S1, &S2 );
+		if( Double.transform( TByteArray( "hello" ) ) != SSLDouble.transform( TByteArray( "hello" ) ) )
+			throw logic_error( "Double hash disagrees with OpenSSL" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Timing" << endl;
+		static const unsigned int LOOPS = 200000;
+		TByteArray Header( 80 ), Out;
+		unsigned char Digest[TSHA256::DIGEST_BYTES];
+		struct timeval start;
+		double t;
+
+		THash_sha256 Reference;
+		gettimeofday( &start, NULL );
+		for( unsigned int i = 0; i < LOOPS; i++ )
+			Out = Reference.transform( Header );
+		t = elapsed( start );
+		log() << "THash_sha256, 80 bytes: " << t / LOOPS * 1e9 << "ns" << endl;
+
+		for( const char **Name = Implementations; *Name != NULL; Name++ ) {
+			if( !TSHA256::useImplementation( *Name ) )
+				continue;
+			TSHA256 Hasher;
+			gettimeofday( &start, NULL );
+			for( unsigned int i = 0; i < LOOPS; i++ )
+				Hasher.transform( Digest, Header.ptr(), Header.size() );
+			t = elapsed( start );
+			log() << "TSHA256 (" << TSHA256::implementation() << "), 80 bytes: " << t / LOOPS * 1e9 << "ns" << endl;
+
+			TSHA256::tState States[64];
+			const unsigned char *Blocks[64];
+			memset( States, 0, sizeof(States) );
+			fill( Blocks, Blocks + 64, Header.ptr() );
+			gettimeofday( &start, NULL );
+			for( unsigned int i = 0; i < LOOPS / 64; i++ )
+				TSHA256::compressMany( States, Blocks, 64 );
+			t = elapsed( start );
+			log() << "compressMany (" << TSHA256::manyImplementation() << "): " << t / (LOOPS / 64 * 64) * 1e9 << "ns per block" << endl;
+
+			TSHA256::tState Midstate;
+			TSHA256::headerMidstate( Midstate, Header.ptr() );
+			gettimeofday( &start, NULL );
+			for( unsigned int i = 0; i < LOOPS; i++ )
+				TSHA256::doubleHashHeader( Digest, Midstate, Header.ptr(TSHA256::BLOCK_BYTES) );
+			t = elapsed( start );
+			log() << "doubleHashHeader from midstate: " << t / LOOPS * 1e9 << "ns" << endl;
+
+			unsigned char Tails[64 * TSHA256::HEADER_TAIL_BYTES], Digests[64 * TSHA256::DIGEST_BYTES];
+			memset( Tails, 0, sizeof(Tails) );
+			gettimeofday( &start, NULL );
+			for( unsigned int i = 0; i < LOOPS / 64; i++ )
+				TSHA256::doubleHashHeaders( Digests, Midstate, Tails, 64 );
+			t = elapsed( start );
+			log() << "doubleHashHeaders from midstate: " << t / (LOOPS / 64 * 64) * 1e9 << "ns per header" << endl;
+
+			// Merkle nodes, one at a time and in a batch
+			TSHA256 H1, H2;
+			TDoubleHash Double( &H1, &H2 );
+			TByteArray Pairs( 64 * 64 ), Node( 64 );
+			gettimeofday( &start, NULL );
+			for( unsigned int i = 0; i < LOOPS; i++ )
+				Out = Double.transform( Node );
+			t = elapsed( start );
+			log() << "Merkle node with transform(): " << t / LOOPS * 1e9 << "ns" << endl;
+			gettimeofday( &start, NULL );
+			for( unsigned int i = 0; i < LOOPS / 64; i++ )
+				Double.transformMany( Digests, Pairs.ptr(), 64, 64 );
+			t = elapsed( start );
+			log() << "Merkle node with transformMany(): " << t / (LOOPS / 64 * 64) * 1e9 << "ns" << endl;
+		}
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
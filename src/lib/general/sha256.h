@@ -0,0 +1,180 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   sha256.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef SHA256_H
+#define SHA256_H
+
+// -------------- Includes
+// --- C
+#include <stddef.h>
+#include <stdint.h>
+// --- C++
+// --- Qt
+// --- OS
+// --- Project
+#include "crypto.h"
+// --- Project lib
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TSHA256
+// Description:
+/// SHA-256, without going through OpenSSL.
+//
+/// THash_sha256 sets up an EVP context for every hash, which is most of
+/// the cost for the short inputs bitcoin hashes most: 80 byte headers,
+/// 64 byte merkle nodes and 32 byte second rounds.  This keeps its
+/// state in the object, and can hash straight from and to caller's
+/// buffers.
+///
+/// The block function is chosen once, for the processor we're running
+/// on:
+///
+///  - "shani", the x86 SHA extensions, one block at a time;
+///  - "scalar", portable C, one block at a time.
+///
+/// compressMany(), and so transformMany(), does independent blocks side
+/// by side, in SIMD lanes, unless the SHA extensions are there, which
+/// are faster a block at a time:
+///
+///  - "shani", one at a time;
+///  - "avx2", eight at a time;
+///  - "sse4", four at a time;
+///  - otherwise one at a time with the single block function.
+///
+/// useImplementation() can force a slower choice, so that the unit
+/// test can check them all against each other.
+///
+/// Block headers get their own double hash.  An 80 byte header is two
+/// blocks, and the first holds only the version, the previous block and
+/// most of the merkle root; headers that differ only in the last 16
+/// bytes (the end of the merkle root, the time, the bits and the nonce)
+/// can start from the same headerMidstate().  Both padded blocks are
+/// constant apart from those bytes, so nothing is buffered or copied
+/// beyond them.
+//
+class TSHA256 : public TMessageDigest
+{
+  public:
+	static const size_t DIGEST_BYTES = 32;
+	static const size_t BLOCK_BYTES = 64;
+	static const unsigned int STATE_WORDS = 8;
+	static const size_t HEADER_BYTES = 80;
+	static const size_t HEADER_TAIL_BYTES = HEADER_BYTES - BLOCK_BYTES;
+
+	typedef uint32_t tState[STATE_WORDS];
+
+  public:
+	TSHA256() : Buffered(0), Length(0) {}
+
+	TByteArray transform( const TByteArray & );
+	size_t transform( unsigned char *Out, const void *In, size_t n ) {
+		update( static_cast<const unsigned char *>(In), n );
+		final( Out );
+		return DIGEST_BYTES;
+	}
+	void transformMany( unsigned char *Out, const unsigned char *In, size_t InBytes, size_t N );
+
+	void update( const TByteArray &s ) { update( s.empty() ? NULL : s.ptr(), s.size() ); }
+	void update( const unsigned char *, size_t );
+	TByteArray final();
+	void final( unsigned char * );
+
+	void reset() { init(); }
+
+	// Block functions, for callers that pad for themselves
+	static const tState INITIAL_STATE;
+	static void compress( tState &, const unsigned char *Blocks, size_t N );
+	static void compressMany( tState *States, const unsigned char *const *Blocks, size_t N );
+
+	// Double SHA-256 of 80 byte block headers
+	static void headerMidstate( tState &, const unsigned char *Header );
+	static void doubleHashHeader( unsigned char *Out, const unsigned char *Header );
+	static void doubleHashHeader( unsigned char *Out, const tState &Midstate, const unsigned char *Tail );
+	static void doubleHashHeaders( unsigned char *Out, const tState &Midstate, const unsigned char *Tails, size_t N );
+	static bool isDoubleHash( const TMessageDigest * );
+
+	static const char *implementation();
+	static const char *manyImplementation();
+	static bool useImplementation( const char * );
+
+  protected:
+	void init();
+
+  protected:
+	tState State;
+	unsigned char Buffer[BLOCK_BYTES];
+	size_t Buffered;
+	uint64_t Length;
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+// The doubled hashes that scripts and addresses use
+typedef TDoubleHashTemplate<TSHA256, TSHA256> THash_hash256;
+#ifndef OPENSSL_NO_RIPEMD
+typedef TDoubleHashTemplate<THash_ripemd160, TSHA256> THash_hash160;
+#endif
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
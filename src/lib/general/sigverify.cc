@@ -0,0 +1,794 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   sigverify.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "sigverify.h"
+
+// -------------- Includes
+// --- C
+#include <string.h>
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+#include <openssl/rand.h>
+// --- Project libs
+// --- Project
+#include "crypto.h"
+#include "logstream.h"
+#include "sha256.h"
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+const size_t TSignatureCache::DEFAULT_ENTRIES;
+const unsigned int TSignatureCache::WAYS;
+const unsigned int TSignatureCache::LOCKS;
+
+//
+// Function:	TSignatureCache :: TSignatureCache
+// Description:
+// Entries is rounded down to a whole number of sets.
+//
+TSignatureCache::TSignatureCache( size_t n ) :
+	Sets( n / WAYS > 0 ? n / WAYS : 1 ),
+	Hits( 0 ),
+	Misses( 0 )
+{
+	if( RAND_bytes( Salt, sizeof(Salt) ) != 1 )
+		throw ssl_error( "RAND_bytes()" );
+
+	Entries.assign( Sets * WAYS, TEntry() );
+}
+
+//
+// Function:	TSignatureCache :: contains
+// Description:
+// True if this signature has verified before.
+//
+bool TSignatureCache::contains( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature )
+{
+	TEntry E;
+
+	hash( E, PublicKey, Digest, Signature );
+	if( find( E ) ) {
+		__sync_fetch_and_add( &Hits, 1 );
+		return true;
+	}
+	__sync_fetch_and_add( &Misses, 1 );
+	return false;
+}
+
+//
+// Function:	TSignatureCache :: insert
+// Description:
+// Record a signature that the caller has verified.
+//
+void TSignatureCache::insert( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature )
+{
+	TEntry E;
+
+	hash( E, PublicKey, Digest, Signature );
+	store( E );
+}
+
+//
+// Function:	TSignatureCache :: verify
+// Description:
+// As TEllipticCurveKey::verify(), but answered from the cache if the
+// signature has verified before, and remembered if it verifies now.
+// A public key that won't parse doesn't verify.
+//
+bool TSignatureCache::verify( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature )
+{
+	TEllipticCurveKey &Key( Keys.get() );
+	TEntry E;
+
+	hash( E, PublicKey, Digest, Signature );
+	if( find( E ) ) {
+		__sync_fetch_and_add( &Hits, 1 );
+		return true;
+	}
+	__sync_fetch_and_add( &Misses, 1 );
+
+	try {
+		Key.setPublicKey( PublicKey, TPublicKeyCache::shared() );
+		if( !Key.verify( Digest, Signature ) )
+			return false;
+	} catch( exception &e ) {
+		return false;
+	}
+
+	store( E );
+	return true;
+}
+
+//
+// Function:	TSignatureCache :: shared
+// Description:
+// The cache that the script engine uses.
+//
+TSignatureCache &TSignatureCache::shared()
+{
+	static TSignatureCache Cache;
+	return Cache;
+}
+
+//
+// Function:	TSignatureCache :: hash
+// Description:
+// The public key and digest are prefixed by their sizes, so that no
+// two different triples hash the same bytes.
+//
+void TSignatureCache::hash( TEntry &E, const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature ) const
+{
+	unsigned char Sizes[4];
+	TSHA256 H;
+
+	Sizes[0] = PublicKey.size() & 0xff;
+	Sizes[1] = PublicKey.size() >> 8;
+	Sizes[2] = Digest.size() & 0xff;
+	Sizes[3] = Digest.size() >> 8;
+
+	H.update( Salt, sizeof(Salt) );
+	H.update( Sizes, sizeof(Sizes) );
+	H.update( PublicKey );
+	H.update( Digest );
+	H.update( Signature );
+	H.final( E.Hash );
+}
+
+//
+// Function:	TSignatureCache :: find
+// Description:
+// A set is kept most recently used first, so a hit moves to the front.
+// An all zero entry is empty; no salted hash will ever be zero.
+//
+bool TSignatureCache::find( const TEntry &E )
+{
+	uint64_t Index;
+
+	memcpy( &Index, E.Hash, sizeof(Index) );
+	Index %= Sets;
+
+	TMutexLocker L( Locks[Index % LOCKS] );
+	TEntry *Set = &Entries[Index * WAYS];
+
+	for( unsigned int i = 0; i < WAYS; i++ ) {
+		if( memcmp( Set[i].Hash, E.Hash, sizeof(E.Hash) ) != 0 )
+			continue;
+		if( i > 0 ) {
+			memmove( Set + 1, Set, i * sizeof(TEntry) );
+			Set[0] = E;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+//
+// Function:	TSignatureCache :: store
+// Description:
+// Put E at the front of its set, dropping the set's last entry unless
+// E was already in it.
+//
+void TSignatureCache::store( const TEntry &E )
+{
+	uint64_t Index;
+	unsigned int i;
+
+	memcpy( &Index, E.Hash, sizeof(Index) );
+	Index %= Sets;
+
+	TMutexLocker L( Locks[Index % LOCKS] );
+	TEntry *Set = &Entries[Index * WAYS];
+
+	for( i = 0; i < WAYS - 1; i++ ) {
+		if( memcmp( Set[i].Hash, E.Hash, sizeof(E.Hash) ) == 0 )
+			break;
+	}
+	memmove( Set + 1, Set, i * sizeof(TEntry) );
+	Set[0] = E;
+}
+
+// --------
+
+//
+// Function:	TVerifyBatch :: TVerifyBatch
+// Description:
+//
+TVerifyBatch::TVerifyBatch() :
+	Verifier( NULL ),
+	Unclaimed( 0 ),
+	Unfinished( 0 ),
+	Complete( false )
+{
+}
+
+//
+// Function:	TVerifyBatch :: ~TVerifyBatch
+// Description:
+// A batch destroyed while the workers have it would leave them
+// writing to freed memory, so wait for it.  Children that supply
+// completed() should wait() in their own destructor; by the time we
+// get here, their completed() has gone.
+//
+TVerifyBatch::~TVerifyBatch()
+{
+	if( Verifier != NULL && !isComplete() )
+		Verifier->wait( *this );
+}
+
+//
+// Function:	TVerifyBatch :: add
+// Description:
+// Append a job, returning its index for result().
+//
+size_t TVerifyBatch::add( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature )
+{
+	if( Verifier != NULL && !isComplete() )
+		throw logic_error( "TVerifyBatch::add() batch is submitted" );
+
+	Jobs.push_back( TJob() );
+	Jobs.back().PublicKey = PublicKey;
+	Jobs.back().Digest = Digest;
+	Jobs.back().Signature = Signature;
+
+	return Jobs.size() - 1;
+}
+
+//
+// Function:	TVerifyBatch :: clear
+// Description:
+// Remove every job, so that the batch can be reused.
+//
+void TVerifyBatch::clear()
+{
+	if( Verifier != NULL && !isComplete() )
+		throw logic_error( "TVerifyBatch::clear() batch is submitted" );
+
+	Jobs.clear();
+	Results.clear();
+	Verifier = NULL;
+	Complete = false;
+}
+
+//
+// Function:	TVerifyBatch :: isComplete
+// Description:
+// True once every job of the submitted batch has been checked.
+//
+bool TVerifyBatch::isComplete() const
+{
+	if( !Complete )
+		return false;
+
+	// Don't read the results before the flag that published them
+	__sync_synchronize();
+	return true;
+}
+
+//
+// Function:	TVerifyBatch :: wait
+// Description:
+// Block until every job has been checked; returns true if they all
+// verified.
+//
+bool TVerifyBatch::wait()
+{
+	if( Verifier == NULL )
+		throw logic_error( "TVerifyBatch::wait() batch was never submitted" );
+
+	if( !isComplete() )
+		Verifier->wait( *this );
+
+	return failures() == 0;
+}
+
+//
+// Function:	TVerifyBatch :: failures
+// Description:
+// The number of jobs that didn't verify.  Only meaningful once the
+// batch is complete.
+//
+size_t TVerifyBatch::failures() const
+{
+	size_t n = 0;
+
+	for( size_t i = 0; i < Results.size(); i++ ) {
+		if( Results[i] == 0 )
+			n++;
+	}
+
+	return n;
+}
+
+// --------
+
+const size_t TSignatureVerifier::MAXIMUM_RUN;
+
+//
+// Function:	TSignatureVerifier :: TSignatureVerifier
+// Description:
+// Start Threads workers; zero means one for each processor.
+//
+TSignatureVerifier::TSignatureVerifier( unsigned int Threads, TSignatureCache *c ) :
+	Stopping( false ),
+	Cache( c )
+{
+	if( Threads == 0 )
+		Threads = TThread::processors();
+
+	while( Workers.size() < Threads ) {
+		Workers.push_back( new TWorker( this ) );
+		Workers.back()->start();
+	}
+}
+
+//
+// Function:	TSignatureVerifier :: ~TSignatureVerifier
+// Description:
+//
+TSignatureVerifier::~TSignatureVerifier()
+{
+	Lock.lock();
+	Stopping = true;
+	WorkAvailable.broadcast();
+	Lock.unlock();
+
+	while( !Workers.empty() ) {
+		Workers.back()->join();
+		delete Workers.back();
+		Workers.pop_back();
+	}
+}
+
+//
+// Function:	TSignatureVerifier :: submit
+// Description:
+// Queue a batch for the workers.  It may be resubmitted once it is
+// complete, but not before.
+//
+void TSignatureVerifier::submit( TVerifyBatch &B )
+{
+	{
+		TMutexLocker L( Lock );
+
+		if( B.Verifier != NULL && !B.Complete )
+			throw logic_error( "TSignatureVerifier::submit() batch is already submitted" );
+
+		B.Verifier = this;
+		B.Results.assign( B.Jobs.size(), 0 );
+		B.Unclaimed = B.Jobs.size();
+		B.Unfinished = B.Jobs.size();
+		B.Complete = false;
+
+		if( !B.Jobs.empty() ) {
+			Queue.push_back( &B );
+			WorkAvailable.broadcast();
+			return;
+		}
+	}
+
+	// Nothing for the workers to do
+	B.completed();
+
+	TMutexLocker L( Lock );
+	B.Complete = true;
+}
+
+//
+// Function:	TSignatureVerifier :: wait
+// Description:
+//
+void TSignatureVerifier::wait( TVerifyBatch &B )
+{
+	TMutexLocker L( Lock );
+
+	if( B.Verifier != this )
+		throw logic_error( "TSignatureVerifier::wait() batch wasn't submitted here" );
+
+	while( !B.Complete )
+		BatchCompleted.wait( Lock );
+}
+
+//
+// Function:	TSignatureVerifier :: claim
+// Description:
+// Called by a worker for its next run of jobs, which are [First,
+// First+Count) of the returned batch.  Sleeps until there is work;
+// returns false when the verifier is stopping and the queue is empty.
+//
+// A run is a share of what's left of the batch, so that the workers
+// still finish together at its end, but never more than MAXIMUM_RUN,
+// so that a later batch isn't held up behind one worker's long run.
+//
+bool TSignatureVerifier::claim( TVerifyBatch *&B, size_t &First, size_t &Count )
+{
+	TMutexLocker L( Lock );
+
+	while( Queue.empty() ) {
+		if( Stopping )
+			return false;
+		WorkAvailable.wait( Lock );
+	}
+
+	B = Queue.front();
+	Count = B->Unclaimed / (Workers.size() * 4);
+	if( Count < 1 )
+		Count = 1;
+	if( Count > MAXIMUM_RUN )
+		Count = MAXIMUM_RUN;
+
+	First = B->Jobs.size() - B->Unclaimed;
+	B->Unclaimed -= Count;
+	if( B->Unclaimed == 0 )
+		Queue.pop_front();
+
+	return true;
+}
+
+//
+// Function:	TSignatureVerifier :: finish
+// Description:
+// Called by a worker when it has written the results of Count jobs of
+// B.  The worker that finishes the batch calls its completed(), then
+// wakes anyone waiting for it.
+//
+void TSignatureVerifier::finish( TVerifyBatch *B, size_t Count )
+{
+	{
+		TMutexLocker L( Lock );
+		B->Unfinished -= Count;
+		if( B->Unfinished != 0 )
+			return;
+	}
+
+	try {
+		B->completed();
+	} catch( exception &e ) {
+		log(TLog::Error) << "TVerifyBatch::completed() threw, " << e.what() << endl;
+	}
+
+	TMutexLocker L( Lock );
+	B->Complete = true;
+	BatchCompleted.broadcast();
+}
+
+//
+// Function:	TSignatureVerifier :: TWorker :: run
+// Description:
+// A public key that won't parse is a signature that doesn't verify.
+//
+void TSignatureVerifier::TWorker::run()
+{
+	TEllipticCurveKey Key;
+	TVerifyBatch *B;
+	size_t First, Count;
+
+	while( Verifier->claim( B, First, Count ) ) {
+		for( size_t i = First; i < First + Count; i++ ) {
+			const TVerifyBatch::TJob &Job( B->Jobs[i] );
+
+			if( Verifier->Cache != NULL ) {
+				B->Results[i] = Verifier->Cache->verify( Job.PublicKey, Job.Digest, Job.Signature );
+				continue;
+			}
+
+			try {
+				Key.setPublicKey( Job.PublicKey, TPublicKeyCache::shared() );
+				B->Results[i] = Key.verify( Job.Digest, Job.Signature );
+			} catch( exception &e ) {
+				B->Results[i] = 0;
+			}
+		}
+		Verifier->finish( B, Count );
+	}
+}
+
+
+// -------------- Function definitions
+
+
+#if defined(UNITTEST) || defined(BENCHMARK)
+#include <stdint.h>
+#include <sys/time.h>
+
+//
+// Function:	makeSignatures
+// Description:
+// Sign Count repeatable digests, cycling through Keys, adding each to
+// Batch.
+//
+static void makeSignatures( TVerifyBatch &Batch, vector<TEllipticCurveKey> &Keys, size_t Count )
+{
+	uint32_t Seed = 0x5eed1234;
+
+	for( size_t i = 0; i < Count; i++ ) {
+		TEllipticCurveKey &Key( Keys[i % Keys.size()] );
+		TByteArray Digest;
+
+		for( unsigned int j = 0; j < 32; j++ ) {
+			Seed = Seed * 1103515245 + 12345;
+			Digest.push_back( Seed >> 16 );
+		}
+		Batch.add( Key.getPublicKey(), Digest, Key.sign( Digest ) );
+	}
+}
+
+//
+// Function:	seconds
+// Description:
+//
+static double seconds( const struct timeval &start, const struct timeval &stop )
+{
+	return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6;
+}
+#endif
+
+
+#ifdef UNITTEST
+
+//
+// Class:	TUnitTestBatch
+// Description:
+// Counts its completions, and checks they come before wait() returns.
+//
+class TUnitTestBatch : public TVerifyBatch
+{
+  public:
+	TUnitTestBatch() : Completions( 0 ) {}
+	~TUnitTestBatch() { if( Verifier != NULL ) wait(); }
+
+	volatile unsigned int Completions;
+
+  protected:
+	void completed() { Completions++; }
+};
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		static const size_t COUNT = 200;
+		vector<TEllipticCurveKey> Keys( 5 );
+		TSignatureVerifier Verifier( 3 );
+		TUnitTestBatch Good, Bad, Empty;
+		struct timeval start, stop;
+		size_t i;
+		double t;
+
+		log() << "Verifier: " << Verifier.getThreadCount() << " threads, "
+			<< TThread::processors() << " processors" << endl;
+
+		for( i = 0; i < Keys.size(); i++ )
+			Keys[i].generate();
+		makeSignatures( Good, Keys, COUNT );
+
+		// Every kind of failure, each next to a job that verifies
+		for( i = 0; i < 4; i++ ) {
+			TByteArray Digest( "0123456789abcdef0123456789abcdef" );
+			TByteArray Signature( Keys[0].sign( Digest ) );
+			Bad.add( Keys[0].getPublicKey(), Digest, Signature );
+			switch( i ) {
+				case 0:
+					// Someone else's key
+					Bad.add( Keys[1].getPublicKey(), Digest, Signature );
+					break;
+				case 1:
+					// Another digest
+					Digest[0] ^= 1;
+					Bad.add( Keys[0].getPublicKey(), Digest, Signature );
+					break;
+				case 2:
+					// A damaged signature
+					Signature[Signature.size() - 1] ^= 1;
+					Bad.add( Keys[0].getPublicKey(), Digest, Signature );
+					break;
+				case 3:
+					// A public key that isn't one
+					Bad.add( TByteArray( "\x04\x01\x02", 3 ), Digest, Signature );
+					break;
+			}
+		}
+
+		gettimeofday( &start, NULL );
+		Verifier.submit( Good );
+		Verifier.submit( Bad );
+		Verifier.submit( Empty );
+		if( !Good.wait() )
+			throw logic_error( "Good signatures didn't verify" );
+		gettimeofday( &stop, NULL );
+		t = seconds( start, stop );
+		log() << "Verifier: " << COUNT << " signatures in " << t << "s = "
+			<< COUNT / t << " signatures/s" << endl;
+
+		if( Bad.wait() )
+			throw logic_error( "Bad signatures verified" );
+		for( i = 0; i < Bad.size(); i++ ) {
+			if( Bad.result( i ) != (i % 2 == 0) )
+				throw logic_error( "Wrong signature failed" );
+		}
+		if( Bad.failures() != 4 )
+			throw logic_error( "Wrong failure count" );
+		log() << "Verifier: " << Bad.failures() << " of " << Bad.size() << " bad signatures failed" << endl;
+
+		if( !Empty.wait() || !Empty.isComplete() )
+			throw logic_error( "Empty batch didn't complete" );
+		if( Good.Completions != 1 || Bad.Completions != 1 || Empty.Completions != 1 )
+			throw logic_error( "completed() not called once per batch" );
+
+		// Reuse
+		Verifier.submit( Good );
+		if( !Good.wait() || Good.Completions != 2 )
+			throw logic_error( "Resubmitted batch didn't verify" );
+		log() << "Verifier: resubmitted batch verified" << endl;
+
+		// A cache misses the first time, hits the second, and never
+		// remembers a failure
+		TSignatureCache Cache, Small( 8 );
+		{
+			TSignatureVerifier CachedVerifier( 2, &Cache );
+
+			CachedVerifier.submit( Good );
+			if( !Good.wait() || Cache.getHits() != 0 || Cache.getMisses() != COUNT )
+				throw logic_error( "Cache wasn't filled" );
+			gettimeofday( &start, NULL );
+			CachedVerifier.submit( Good );
+			if( !Good.wait() || Cache.getHits() != COUNT || Cache.getMisses() != COUNT )
+				throw logic_error( "Cache didn't hit" );
+			gettimeofday( &stop, NULL );
+			t = seconds( start, stop );
+			log() << "Cache: " << COUNT << " hits in " << t << "s = "
+				<< COUNT / t << " signatures/s" << endl;
+
+			for( i = 0; i < 2; i++ ) {
+				CachedVerifier.submit( Bad );
+				if( Bad.wait() || Bad.failures() != 4 )
+					throw logic_error( "Cache changed bad signature results" );
+			}
+			if( Cache.getHits() != COUNT + 4 || Cache.getMisses() != COUNT + 12 )
+				throw logic_error( "Cache remembered a bad signature" );
+			log() << "Cache: " << Cache.getHits() << " hits, " << Cache.getMisses()
+				<< " misses of " << Cache.getCapacity() << " entries" << endl;
+		}
+		{
+			TSignatureVerifier CachedVerifier( 1, &Small );
+
+			CachedVerifier.submit( Good );
+			Good.wait();
+			CachedVerifier.submit( Good );
+			if( !Good.wait() || Small.getHits() > Small.getCapacity() )
+				throw logic_error( "Cache holds more than its capacity" );
+			log() << "Cache: " << Small.getHits() << " hits from a cache of "
+				<< Small.getCapacity() << " entries" << endl;
+		}
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
+
+
+#ifdef BENCHMARK
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// Class:	TBenchmarkBatch
+// Description:
+// Lets the serial benchmark see the jobs.
+//
+class TBenchmarkBatch : public TVerifyBatch
+{
+  public:
+	const TByteArray &publicKey( size_t i ) const { return Jobs[i].PublicKey; }
+	const TByteArray &digest( size_t i ) const { return Jobs[i].Digest; }
+	const TByteArray &signature( size_t i ) const { return Jobs[i].Signature; }
+};
+
+//
+// Function:	benchmark
+// Description:
+// Verify the whole batch with Threads workers, and print a line of
+// results.
+//
+static void benchmark( const char *Method, TVerifyBatch &Batch, TSignatureVerifier &Verifier )
+{
+	struct timeval start, stop;
+	double t;
+
+	gettimeofday( &start, NULL );
+	Verifier.submit( Batch );
+	if( !Batch.wait() )
+		throw logic_error( "Benchmark signatures didn't verify" );
+	gettimeofday( &stop, NULL );
+	t = seconds( start, stop );
+
+	printf( "%s,%u,%lu,%.3f,%.0f\n", Method, Verifier.getThreadCount(),
+			static_cast<unsigned long>( Batch.size() ), t, Batch.size() / t );
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		size_t Count = argc > 1 ? strtoul( argv[1], NULL, 10 ) : 100000;
+		vector<TEllipticCurveKey> Keys( 1000 );
+		TBenchmarkBatch Batch;
+		TEllipticCurveKey Key;
+		struct timeval start, stop;
+		unsigned int Threads;
+		double t;
+
+		for( size_t i = 0; i < Keys.size(); i++ )
+			Keys[i].generate();
+		makeSignatures( Batch, Keys, Count );
+
+		printf( "method,threads,signatures,seconds,signatures/s\n" );
+
+		// What verify() on the calling thread manages
+		gettimeofday( &start, NULL );
+		for( size_t i = 0; i < Batch.size(); i++ ) {
+			Key.setPublicKey( Batch.publicKey( i ) );
+			if( !Key.verify( Batch.digest( i ), Batch.signature( i ) ) )
+				throw logic_error( "Benchmark signatures didn't verify" );
+		}
+		gettimeofday( &stop, NULL );
+		t = seconds( start, stop );
+		printf( "serial,1,%lu,%.3f,%.0f\n", static_cast<unsigned long>( Batch.size() ), t, Batch.size() / t );
+
+		for( Threads = 1; Threads < TThread::processors(); Threads *= 2 ) {
+			TSignatureVerifier Verifier( Threads );
+			benchmark( "verifier", Batch, Verifier );
+		}
+		{
+			TSignatureVerifier Verifier;
+			benchmark( "verifier", Batch, Verifier );
+		}
+
+		// A block whose transactions have already been seen.  The
+		// cache is made roomy enough that no set overflows
+		{
+			TSignatureCache Cache( 4 * Count );
+			TSignatureVerifier Verifier( 0, &Cache );
+			benchmark( "cache-cold", Batch, Verifier );
+			benchmark( "cache-warm", Batch, Verifier );
+		}
+
+	} catch( exception &e ) {
+		log(TLog::Error) << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
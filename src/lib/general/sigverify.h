@@ -0,0 +1,284 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   sigverify.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef SIGVERIFY_H
+#define SIGVERIFY_H
+
+// -------------- Includes
+// --- C
+#include <stddef.h>
+#include <stdint.h>
+// --- C++
+#include <deque>
+#include <vector>
+// --- Qt
+// --- OS
+// --- Project
+#include "bytearray.h"
+#include "thread.h"
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+class TSignatureVerifier;
+class TEllipticCurveKey;
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TSignatureCache
+// Description:
+/// Remembers ECDSA signatures that have verified.
+//
+/// A transaction's signatures are checked when it arrives on its own,
+/// then again when the block holding it arrives.  The cache keeps a
+/// salted SHA-256 of each (public key, digest, signature) that
+/// verified, so the second check is a lookup.  The salt is random, and
+/// different in every process, so nobody can choose signatures that
+/// collide in the cache.  Failures are never cached.
+///
+/// Entries live in sets of WAYS, chosen by the hash; a full set drops
+/// its least recently used entry, so the memory used is fixed.  Sets
+/// are locked in stripes of LOCKS, so threads only wait for each other
+/// when they touch the same stripe.
+//
+class TSignatureCache
+{
+  public:
+	TSignatureCache( size_t Entries = DEFAULT_ENTRIES );
+
+	bool contains( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature );
+	void insert( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature );
+	bool verify( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature );
+
+	size_t getCapacity() const { return Entries.size(); }
+	unsigned long getHits() const { return Hits; }
+	unsigned long getMisses() const { return Misses; }
+
+	static TSignatureCache &shared();
+
+	static const size_t DEFAULT_ENTRIES = 1 << 18;
+
+  protected:
+	struct TEntry {
+		unsigned char Hash[32];
+	};
+
+	void hash( TEntry &, const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature ) const;
+	bool find( const TEntry & );
+	void store( const TEntry & );
+
+	static const unsigned int WAYS = 4;
+	static const unsigned int LOCKS = 64;
+
+  protected:
+	unsigned char Salt[32];
+	vector<TEntry> Entries;
+	size_t Sets;
+	TMutex Locks[LOCKS];
+
+	volatile unsigned long Hits;
+	volatile unsigned long Misses;
+
+	// Keys to verify() misses with, one for each thread
+	TThreadLocal<TEllipticCurveKey> Keys;
+
+  private:
+	// Not copyable
+	TSignatureCache( const TSignatureCache & );
+	TSignatureCache &operator=( const TSignatureCache & );
+};
+
+//
+// Class:	TVerifyBatch
+// Description:
+/// A set of ECDSA signatures for a TSignatureVerifier to check.
+//
+/// Each job is a public key, in the octet form that
+/// TEllipticCurveKey::setPublicKey() takes, a digest and a DER encoded
+/// signature, as TEllipticCurveKey::verify() takes.  add() the jobs,
+/// TSignatureVerifier::submit() the batch, then wait() for it, after
+/// which result() says whether each job verified.
+///
+/// Children can instead, or as well, supply completed(), which is
+/// called on the worker thread that finishes the last job, before
+/// wait() returns.
+///
+/// A batch must not be changed or destroyed while it is submitted.
+//
+class TVerifyBatch
+{
+  public:
+	TVerifyBatch();
+	virtual ~TVerifyBatch();
+
+	size_t add( const TByteArray &PublicKey, const TByteArray &Digest, const TByteArray &Signature );
+	void clear();
+
+	size_t size() const { return Jobs.size(); }
+	bool isComplete() const;
+	bool wait();
+
+	bool result( size_t i ) const { return Results[i] != 0; }
+	size_t failures() const;
+
+  protected:
+	virtual void completed() {}
+
+  protected:
+	struct TJob {
+		TByteArray PublicKey;
+		TByteArray Digest;
+		TByteArray Signature;
+	};
+
+	vector<TJob> Jobs;
+	vector<unsigned char> Results;
+
+	// Owned by the verifier's lock while submitted.  Complete is set
+	// last, so once it is seen the batch no longer needs its verifier
+	TSignatureVerifier *Verifier;
+	size_t Unclaimed;
+	size_t Unfinished;
+	volatile bool Complete;
+
+	friend class TSignatureVerifier;
+
+  private:
+	// Not copyable
+	TVerifyBatch( const TVerifyBatch & );
+	TVerifyBatch &operator=( const TVerifyBatch & );
+};
+
+//
+// Class:	TSignatureVerifier
+// Description:
+/// A pool of threads that check TVerifyBatch signatures.
+//
+/// Checking a signature is the expensive part of validating a
+/// transaction input, and the inputs of a block are independent, so
+/// their signatures can be checked on every core at once.  Submitted
+/// batches are worked through in order; each worker takes a run of
+/// jobs from the front batch at a time, so that a large batch is
+/// shared between the workers but the queue's lock is only taken once
+/// for each run.  Each worker has its own TEllipticCurveKey, as an
+/// OpenSSL key mustn't be used by two threads at once, but they share
+/// the decoded public keys of TPublicKeyCache::shared().
+///
+/// Given a TSignatureCache, workers look each job up in it first, and
+/// add those that verify.
+///
+/// The destructor finishes any batches still queued before it stops
+/// the workers.
+//
+class TSignatureVerifier
+{
+  public:
+	TSignatureVerifier( unsigned int Threads = 0, TSignatureCache *Cache = NULL );
+	~TSignatureVerifier();
+
+	void submit( TVerifyBatch & );
+	void wait( TVerifyBatch & );
+
+	unsigned int getThreadCount() const { return Workers.size(); }
+
+  protected:
+	//
+	// Class:	TSignatureVerifier :: TWorker
+	// Description:
+	//
+	class TWorker : public TThread
+	{
+	  public:
+		TWorker( TSignatureVerifier *v ) : Verifier( v ) {}
+
+	  protected:
+		void run();
+
+	  protected:
+		TSignatureVerifier *Verifier;
+	};
+
+	bool claim( TVerifyBatch *&, size_t &First, size_t &Count );
+	void finish( TVerifyBatch *, size_t Count );
+
+  protected:
+	TMutex Lock;
+	TCondition WorkAvailable;
+	TCondition BatchCompleted;
+
+	deque<TVerifyBatch *> Queue;
+	vector<TWorker *> Workers;
+	bool Stopping;
+
+	TSignatureCache *Cache;
+
+	// The most jobs a worker takes at once
+	static const size_t MAXIMUM_RUN = 32;
+
+  private:
+	// Not copyable
+	TSignatureVerifier( const TSignatureVerifier & );
+	TSignatureVerifier &operator=( const TSignatureVerifier & );
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
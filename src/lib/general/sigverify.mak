@@ -0,0 +1 @@
+sigverify_LIBS += ssl crypto pthread
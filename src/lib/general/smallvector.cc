@@ -0,0 +1,141 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   smallvector.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "smallvector.h"
+
+// -------------- Includes
+// --- C
+// --- C++
+// --- Qt
+// --- OS
+// --- Project libs
+// --- Project
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Template instantiations
+
+
+// -------------- Class declarations
+
+
+// -------------- Class member definitions
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <stdexcept>
+#include "logstream.h"
+
+typedef TSmallVector<unsigned int, 4> TSmall;
+
+//
+// Function:	checkContents
+// Description:
+// V should hold 0, 1, 2 ... n-1.
+//
+static void checkContents( const TSmall &V, unsigned int n, const char *what )
+{
+	if( V.size() != n )
+		throw logic_error( string(what) + ": wrong size" );
+	for( unsigned int i = 0; i < n; i++ )
+		if( V[i] != i )
+			throw logic_error( string(what) + ": wrong contents" );
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		TSmall A;
+
+		log() << "Filling to the inline capacity" << endl;
+		for( unsigned int i = 0; i < 4; i++ )
+			A.push_back( i );
+		checkContents( A, 4, "inline" );
+		if( !A.isInline() )
+			throw logic_error( "Four elements should be inline" );
+
+		log() << "Growing onto the heap" << endl;
+		A.push_back( 4 );
+		checkContents( A, 5, "heap" );
+		if( A.isInline() )
+			throw logic_error( "Five elements shouldn't be inline" );
+
+		// push_back() of our own element, as the reallocation happens
+		TSmall B;
+		for( unsigned int i = 0; i < 4; i++ )
+			B.push_back( i );
+		B.push_back( B.back() );
+		if( B[4] != 3 )
+			throw logic_error( "push_back() of own element lost the value" );
+
+		log() << "Copying" << endl;
+		TSmall C( A );
+		checkContents( C, 5, "copy" );
+		C = TSmall( 3 );
+		if( C.size() != 3 || C[2] != 0 )
+			throw logic_error( "Assigning a short vector failed" );
+
+		log() << "Swapping every combination of inline and heap" << endl;
+		for( unsigned int an = 0; an < 10; an++ ) {
+			for( unsigned int bn = 0; bn < 10; bn++ ) {
+				TSmall X, Y;
+				for( unsigned int i = 0; i < an; i++ )
+					X.push_back( i );
+				for( unsigned int i = 0; i < bn; i++ )
+					Y.push_back( i );
+				X.swap( Y );
+				checkContents( X, bn, "swap" );
+				checkContents( Y, an, "swap" );
+			}
+		}
+
+		log() << "Erasing and resizing" << endl;
+		A.erase( A.begin() + 1, A.begin() + 3 );
+		if( A.size() != 3 || A[0] != 0 || A[1] != 3 || A[2] != 4 )
+			throw logic_error( "erase() failed" );
+		A.resize( 6, 9 );
+		if( A.size() != 6 || A[5] != 9 )
+			throw logic_error( "resize() failed" );
+		A.clear();
+		if( !A.empty() )
+			throw logic_error( "clear() failed" );
+
+		log() << "Reverse iteration: ";
+		for( TSmall::const_reverse_iterator it = C.rbegin(); it != C.rend(); it++ )
+			log() << *it << " ";
+		log() << endl;
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
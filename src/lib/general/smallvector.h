@@ -0,0 +1,290 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   smallvector.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef SMALLVECTOR_H
+#define SMALLVECTOR_H
+
+// -------------- Includes
+// --- C
+#include <stddef.h>
+#include <string.h>
+// --- C++
+#include <iterator>
+#include <algorithm>
+// --- Qt
+// --- OS
+// --- Project
+// --- Project lib
+
+
+// -------------- Namespace
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TSmallVector
+// Description:
+// A vector with room for N elements inside the object itself.  Only
+// when it grows past N does it go to the heap, so short vectors are
+// created, copied and destroyed without touching the allocator.
+//
+// It implements the parts of std::vector's interface that
+// TGenericBigInteger uses; iterators are plain pointers.  Elements are
+// copied with memcpy() and never constructed or destroyed, so T must
+// be a plain old data type.
+//
+// Capacity, once taken from the heap, is kept until destruction;
+// clear() and shrinking resize() don't give it back.
+//
+template <typename T, size_t N>
+class TSmallVector
+{
+  public:
+	typedef T value_type;
+	typedef size_t size_type;
+	typedef T *iterator;
+	typedef const T *const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  public:
+	TSmallVector() : Data(Inline), Size(0), Capacity(N) {}
+	explicit TSmallVector( size_type n, const T &v = T() ) : Data(Inline), Size(0), Capacity(N) { assign(n, v); }
+	TSmallVector( const TSmallVector &O ) : Data(Inline), Size(0), Capacity(N) { assign(O.begin(), O.end()); }
+	~TSmallVector() { if( !isInline() ) delete[] Data; }
+
+	TSmallVector &operator=( const TSmallVector &O ) { if( this != &O ) assign(O.begin(), O.end()); return *this; }
+#if __cplusplus >= 201103L
+	TSmallVector( TSmallVector &&O ) : Data(Inline), Size(0), Capacity(N) { take(O); }
+	TSmallVector &operator=( TSmallVector &&O ) { if( this != &O ) take(O); return *this; }
+#endif
+
+	size_type size() const { return Size; }
+	size_type capacity() const { return Capacity; }
+	bool empty() const { return Size == 0; }
+	bool isInline() const { return Data == Inline; }
+
+	iterator begin() { return Data; }
+	iterator end() { return Data + Size; }
+	const_iterator begin() const { return Data; }
+	const_iterator end() const { return Data + Size; }
+	reverse_iterator rbegin() { return reverse_iterator(end()); }
+	reverse_iterator rend() { return reverse_iterator(begin()); }
+	const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+	const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+	T &operator[]( size_type i ) { return Data[i]; }
+	const T &operator[]( size_type i ) const { return Data[i]; }
+	T &front() { return Data[0]; }
+	const T &front() const { return Data[0]; }
+	T &back() { return Data[Size-1]; }
+	const T &back() const { return Data[Size-1]; }
+
+	void push_back( const T &v ) {
+		// v might be one of our own elements, so copy it before a
+		// reallocation can move it
+		T Hold = v;
+		if( Size == Capacity )
+			reserve( Capacity * 2 );
+		Data[Size++] = Hold;
+	}
+	void pop_back() { Size--; }
+	void clear() { Size = 0; }
+
+	void reserve( size_type );
+	void resize( size_type n, const T &v = T() );
+	void assign( size_type n, const T &v );
+	void assign( const T *first, const T *last );
+	iterator erase( iterator first, iterator last );
+	void swap( TSmallVector & );
+
+  protected:
+	void take( TSmallVector & );
+
+  protected:
+	T *Data;
+	size_type Size;
+	size_type Capacity;
+	T Inline[N];
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+//
+// Function:	TSmallVector :: reserve
+// Description:
+//
+template <typename T, size_t N>
+void TSmallVector<T,N>::reserve( size_type n )
+{
+	if( n <= Capacity )
+		return;
+
+	T *NewData = new T[n];
+	memcpy( NewData, Data, Size * sizeof(T) );
+	if( !isInline() )
+		delete[] Data;
+	Data = NewData;
+	Capacity = n;
+}
+
+//
+// Function:	TSmallVector :: resize
+// Description:
+//
+template <typename T, size_t N>
+void TSmallVector<T,N>::resize( size_type n, const T &v )
+{
+	T Hold = v;
+
+	reserve( n );
+	while( Size < n )
+		Data[Size++] = Hold;
+	Size = n;
+}
+
+//
+// Function:	TSmallVector :: assign
+// Description:
+//
+template <typename T, size_t N>
+void TSmallVector<T,N>::assign( size_type n, const T &v )
+{
+	T Hold = v;
+
+	Size = 0;
+	resize( n, Hold );
+}
+
+//
+// Function:	TSmallVector :: assign
+// Description:
+// The range mustn't be from this vector.
+//
+template <typename T, size_t N>
+void TSmallVector<T,N>::assign( const T *first, const T *last )
+{
+	Size = 0;
+	reserve( last - first );
+	memcpy( Data, first, (last - first) * sizeof(T) );
+	Size = last - first;
+}
+
+//
+// Function:	TSmallVector :: erase
+// Description:
+//
+template <typename T, size_t N>
+typename TSmallVector<T,N>::iterator
+TSmallVector<T,N>::erase( iterator first, iterator last )
+{
+	memmove( first, last, (end() - last) * sizeof(T) );
+	Size -= last - first;
+	return first;
+}
+
+//
+// Function:	TSmallVector :: swap
+// Description:
+// Two heap vectors swap pointers; otherwise there's inline storage to
+// copy, which take() handles.
+//
+template <typename T, size_t N>
+void TSmallVector<T,N>::swap( TSmallVector &O )
+{
+	if( this == &O )
+		return;
+
+	if( !isInline() && !O.isInline() ) {
+		std::swap( Data, O.Data );
+		std::swap( Size, O.Size );
+		std::swap( Capacity, O.Capacity );
+		return;
+	}
+
+	TSmallVector Hold;
+	Hold.take( *this );
+	take( O );
+	O.take( Hold );
+}
+
+//
+// Function:	TSmallVector :: take
+// Description:
+// Move the contents of O into this vector, leaving O empty.  Heap
+// storage changes hands; inline storage is copied.
+//
+template <typename T, size_t N>
+void TSmallVector<T,N>::take( TSmallVector &O )
+{
+	if( O.isInline() ) {
+		// O.Size <= N, so this can't need to allocate
+		assign( O.begin(), O.end() );
+	} else {
+		if( !isInline() )
+			delete[] Data;
+		Data = O.Data;
+		Size = O.Size;
+		Capacity = O.Capacity;
+		O.Data = O.Inline;
+		O.Capacity = N;
+	}
+	O.Size = 0;
+}
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
@@ -0,0 +1,453 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   socketpoller.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "socketpoller.h"
+
+// -------------- Includes
+// --- C
+#include <errno.h>
+#include <stdlib.h>
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#ifdef HAVE_EPOLL
+#	include <sys/epoll.h>
+#endif
+// --- Project libs
+// --- Project
+#include "extraexcept.h"
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+//
+// Function:	TSocketPoller :: createBest
+// Description:
+// Returns a new poller of the best type available on this platform.
+//
+TSocketPoller *TSocketPoller::createBest()
+{
+#ifdef HAVE_EPOLL
+	return new TSocketPoller_epoll;
+#else
+	return new TSocketPoller_select;
+#endif
+}
+
+//
+// Function:	TSocketPoller :: setNonBlocking
+// Description:
+//
+void TSocketPoller::setNonBlocking( fd_t fd )
+{
+	int flags;
+
+	flags = fcntl( fd, F_GETFL, 0 );
+	if( flags < 0 )
+		throw libc_error( "fcntl(F_GETFL)" );
+	if( fcntl( fd, F_SETFL, flags | O_NONBLOCK ) < 0 )
+		throw libc_error( "fcntl(F_SETFL)" );
+}
+
+// --------
+
+//
+// Function:	TSocketPoller_select :: add
+// Description:
+//
+void TSocketPoller_select::add( fd_t fd )
+{
+	if( fd < 0 || fd >= FD_SETSIZE )
+		throw range_error( "TSocketPoller_select::add() descriptor is outside the range select() can watch" );
+	Descriptors.insert( fd );
+}
+
+//
+// Function:	TSocketPoller_select :: remove
+// Description:
+//
+void TSocketPoller_select::remove( fd_t fd )
+{
+	Descriptors.erase( fd );
+	WriteInterest.erase( fd );
+}
+
+//
+// Function:	TSocketPoller_select :: setWriteInterest
+// Description:
+//
+void TSocketPoller_select::setWriteInterest( fd_t fd, bool b )
+{
+	if( b ) {
+		WriteInterest.insert( fd );
+	} else {
+		WriteInterest.erase( fd );
+	}
+}
+
+//
+// Function:	TSocketPoller_select :: wait
+// Description:
+// Waits up to the given number of milliseconds (negative for forever)
+// and fills Events with the ready descriptors.  Returns the number of
+// ready descriptors; zero on timeout or interruption.
+//
+unsigned int TSocketPoller_select::wait( int ms, vector<TEvent> &Events )
+{
+	set<fd_t>::const_iterator it;
+	fd_set readfds, writefds;
+	struct timeval timeout;
+	fd_t maxfd = -1;
+	int ret;
+
+	Events.clear();
+
+	FD_ZERO( &readfds );
+	FD_ZERO( &writefds );
+	for( it = Descriptors.begin(); it != Descriptors.end(); it++ ) {
+		FD_SET( *it, &readfds );
+		if( maxfd < *it )
+			maxfd = *it;
+	}
+	for( it = WriteInterest.begin(); it != WriteInterest.end(); it++ ) {
+		FD_SET( *it, &writefds );
+	}
+
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+
+	ret = select( maxfd + 1, &readfds, &writefds, NULL, ms < 0 ? NULL : &timeout );
+	if( ret < 0 ) {
+		if( errno == EINTR )
+			return 0;
+		throw libc_error( "select()" );
+	}
+
+	for( it = Descriptors.begin(); ret > 0 && it != Descriptors.end(); it++ ) {
+		TEvent E;
+		E.Descriptor = *it;
+		E.Readable = FD_ISSET( *it, &readfds );
+		E.Writable = FD_ISSET( *it, &writefds );
+		if( !E.Readable && !E.Writable )
+			continue;
+		Events.push_back( E );
+		ret -= E.Readable + E.Writable;
+	}
+
+	return Events.size();
+}
+
+// --------
+
+#ifdef HAVE_EPOLL
+//
+// Function:	TSocketPoller_epoll :: TSocketPoller_epoll
+// Description:
+//
+TSocketPoller_epoll::TSocketPoller_epoll() :
+	Registered(0)
+{
+	// The size argument is ignored by modern kernels, but must be
+	// positive
+	EpollDescriptor = epoll_create( 256 );
+	if( EpollDescriptor < 0 )
+		throw libc_error( "epoll_create()" );
+}
+
+//
+// Function:	TSocketPoller_epoll :: ~TSocketPoller_epoll
+// Description:
+//
+TSocketPoller_epoll::~TSocketPoller_epoll()
+{
+	close( EpollDescriptor );
+}
+
+//
+// Function:	TSocketPoller_epoll :: add
+// Description:
+//
+void TSocketPoller_epoll::add( fd_t fd )
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = fd;
+	if( epoll_ctl( EpollDescriptor, EPOLL_CTL_ADD, fd, &ev ) < 0 )
+		throw libc_error( "epoll_ctl(EPOLL_CTL_ADD)" );
+	Registered++;
+}
+
+//
+// Function:	TSocketPoller_epoll :: remove
+// Description:
+//
+void TSocketPoller_epoll::remove( fd_t fd )
+{
+	// Pre-2.6.9 kernels insist on a non-NULL event even for delete
+	struct epoll_event ev;
+
+	if( epoll_ctl( EpollDescriptor, EPOLL_CTL_DEL, fd, &ev ) < 0 )
+		throw libc_error( "epoll_ctl(EPOLL_CTL_DEL)" );
+	Registered--;
+}
+
+//
+// Function:	TSocketPoller_epoll :: wait
+// Description:
+// As TSocketPoller_select::wait()
+//
+unsigned int TSocketPoller_epoll::wait( int ms, vector<TEvent> &Events )
+{
+	// Don't make one call enormous; anything not returned this time
+	// will be returned next time
+	static const unsigned int MAXIMUM_EVENTS = 256;
+	struct epoll_event ev[MAXIMUM_EVENTS];
+	int i, ret;
+
+	Events.clear();
+
+	ret = epoll_wait( EpollDescriptor, ev,
+			Registered == 0 ? 1 : (Registered < MAXIMUM_EVENTS ? Registered : MAXIMUM_EVENTS),
+			ms );
+	if( ret < 0 ) {
+		if( errno == EINTR )
+			return 0;
+		throw libc_error( "epoll_wait()" );
+	}
+
+	Events.resize( ret );
+	for( i = 0; i < ret; i++ ) {
+		Events[i].Descriptor = ev[i].data.fd;
+		// Hang ups and errors are reported as readable, the following
+		// read() will discover what went wrong
+		Events[i].Readable = (ev[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+		Events[i].Writable = (ev[i].events & EPOLLOUT) != 0;
+	}
+
+	return Events.size();
+}
+#endif
+
+// --------
+
+//
+// Function:	TPollerWakeup :: TPollerWakeup
+// Description:
+//
+TPollerWakeup::TPollerWakeup() :
+	Pending( 0 )
+{
+	if( pipe( Pipe ) < 0 )
+		throw libc_error( "pipe()" );
+	TSocketPoller::setNonBlocking( Pipe[0] );
+	TSocketPoller::setNonBlocking( Pipe[1] );
+}
+
+//
+// Function:	TPollerWakeup :: ~TPollerWakeup
+// Description:
+//
+TPollerWakeup::~TPollerWakeup()
+{
+	close( Pipe[0] );
+	close( Pipe[1] );
+}
+
+//
+// Function:	TPollerWakeup :: wake
+// Description:
+//
+void TPollerWakeup::wake()
+{
+	char ch = 0;
+
+	if( __sync_lock_test_and_set( &Pending, 1 ) != 0 )
+		return;
+
+	// If the pipe is full the waiter is certainly going to wake, so a
+	// failure here doesn't matter
+	if( write( Pipe[1], &ch, 1 ) < 0 ) {
+	}
+}
+
+//
+// Function:	TPollerWakeup :: clear
+// Description:
+// Must come before the waker's work is looked for, not after, or a
+// wake() in between would be lost.  The pipe is emptied before the flag
+// is dropped; the other way round, a wake() could write a byte that we
+// then swallow while leaving the flag set, and nothing would write
+// again.
+//
+void TPollerWakeup::clear()
+{
+	char buffer[64];
+
+	while( read( Pipe[0], buffer, sizeof(buffer) ) > 0 )
+		;
+
+	__sync_lock_release( &Pending );
+	__sync_synchronize();
+}
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <memory>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "logstream.h"
+
+//
+// Function:	loopbackLoadTest
+// Description:
+// Opens Count loopback TCP connections, registers the server end of each
+// with P, then repeatedly writes a byte to a random client and measures
+// how long it takes for P to report the matching server end readable.
+//
+static void loopbackLoadTest( TSocketPoller &P, unsigned int Count, unsigned int Rounds )
+{
+	vector<int> Clients, Servers;
+	vector<TSocketPoller::TEvent> Events;
+	struct sockaddr_in SAI;
+	socklen_t len = sizeof(SAI);
+	struct timeval start, end;
+	double total = 0, worst = 0;
+	unsigned int i, j;
+	int listener;
+	char ch = 'x';
+
+	listener = socket( PF_INET, SOCK_STREAM, 0 );
+	if( listener < 0 )
+		throw socket_error( "socket()" );
+	SAI.sin_family = AF_INET;
+	SAI.sin_port = 0;
+	SAI.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	if( bind( listener, reinterpret_cast<sockaddr*>(&SAI), sizeof(SAI) ) < 0 )
+		throw socket_error( "bind()" );
+	if( listen( listener, 128 ) < 0 )
+		throw socket_error( "listen()" );
+	getsockname( listener, reinterpret_cast<sockaddr*>(&SAI), &len );
+
+	for( i = 0; i < Count; i++ ) {
+		int c, s;
+		c = socket( PF_INET, SOCK_STREAM, 0 );
+		if( c < 0 )
+			throw socket_error( "socket()" );
+		if( connect( c, reinterpret_cast<sockaddr*>(&SAI), sizeof(SAI) ) < 0 )
+			throw socket_error( "connect()" );
+		s = accept( listener, NULL, NULL );
+		if( s < 0 )
+			throw socket_error( "accept()" );
+		TSocketPoller::setNonBlocking( s );
+		P.add( s );
+		Clients.push_back( c );
+		Servers.push_back( s );
+	}
+
+	// Swallow the initial write readiness epoll reports
+	while( P.wait( 0, Events ) > 0 )
+		;
+
+	for( i = 0; i < Rounds; i++ ) {
+		unsigned int n = rand() % Count;
+		bool found = false;
+
+		gettimeofday( &start, NULL );
+		if( write( Clients[n], &ch, 1 ) != 1 )
+			throw libc_error( "write()" );
+
+		while( !found ) {
+			P.wait( 1000, Events );
+			for( j = 0; j < Events.size(); j++ ) {
+				if( Events[j].Descriptor != Servers[n] || !Events[j].Readable )
+					continue;
+				gettimeofday( &end, NULL );
+				found = true;
+				// Edge triggered, so drain
+				while( read( Servers[n], &ch, 1 ) > 0 )
+					;
+			}
+		}
+
+		double t = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+		total += t;
+		if( t > worst )
+			worst = t;
+	}
+
+	log() << P.className() << ": " << Count << " peers, " << Rounds
+		<< " wakeups, mean latency " << total / Rounds << "us, worst "
+		<< worst << "us" << endl;
+
+	for( i = 0; i < Count; i++ ) {
+		P.remove( Servers[i] );
+		close( Servers[i] );
+		close( Clients[i] );
+	}
+	close( listener );
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		struct rlimit rl;
+
+		// Two descriptors per peer, so we'll need more than the
+		// usual 1024
+		if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < 2100 ) {
+			rl.rlim_cur = rl.rlim_max < 2100 ? rl.rlim_max : 2100;
+			setrlimit( RLIMIT_NOFILE, &rl );
+		}
+
+		// select() can't go past FD_SETSIZE
+		TSocketPoller_select S;
+		loopbackLoadTest( S, 400, 2000 );
+
+		auto_ptr<TSocketPoller> P( TSocketPoller::createBest() );
+		loopbackLoadTest( *P, 400, 2000 );
+		loopbackLoadTest( *P, 1000, 2000 );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,215 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   socketpoller.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef SOCKETPOLLER_H
+#define SOCKETPOLLER_H
+
+// -------------- Includes
+// --- C
+// --- C++
+#include <vector>
+#include <set>
+// --- Qt
+// --- OS
+// --- Project
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+#if defined(__linux__)
+#	define HAVE_EPOLL 1
+#endif
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TSocketPoller
+// Description:
+// Waits for readiness on a set of descriptors.
+//
+// Descriptors are registered once with add() and stay registered until
+// remove().  Callers must treat readiness as edge triggered: having been
+// told a descriptor is readable (or writable) they must read (or write)
+// until the call would block.  That is required by the epoll
+// implementation, and harmless for select().
+//
+// Write readiness is only reported for descriptors that have asked for
+// it with setWriteInterest(); there is no point waking for a socket
+// that has nothing to send.
+//
+// Users that need a poller per thread take a TFactory; createBest() is
+// one, and each implementation's create() is another.
+//
+class TSocketPoller
+{
+  public:
+	typedef int fd_t;
+	typedef TSocketPoller *(*TFactory)();
+
+	struct TEvent {
+		fd_t Descriptor;
+		bool Readable;
+		bool Writable;
+	};
+
+  public:
+	TSocketPoller() {}
+	virtual ~TSocketPoller() {}
+	virtual const char *className() const { return "TSocketPoller"; }
+
+	virtual void add( fd_t ) = 0;
+	virtual void remove( fd_t ) = 0;
+	virtual void setWriteInterest( fd_t, bool ) = 0;
+
+	virtual unsigned int wait( int, vector<TEvent> & ) = 0;
+
+	static TSocketPoller *createBest();
+	static void setNonBlocking( fd_t );
+};
+
+//
+// Class:	TSocketPoller_select
+// Description:
+// The portable fallback.  select() is limited to descriptors below
+// FD_SETSIZE and costs time proportional to the number registered on
+// every call.
+//
+class TSocketPoller_select : public TSocketPoller
+{
+  public:
+	const char *className() const { return "TSocketPoller_select"; }
+	static TSocketPoller *create() { return new TSocketPoller_select; }
+
+	void add( fd_t );
+	void remove( fd_t );
+	void setWriteInterest( fd_t, bool );
+
+	unsigned int wait( int, vector<TEvent> & );
+
+  protected:
+	set<fd_t> Descriptors;
+	set<fd_t> WriteInterest;
+};
+
+#ifdef HAVE_EPOLL
+//
+// Class:	TSocketPoller_epoll
+// Description:
+// Edge triggered epoll.  Each descriptor is registered once for both
+// read and write readiness, and only ready descriptors are returned, so
+// the cost of a wait doesn't depend on how many descriptors are idle.
+//
+class TSocketPoller_epoll : public TSocketPoller
+{
+  public:
+	TSocketPoller_epoll();
+	~TSocketPoller_epoll();
+	const char *className() const { return "TSocketPoller_epoll"; }
+	static TSocketPoller *create() { return new TSocketPoller_epoll; }
+
+	void add( fd_t );
+	void remove( fd_t );
+	void setWriteInterest( fd_t, bool ) {}
+
+	unsigned int wait( int, vector<TEvent> & );
+
+  protected:
+	fd_t EpollDescriptor;
+	unsigned int Registered;
+};
+#endif
+
+//
+// Class:	TPollerWakeup
+// Description:
+// Lets other threads interrupt a TSocketPoller::wait().  add() the
+// descriptor() to the poller; any thread may then wake(), and the
+// waiting thread, seeing descriptor() readable, calls clear() before
+// looking for whatever work it was woken for.
+//
+// Only the first wake() after each clear() writes to the pipe, so
+// waking a thread that is already awake costs nothing.
+//
+class TPollerWakeup
+{
+  public:
+	typedef TSocketPoller::fd_t fd_t;
+
+  public:
+	TPollerWakeup();
+	~TPollerWakeup();
+
+	fd_t descriptor() const { return Pipe[0]; }
+
+	void wake();
+	void clear();
+
+  protected:
+	fd_t Pipe[2];
+	volatile int Pending;
+
+  private:
+	// Not copyable
+	TPollerWakeup( const TPollerWakeup & );
+	TPollerWakeup &operator=( const TPollerWakeup & );
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
@@ -0,0 +1,314 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   thread.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "thread.h"
+
+// -------------- Includes
+// --- C
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+#include <unistd.h>
+// --- Project libs
+// --- Project
+#include "extraexcept.h"
+#include "logstream.h"
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+//
+// Function:	TMutex :: TMutex
+// Description:
+//
+TMutex::TMutex()
+{
+	int ret = pthread_mutex_init( &Mutex, NULL );
+	if( ret != 0 )
+		throw libc_error( "pthread_mutex_init()", ret );
+}
+
+//
+// Function:	TMutex :: ~TMutex
+// Description:
+//
+TMutex::~TMutex()
+{
+	pthread_mutex_destroy( &Mutex );
+}
+
+//
+// Function:	TMutex :: lock
+// Description:
+//
+void TMutex::lock()
+{
+	int ret = pthread_mutex_lock( &Mutex );
+	if( ret != 0 )
+		throw libc_error( "pthread_mutex_lock()", ret );
+}
+
+//
+// Function:	TMutex :: unlock
+// Description:
+//
+void TMutex::unlock()
+{
+	pthread_mutex_unlock( &Mutex );
+}
+
+// --------
+
+//
+// Function:	TCondition :: TCondition
+// Description:
+//
+TCondition::TCondition()
+{
+	int ret = pthread_cond_init( &Condition, NULL );
+	if( ret != 0 )
+		throw libc_error( "pthread_cond_init()", ret );
+}
+
+//
+// Function:	TCondition :: ~TCondition
+// Description:
+//
+TCondition::~TCondition()
+{
+	pthread_cond_destroy( &Condition );
+}
+
+//
+// Function:	TCondition :: wait
+// Description:
+//
+void TCondition::wait( TMutex &m )
+{
+	int ret = pthread_cond_wait( &Condition, &m.Mutex );
+	if( ret != 0 )
+		throw libc_error( "pthread_cond_wait()", ret );
+}
+
+//
+// Function:	TCondition :: signal
+// Description:
+// Wake one waiter.
+//
+void TCondition::signal()
+{
+	pthread_cond_signal( &Condition );
+}
+
+//
+// Function:	TCondition :: broadcast
+// Description:
+// Wake every waiter.
+//
+void TCondition::broadcast()
+{
+	pthread_cond_broadcast( &Condition );
+}
+
+// --------
+
+//
+// Function:	TThread :: TThread
+// Description:
+//
+TThread::TThread() :
+	Started( false )
+{
+}
+
+//
+// Function:	TThread :: ~TThread
+// Description:
+//
+TThread::~TThread()
+{
+	if( Started )
+		log(TLog::Error) << "TThread destroyed without being joined" << endl;
+}
+
+//
+// Function:	TThread :: start
+// Description:
+//
+void TThread::start()
+{
+	int ret;
+
+	if( Started )
+		throw logic_error( "TThread::start() thread is already started" );
+
+	ret = pthread_create( &Thread, NULL, entry, this );
+	if( ret != 0 )
+		throw libc_error( "pthread_create()", ret );
+	Started = true;
+}
+
+//
+// Function:	TThread :: join
+// Description:
+//
+void TThread::join()
+{
+	int ret;
+
+	if( !Started )
+		return;
+
+	ret = pthread_join( Thread, NULL );
+	if( ret != 0 )
+		throw libc_error( "pthread_join()", ret );
+	Started = false;
+}
+
+//
+// Function:	TThread :: isCurrent
+// Description:
+// Returns true if called from this object's thread.
+//
+bool TThread::isCurrent() const
+{
+	return Started && pthread_equal( Thread, pthread_self() );
+}
+
+//
+// Function:	TThread :: processors
+// Description:
+// The number of processors online, for sizing pools of threads.
+//
+unsigned int TThread::processors()
+{
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+
+	return n < 1 ? 1 : n;
+}
+
+//
+// Function:	TThread :: entry
+// Description:
+// There is nobody to catch an exception that escapes a thread, so we
+// log it here rather than let it terminate the process silently.
+//
+void *TThread::entry( void *p )
+{
+	TThread *T = reinterpret_cast<TThread *>( p );
+
+	try {
+		T->run();
+	} catch( exception &e ) {
+		log(TLog::Error) << "Thread terminated by exception, " << e.what() << endl;
+	}
+
+	return NULL;
+}
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <sys/time.h>
+#include <vector>
+
+//
+// Class:	TUnitTestProducer
+// Description:
+// Pushes Count values onto the queue, each tagged with the producer's
+// identity so the consumer can check they arrive in order.
+//
+class TUnitTestProducer : public TThread
+{
+  public:
+	TUnitTestProducer( TMPSCQueue<unsigned long> &q, unsigned long id, unsigned long n ) :
+		Queue( q ), ID( id ), Count( n ) {}
+
+  protected:
+	void run() {
+		for( unsigned long i = 0; i < Count; i++ )
+			Queue.push( (ID << 32) | i );
+	}
+
+	TMPSCQueue<unsigned long> &Queue;
+	unsigned long ID;
+	unsigned long Count;
+};
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		static const unsigned long PRODUCERS = 4;
+		static const unsigned long COUNT = 1000000;
+		TMPSCQueue<unsigned long> Queue;
+		vector<TUnitTestProducer *> Producers;
+		vector<unsigned long> Next( PRODUCERS, 0 );
+		struct timeval start, end;
+		unsigned long v, n = 0;
+		unsigned int i;
+		double t;
+
+		gettimeofday( &start, NULL );
+		for( i = 0; i < PRODUCERS; i++ ) {
+			Producers.push_back( new TUnitTestProducer( Queue, i, COUNT ) );
+			Producers.back()->start();
+		}
+
+		while( n < PRODUCERS * COUNT ) {
+			if( !Queue.pop( v ) )
+				continue;
+			// Each producer's values must arrive in the order they
+			// were pushed
+			if( (v & 0xffffffff) != Next[v >> 32] )
+				throw logic_error( "TMPSCQueue delivered out of order" );
+			Next[v >> 32]++;
+			n++;
+		}
+		gettimeofday( &end, NULL );
+
+		for( i = 0; i < PRODUCERS; i++ ) {
+			Producers[i]->join();
+			delete Producers[i];
+		}
+		if( !Queue.empty() )
+			throw logic_error( "TMPSCQueue not empty" );
+
+		t = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+		log() << "TMPSCQueue: " << n << " values from " << PRODUCERS
+			<< " producers in " << t << "s = " << n / t << " values/s" << endl;
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
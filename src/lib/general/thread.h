@@ -0,0 +1,293 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   thread.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef THREAD_H
+#define THREAD_H
+
+// -------------- Includes
+// --- C
+#include <stddef.h>
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+#include <pthread.h>
+// --- Project
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TMutex
+// Description:
+//
+class TMutex
+{
+  public:
+	TMutex();
+	~TMutex();
+
+	void lock();
+	void unlock();
+
+  protected:
+	pthread_mutex_t Mutex;
+
+	friend class TCondition;
+
+  private:
+	// Not copyable
+	TMutex( const TMutex & );
+	TMutex &operator=( const TMutex & );
+};
+
+//
+// Class:	TCondition
+// Description:
+// A condition variable.  wait() must be called with the given TMutex
+// held; it is released while waiting and held again on return.  As
+// with any condition variable, waiters can wake without a signal, so
+// should wait in a loop that checks what they are waiting for.
+//
+class TCondition
+{
+  public:
+	TCondition();
+	~TCondition();
+
+	void wait( TMutex & );
+	void signal();
+	void broadcast();
+
+  protected:
+	pthread_cond_t Condition;
+
+  private:
+	// Not copyable
+	TCondition( const TCondition & );
+	TCondition &operator=( const TCondition & );
+};
+
+//
+// Class:	TMutexLocker
+// Description:
+// Holds a TMutex for the lifetime of the locker.
+//
+class TMutexLocker
+{
+  public:
+	TMutexLocker( TMutex &m ) : Mutex( m ) { Mutex.lock(); }
+	~TMutexLocker() { Mutex.unlock(); }
+
+  protected:
+	TMutex &Mutex;
+};
+
+//
+// Class:	TThread
+// Description:
+// Children supply run(), which is called in a new thread by start().
+// The thread must have finished, or be joined, before the TThread is
+// destroyed.
+//
+class TThread
+{
+  public:
+	TThread();
+	virtual ~TThread();
+
+	void start();
+	void join();
+
+	bool isStarted() const { return Started; }
+	bool isCurrent() const;
+
+	static unsigned int processors();
+
+  protected:
+	virtual void run() = 0;
+
+  private:
+	static void *entry( void * );
+
+  protected:
+	pthread_t Thread;
+	bool Started;
+};
+
+//
+// Class:	TThreadLocal
+// Description:
+// One T per thread, created by the thread's first get() and deleted
+// when the thread exits.  T must be default constructible.
+//
+template <typename T>
+class TThreadLocal
+{
+  public:
+	TThreadLocal() {
+		if( pthread_key_create( &Key, destroy ) != 0 )
+			throw runtime_error( "TThreadLocal: pthread_key_create() failed" );
+	}
+	~TThreadLocal() { pthread_key_delete( Key ); }
+
+	T &get() {
+		T *p = static_cast<T *>( pthread_getspecific( Key ) );
+		if( p == NULL ) {
+			p = new T;
+			pthread_setspecific( Key, p );
+		}
+		return *p;
+	}
+
+  protected:
+	static void destroy( void *p ) { delete static_cast<T *>( p ); }
+
+  protected:
+	pthread_key_t Key;
+
+  private:
+	// Not copyable
+	TThreadLocal( const TThreadLocal & );
+	TThreadLocal &operator=( const TThreadLocal & );
+};
+
+//
+// Class:	TMPSCQueue
+// Description:
+// A lock-free, unbounded, first-in first-out queue that any number of
+// threads may push() to, but only one thread may pop() from.
+//
+// This is Dmitry Vyukov's node based MPSC queue:
+// http://www.1024cores.net/home/lock-free-algorithms/queues/non-intrusive-mpsc-node-based-queue
+//
+// A push is one atomic exchange and one store; a pop touches no shared
+// variable that a producer writes except the link it follows.  A
+// producer that is preempted between its exchange and its store can
+// make the queue look empty to the consumer until it resumes, so a
+// consumer that sleeps must be woken after the push, not before.
+//
+template <typename T>
+class TMPSCQueue
+{
+  protected:
+	struct TNode {
+		TNode * volatile Next;
+		T Value;
+	};
+
+  public:
+	TMPSCQueue() {
+		Tail = new TNode;
+		Tail->Next = NULL;
+		Head = Tail;
+	}
+	~TMPSCQueue() {
+		T v;
+		while( pop( v ) )
+			;
+		delete Tail;
+	}
+
+	void push( const T &v ) {
+		TNode *n = new TNode;
+		TNode *prev;
+		n->Value = v;
+		n->Next = NULL;
+		// __sync_lock_test_and_set() is only an acquire barrier, but
+		// the node must be complete before anyone can see it
+		__sync_synchronize();
+		prev = __sync_lock_test_and_set( &Head, n );
+		prev->Next = n;
+	}
+
+	bool pop( T &v ) {
+		TNode *t = Tail;
+		TNode *next = t->Next;
+		if( next == NULL )
+			return false;
+		// Don't read the value before the link that published it
+		__sync_synchronize();
+		v = next->Value;
+		// next becomes the new stub, and its value is no longer ours
+		Tail = next;
+		delete t;
+		return true;
+	}
+
+	bool empty() const { return Tail->Next == NULL; }
+
+  protected:
+	// Producers' end
+	TNode * volatile Head;
+	// Consumer's end, always a stub whose value has been taken
+	TNode *Tail;
+
+  private:
+	// Not copyable
+	TMPSCQueue( const TMPSCQueue & );
+	TMPSCQueue &operator=( const TMPSCQueue & );
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif
@@ -0,0 +1 @@
+thread_LIBS += pthread
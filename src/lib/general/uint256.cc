@@ -0,0 +1,871 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   uint256.cc
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Module include
+#include "uint256.h"
+
+// -------------- Includes
+// --- C
+#include <ctype.h>
+// --- C++
+#include <stdexcept>
+// --- Qt
+// --- OS
+// --- Project libs
+// --- Project
+
+
+// -------------- Namespace
+
+
+// -------------- Module Globals
+
+//
+// Function:	multiplyLimbs
+// Description:
+// Full 64x64 -> 128 bit product, as two limbs.
+//
+static inline void multiplyLimbs( uint64_t a, uint64_t b, uint64_t &High, uint64_t &Low )
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = static_cast<unsigned __int128>(a) * b;
+	High = static_cast<uint64_t>( p >> 64 );
+	Low = static_cast<uint64_t>( p );
+#else
+	// Four 32x32 products; the middle two can carry into the top half
+	uint64_t a0 = a & 0xffffffffULL, a1 = a >> 32;
+	uint64_t b0 = b & 0xffffffffULL, b1 = b >> 32;
+	uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	uint64_t Middle = (p00 >> 32) + (p01 & 0xffffffffULL) + (p10 & 0xffffffffULL);
+	High = p11 + (p01 >> 32) + (p10 >> 32) + (Middle >> 32);
+	Low = (Middle << 32) | (p00 & 0xffffffffULL);
+#endif
+}
+
+//
+// Function:	characterValue
+// Description:
+// The value of a digit in bases up to 36, or Base if it isn't one.
+//
+static inline unsigned int characterValue( unsigned char ch, unsigned int Base )
+{
+	unsigned int v;
+
+	if( isdigit(ch) ) {
+		v = ch - '0';
+	} else if( ch >= 'a' && ch <= 'z' ) {
+		v = ch - 'a' + 10;
+	} else if( ch >= 'A' && ch <= 'Z' ) {
+		v = ch - 'A' + 10;
+	} else {
+		return Base;
+	}
+
+	return v < Base ? v : Base;
+}
+
+
+//
+// Function:	divideLimbs
+// Description:
+// Divides the n limbs at N, least significant first, in place by a
+// single limb, returning the remainder.
+//
+static uint64_t divideLimbs( uint64_t *N, int n, uint64_t d )
+{
+	uint64_t Remainder = 0;
+	int i;
+
+#ifdef __SIZEOF_INT128__
+	for( i = n - 1; i >= 0; i-- ) {
+		unsigned __int128 x = (static_cast<unsigned __int128>(Remainder) << 64) | N[i];
+		N[i] = static_cast<uint64_t>( x / d );
+		Remainder = static_cast<uint64_t>( x % d );
+	}
+#else
+	// A bit at a time; Remainder < d throughout, so the top bit that
+	// falls off the shift is the only thing that can make it exceed d
+	for( i = n * 64 - 1; i >= 0; i-- ) {
+		bool Overflow = (Remainder >> 63) != 0;
+		Remainder = (Remainder << 1) | ((N[i / 64] >> (i % 64)) & 1);
+		if( Overflow || Remainder >= d ) {
+			Remainder -= d;
+			N[i / 64] |= (1ULL << (i % 64));
+		} else {
+			N[i / 64] &= ~(1ULL << (i % 64));
+		}
+	}
+#endif
+
+	return Remainder;
+}
+
+
+// -------------- World Globals (need "extern"s in header)
+
+
+// -------------- Class member definitions
+
+//
+// Function:	TUnsignedInteger256 :: fromBytes
+// Description:
+// Big endian, as TGenericBigInteger::fromBytes().
+//
+TUnsignedInteger256 &TUnsignedInteger256::fromBytes( const string &s )
+{
+	string::size_type i, n;
+
+	if( s.size() > BYTES )
+		throw range_error( "TUnsignedInteger256::fromBytes() given more than 32 bytes" );
+
+	Limbs[0] = Limbs[1] = Limbs[2] = Limbs[3] = 0;
+	n = s.size();
+	for( i = 0; i < n; i++ )
+		Limbs[i / 8] |= static_cast<uint64_t>( static_cast<unsigned char>( s[n - 1 - i] ) ) << ((i % 8) * 8);
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: fromLittleEndian
+// Description:
+// Loads exactly BYTES bytes, least significant first; which is how
+// hashes travel on the wire.
+//
+TUnsignedInteger256 &TUnsignedInteger256::fromLittleEndian( const unsigned char *p )
+{
+	unsigned int i, j;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		Limbs[i] = 0;
+		for( j = 0; j < 8; j++ )
+			Limbs[i] |= static_cast<uint64_t>( p[i * 8 + j] ) << (j * 8);
+	}
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: fromString
+// Description:
+// Accepts bases up to 36, in either case, stopping at the first
+// character that isn't a digit.
+//
+TUnsignedInteger256 &TUnsignedInteger256::fromString( const string &s, unsigned int Base )
+{
+	string::size_type pos;
+	unsigned int ch, i;
+	uint64_t Carry, High, Low;
+
+	if( Base < 2 || Base > 36 )
+		throw range_error( "TUnsignedInteger256::fromString() base out of range" );
+
+	Limbs[0] = Limbs[1] = Limbs[2] = Limbs[3] = 0;
+
+	for( pos = 0; pos < s.size(); pos++ ) {
+		ch = characterValue( static_cast<unsigned char>( s[pos] ), Base );
+		if( ch >= Base )
+			break;
+
+		// Multiply by the base, and add the next digit, in one pass
+		Carry = ch;
+		for( i = 0; i < LIMBS; i++ ) {
+			multiplyLimbs( Limbs[i], Base, High, Low );
+			Limbs[i] = Low + Carry;
+			Carry = High + (Limbs[i] < Low);
+		}
+		if( Carry != 0 )
+			throw range_error( "TUnsignedInteger256::fromString() value exceeds 256 bits" );
+	}
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: highestBit
+// Description:
+// Zero for zero, as TGenericBigInteger::highestBit().
+//
+TUnsignedInteger256::tIndex TUnsignedInteger256::highestBit() const
+{
+	int i;
+
+	for( i = LIMBS - 1; i >= 0; i-- ) {
+		if( Limbs[i] != 0 )
+			return i * bitsPerBlock + (bitsPerBlock - 1 - __builtin_clzll( Limbs[i] ));
+	}
+
+	return 0;
+}
+
+//
+// Function:	TUnsignedInteger256 :: lowestBit
+// Description:
+//
+TUnsignedInteger256::tIndex TUnsignedInteger256::lowestBit() const
+{
+	unsigned int i;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		if( Limbs[i] != 0 )
+			return i * bitsPerBlock + __builtin_ctzll( Limbs[i] );
+	}
+
+	return 0;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator+=
+// Description:
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator+=( const TUnsignedInteger256 &x )
+{
+	uint64_t Carry = 0, Sum;
+	unsigned int i;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		Sum = Limbs[i] + Carry;
+		Carry = (Sum < Carry);
+		Limbs[i] = Sum + x.Limbs[i];
+		Carry += (Limbs[i] < Sum);
+	}
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator-=
+// Description:
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator-=( const TUnsignedInteger256 &x )
+{
+	uint64_t Borrow = 0, Difference;
+	unsigned int i;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		Difference = Limbs[i] - x.Limbs[i];
+		uint64_t NextBorrow = (Difference > Limbs[i]);
+		Limbs[i] = Difference - Borrow;
+		NextBorrow |= (Limbs[i] > Difference);
+		Borrow = NextBorrow;
+	}
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator*=
+// Description:
+// Schoolbook, keeping only the products that land in the bottom four
+// limbs.
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator*=( const TUnsignedInteger256 &x )
+{
+	uint64_t Result[LIMBS] = { 0, 0, 0, 0 };
+	uint64_t Carry, High, Low;
+	unsigned int i, j;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		if( Limbs[i] == 0 )
+			continue;
+		Carry = 0;
+		for( j = 0; i + j < LIMBS; j++ ) {
+			multiplyLimbs( Limbs[i], x.Limbs[j], High, Low );
+			Low += Carry;
+			High += (Low < Carry);
+			Result[i + j] += Low;
+			High += (Result[i + j] < Low);
+			Carry = High;
+		}
+	}
+
+	for( i = 0; i < LIMBS; i++ )
+		Limbs[i] = Result[i];
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator&=
+// Description:
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator&=( const TUnsignedInteger256 &x )
+{
+	for( unsigned int i = 0; i < LIMBS; i++ )
+		Limbs[i] &= x.Limbs[i];
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator|=
+// Description:
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator|=( const TUnsignedInteger256 &x )
+{
+	for( unsigned int i = 0; i < LIMBS; i++ )
+		Limbs[i] |= x.Limbs[i];
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator^=
+// Description:
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator^=( const TUnsignedInteger256 &x )
+{
+	for( unsigned int i = 0; i < LIMBS; i++ )
+		Limbs[i] ^= x.Limbs[i];
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator~
+// Description:
+//
+TUnsignedInteger256 TUnsignedInteger256::operator~() const
+{
+	TUnsignedInteger256 x;
+
+	for( unsigned int i = 0; i < LIMBS; i++ )
+		x.Limbs[i] = ~Limbs[i];
+
+	return x;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator<<=
+// Description:
+// Bits shifted beyond the top are lost.
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator<<=( tIndex b )
+{
+	unsigned int LimbShift = b / bitsPerBlock;
+	unsigned int BitShift = b % bitsPerBlock;
+	int i;
+
+	if( b >= LIMBS * bitsPerBlock ) {
+		Limbs[0] = Limbs[1] = Limbs[2] = Limbs[3] = 0;
+		return *this;
+	}
+
+	for( i = LIMBS - 1; i >= 0; i-- ) {
+		uint64_t v = 0;
+		if( i >= static_cast<int>(LimbShift) ) {
+			v = Limbs[i - LimbShift] << BitShift;
+			// Shifting by 64 is undefined, so a whole-limb shift must
+			// not pull anything in from below
+			if( BitShift != 0 && i > static_cast<int>(LimbShift) )
+				v |= Limbs[i - LimbShift - 1] >> (bitsPerBlock - BitShift);
+		}
+		Limbs[i] = v;
+	}
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: operator>>=
+// Description:
+//
+TUnsignedInteger256 &TUnsignedInteger256::operator>>=( tIndex b )
+{
+	unsigned int LimbShift = b / bitsPerBlock;
+	unsigned int BitShift = b % bitsPerBlock;
+	unsigned int i;
+
+	if( b >= LIMBS * bitsPerBlock ) {
+		Limbs[0] = Limbs[1] = Limbs[2] = Limbs[3] = 0;
+		return *this;
+	}
+
+	for( i = 0; i < LIMBS; i++ ) {
+		uint64_t v = 0;
+		if( i + LimbShift < LIMBS ) {
+			v = Limbs[i + LimbShift] >> BitShift;
+			if( BitShift != 0 && i + LimbShift + 1 < LIMBS )
+				v |= Limbs[i + LimbShift + 1] << (bitsPerBlock - BitShift);
+		}
+		Limbs[i] = v;
+	}
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: divideByLimb
+// Description:
+// Divides in place by a single limb, returning the remainder.  This is
+// the common case: converting to a string, or scaling a difficulty
+// target by a timespan.
+//
+TUnsignedInteger256::tStorageType TUnsignedInteger256::divideByLimb( tStorageType d )
+{
+	return divideLimbs( Limbs, LIMBS, d );
+}
+
+//
+// Function:	TUnsignedInteger256 :: multiplyDivide
+// Description:
+// this = this * m / d, rounding down, with the product held in five
+// limbs so that it can't overflow on the way.  Throws range_error if d
+// is zero, or if the quotient doesn't fit in 256 bits.
+//
+// This is how a difficulty target is scaled by the ratio of two
+// timespans, without making the product as a separate number.
+//
+TUnsignedInteger256 &TUnsignedInteger256::multiplyDivide( tStorageType m, tStorageType d )
+{
+	uint64_t Product[LIMBS + 1];
+	uint64_t Carry = 0, High, Low;
+
+	if( d == 0 )
+		throw range_error( "TUnsignedInteger256::multiplyDivide: division by zero" );
+
+	for( unsigned int i = 0; i < LIMBS; i++ ) {
+		multiplyLimbs( Limbs[i], m, High, Low );
+		Low += Carry;
+		High += (Low < Carry);
+		Product[i] = Low;
+		Carry = High;
+	}
+	Product[LIMBS] = Carry;
+
+	divideLimbs( Product, LIMBS + 1, d );
+	if( Product[LIMBS] != 0 )
+		throw range_error( "TUnsignedInteger256::multiplyDivide: result exceeds 256 bits" );
+
+	for( unsigned int i = 0; i < LIMBS; i++ )
+		Limbs[i] = Product[i];
+
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: divideWithRemainder
+// Description:
+// As TGenericBigInteger: "this" is the numerator, and is replaced by
+// the remainder; Q receives the quotient.
+//
+TUnsignedInteger256 &TUnsignedInteger256::divideWithRemainder( const TUnsignedInteger256 &d, TUnsignedInteger256 &Q )
+{
+	TUnsignedInteger256 D( d ), N( *this );
+	int Shift;
+
+	if( D.isZero() )
+		throw range_error( "TUnsignedInteger256 division by zero" );
+
+	if( (D.Limbs[1] | D.Limbs[2] | D.Limbs[3]) == 0 ) {
+		uint64_t r = N.divideByLimb( D.Limbs[0] );
+		Q = N;
+		*this = TUnsignedInteger256( r );
+		return *this;
+	}
+
+	Q = TUnsignedInteger256();
+	if( N < D ) {
+		*this = N;
+		return *this;
+	}
+
+	// Line the divisor up with the numerator's top bit, then shift and
+	// subtract back down; at most 192 steps, as D is over 64 bits
+	Shift = N.highestBit() - D.highestBit();
+	D <<= Shift;
+	for( ; Shift >= 0; Shift-- ) {
+		if( N >= D ) {
+			N -= D;
+			Q.Limbs[Shift / 64] |= (1ULL << (Shift % 64));
+		}
+		D >>= 1;
+	}
+
+	*this = N;
+	return *this;
+}
+
+//
+// Function:	TUnsignedInteger256 :: reversedBytes
+// Description:
+// Reverses all 32 bytes, whatever their value; the fixed width is what
+// hashes need.
+//
+TUnsignedInteger256 TUnsignedInteger256::reversedBytes() const
+{
+	TUnsignedInteger256 x;
+
+	x.Limbs[0] = __builtin_bswap64( Limbs[3] );
+	x.Limbs[1] = __builtin_bswap64( Limbs[2] );
+	x.Limbs[2] = __builtin_bswap64( Limbs[1] );
+	x.Limbs[3] = __builtin_bswap64( Limbs[0] );
+
+	return x;
+}
+
+//
+// Function:	TUnsignedInteger256 :: compareTo
+// Description:
+// The most significant difference decides, but every limb is examined,
+// and without branching on the values, so the time taken doesn't
+// depend on where the values differ.
+//
+TUnsignedInteger256::eComparisonResult TUnsignedInteger256::compareTo( const TUnsignedInteger256 &O ) const
+{
+	int Result = 0;
+	unsigned int i;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		int gt = (Limbs[i] > O.Limbs[i]);
+		int lt = (Limbs[i] < O.Limbs[i]);
+		// All ones if this limb differs, in which case it overrides
+		// whatever the less significant limbs said
+		int Mask = -(gt | lt);
+		Result = (Result & ~Mask) | ((gt - lt) & Mask);
+	}
+
+	return static_cast<eComparisonResult>( Result );
+}
+
+//
+// Function:	TUnsignedInteger256 :: printOn
+// Description:
+// Honours the stream's base, as TGenericBigInteger::printOn() does.
+//
+ostream &TUnsignedInteger256::printOn( ostream &s ) const
+{
+	if( s.flags() & ostream::hex ) {
+		s << toString(16);
+	} else if( s.flags() & ostream::oct ) {
+		s << toString(8);
+	} else {
+		s << toString(10);
+	}
+
+	return s;
+}
+
+//
+// Function:	TUnsignedInteger256 :: toString
+// Description:
+// Lower case digits for bases over ten, as TGenericBigInteger.
+//
+string TUnsignedInteger256::toString( unsigned int Base ) const
+{
+	static const char Digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	// Enough for 256 binary digits
+	char Buffer[LIMBS * bitsPerBlock];
+	char *p = Buffer + sizeof(Buffer);
+	TUnsignedInteger256 x( *this );
+
+	if( Base < 2 || Base > 36 )
+		throw range_error( "TUnsignedInteger256::toString() base out of range" );
+
+	do {
+		*--p = Digits[ x.divideByLimb( Base ) ];
+	} while( !x.isZero() );
+
+	return string( p, Buffer + sizeof(Buffer) - p );
+}
+
+//
+// Function:	TUnsignedInteger256 :: toBytes
+// Description:
+// Big endian, with leading zeroes stripped down to Minimum bytes, as
+// TGenericBigInteger::toBytes().
+//
+string TUnsignedInteger256::toBytes( unsigned int Minimum ) const
+{
+	string output;
+	unsigned int i, Length;
+
+	Length = isZero() ? 1 : highestBit() / 8 + 1;
+	if( Length < Minimum )
+		Length = Minimum;
+
+	output.resize( Length );
+	for( i = 0; i < Length; i++ )
+		output[Length - 1 - i] = i < BYTES ? static_cast<char>( Limbs[i / 8] >> ((i % 8) * 8) ) : 0;
+
+	return output;
+}
+
+//
+// Function:	TUnsignedInteger256 :: toLittleEndian
+// Description:
+// Stores exactly BYTES bytes, least significant first.
+//
+void TUnsignedInteger256::toLittleEndian( unsigned char *p ) const
+{
+	unsigned int i, j;
+
+	for( i = 0; i < LIMBS; i++ ) {
+		for( j = 0; j < 8; j++ )
+			p[i * 8 + j] = static_cast<unsigned char>( Limbs[i] >> (j * 8) );
+	}
+}
+
+
+// -------------- Function definitions
+
+
+#ifdef UNITTEST
+#include <map>
+#include <vector>
+#include <sys/time.h>
+#include <new>
+#include <stdlib.h>
+#include "extraint.h"
+#include "logstream.h"
+
+// Count heap allocations, so that we can see what the arithmetic costs
+static unsigned long Allocations = 0;
+#if __cplusplus >= 201103L
+void *operator new( size_t n )
+#else
+void *operator new( size_t n ) throw( bad_alloc )
+#endif
+{
+	void *p = malloc( n == 0 ? 1 : n );
+	if( p == NULL )
+		throw bad_alloc();
+	Allocations++;
+	return p;
+}
+void operator delete( void *p ) throw()
+{
+	free( p );
+}
+
+//
+// Function:	elapsed
+// Description:
+//
+static double elapsed( const struct timeval &start )
+{
+	struct timeval end;
+
+	gettimeofday( &end, NULL );
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+// -------------- main()
+
+int main( int argc, char *argv[] )
+{
+	try {
+		log() << "--- Testing arithmetic against TBigUnsignedInteger" << endl;
+
+		static const char *Values[] = {
+			"0", "1", "ffffffffffffffff", "10000000000000000",
+			"00000000000404CB123456789012345678901234567890123456789012345678",
+			"ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+			"123456789abcdef0fedcba9876543210",
+			"8000000000000000000000000000000000000000000000000000000000000000",
+			NULL
+		};
+		unsigned int i, j;
+
+		for( i = 0; Values[i] != NULL; i++ ) {
+			TUnsignedInteger256 a( Values[i], 16 );
+			TBigUnsignedInteger A( Values[i], 16 );
+
+			if( a.toString(16) != A.toString(16) )
+				throw logic_error( string("Conversion of ") + Values[i] + " gave " + a.toString(16) );
+			if( a.toString(10) != A.toString(10) )
+				throw logic_error( string("Decimal conversion of ") + Values[i] + " gave " + a.toString(10) );
+			if( a.toBytes(32) != A.toBytes(32) )
+				throw logic_error( string("toBytes() of ") + Values[i] );
+			if( TUnsignedInteger256().fromBytes( a.toBytes() ) != a )
+				throw logic_error( string("fromBytes() of ") + Values[i] );
+			if( a.reversedBytes().reversedBytes() != a )
+				throw logic_error( string("reversedBytes() of ") + Values[i] );
+			if( (a >> 7 << 7) != (a & ~TUnsignedInteger256(0x7f)) )
+				throw logic_error( string("Shifts of ") + Values[i] );
+
+			for( j = 0; Values[j] != NULL; j++ ) {
+				TUnsignedInteger256 b( Values[j], 16 );
+				TBigUnsignedInteger B( Values[j], 16 );
+				// TBigUnsignedInteger doesn't wrap
+				TBigUnsignedInteger Modulus( TBigUnsignedInteger(1) << 256 );
+
+				if( (a < b) != (A < B) || (a == b) != (A == B) || (a > b) != (A > B) )
+					throw logic_error( string("Comparison of ") + Values[i] + " and " + Values[j] );
+				if( (a + b).toString(16) != ((A + B) % Modulus).toString(16) )
+					throw logic_error( string("Addition of ") + Values[i] + " and " + Values[j] );
+				if( (a * b).toString(16) != ((A * B) % Modulus).toString(16) )
+					throw logic_error( string("Multiplication of ") + Values[i] + " and " + Values[j] );
+				if( (a - b) + b != a )
+					throw logic_error( string("Subtraction of ") + Values[i] + " and " + Values[j] );
+				if( b.isZero() )
+					continue;
+				if( (a / b).toString(16) != (A / B).toString(16) || (a % b).toString(16) != (A % B).toString(16) )
+					throw logic_error( string("Division of ") + Values[i] + " by " + Values[j] );
+			}
+		}
+
+		unsigned char Wire[TUnsignedInteger256::BYTES];
+		TUnsignedInteger256 w( "0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20", 16 );
+		w.toLittleEndian( Wire );
+		if( Wire[0] != 0x20 || Wire[31] != 0x01 )
+			throw logic_error( "toLittleEndian() byte order" );
+		if( TUnsignedInteger256().fromLittleEndian( Wire ) != w )
+			throw logic_error( "fromLittleEndian() doesn't reverse toLittleEndian()" );
+		if( w.reversedBytes().toBytes(32) != string( reinterpret_cast<char *>(Wire), 32 ) )
+			throw logic_error( "reversedBytes() isn't the wire format" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Testing multiplyDivide()" << endl;
+
+		static const char *Values[] = {
+			"0", "1", "ffffffffffffffff",
+			"00000000ffff0000000000000000000000000000000000000000000000000000",
+			"00000000000404CB000000000000000000000000000000000000000000000000",
+			"ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+			NULL
+		};
+		static const unsigned long long Ratios[][2] = {
+			{ 1, 1 }, { 302400, 1209600 }, { 4838400, 1209600 }, { 1209599, 1209600 },
+			{ 0xffffffffffffffffULL, 0xffffffffffffffffULL }, { 3, 0xffffffffffffffffULL },
+			{ 0, 0 }
+		};
+
+		for( unsigned int i = 0; Values[i] != NULL; i++ ) {
+			for( unsigned int j = 0; Ratios[j][1] != 0; j++ ) {
+				TBigUnsignedInteger Expected( TBigUnsignedInteger( Values[i], 16 )
+					* TBigUnsignedInteger( Ratios[j][0] ) / TBigUnsignedInteger( Ratios[j][1] ) );
+				TUnsignedInteger256 a( Values[i], 16 );
+
+				if( Expected.highestBit() >= 256 ) {
+					bool Threw = false;
+					try {
+						a.multiplyDivide( Ratios[j][0], Ratios[j][1] );
+					} catch( range_error &e ) {
+						Threw = true;
+					}
+					if( !Threw )
+						throw logic_error( string("multiplyDivide() of ") + Values[i] + " should overflow" );
+					continue;
+				}
+
+				if( a.multiplyDivide( Ratios[j][0], Ratios[j][1] ).toString(16) != Expected.toString(16) )
+					throw logic_error( string("multiplyDivide() of ") + Values[i] + " gave " + a.toString(16) );
+			}
+		}
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Timing difficulty retargets" << endl;
+
+		// What TBlock::getNextRequiredDifficulty() does: scale the
+		// target by observed over expected timespan, and limit it
+		static const unsigned int COUNT = 100000;
+		static const unsigned int TIMESPAN = 14 * 24 * 60 * 60;
+		const string LimitHex( "00000000ffffffffffffffffffffffffffffffffffffffffffffffffffffffff" );
+		const string TargetHex( "00000000000404CB000000000000000000000000000000000000000000000000" );
+		struct timeval start;
+		unsigned long Before;
+		unsigned int i;
+		double t;
+
+		TBigUnsignedInteger GenericLimit( LimitHex, 16 ), GenericTarget( TargetHex, 16 ), Generic;
+		Before = Allocations;
+		gettimeofday( &start, NULL );
+		for( i = 0; i < COUNT; i++ ) {
+			Generic = GenericTarget;
+			Generic *= TIMESPAN / 4 + i;
+			Generic /= TIMESPAN;
+			if( Generic > GenericLimit )
+				Generic = GenericLimit;
+		}
+		t = elapsed( start );
+		log() << "TBigUnsignedInteger *= and /=: " << t / COUNT * 1e6 << "us and "
+			<< static_cast<double>(Allocations - Before) / COUNT << " allocations per retarget" << endl;
+
+		TUnsignedInteger256 FixedLimit( LimitHex, 16 ), FixedTarget( TargetHex, 16 ), Fixed;
+		Before = Allocations;
+		gettimeofday( &start, NULL );
+		for( i = 0; i < COUNT; i++ ) {
+			Fixed = FixedTarget;
+			Fixed.multiplyDivide( TIMESPAN / 4 + i, TIMESPAN );
+			if( Fixed > FixedLimit )
+				Fixed = FixedLimit;
+		}
+		t = elapsed( start );
+		log() << "TUnsignedInteger256 multiplyDivide(): " << t / COUNT * 1e6 << "us and "
+			<< static_cast<double>(Allocations - Before) / COUNT << " allocations per retarget" << endl;
+
+		if( Allocations != Before )
+			throw logic_error( "A retarget shouldn't allocate" );
+		if( Fixed.toString(16) != Generic.toString(16) )
+			throw logic_error( "Retargets disagree" );
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	try {
+		log() << "--- Timing map lookups" << endl;
+
+		static const unsigned int COUNT = 100000;
+		map<TUnsignedInteger256, unsigned int> Fixed;
+		map<TBigUnsignedInteger, unsigned int> Generic;
+		vector<TUnsignedInteger256> FixedKeys;
+		vector<TBigUnsignedInteger> GenericKeys;
+		TUnsignedInteger256 x( 0x123456789abcdefULL );
+		struct timeval start;
+		unsigned int i, Found;
+		double t;
+
+		for( i = 0; i < COUNT; i++ ) {
+			// Cheap, but well spread, pseudo random 256 bit values
+			x *= TUnsignedInteger256( "6364136223846793005" );
+			x += 1442695040888963407ULL;
+			FixedKeys.push_back( x );
+			GenericKeys.push_back( TBigUnsignedInteger( x.toString(16), 16 ) );
+			Fixed[FixedKeys.back()] = i;
+			Generic[GenericKeys.back()] = i;
+		}
+
+		gettimeofday( &start, NULL );
+		for( i = 0, Found = 0; i < COUNT; i++ )
+			Found += Fixed.count( FixedKeys[i] );
+		t = elapsed( start );
+		log() << "TUnsignedInteger256: " << Found << " lookups in " << t << "s; "
+			<< sizeof(TUnsignedInteger256) << " bytes per key" << endl;
+
+		gettimeofday( &start, NULL );
+		for( i = 0, Found = 0; i < COUNT; i++ )
+			Found += Generic.count( GenericKeys[i] );
+		t = elapsed( start );
+		log() << "TBigUnsignedInteger: " << Found << " lookups in " << t << "s; "
+			<< sizeof(TBigUnsignedInteger) << " bytes per key, plus the heap" << endl;
+
+	} catch( exception &e ) {
+		log() << e.what() << endl;
+		return 255;
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,190 @@
+// ----------------------------------------------------------------------------
+// Project: library
+/// @file   uint256.h
+/// @author Andy Parkins
+//
+// Version Control
+//    $Author$
+//      $Date$
+//        $Id$
+//
+// Legal
+//    Copyright 2011  Andy Parkins
+//
+// ----------------------------------------------------------------------------
+
+// Catch multiple includes
+#ifndef UINT256_H
+#define UINT256_H
+
+// -------------- Includes
+// --- C
+#include <stdint.h>
+#include <stddef.h>
+// --- C++
+#include <string>
+#include <iostream>
+// --- Qt
+// --- OS
+// --- Project
+
+
+// -------------- Namespace
+	// --- Imported namespaces
+	using namespace std;
+
+
+// -------------- Defines
+// General
+// Project
+
+
+// -------------- Constants
+
+
+// -------------- Typedefs (pre-structure)
+
+
+// -------------- Enumerations
+
+
+// -------------- Structures/Unions
+
+
+// -------------- Typedefs (post-structure)
+
+
+// -------------- Class pre-declarations
+
+
+// -------------- Function pre-class prototypes
+
+
+// -------------- Class declarations
+
+//
+// Class:	TUnsignedInteger256
+// Description:
+// A 256 bit unsigned integer, held as four 64 bit limbs, least
+// significant first.
+//
+// Unlike TGenericBigInteger, it never allocates, and has no virtual
+// functions, so copying it is copying 32 bytes.  Arithmetic wraps
+// modulo 2^256.  compareTo() examines every limb whatever it finds, so
+// it takes the same time for any pair of values.
+//
+// The interface mirrors TGenericBigInteger's where it can, so that
+// TBitcoinHash can move from one to the other.
+//
+class TUnsignedInteger256
+{
+  public:
+	enum eComparisonResult {
+		LessThan = -1,
+		EqualTo = 0,
+		GreaterThan = 1
+	};
+	typedef uint64_t tStorageType;
+	typedef unsigned int tIndex;
+	static const unsigned int LIMBS = 4;
+	static const unsigned int BYTES = 32;
+	static const size_t bitsPerBlock = 64;
+
+  public:
+	TUnsignedInteger256() { Limbs[0] = Limbs[1] = Limbs[2] = Limbs[3] = 0; }
+	TUnsignedInteger256( unsigned long long t ) { Limbs[0] = t; Limbs[1] = Limbs[2] = Limbs[3] = 0; }
+	TUnsignedInteger256( const string &s, unsigned int b = 10 ) { fromString(s,b); }
+
+	bool isZero() const { return (Limbs[0] | Limbs[1] | Limbs[2] | Limbs[3]) == 0; }
+
+	// Assignment
+	TUnsignedInteger256 &fromBytes( const string & );
+	TUnsignedInteger256 &fromString( const string &, unsigned int = 10 );
+	TUnsignedInteger256 &fromLittleEndian( const unsigned char * );
+
+	// Access
+	bool getBit( tIndex bi ) const {
+		return bi < LIMBS * bitsPerBlock && ((Limbs[bi/bitsPerBlock] >> (bi % bitsPerBlock)) & 1) != 0;
+	}
+	tStorageType getBlock( tIndex bl ) const { return bl < LIMBS ? Limbs[bl] : 0; }
+	tIndex highestBit() const;
+	tIndex lowestBit() const;
+
+	// Arithmetic - Compound
+	TUnsignedInteger256 &operator +=( const TUnsignedInteger256 & );
+	TUnsignedInteger256 &operator -=( const TUnsignedInteger256 & );
+	TUnsignedInteger256 &operator *=( const TUnsignedInteger256 & );
+	TUnsignedInteger256 &operator /=( const TUnsignedInteger256 &x ) { TUnsignedInteger256 q; divideWithRemainder(x,q); *this = q; return *this; }
+	TUnsignedInteger256 &operator %=( const TUnsignedInteger256 &x ) { TUnsignedInteger256 q; divideWithRemainder(x,q); return *this; }
+	TUnsignedInteger256 &operator &=( const TUnsignedInteger256 & );
+	TUnsignedInteger256 &operator |=( const TUnsignedInteger256 & );
+	TUnsignedInteger256 &operator ^=( const TUnsignedInteger256 & );
+	TUnsignedInteger256 &operator <<=( tIndex );
+	TUnsignedInteger256 &operator >>=( tIndex );
+	TUnsignedInteger256 &divideWithRemainder( const TUnsignedInteger256 &, TUnsignedInteger256 & );
+
+	// Arithmetic - Fused
+	TUnsignedInteger256 &multiplyDivide( tStorageType, tStorageType );
+
+	TUnsignedInteger256 &operator++() { return (*this += 1); }
+	TUnsignedInteger256 &operator--() { return (*this -= 1); }
+
+	// Arithmetic - non compound
+	TUnsignedInteger256 operator+( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) += x; }
+	TUnsignedInteger256 operator-( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) -= x; }
+	TUnsignedInteger256 operator*( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) *= x; }
+	TUnsignedInteger256 operator/( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) /= x; }
+	TUnsignedInteger256 operator%( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) %= x; }
+	TUnsignedInteger256 operator&( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) &= x; }
+	TUnsignedInteger256 operator|( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) |= x; }
+	TUnsignedInteger256 operator^( const TUnsignedInteger256 &x ) const { return TUnsignedInteger256(*this) ^= x; }
+	TUnsignedInteger256 operator~() const;
+	TUnsignedInteger256 operator<<( tIndex b ) const { return TUnsignedInteger256(*this) <<= b; }
+	TUnsignedInteger256 operator>>( tIndex b ) const { return TUnsignedInteger256(*this) >>= b; }
+	TUnsignedInteger256 reversedBytes() const;
+
+	// Comparison
+	eComparisonResult compareTo( const TUnsignedInteger256 & ) const;
+	bool operator<( const TUnsignedInteger256 &O ) const { return compareTo(O) == LessThan; }
+	bool operator>( const TUnsignedInteger256 &O ) const { return compareTo(O) == GreaterThan; }
+	bool operator==( const TUnsignedInteger256 &O ) const { return compareTo(O) == EqualTo; }
+	bool operator!=( const TUnsignedInteger256 &O ) const { return compareTo(O) != EqualTo; }
+	bool operator<=( const TUnsignedInteger256 &O ) const { return compareTo(O) != GreaterThan; }
+	bool operator>=( const TUnsignedInteger256 &O ) const { return compareTo(O) != LessThan; }
+
+	ostream &printOn( ostream & ) const;
+	string toString( unsigned int = 10 ) const;
+
+	string toBytes( unsigned int = 0 ) const;
+	void toLittleEndian( unsigned char * ) const;
+
+  protected:
+	tStorageType divideByLimb( tStorageType );
+
+  protected:
+	tStorageType Limbs[LIMBS];
+};
+
+
+// -------------- Constants
+
+
+// -------------- Inline Functions
+
+inline ostream &operator<<( ostream &s, const TUnsignedInteger256 &O )
+{
+	return O.printOn(s);
+}
+
+
+// -------------- Function prototypes
+
+
+// -------------- Template instantiations
+
+
+// -------------- World globals ("extern"s only)
+
+
+// End of conditional compilation
+#endif